@@ -44,9 +44,15 @@
 *                                                                              *
 *******************************************************************************/
 
-// #include <stdint.h>
+#include <stddef.h>
 
-// #include <stdarg.h>
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <sys/types.h>
+
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -110,6 +116,22 @@ typedef enum LOGMSG_LEVEL {
 
 extern LOGMSG_LEVEL logmsg_level;
 
+/*******************************************************************************
+
+    logmsg_recorder_level - Program-wide flight recorder level.
+    
+    Description
+    ===========
+    
+    Entries at levels above logmsg_level, up to this level, are kept in 
+    memory by the flight recorder rather than written. Set by 
+    logmsg_start_recorder(); the default value LOGMSG_LEVEL_NONE records
+    nothing.
+    
+*******************************************************************************/
+
+extern LOGMSG_LEVEL logmsg_recorder_level;
+
 /*******************************************************************************
 *                                                                              *
 *                           Function declarations                              *
@@ -120,6 +142,8 @@ extern LOGMSG_LEVEL logmsg_level;
 
     logmsg_open_file() - Open log file for concurrent writing.
     
+    The file may be divided among writers by logmsg_set_sharding().
+    
     Return 0 on success, -1 on failure.
     
 *******************************************************************************/
@@ -128,119 +152,1273 @@ int logmsg_open_file(const char* file_spec);
 
 /*******************************************************************************
 
-    logmsg_open_conn() - Open network connection to log recorder server.
+    logmsg_open_index() - Open time index sidecar file for the log file.
+    
+    Description
+    ===========
+    
+    Once the log file has been opened, maintain a sparse index of it in the
+    file named by index_spec (conventionally the log file name followed by
+    ".idx"), so that readers such as seek-log can find the entries for a 
+    time range without scanning the whole log file.
+    
+    An index record is appended for the first entry, and thereafter every
+    interval_entries entries or interval_bytes bytes written by this pro-
+    cess, whichever comes first. Either interval may be zero to disable it,
+    but not both. Each record costs an fstat(), a clock_gettime() and a 
+    16 byte write().
     
     Return 0 on success, -1 on failure.
     
 *******************************************************************************/
 
-int logmsg_open_conn(const char* server_spec);  
+int logmsg_open_index(const char* index_spec, 
+                      uint64_t interval_entries, 
+                      uint64_t interval_bytes);
 
 /*******************************************************************************
 
-    logmsg_level_to_string() - Convert log level from binary to text
+    LOGMSG_SHARDING - Division of the log file among writers
     
 *******************************************************************************/
 
-const char* logmsg_level_to_string(LOGMSG_LEVEL level);
+typedef enum LOGMSG_SHARDING {
+
+    LOGMSG_SHARDING_NONE    = 0,    // One file, shared by all (default)
+    
+    LOGMSG_SHARDING_PROCESS = 1,    // <file>.<pid> for each process
+    
+    LOGMSG_SHARDING_THREAD  = 2,    // <file>.<pid>.<tid> for each thread
+    
+} LOGMSG_SHARDING;
 
 /*******************************************************************************
 
-    logmsg_printf() - Write log entry using printf style formatting
+    logmsg_set_sharding() - Select division of the log file among writers
     
     Description
     ===========
     
-    Write a single log entry of the form:
+    Call before logmsg_open_file(). 
     
-        <utc-time> <log-level> <host-name>:<program-name>[pid:tid] <message>
-        
-    where:
-   
-        <utc-time>     = system UTC time in nanosecond precision, returned
-                         by clock_gettime() vDSO library function
-        
-        <log-level>    = name for the log level associated with this entry 
+    Processes appending to the same file contend for its inode lock on 
+    every write, which limits how far logging scales with the number of
+    writers. With LOGMSG_SHARDING_PROCESS, logmsg_open_file() instead 
+    opens the file named by its file_spec followed by "." and the process
+    ID, so that each process appends to its own shard. With 
+    LOGMSG_SHARDING_THREAD, each thread which writes entries opens its own
+    shard, named by file_spec followed by "." and the process and thread 
+    IDs separated by ".", on its first write. As a writer thread would be
+    the only thread writing entries, LOGMSG_SHARDING_THREAD cannot be used
+    with one: logmsg_set_sharding() fails once it has been started, and 
+    logmsg_start_writer() and logmsg_start_writer_per_cpu() fail with it
+    set. Signal-safe entries and flight recorder dumps are written to the
+    shard of the thread which opened the log file. A child process 
+    switches to shards of its own after fork().
+    
+    Shards are read as one log, in time order, by merge-logs -s. The time
+    index and durability modes are not available for a sharded log file.
+    
+    Return 0 on success, -1 on failure, or if the log file is already 
+    open.
+    
+*******************************************************************************/
+
+int logmsg_set_sharding(LOGMSG_SHARDING sharding);
+
+/*******************************************************************************
+
+    LOGMSG_CLOCK - Source of entry timestamps
+    
+*******************************************************************************/
+
+typedef enum LOGMSG_CLOCK {
+
+    LOGMSG_CLOCK_REALTIME = 0,  // clock_gettime(CLOCK_REALTIME) (default)
+    
+    LOGMSG_CLOCK_TSC      = 1,  // Invariant TSC, calibrated against 
+                                // CLOCK_REALTIME
+    
+} LOGMSG_CLOCK;
+
+/*******************************************************************************
+
+    logmsg_set_clock() - Select source of entry timestamps
+    
+    Description
+    ===========
+    
+    Call before opening the log file or starting the flight recorder. 
+    
+    With LOGMSG_CLOCK_TSC, entries are timestamped by reading the time stamp
+    counter, which costs a few nanoseconds rather than a clock_gettime() 
+    call, and converted to UTC using a TSC frequency measured here, which
+    takes 20 msecs. The conversion is re-anchored against CLOCK_REALTIME 
+    every second, bounding drift, and follows steps of the system clock
+    within that time. The flight recorder defers conversion until entries
+    are dumped, and timing spans until they are exported. Log entries are
+    converted when built, by the calling thread, as their time is written 
+    into the entry text, which the writer thread and sinks then only copy;
+    the conversion, without re-anchoring, costs about 11 nsecs on top of
+    reading the TSC.
+    
+    The TSC is used only if the CPU reports it as invariant; otherwise, 
+    LOGMSG_CLOCK_REALTIME remains in use and -1 is returned.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_set_clock(LOGMSG_CLOCK clock);
+
+/*******************************************************************************
+
+    logmsg_set_layout() - Select layout of text log entries
+    
+    Description
+    ===========
+    
+    The pattern is compiled once, here, so that writing an entry only 
+    copies pre-rendered text and fills in the fields which change. Pattern
+    directives are:
+    
+        %d  UTC time, as YYYY-MM-DD-hh:mm:ss-nnnnnnnnn
+        %D  UTC time in ISO 8601 form, as YYYY-MM-DDThh:mm:ss.nnnnnnnnnZ
+        %e  UTC time in nsecs since the Epoch
+        %l  Log level
+        %h  Host name
+        %p  Program name
+        %P  Process ID
+        %t  Thread ID
+        %s  Entry sequence number, counted across all threads
+        %m  Message
+        %j  Message as a JSON string, quoted and escaped
+        %%  Percent sign
+    
+    Exactly one of %m or %j is required; everything else is literal text.
+    The default, used if pattern is NULL, is:
+    
+        "%d %l %h:%p[%P:%t] %m"
+    
+    and JSON lines are produced by, for example:
+    
+        "{\"time\":\"%D\",\"level\":\"%l\",\"pid\":%P,\"msg\":%j}"
+    
+    The layout applies to text entries written by every API function, and 
+    to flight recorder dumps. It may be changed while logging: entries
+    already begun are completed with the layout they began with, which is
+    kept for the life of the process.
+    
+    Return 0 on success, -1 if the pattern is invalid or too long, in which
+    case the layout is unchanged.
+    
+*******************************************************************************/
+
+int logmsg_set_layout(const char* pattern);
+
+/*******************************************************************************
+
+    logmsg_open_conn() - Open network connection to log recorder server.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_open_conn(const char* server_spec);  
+
+/*******************************************************************************
+
+    Sinks - Log destinations in addition to the log file or log server 
+            connection, each with its own level
+    
+    Description
+    ===========
+    
+    Each entry is rendered once, and the same text written to the log file
+    or connection and to each sink whose level is no lower than the level 
+    of the entry. Entries must first pass logmsg_level, so that for example
+    to write ERROR entries to a local file and all entries to a log server:
+    
+        logmsg_level = LOGMSG_LEVEL_TRACE;
         
-        <host-name>    = value returned by gethostname() library function
+        logmsg_add_file_sink("/var/log/app.log", LOGMSG_LEVEL_ERROR);
         
-        <program-name> = value stored in the process-wide global variable
-                         program_invocation_short_name
-                         
-        pid            = Process ID assigned to main thread of program, re-
-                         turned by getpid() library function
-                         
-        tid            = Process ID assigned to calling thread, returned by
-                         SYS_gettid system call
-                         
-        <message>      = text produced by feeding format and its following 
-                         arguments to the vsnprintf() library function, and
-                         appending a newline character
+        logmsg_add_conn_sink("collector:5140", LOGMSG_LEVEL_TRACE);
+    
+    Sinks cannot be removed. Each add function returns the number of the 
+    new sink on success, or -1 on failure or if LOGMSG_MAX_SINKS have been
+    added.
     
 *******************************************************************************/
 
-void logmsg_printf(LOGMSG_LEVEL level, const char* format, ...);
+#define LOGMSG_MAX_SINKS 8
 
 /*******************************************************************************
 
-    LOGMSG_PRINTF() - Convenience macro 
+    logmsg_add_file_sink() - Add sink appending to a file, created if need be
+    
+*******************************************************************************/
+
+int logmsg_add_file_sink(const char* file_spec, LOGMSG_LEVEL level);
+
+/*******************************************************************************
+
+    logmsg_add_conn_sink() - Add sink writing to a log server connection
     
     Description
     ===========
     
-    Invoke logmsg_printf() but supply __FILE__, __LINE__, and __FUNCTION__ 
-    as additional initial arguments to be printed.
+    The server is given as <host>:<port> for TCP, or by the path of a UNIX
+    domain stream socket, recognized by containing a '/'. The same forms
+    are accepted by logmsg_open_conn().
     
 *******************************************************************************/
 
-#define LOGMSG_PRINTF(level, format, ...)                         \
-    logmsg_printf(level,                                          \
-                  "%s:%d:%s() " format,                           \
-                  __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+int logmsg_add_conn_sink(const char* server_spec, LOGMSG_LEVEL level);
 
 /*******************************************************************************
 
-    LOGMSG_<LEVEL>_PRINTF() - 
+    logmsg_add_stderr_sink() - Add sink writing to standard error
     
-    Convenience macros which conditionally generate log entries
+*******************************************************************************/
+
+int logmsg_add_stderr_sink(LOGMSG_LEVEL level);
+
+/*******************************************************************************
+
+    logmsg_add_memory_sink() - Add sink keeping the latest ring_len bytes of 
+                               entries in memory (64 KiB if 0), for reading 
+                               by logmsg_read_memory_sink()
+    
+*******************************************************************************/
+
+int logmsg_add_memory_sink(size_t ring_len, LOGMSG_LEVEL level);
+
+/*******************************************************************************
+
+    logmsg_set_sink_level() - Set highest level of entry written to sink
+    
+    Return 0 on success, -1 if there is no such sink.
+    
+*******************************************************************************/
+
+int logmsg_set_sink_level(int sink, LOGMSG_LEVEL level);
+
+/*******************************************************************************
+
+    logmsg_read_memory_sink() - Copy latest whole entries held by memory sink
+    
+    Return number of bytes copied, or -1 if not a memory sink.
+    
+*******************************************************************************/
+
+ssize_t logmsg_read_memory_sink(int sink, char* p_buffer, size_t buffer_len);
+
+/*******************************************************************************
+
+    logmsg_start_writer() - Start writer thread
     
     Description
     ===========
     
-    If logmsg_level is >= <LEVEL>, invoke logmsg_printf() but supply __FILE__, 
-    __LINE__, and __FUNCTION__ as additional initial arguments to be printed.
+    Once started, entries are copied into a queue of queue_len bytes (1 MiB
+    if 0) and written to the log file or connection, and to sinks, by the
+    writer thread, so that the number of sinks adds nothing to the time 
+    taken by the caller. An entry which does not fit in the queue is writ-
+    ten by the calling thread.
+    
+    When the queue empties, the writer thread polls briefly if entries 
+    have been arriving often, and otherwise sleeps on a futex, which a 
+    caller wakes only if the thread is asleep. While entries arrive in a
+    steady stream, it waits briefly after a small batch for more entries,
+    so that they are written together.
+    
+    FATAL entries and logmsg_printf_signal_safe() entries are always written
+    by the calling thread, the former after the queue has been flushed.
+    Queued entries are also flushed when the process exits normally.
+    
+    fork() flushes the queue first, and the child starts its own writer 
+    thread with an empty queue, so that each entry queued around the fork
+    is written once, by the process which wrote it.
+    
+    Return 0 on success, -1 on failure, if already started, or if the log
+    file is sharded by thread (see logmsg_set_sharding()).
     
 *******************************************************************************/
 
-#define LOGMSG_FATAL_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_FATAL) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_FATAL, format, __VA_ARGS__); \
-}
+int logmsg_start_writer(size_t queue_len);
 
-#define LOGMSG_ERROR_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_ERROR) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_ERROR, format, __VA_ARGS__); \
-}
+/*******************************************************************************
 
-#define LOGMSG_WARN_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_WARN) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_WARN, format, __VA_ARGS__); \
-}
+    logmsg_start_writer_per_cpu() - Start writer thread, with entries 
+                                    appended to per-CPU buffers
+    
+    Description
+    ===========
+    
+    As logmsg_start_writer(), except that each entry is appended to a 
+    buffer of buffer_len bytes (256 KiB if 0) belonging to the CPU the 
+    caller is running on, in a restartable sequence, without atomic in-
+    structions or contention between threads. The writer thread drains
+    the buffers, merging entries in the order they were appended, so that
+    entries of each thread stay in order. Entries of different threads are
+    only approximately in the order of their timestamps, which are taken
+    when the entries are built. Memory used grows with the number of CPUs
+    rather than threads.
+    
+    Requires x86-64 and Linux rseq registration by the C library (glibc
+    2.35 or later, unless disabled with glibc.pthread.rseq=0). Where 
+    membarrier(2) is not available (before Linux 4.14), each entry costs a
+    memory fence, so that the writer thread is not left asleep.
+    
+    Return 0 on success, -1 if not supported, on failure or if already 
+    started.
+    
+*******************************************************************************/
 
-#define LOGMSG_INFO_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_INFO) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_INFO, format, __VA_ARGS__); \
-}
+int logmsg_start_writer_per_cpu(size_t buffer_len);
+
+/*******************************************************************************
+
+    logmsg_flush() - Wait for entries already queued for the writer thread to
+                     be written, and write out entries held for O_DIRECT
+                     writing
     
-#define LOGMSG_DEBUG_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_DEBUG) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_DEBUG, format, __VA_ARGS__); \
-}
+*******************************************************************************/
+
+void logmsg_flush(void);
+
+/*******************************************************************************
+
+    logmsg_flush_async() - Signal an eventfd once the entries already written
+                           have been flushed, without waiting
     
-#define LOGMSG_TRACE_PRINTF(format, ...)                    \
-if (logmsg_level >= LOGMSG_LEVEL_TRACE) {                   \
-    LOGMSG_PRINTF(LOGMSG_LEVEL_TRACE, format, __VA_ARGS__); \
-}
+    Description
+    ===========
+    
+    Once the entries written before the call have been written out, as by 
+    logmsg_flush(), and, if any durability mode is set (see 
+    logmsg_set_durability()), the log file synced to storage, 1 is added 
+    to the counter of event_fd, an eventfd(2) FD, which an event loop can 
+    wait on to become readable. Without a durability mode, completion means
+    only that the entries are written to the file, not that they are 
+    durable. Flushes complete in the order requested. The library keeps a
+    duplicate of the FD until then, so the caller may close its own at any
+    time.
+    
+    Without a writer thread, entries are written by the calling threads,
+    so the flush completes before the call returns.
+    
+    Return 0 on success, -1 on failure, or if LOGMSG_MAX_ASYNC_FLUSHES are
+    already pending.
+    
+*******************************************************************************/
+
+#define LOGMSG_MAX_ASYNC_FLUSHES 256
+
+int logmsg_flush_async(int event_fd);
+
+/*******************************************************************************
+
+    LOGMSG_DURABILITY - Modes of syncing the log file to storage, which may
+                        be combined
+    
+*******************************************************************************/
+
+typedef enum LOGMSG_DURABILITY {
+
+    LOGMSG_DURABILITY_NONE        = 0,  // Left to the kernel (default)
+    
+    LOGMSG_DURABILITY_GROUP_SYNC  = 1,  // fdatasync() by a background thread
+                                        // every interval, or interval bytes
+                                        
+    LOGMSG_DURABILITY_SYNC_ERRORS = 2,  // fdatasync() after each ERROR or 
+                                        // FATAL entry, before returning
+                                        
+    LOGMSG_DURABILITY_DIRECT      = 4,  // O_DIRECT writes of whole blocks
+    
+} LOGMSG_DURABILITY;
+
+/*******************************************************************************
+
+    logmsg_set_durability() - Select when the log file is synced to storage
+    
+    Description
+    ===========
+    
+    Call after logmsg_open_file(), once. modes is a combination of 
+    LOGMSG_DURABILITY flags. 
+    
+    With LOGMSG_DURABILITY_GROUP_SYNC, a background thread syncs the file 
+    every interval_ms msecs (1 sec if 0), or sooner once interval_bytes
+    have been written (unless 0), so that a power loss costs at most that 
+    much of the log, while callers never wait for storage.
+    
+    With LOGMSG_DURABILITY_SYNC_ERRORS, each ERROR or FATAL entry is 
+    synced, with the entries preceding it, before the call which wrote it 
+    returns, bypassing the writer thread.
+    
+    With LOGMSG_DURABILITY_DIRECT, entries are collected in an aligned 
+    buffer and written with O_DIRECT in 4 KiB blocks, so that write-once
+    log data does not fill the page cache. The buffer is written out when
+    full, by the background thread every interval, by logmsg_flush(), 
+    and for signal-safe entries and recorder dumps. The last block, being 
+    partial, is padded with NULs and the file truncated to length, and
+    rewritten as entries are added, so this process and its children must
+    be the only writers of the file. Until the file is truncated, a reader,
+    or the file after a crash, may end with up to 4 KiB of NULs following
+    the last entry.
+    
+    Modes are not inherited by a child process, other than 
+    LOGMSG_DURABILITY_SYNC_ERRORS. A child of a process in O_DIRECT mode 
+    reopens the file to append its entries, locking it against the parent
+    rewriting its last block meanwhile.
+    
+    Return 0 on success, -1 on failure, or if there is no log file or the 
+    modes have already been set.
+    
+*******************************************************************************/
+
+int logmsg_set_durability(int modes, 
+                          uint64_t interval_ms, 
+                          uint64_t interval_bytes);
+
+/*******************************************************************************
+
+    LOGMSG_LATENCY_STATS - Count and latency of operations, in nsecs
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_LATENCY_STATS {
+
+    uint64_t count;
+    
+    uint64_t total_ns;
+    
+    uint64_t max_ns;
+    
+} LOGMSG_LATENCY_STATS;
+
+/*******************************************************************************
+
+    LOGMSG_DURABILITY_STATS - Latencies of each durability mode
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_DURABILITY_STATS {
+
+    LOGMSG_LATENCY_STATS group_syncs;   // LOGMSG_DURABILITY_GROUP_SYNC 
+    
+    LOGMSG_LATENCY_STATS error_syncs;   // LOGMSG_DURABILITY_SYNC_ERRORS
+    
+    LOGMSG_LATENCY_STATS direct_writes; // LOGMSG_DURABILITY_DIRECT
+    
+    LOGMSG_LATENCY_STATS flush_syncs;   // logmsg_flush_async()
+    
+} LOGMSG_DURABILITY_STATS;
+
+/*******************************************************************************
+
+    logmsg_get_durability_stats() - Get latencies of syncs and O_DIRECT 
+                                    writes since logmsg_set_durability()
+    
+*******************************************************************************/
+
+void logmsg_get_durability_stats(LOGMSG_DURABILITY_STATS* p_stats);
+
+/*******************************************************************************
+
+    logmsg_start_recorder() - Start recording entries too detailed for the
+                              log file
+    
+    Description
+    ===========
+    
+    From now on, entries at levels above logmsg_level and no higher than
+    level are not written, but recorded in a ring of ring_len bytes (64 KiB
+    if 0) per thread, each holding the latest few hundred entries of that 
+    thread. Recording costs a timestamp and a copy of the format and its
+    arguments: formatting is deferred until the entries are dumped, except
+    for formats with conversions such as %e or %p, which are formatted at
+    once. Messages are truncated to about 200 characters.
+    
+    The rings are dumped, merged in time order and between marker entries,
+    to the file named by dump_spec, or to the log file if dump_spec is NULL:
+    
+    - before a FATAL entry is written,
+    - on SIGSEGV, SIGABRT or SIGBUS, after which the signal has the effect
+      it had before the recorder was started,
+    - on calling logmsg_dump_recorder().
+    
+    Each dump writes only entries not written by a previous one.
+    
+    Return 0 on success, -1 on failure or if already started.
+    
+*******************************************************************************/
+
+int logmsg_start_recorder(LOGMSG_LEVEL level, 
+                          size_t ring_len, 
+                          const char* dump_spec);
+
+/*******************************************************************************
+
+    logmsg_dump_recorder() - Write recorded entries
+    
+    Description
+    ===========
+    
+    See logmsg_start_recorder().
+    
+*******************************************************************************/
+
+void logmsg_dump_recorder(void);
+
+/*******************************************************************************
+
+    logmsg_level_to_string() - Convert log level from binary to text
+    
+*******************************************************************************/
+
+const char* logmsg_level_to_string(LOGMSG_LEVEL level);
+
+/*******************************************************************************
+
+    logmsg_printf() - Write log entry using printf style formatting
+    
+    Description
+    ===========
+    
+    Write a single log entry of the form:
+    
+        <utc-time> <log-level> <host-name>:<program-name>[pid:tid] <message>
+        
+    where:
+   
+        <utc-time>     = system UTC time in nanosecond precision, returned
+                         by clock_gettime() vDSO library function
+        
+        <log-level>    = name for the log level associated with this entry 
+        
+        <host-name>    = value returned by gethostname() library function
+        
+        <program-name> = value stored in the process-wide global variable
+                         program_invocation_short_name
+                         
+        pid            = Process ID assigned to main thread of program, re-
+                         turned by getpid() library function
+                         
+        tid            = Process ID assigned to calling thread, returned by
+                         SYS_gettid system call
+                         
+        <message>      = text produced by feeding format and its following 
+                         arguments to logmsg_vsnprintf(), which gives the 
+                         same text as the vsnprintf() library function, and
+                         appending a newline character
+    
+*******************************************************************************/
+
+void logmsg_printf(LOGMSG_LEVEL level, const char* format, ...);
+
+/*******************************************************************************
+
+    logmsg_printf_signal_safe() - Write log entry using printf style format-
+                                  ting, from a signal handler
+    
+    Description
+    ===========
+    
+    As logmsg_printf(), but using only async-signal-safe functions, so that
+    it may be called from a signal handler or a crashing thread: the entry 
+    is built on the stack, truncated to 1024 characters, and written to the
+    log file with a single write(), preserving errno. The index is not 
+    updated. The entry also goes to the sinks (see logmsg_add_file_sink()
+    and the like), directly rather than through the writer thread, even if
+    the log file is not open.
+    
+    The formatter is restricted: d i u x X o c s f F and %% are formatted
+    as by logmsg_printf(), %p as %#x, and %e %E %g %G %a %A as the shortest
+    text which reads back as the value. Any other conversion, and the rest
+    of the format after it, is copied as it is.
+    
+*******************************************************************************/
+
+void logmsg_printf_signal_safe(LOGMSG_LEVEL level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*******************************************************************************
+
+    logmsg_snprintf(), logmsg_vsnprintf() - Format text as snprintf() and
+                                            vsnprintf()
+    
+    Description
+    ===========
+    
+    The formatter used by logmsg_printf(). The conversions most common in
+    log messages - d i u x X o c s f F and %%, with any flags, width, pre-
+    cision and the length modifiers hh h l ll z j t - are done directly, 
+    with output identical to glibc's. Any other conversion, such as %e, %g,
+    %p or %m, causes the whole format to be passed to vsnprintf().
+    
+    In test-format, a typical message of seven conversions is formatted in
+    about 265 nsecs, against 586 nsecs by snprintf(). As the time taken by
+    logmsg_printf() is mostly that of writing the entry, it gains far less:
+    about 10% per entry, from 726 to 655 nsecs.
+    
+*******************************************************************************/
+
+int logmsg_snprintf(char* p_buffer, size_t buffer_len, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+int logmsg_vsnprintf(char* p_buffer, 
+                     size_t buffer_len, 
+                     const char* format, 
+                     va_list ap);
+
+/*******************************************************************************
+
+    logmsg_write() - Write log entry with preformatted message
+    
+    Description
+    ===========
+    
+    Write a single log entry of the same form as logmsg_printf(), with the
+    message_len characters at p_message as the message. This is the entry
+    point for front ends which do their own formatting, such as logmsg.hpp.
+    
+*******************************************************************************/
+
+void logmsg_write(LOGMSG_LEVEL level, const char* p_message, size_t message_len);
+
+/*******************************************************************************
+
+    logmsg_write_raw(), logmsg_writev_raw() - Write log entry with message
+                                              bytes as they are
+    
+    Description
+    ===========
+    
+    As logmsg_write(), for callers which already hold the message, such as
+    protocol dumps. logmsg_writev_raw() takes the message in num_parts 
+    parts (at most LOGMSG_RAW_MAX_PARTS), which are concatenated.
+    
+    The message is not formatted or copied to an intermediate buffer: the
+    entry's prefix and suffix are written around the caller's bytes with a
+    single writev(), or copied with them directly into the writer queue. 
+    Only JSON layouts, which escape the message, and per-CPU buffers, for
+    an entry in several parts, gather the message first.
+    
+    logmsg_writev_raw() returns 0 on success, or -1 if there are too many
+    parts.
+    
+*******************************************************************************/
+
+#define LOGMSG_RAW_MAX_PARTS 16
+
+void logmsg_write_raw(LOGMSG_LEVEL level, 
+                      const void* p_message, 
+                      size_t message_len);
+
+int logmsg_writev_raw(LOGMSG_LEVEL level, 
+                      const struct iovec* p_parts, 
+                      int num_parts);
+
+/*******************************************************************************
+
+    LOGMSG_SITE - Call site of the LOGMSG_<LEVEL>_PRINTF() macros, with its
+                  counts
+    
+    Description
+    ===========
+    
+    Each site has a static descriptor, whose counters are updated with 
+    relaxed atomic additions, and only while logmsg_site_stats_enabled is
+    set. A site is listed for reports on its first count.
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_SITE {
+
+    const char*         file;
+    
+    int                 line;
+    
+    const char*         function;
+    
+    LOGMSG_LEVEL        level;
+    
+    uint64_t            num_calls;      // Calls admitted by level
+    
+    uint64_t            num_bytes;      // Bytes of entries written
+    
+    uint64_t            num_suppressed; // Calls suppressed by level, or 
+                                        // only recorded in memory
+    
+    int                 is_registered;
+    
+    struct LOGMSG_SITE* p_next;
+    
+} LOGMSG_SITE;
+
+/*******************************************************************************
+
+    LOGMSG_SITE_STATS - Counts of a call site
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_SITE_STATS {
+
+    const char*  file;
+    
+    int          line;
+    
+    const char*  function;
+    
+    LOGMSG_LEVEL level;
+    
+    uint64_t     num_calls;
+    
+    uint64_t     num_bytes;
+    
+    uint64_t     num_suppressed;
+    
+} LOGMSG_SITE_STATS;
+
+/*******************************************************************************
+
+    logmsg_site_stats_enabled - Set once sites are counted
+    
+*******************************************************************************/
+
+extern int logmsg_site_stats_enabled;
+
+/*******************************************************************************
+
+    logmsg_start_site_stats() - Start counting the calls, bytes written and
+                                calls suppressed of each site
+    
+    Description
+    ===========
+    
+    Sites of the LOGMSG_<LEVEL>_PRINTF() macros are counted from now on. A
+    report of the sites which wrote most is written to report_spec (stan-
+    dard error if NULL) at exit, and on each report_signal (none if 0), 
+    e.g. SIGUSR2.
+    
+    Return 0 on success, -1 on failure or if already started.
+    
+*******************************************************************************/
+
+int logmsg_start_site_stats(const char* report_spec, int report_signal);
+
+/*******************************************************************************
+
+    logmsg_printf_site() - As logmsg_printf(), counting the call and the 
+                           bytes written for the site
+    
+    Description
+    ===========
+    
+    A call whose entry is only recorded by the flight recorder, as too 
+    detailed for the log file, is counted as suppressed.
+    
+*******************************************************************************/
+
+void logmsg_printf_site(LOGMSG_SITE* p_site, 
+                        LOGMSG_LEVEL level, 
+                        const char* format, 
+                        ...);
+
+/*******************************************************************************
+
+    logmsg_site_suppressed() - Count call of site suppressed by level
+    
+*******************************************************************************/
+
+void logmsg_site_suppressed(LOGMSG_SITE* p_site);
+
+/*******************************************************************************
+
+    logmsg_get_site_stats() - Get counts of sites, in decreasing order of
+                              bytes written
+    
+    Description
+    ===========
+    
+    Fills in at most max_stats entries of p_stats, for the sites which 
+    wrote most, and returns the number filled in. Uses only async-signal-
+    safe functions.
+    
+*******************************************************************************/
+
+size_t logmsg_get_site_stats(LOGMSG_SITE_STATS* p_stats, size_t max_stats);
+
+/*******************************************************************************
+
+    logmsg_write_site_report() - Write table of the counts of the 32 sites
+                                 which wrote most to fd
+    
+    Description
+    ===========
+    
+    Uses only async-signal-safe functions.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_write_site_report(int fd);
+
+/*******************************************************************************
+
+    LOGMSG_PRINTF() - Convenience macro 
+    
+    Description
+    ===========
+    
+    Invoke logmsg_printf() but supply __FILE__, __LINE__, and __FUNCTION__ 
+    as additional initial arguments to be printed.
+    
+*******************************************************************************/
+
+#define LOGMSG_PRINTF(level, format, ...)                         \
+    logmsg_printf(level,                                          \
+                  "%s:%d:%s() " format,                           \
+                  __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+/*******************************************************************************
+
+    LOGMSG_<LEVEL>_PRINTF() - 
+    
+    Convenience macros which conditionally generate log entries
+    
+    Description
+    ===========
+    
+    If logmsg_level or logmsg_recorder_level is >= <LEVEL>, invoke 
+    logmsg_printf() but supply __FILE__, __LINE__, and __FUNCTION__ as addi-
+    tional initial arguments to be printed.
+    
+    Once logmsg_start_site_stats() is called, each call is also counted in
+    the static LOGMSG_SITE of the call site, via logmsg_printf_site() or
+    logmsg_site_suppressed(), a call recorded only by the flight recorder
+    being counted as suppressed.
+    
+*******************************************************************************/
+
+#define LOGMSG_SITE_PRINTF(level, format, ...)                          \
+do {                                                                    \
+    static LOGMSG_SITE logmsg_site_ =                                   \
+        { __FILE__, __LINE__, __FUNCTION__, level };                    \
+    if (logmsg_level >= level || logmsg_recorder_level >= level) {      \
+        if (logmsg_site_stats_enabled) {                                \
+            logmsg_printf_site(&logmsg_site_,                           \
+                               level,                                   \
+                               "%s:%d:%s() " format,                    \
+                               __FILE__, __LINE__, __FUNCTION__,        \
+                               __VA_ARGS__);                            \
+        } else {                                                        \
+            LOGMSG_PRINTF(level, format, __VA_ARGS__);                  \
+        }                                                               \
+    } else if (logmsg_site_stats_enabled) {                             \
+        logmsg_site_suppressed(&logmsg_site_);                          \
+    }                                                                   \
+} while (0)
+
+#define LOGMSG_FATAL_PRINTF(format, ...)                    \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_FATAL, format, __VA_ARGS__)
+
+#define LOGMSG_ERROR_PRINTF(format, ...)                    \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_ERROR, format, __VA_ARGS__)
+
+#define LOGMSG_WARN_PRINTF(format, ...)                     \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_WARN, format, __VA_ARGS__)
+
+#define LOGMSG_INFO_PRINTF(format, ...)                     \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_INFO, format, __VA_ARGS__)
+
+#define LOGMSG_DEBUG_PRINTF(format, ...)                    \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_DEBUG, format, __VA_ARGS__)
+
+#define LOGMSG_TRACE_PRINTF(format, ...)                    \
+    LOGMSG_SITE_PRINTF(LOGMSG_LEVEL_TRACE, format, __VA_ARGS__)
+
+
+/*******************************************************************************
+
+    LOGMSG_SIGNAL_SAFE_PRINTF() - Convenience macro 
+    
+    Description
+    ===========
+    
+    As LOGMSG_PRINTF(), invoking logmsg_printf_signal_safe().
+    
+*******************************************************************************/
+
+#define LOGMSG_SIGNAL_SAFE_PRINTF(level, format, ...)             \
+    logmsg_printf_signal_safe(level,                              \
+                              "%s:%d:%s() " format,               \
+                              __FILE__, __LINE__, __FUNCTION__,   \
+                              __VA_ARGS__)
+
+/*******************************************************************************
+
+    LOGMSG_<LEVEL>_PRINTF_SIGNAL_SAFE() - 
+    
+    Convenience macros which conditionally generate log entries from signal
+    handlers
+    
+    Description
+    ===========
+    
+    If logmsg_level is >= <LEVEL>, invoke LOGMSG_SIGNAL_SAFE_PRINTF(). 
+    Entries are never recorded by the flight recorder.
+    
+*******************************************************************************/
+
+#define LOGMSG_FATAL_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_FATAL) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_FATAL, format, __VA_ARGS__); \
+}
+
+#define LOGMSG_ERROR_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_ERROR) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_ERROR, format, __VA_ARGS__); \
+}
+
+#define LOGMSG_WARN_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_WARN) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_WARN, format, __VA_ARGS__); \
+}
+
+#define LOGMSG_INFO_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_INFO) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_INFO, format, __VA_ARGS__); \
+}
+
+#define LOGMSG_DEBUG_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_DEBUG) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_DEBUG, format, __VA_ARGS__); \
+}
+
+#define LOGMSG_TRACE_PRINTF_SIGNAL_SAFE(format, ...)                    \
+if (logmsg_level >= LOGMSG_LEVEL_TRACE) {                               \
+    LOGMSG_SIGNAL_SAFE_PRINTF(LOGMSG_LEVEL_TRACE, format, __VA_ARGS__); \
+}
+
+/*******************************************************************************
+
+    LOGMSG_KV_TYPE - Type of the value of a structured log entry field
+    
+*******************************************************************************/
+
+typedef enum LOGMSG_KV_TYPE {
+
+    LOGMSG_KV_TYPE_INT    = 1,  // int64_t
+    
+    LOGMSG_KV_TYPE_DOUBLE = 2,  // double
+    
+    LOGMSG_KV_TYPE_STRING = 3,  // NULL terminated string
+    
+} LOGMSG_KV_TYPE;
+
+/*******************************************************************************
+
+    LOGMSG_KV - Key and typed value of a structured log entry field
+    
+    Description
+    ===========
+    
+    Keys should consist of letters, digits, '_', '.' and '-' only, and be no
+    longer than 255 characters. Use the constructors below rather than ini-
+    tializing the structure directly.
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_KV {
+
+    const char*    key;
+    
+    LOGMSG_KV_TYPE type;
+    
+    union {
+    
+        int64_t     i;
+        
+        double      d;
+        
+        const char* s;
+        
+    } value;
+    
+} LOGMSG_KV;
+
+static inline LOGMSG_KV logmsg_kv_int(const char* key, int64_t value) {
+
+    LOGMSG_KV kv;
+    
+    kv.key = key;
+    
+    kv.type = LOGMSG_KV_TYPE_INT;
+    
+    kv.value.i = value;
+    
+    return kv;
+}
+
+static inline LOGMSG_KV logmsg_kv_double(const char* key, double value) {
+
+    LOGMSG_KV kv;
+    
+    kv.key = key;
+    
+    kv.type = LOGMSG_KV_TYPE_DOUBLE;
+    
+    kv.value.d = value;
+    
+    return kv;
+}
+
+static inline LOGMSG_KV logmsg_kv_string(const char* key, const char* value) {
+
+    LOGMSG_KV kv;
+    
+    kv.key = key;
+    
+    kv.type = LOGMSG_KV_TYPE_STRING;
+    
+    kv.value.s = value;
+    
+    return kv;
+}
+
+/*******************************************************************************
+
+    LOGMSG_KV_FORMAT - Rendering of structured log entries
+    
+    Description
+    ===========
+    
+    LOGMSG_KV_FORMAT_LOGFMT (default) and LOGMSG_KV_FORMAT_JSON append the 
+    fields to the usual entry text, e.g.
+    
+        <utc-time> INFO host:prog[pid:tid] request done status=200 path=/a
+        
+        <utc-time> INFO host:prog[pid:tid] {"msg":"request done",
+                                            "status":200,"path":"/a"}
+                                            
+    (the latter on a single line). Strings are quoted and escaped as needed,
+    so that each entry remains a single line.
+    
+    LOGMSG_KV_FORMAT_BINARY writes each entry as a length prefixed binary
+    record instead of a line of text, so that consumers can read the fields
+    without parsing them. Such records should not be mixed with text 
+    entries in one file. The layout is described with logmsg_parse_binary()
+    in logmsg_parse.h, which decodes them.
+    
+*******************************************************************************/
+
+typedef enum LOGMSG_KV_FORMAT {
+
+    LOGMSG_KV_FORMAT_LOGFMT = 0,
+    
+    LOGMSG_KV_FORMAT_JSON   = 1,
+    
+    LOGMSG_KV_FORMAT_BINARY = 2,
+    
+} LOGMSG_KV_FORMAT;
+
+/*******************************************************************************
+
+    logmsg_set_kv_format() - Select rendering of structured log entries
+    
+    Return 0 on success, -1 if the format is not recognized.
+    
+*******************************************************************************/
+
+int logmsg_set_kv_format(LOGMSG_KV_FORMAT format);
+
+/*******************************************************************************
+
+    logmsg_kv() - Write structured log entry
+    
+    Description
+    ===========
+    
+    Write a log entry consisting of a fixed message and the num_fields 
+    fields of p_fields, rendered according to the format selected by 
+    logmsg_set_kv_format(). No printf style formatting is involved: integers
+    are converted directly, and strings copied with escaping as needed.
+    
+*******************************************************************************/
+
+void logmsg_kv(LOGMSG_LEVEL level, 
+               const char* message, 
+               const LOGMSG_KV* p_fields, 
+               size_t num_fields);
+
+/*******************************************************************************
+
+    LOGMSG_KV_LOG() - Convenience macro
+    
+    Description
+    ===========
+    
+    Invoke logmsg_kv() with the fields given as further arguments, e.g.
+    
+        LOGMSG_KV_LOG(LOGMSG_LEVEL_INFO, "request done",
+                      logmsg_kv_int("status", 200),
+                      logmsg_kv_string("path", path));
+    
+*******************************************************************************/
+
+#define LOGMSG_KV_LOG(level, message, ...)                               \
+do {                                                                     \
+    const LOGMSG_KV logmsg_kv_fields_[] = { __VA_ARGS__ };               \
+    logmsg_kv(level,                                                     \
+              message,                                                   \
+              logmsg_kv_fields_,                                         \
+              sizeof(logmsg_kv_fields_) / sizeof(logmsg_kv_fields_[0])); \
+} while (0)
+
+/*******************************************************************************
+
+    LOGMSG_<LEVEL>_KV() - 
+    
+    Convenience macros which conditionally generate structured log entries
+    
+*******************************************************************************/
+
+#define LOGMSG_FATAL_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_FATAL ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_FATAL) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_FATAL, message, __VA_ARGS__); \
+}
+
+#define LOGMSG_ERROR_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_ERROR ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_ERROR) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_ERROR, message, __VA_ARGS__); \
+}
+
+#define LOGMSG_WARN_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_WARN ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_WARN) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_WARN, message, __VA_ARGS__); \
+}
+
+#define LOGMSG_INFO_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_INFO ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_INFO) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_INFO, message, __VA_ARGS__); \
+}
+
+#define LOGMSG_DEBUG_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_DEBUG ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_DEBUG) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_DEBUG, message, __VA_ARGS__); \
+}
+
+#define LOGMSG_TRACE_KV(message, ...)                        \
+if (logmsg_level >= LOGMSG_LEVEL_TRACE ||                    \
+    logmsg_recorder_level >= LOGMSG_LEVEL_TRACE) {           \
+    LOGMSG_KV_LOG(LOGMSG_LEVEL_TRACE, message, __VA_ARGS__); \
+}
+
+
+/*******************************************************************************
+
+    LOGMSG_SPAN_SITE - Call site of a timing span
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_SPAN_SITE {
+
+    const char* name;
+    
+    const char* file;
+    
+    int         line;
+    
+    const char* function;
+    
+} LOGMSG_SPAN_SITE;
+
+/*******************************************************************************
+
+    logmsg_start_spans() - Start recording timing spans
+    
+    Description
+    ===========
+    
+    Each thread records the beginnings and ends of its spans, with their 
+    timestamps, in a ring of the latest num_events events (65536 if 0), 
+    without locks or formatting. Until this is called, spans cost only a
+    check.
+    
+    Return 0 on success, -1 on failure or if already started.
+    
+*******************************************************************************/
+
+int logmsg_start_spans(size_t num_events);
+
+/*******************************************************************************
+
+    logmsg_span_begin(), logmsg_span_end() - Record beginning and end of span
+    
+    Description
+    ===========
+    
+    Spans of a thread must nest. Usually called by LOGMSG_SPAN_BEGIN() and
+    LOGMSG_SPAN_END(), or by logmsg::span in C++.
+    
+*******************************************************************************/
+
+void logmsg_span_begin(const LOGMSG_SPAN_SITE* p_site);
+
+void logmsg_span_end(const LOGMSG_SPAN_SITE* p_site);
+
+/*******************************************************************************
+
+    logmsg_export_trace() - Write recorded spans as Chrome trace events
+    
+    Description
+    ===========
+    
+    The events still held for each thread are written to file_spec in the
+    trace event JSON format, for loading into chrome://tracing or Perfetto.
+    Timestamps are UTC, and each beginning carries the file, line and func-
+    tion of its call site. Ends whose beginnings have been overwritten are
+    omitted.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_export_trace(const char* file_spec);
+
+/*******************************************************************************
+
+    LOGMSG_SPAN_BEGIN(), LOGMSG_SPAN_END() - Convenience macros
+    
+    Description
+    ===========
+    
+    Record the beginning and end of a span named by an identifier, in the
+    same block, e.g.
+    
+        LOGMSG_SPAN_BEGIN(parse_request);
+        ...
+        LOGMSG_SPAN_END(parse_request);
+    
+*******************************************************************************/
+
+#define LOGMSG_SPAN_BEGIN(name)                                      \
+    static const LOGMSG_SPAN_SITE logmsg_span_site_##name =          \
+        { #name, __FILE__, __LINE__, __func__ };                     \
+    logmsg_span_begin(&logmsg_span_site_##name)
+
+#define LOGMSG_SPAN_END(name)                                        \
+    logmsg_span_end(&logmsg_span_site_##name)
 
 
 #ifdef __cplusplus
@@ -0,0 +1,1208 @@
+/*******************************************************************************
+
+    logmsg.hpp - Type-safe C++ interface to the logmsg library
+
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#ifndef LOGMSG_HPP
+
+#define LOGMSG_HPP
+
+/*******************************************************************************
+*                                                                              *
+*                           Additional header files                            *
+*                                                                              *
+*******************************************************************************/
+
+#include <logmsg.h>
+
+#include <sys/eventfd.h>
+
+#include <unistd.h>
+
+#include <charconv>
+
+#include <cmath>
+
+#include <coroutine>
+
+#include <cstddef>
+
+#include <cstdint>
+
+#include <cstring>
+
+#include <memory>
+
+#include <string>
+
+#include <string_view>
+
+#include <type_traits>
+
+#include <utility>
+
+#if __cplusplus < 202002L
+#error "logmsg.hpp requires C++20 (consteval format checking)"
+#endif
+
+/*******************************************************************************
+
+    Description
+    ===========
+
+    The functions of this header take a printf style format, which is par-
+    sed and checked against the types of the arguments at compile time:
+
+        logmsg::info("%s took %.3f ms (%d retries)", name, elapsed, retries);
+
+    A format which is malformed, or whose conversions do not suit the argu-
+    ments, fails to compile. The parsed format records, for each argument,
+    the literal text which precedes it and its conversion, so that at run
+    time each argument is passed directly to a writer for its type, with
+    no va_list and no format scanning.
+
+    Supported conversions are d i u x X o c s p f F e E g G, with flags
+    - 0 + space #, and literal width and precision. Length modifiers (h, l,
+    ll, z, j, t, L) are accepted and ignored, since the argument type is
+    known. Arguments of %s may be const char*, std::string or
+    std::string_view; enumerations are written as their underlying type.
+
+*******************************************************************************/
+
+namespace logmsg {
+
+namespace detail {
+
+/*******************************************************************************
+
+    arg_kind - Category of argument type, used to check conversions
+
+*******************************************************************************/
+
+enum class arg_kind : unsigned char {
+
+    integer,
+
+    floating,
+
+    string,
+
+    pointer,
+
+    other,
+};
+
+template <typename T>
+constexpr arg_kind kind_of() {
+
+    using D = std::decay_t<T>;
+
+    if constexpr (std::is_integral_v<D> || std::is_enum_v<D>) {
+
+        return arg_kind::integer;
+
+    } else if constexpr (std::is_floating_point_v<D>) {
+
+        return arg_kind::floating;
+
+    } else if constexpr (std::is_same_v<D, const char*> ||
+                         std::is_same_v<D, char*> ||
+                         std::is_same_v<D, std::string> ||
+                         std::is_same_v<D, std::string_view>) {
+
+        return arg_kind::string;
+
+    } else if constexpr (std::is_pointer_v<D> ||
+                         std::is_same_v<D, std::nullptr_t>) {
+
+        return arg_kind::pointer;
+
+    } else {
+
+        return arg_kind::other;
+    }
+}
+
+/*******************************************************************************
+
+    spec - Parsed conversion of an argument, and the literal text preceding
+           it in the format
+
+*******************************************************************************/
+
+enum : unsigned char {
+
+    FLAG_LEFT  = 0x01,
+
+    FLAG_ZERO  = 0x02,
+
+    FLAG_PLUS  = 0x04,
+
+    FLAG_SPACE = 0x08,
+
+    FLAG_ALT   = 0x10,
+};
+
+// Bound on width and precision, so that numbers fit in fixed buffers
+
+constexpr int MAX_WIDTH_PRECISION = 100;
+
+struct spec {
+
+    unsigned short lit_begin;   // Literal text preceding conversion, which
+
+    unsigned short lit_end;     // contains "%%" escapes if lit_escaped
+
+    bool           lit_escaped;
+
+    char           conv;        // Conversion character
+
+    unsigned char  flags;
+
+    short          width;       // -1 if not specified
+
+    short          precision;   // -1 if not specified
+};
+
+/*******************************************************************************
+
+    format_error() - Not constexpr, so that a call to it while parsing a
+                     format fails compilation, showing the error text
+
+*******************************************************************************/
+
+void format_error(const char* error_text);
+
+/*******************************************************************************
+
+    basic_format_string - Format parsed and checked at compile time against
+                          argument types Args
+
+*******************************************************************************/
+
+template <typename... Args>
+struct basic_format_string {
+
+    static constexpr std::size_t num_args = sizeof...(Args);
+
+    const char* text;
+
+    std::size_t length;
+
+    spec specs[num_args + 1];   // Last covers only the trailing literal
+
+    template <std::size_t N>
+    consteval basic_format_string(const char (&format)[N]) :
+        text(format), length(N - 1), specs{} {
+
+        constexpr arg_kind kinds[] = { kind_of<Args>()..., arg_kind::other };
+
+        if (N - 1 > 0xFFFF) {
+
+            format_error("format too long");
+        }
+
+        std::size_t i = 0;
+
+        std::size_t arg = 0;
+
+        std::size_t lit_begin = 0;
+
+        bool lit_escaped = false;
+
+        while (i < length) {
+
+            if (format[i] != '%') {
+
+                i++;
+
+                continue;
+            }
+
+            if (i + 1 < length && format[i + 1] == '%') {
+
+                lit_escaped = true;
+
+                i += 2;
+
+                continue;
+            }
+
+            spec s{};
+
+            s.lit_begin = (unsigned short)lit_begin;
+
+            s.lit_end = (unsigned short)i;
+
+            s.lit_escaped = lit_escaped;
+
+            s.width = -1;
+
+            s.precision = -1;
+
+            i++;
+
+            /*
+             *  Flags
+             */
+
+            for (;; i++) {
+
+                char c = i < length ? format[i] : 0;
+
+                if (c == '-') {
+
+                    s.flags |= FLAG_LEFT;
+
+                } else if (c == '0') {
+
+                    s.flags |= FLAG_ZERO;
+
+                } else if (c == '+') {
+
+                    s.flags |= FLAG_PLUS;
+
+                } else if (c == ' ') {
+
+                    s.flags |= FLAG_SPACE;
+
+                } else if (c == '#') {
+
+                    s.flags |= FLAG_ALT;
+
+                } else {
+
+                    break;
+                }
+            }
+
+            /*
+             *  Width and precision
+             */
+
+            if (i < length && format[i] == '*') {
+
+                format_error("'*' width is not supported");
+            }
+
+            if (i < length && format[i] >= '0' && format[i] <= '9') {
+
+                int width = 0;
+
+                while (i < length && format[i] >= '0' && format[i] <= '9') {
+
+                    width = 10 * width + (format[i++] - '0');
+
+                    if (width > MAX_WIDTH_PRECISION) {
+
+                        format_error("width too large");
+                    }
+                }
+
+                s.width = (short)width;
+            }
+
+            if (i < length && format[i] == '.') {
+
+                i++;
+
+                if (i < length && format[i] == '*') {
+
+                    format_error("'*' precision is not supported");
+                }
+
+                int precision = 0;
+
+                while (i < length && format[i] >= '0' && format[i] <= '9') {
+
+                    precision = 10 * precision + (format[i++] - '0');
+
+                    if (precision > MAX_WIDTH_PRECISION) {
+
+                        format_error("precision too large");
+                    }
+                }
+
+                s.precision = (short)precision;
+            }
+
+            /*
+             *  Length modifiers
+             */
+
+            while (i < length && (format[i] == 'h' || format[i] == 'l' ||
+                                  format[i] == 'z' || format[i] == 'j' ||
+                                  format[i] == 't' || format[i] == 'L' ||
+                                  format[i] == 'q')) {
+
+                i++;
+            }
+
+            /*
+             *  Conversion, which must suit the argument
+             */
+
+            if (i >= length) {
+
+                format_error("incomplete conversion at end of format");
+            }
+
+            s.conv = format[i++];
+
+            if (arg >= num_args) {
+
+                format_error("more conversions than arguments");
+            }
+
+            arg_kind kind = kinds[arg];
+
+            switch (s.conv) {
+
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            case 'c':
+
+                if (kind != arg_kind::integer) {
+
+                    format_error("integer conversion of non-integer argument");
+                }
+
+                break;
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+
+                if (kind != arg_kind::floating) {
+
+                    format_error("floating conversion of non-floating argument");
+                }
+
+                if (s.flags & FLAG_ALT) {
+
+                    format_error("'#' flag is not supported for floating conversions");
+                }
+
+                break;
+
+            case 's':
+
+                if (kind != arg_kind::string) {
+
+                    format_error("%s conversion of non-string argument");
+                }
+
+                break;
+
+            case 'p':
+
+                if (kind != arg_kind::pointer && kind != arg_kind::string) {
+
+                    format_error("%p conversion of non-pointer argument");
+                }
+
+                break;
+
+            default:
+
+                format_error("unsupported conversion");
+
+                break;
+            }
+
+            specs[arg++] = s;
+
+            lit_begin = i;
+
+            lit_escaped = false;
+        }
+
+        if (arg != num_args) {
+
+            format_error("more arguments than conversions");
+        }
+
+        specs[num_args].lit_begin = (unsigned short)lit_begin;
+
+        specs[num_args].lit_end = (unsigned short)length;
+
+        specs[num_args].lit_escaped = lit_escaped;
+    }
+};
+
+/*******************************************************************************
+
+    message_buffer - Growable buffer for formatted message, on the stack
+                     unless the message is large
+
+*******************************************************************************/
+
+class message_buffer {
+
+public:
+
+    message_buffer() :
+        p_begin_(stack_), p_write_(stack_), p_end_(stack_ + sizeof(stack_)) {}
+
+    message_buffer(const message_buffer&) = delete;
+
+    message_buffer& operator=(const message_buffer&) = delete;
+
+    // Return pointer to space for at least len characters
+
+    char* reserve(std::size_t len) {
+
+        if ((std::size_t)(p_end_ - p_write_) < len) {
+
+            grow(len);
+        }
+
+        return p_write_;
+    }
+
+    // Account for characters written to reserved space
+
+    void commit(char* p_write) {
+
+        p_write_ = p_write;
+    }
+
+    void append(const char* p_text, std::size_t len) {
+
+        std::memcpy(reserve(len), p_text, len);
+
+        p_write_ += len;
+    }
+
+    void fill(char c, std::size_t len) {
+
+        std::memset(reserve(len), c, len);
+
+        p_write_ += len;
+    }
+
+    const char* data() const {
+
+        return p_begin_;
+    }
+
+    std::size_t size() const {
+
+        return p_write_ - p_begin_;
+    }
+
+private:
+
+    void grow(std::size_t len) {
+
+        std::size_t size = p_write_ - p_begin_;
+
+        std::size_t capacity = 2 * (p_end_ - p_begin_);
+
+        if (capacity < size + len) {
+
+            capacity = size + len;
+        }
+
+        std::unique_ptr<char[]> heap(new char[capacity]);
+
+        std::memcpy(heap.get(), p_begin_, size);
+
+        heap_ = std::move(heap);
+
+        p_begin_ = heap_.get();
+
+        p_write_ = p_begin_ + size;
+
+        p_end_ = p_begin_ + capacity;
+    }
+
+    char stack_[512];
+
+    std::unique_ptr<char[]> heap_;
+
+    char* p_begin_;
+
+    char* p_write_;
+
+    char* p_end_;
+};
+
+/*******************************************************************************
+
+    write_literal() - Write literal text of format, replacing "%%" by "%"
+
+*******************************************************************************/
+
+inline void write_literal(message_buffer& buffer,
+                          const char* text,
+                          const spec& s) {
+
+    if (!s.lit_escaped) {
+
+        buffer.append(text + s.lit_begin, s.lit_end - s.lit_begin);
+
+        return;
+    }
+
+    for (std::size_t i = s.lit_begin; i < s.lit_end; i++) {
+
+        const char* p_percent =
+            (const char*)std::memchr(text + i, '%', s.lit_end - i);
+
+        std::size_t end = p_percent ? p_percent - text + 1 : s.lit_end;
+
+        buffer.append(text + i, end - i);
+
+        i = end;    // Skip second '%'
+    }
+}
+
+/*******************************************************************************
+
+    write_padded() - Write prefix (sign or radix) and body of a conversion,
+                     padded to the width of the conversion
+
+*******************************************************************************/
+
+inline void write_padded(message_buffer& buffer,
+                         const spec& s,
+                         const char* p_prefix,
+                         std::size_t prefix_len,
+                         const char* p_body,
+                         std::size_t body_len,
+                         bool zero_pad) {
+
+    std::size_t len = prefix_len + body_len;
+
+    std::size_t pad_len = s.width > (int)len ? s.width - len : 0;
+
+    if (pad_len == 0) {
+
+        buffer.append(p_prefix, prefix_len);
+
+        buffer.append(p_body, body_len);
+
+    } else if (s.flags & FLAG_LEFT) {
+
+        buffer.append(p_prefix, prefix_len);
+
+        buffer.append(p_body, body_len);
+
+        buffer.fill(' ', pad_len);
+
+    } else if (zero_pad) {
+
+        buffer.append(p_prefix, prefix_len);
+
+        buffer.fill('0', pad_len);
+
+        buffer.append(p_body, body_len);
+
+    } else {
+
+        buffer.fill(' ', pad_len);
+
+        buffer.append(p_prefix, prefix_len);
+
+        buffer.append(p_body, body_len);
+    }
+}
+
+/*******************************************************************************
+
+    write_integer() - Write integer conversion (d i u x X o)
+
+*******************************************************************************/
+
+template <typename T>
+void write_integer(message_buffer& buffer, const spec& s, T value) {
+
+    using U = std::make_unsigned_t<T>;
+
+    char prefix[2];
+
+    std::size_t prefix_len = 0;
+
+    unsigned long long magnitude = (U)value;
+
+    int base = 10;
+
+    /*
+     *  Determine sign or radix prefix, and magnitude
+     */
+
+    if (s.conv == 'd' || s.conv == 'i') {
+
+        if constexpr (std::is_signed_v<T>) {
+
+            if (value < 0) {
+
+                prefix[prefix_len++] = '-';
+
+                magnitude = 0ULL - (unsigned long long)(long long)value;
+            }
+        }
+
+        if (prefix_len == 0 && (s.flags & (FLAG_PLUS | FLAG_SPACE))) {
+
+            prefix[prefix_len++] = (s.flags & FLAG_PLUS) ? '+' : ' ';
+        }
+
+    } else if (s.conv == 'x' || s.conv == 'X') {
+
+        base = 16;
+
+        if ((s.flags & FLAG_ALT) && magnitude != 0) {
+
+            prefix[prefix_len++] = '0';
+
+            prefix[prefix_len++] = s.conv;
+        }
+
+    } else if (s.conv == 'o') {
+
+        base = 8;
+    }
+
+    /*
+     *  Convert digits, including leading zeros required by precision
+     */
+
+    char body[MAX_WIDTH_PRECISION + 32];
+
+    char* p_digits = body + MAX_WIDTH_PRECISION;
+
+    char* p_end = p_digits;
+
+    if (!(s.precision == 0 && magnitude == 0)) {
+
+        p_end = std::to_chars(p_digits, body + sizeof(body),
+                              magnitude, base).ptr;
+    }
+
+    if (s.conv == 'X') {
+
+        for (char* p = p_digits; p < p_end; p++) {
+
+            if (*p >= 'a') {
+
+                *p -= 'a' - 'A';
+            }
+        }
+    }
+
+    char* p_body = p_digits;
+
+    while (p_end - p_body < s.precision) {
+
+        *--p_body = '0';
+    }
+
+    if (s.conv == 'o' && (s.flags & FLAG_ALT) &&
+        (p_body == p_end || *p_body != '0')) {
+
+        *--p_body = '0';
+    }
+
+    write_padded(buffer, s, prefix, prefix_len, p_body, p_end - p_body,
+                 (s.flags & FLAG_ZERO) && s.precision < 0);
+}
+
+/*******************************************************************************
+
+    write_floating() - Write floating conversion (f F e E g G)
+
+*******************************************************************************/
+
+template <typename T>
+void write_floating(message_buffer& buffer, const spec& s, T value) {
+
+    char prefix[1];
+
+    std::size_t prefix_len = 0;
+
+    if (std::signbit(value)) {
+
+        prefix[prefix_len++] = '-';
+
+    } else if (s.flags & (FLAG_PLUS | FLAG_SPACE)) {
+
+        prefix[prefix_len++] = (s.flags & FLAG_PLUS) ? '+' : ' ';
+    }
+
+    bool upper = s.conv == 'F' || s.conv == 'E' || s.conv == 'G';
+
+    /*
+     *  Infinity and NaN are never zero padded
+     */
+
+    if (!std::isfinite(value)) {
+
+        const char* p_body = std::isnan(value) ? (upper ? "NAN" : "nan")
+                                               : (upper ? "INF" : "inf");
+
+        write_padded(buffer, s, prefix, prefix_len, p_body, 3, false);
+
+        return;
+    }
+
+    std::chars_format format =
+        (s.conv == 'f' || s.conv == 'F') ? std::chars_format::fixed :
+            (s.conv == 'e' || s.conv == 'E') ? std::chars_format::scientific :
+                std::chars_format::general;
+
+    // Largest fixed conversion is 309 integer digits, point and precision
+
+    char body[320 + MAX_WIDTH_PRECISION];
+
+    char* p_end = std::to_chars(body, body + sizeof(body),
+                                std::fabs(value), format,
+                                s.precision < 0 ? 6 : s.precision).ptr;
+
+    if (upper) {
+
+        for (char* p = body; p < p_end; p++) {
+
+            if (*p == 'e') {
+
+                *p = 'E';
+            }
+        }
+    }
+
+    write_padded(buffer, s, prefix, prefix_len, body, p_end - body,
+                 (s.flags & FLAG_ZERO) != 0);
+}
+
+/*******************************************************************************
+
+    write_string() - Write %s conversion, truncated to precision
+
+*******************************************************************************/
+
+inline void write_string(message_buffer& buffer,
+                         const spec& s,
+                         const char* p_text,
+                         std::size_t text_len) {
+
+    if (s.precision >= 0 && text_len > (std::size_t)s.precision) {
+
+        text_len = s.precision;
+    }
+
+    write_padded(buffer, s, "", 0, p_text, text_len, false);
+}
+
+/*******************************************************************************
+
+    write_pointer() - Write %p conversion as glibc does
+
+*******************************************************************************/
+
+inline void write_pointer(message_buffer& buffer,
+                          const spec& s,
+                          const void* p_value) {
+
+    if (p_value == nullptr) {
+
+        write_padded(buffer, s, "", 0, "(nil)", 5, false);
+
+        return;
+    }
+
+    char body[2 * sizeof(void*)];
+
+    char* p_end = std::to_chars(body, body + sizeof(body),
+                                (std::uintptr_t)p_value, 16).ptr;
+
+    write_padded(buffer, s, "0x", 2, body, p_end - body, false);
+}
+
+/*******************************************************************************
+
+    write_arg() - Write argument according to its conversion, selecting the
+                  writer for its type at compile time
+
+*******************************************************************************/
+
+template <typename T>
+inline void write_arg(message_buffer& buffer, const spec& s, const T& value) {
+
+    using D = std::decay_t<T>;
+
+    if constexpr (std::is_enum_v<D>) {
+
+        write_arg(buffer, s, static_cast<std::underlying_type_t<D>>(value));
+
+    } else if constexpr (std::is_same_v<D, bool>) {
+
+        write_integer(buffer, s, static_cast<int>(value));
+
+    } else if constexpr (std::is_integral_v<D>) {
+
+        if (s.conv == 'c') {
+
+            char c = static_cast<char>(value);
+
+            write_padded(buffer, s, "", 0, &c, 1, false);
+
+        } else {
+
+            write_integer(buffer, s, value);
+        }
+
+    } else if constexpr (std::is_floating_point_v<D>) {
+
+        write_floating(buffer, s, value);
+
+    } else if constexpr (std::is_same_v<D, std::string> ||
+                         std::is_same_v<D, std::string_view>) {
+
+        if (s.conv == 'p') {
+
+            write_pointer(buffer, s, value.data());
+
+        } else {
+
+            write_string(buffer, s, value.data(), value.size());
+        }
+
+    } else if constexpr (std::is_same_v<D, const char*> ||
+                         std::is_same_v<D, char*>) {
+
+        const char* p_text = value;
+
+        if (s.conv == 'p') {
+
+            write_pointer(buffer, s, p_text);
+
+        } else if (p_text == nullptr) {
+
+            write_string(buffer, s, "(null)", 6);
+
+        } else {
+
+            write_string(buffer, s, p_text, std::strlen(p_text));
+        }
+
+    } else {
+
+        write_pointer(buffer, s, (const void*)value);
+    }
+}
+
+/*******************************************************************************
+
+    format_to() - Write formatted message to buffer
+
+*******************************************************************************/
+
+template <typename... Args>
+inline void format_to(message_buffer& buffer,
+                      const basic_format_string<Args...>& format,
+                      const Args&... args) {
+
+    std::size_t i = 0;
+
+    ((write_literal(buffer, format.text, format.specs[i]),
+      write_arg(buffer, format.specs[i], args),
+      i++), ...);
+
+    write_literal(buffer, format.text, format.specs[i]);
+}
+
+} // namespace detail
+
+/*******************************************************************************
+
+    format_string - Format checked at compile time against the types of the
+                    arguments which follow it
+
+*******************************************************************************/
+
+template <typename... Args>
+using format_string =
+    detail::basic_format_string<std::type_identity_t<Args>...>;
+
+/*******************************************************************************
+
+    format() - Return formatted message
+
+*******************************************************************************/
+
+template <typename... Args>
+std::string format(format_string<Args...> format, const Args&... args) {
+
+    detail::message_buffer buffer;
+
+    detail::format_to(buffer, format, args...);
+
+    return std::string(buffer.data(), buffer.size());
+}
+
+/*******************************************************************************
+
+    log() - Write log entry using compile-time checked printf style format
+
+    Description
+    ===========
+
+    As logmsg_printf(), whatever the value of logmsg_level.
+
+*******************************************************************************/
+
+template <typename... Args>
+void log(LOGMSG_LEVEL level, format_string<Args...> format, const Args&... args) {
+
+    detail::message_buffer buffer;
+
+    detail::format_to(buffer, format, args...);
+
+    logmsg_write(level, buffer.data(), buffer.size());
+}
+
+/*******************************************************************************
+
+    fatal(), error(), warn(), info(), debug(), trace() -
+
+    Write log entry if logmsg_level, or logmsg_recorder_level, is at least
+    the level of the function
+
+*******************************************************************************/
+
+template <typename... Args>
+inline void fatal(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_FATAL ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_FATAL) {
+
+        log(LOGMSG_LEVEL_FATAL, format, args...);
+    }
+}
+
+template <typename... Args>
+inline void error(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_ERROR ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_ERROR) {
+
+        log(LOGMSG_LEVEL_ERROR, format, args...);
+    }
+}
+
+template <typename... Args>
+inline void warn(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_WARN ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_WARN) {
+
+        log(LOGMSG_LEVEL_WARN, format, args...);
+    }
+}
+
+template <typename... Args>
+inline void info(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_INFO ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_INFO) {
+
+        log(LOGMSG_LEVEL_INFO, format, args...);
+    }
+}
+
+template <typename... Args>
+inline void debug(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_DEBUG ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_DEBUG) {
+
+        log(LOGMSG_LEVEL_DEBUG, format, args...);
+    }
+}
+
+template <typename... Args>
+inline void trace(format_string<Args...> format, const Args&... args) {
+
+    if (logmsg_level >= LOGMSG_LEVEL_TRACE ||
+        logmsg_recorder_level >= LOGMSG_LEVEL_TRACE) {
+
+        log(LOGMSG_LEVEL_TRACE, format, args...);
+    }
+}
+
+/*******************************************************************************
+
+    span - Records a timing span lasting the guard's lifetime
+
+    Description
+    ===========
+
+    Usually declared by LOGMSG_SPAN(), e.g.
+
+        LOGMSG_SPAN(handle_request);
+
+*******************************************************************************/
+
+class span {
+
+public:
+
+    explicit span(const LOGMSG_SPAN_SITE& site) : p_site_(&site) {
+
+        logmsg_span_begin(p_site_);
+    }
+
+    span(const span&) = delete;
+
+    span& operator=(const span&) = delete;
+
+    ~span() {
+
+        logmsg_span_end(p_site_);
+    }
+
+private:
+
+    const LOGMSG_SPAN_SITE* p_site_;
+};
+
+/*******************************************************************************
+
+    flush_awaitable - Awaits logmsg_flush_async() in a coroutine, which the
+                      caller's event loop resumes
+
+    Description
+    ===========
+
+    Usually obtained from flush_async(). When the coroutine suspends, 
+    on_readable(fd, handle) is called, and is to resume handle once fd is
+    readable, e.g. having added fd to the loop's epoll set:
+
+        bool is_flushed = co_await logmsg::flush_async(
+            [&](int fd, std::coroutine_handle<> handle) {
+                loop.resume_when_readable(fd, handle);
+            });
+
+    The result is true once flushed - synced to storage only if a dura-
+    bility mode is set - or false if the flush could not be requested, in
+    which case the coroutine does not suspend. The eventfd belongs to the
+    awaitable, so that concurrent awaits do not interfere.
+
+*******************************************************************************/
+
+template <typename OnReadable>
+class flush_awaitable {
+
+public:
+
+    explicit flush_awaitable(OnReadable on_readable) :
+        on_readable_(std::move(on_readable)),
+        fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    }
+
+    flush_awaitable(const flush_awaitable&) = delete;
+
+    flush_awaitable& operator=(const flush_awaitable&) = delete;
+
+    ~flush_awaitable() {
+
+        if (fd_ >= 0) {
+
+            close(fd_);
+        }
+    }
+
+    bool await_ready() {
+
+        is_requested_ = fd_ >= 0 && logmsg_flush_async(fd_) == 0;
+
+        return !is_requested_ || read_flushed();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+
+        on_readable_(fd_, handle);
+    }
+
+    bool await_resume() {
+
+        return is_requested_ && (is_flushed_ || read_flushed());
+    }
+
+private:
+
+    bool read_flushed() {
+
+        std::uint64_t count;
+
+        is_flushed_ = read(fd_, &count, sizeof(count)) == sizeof(count);
+
+        return is_flushed_;
+    }
+
+    OnReadable on_readable_;
+
+    int fd_;
+
+    bool is_requested_ = false;
+
+    bool is_flushed_ = false;
+};
+
+/*******************************************************************************
+
+    flush_async() - Return awaitable of a flush of the entries written so
+                    far, with on_readable() as for flush_awaitable
+
+*******************************************************************************/
+
+template <typename OnReadable>
+inline flush_awaitable<OnReadable> flush_async(OnReadable on_readable) {
+
+    return flush_awaitable<OnReadable>(std::move(on_readable));
+}
+
+} // namespace logmsg
+
+/*******************************************************************************
+
+    LOGMSG_SPAN() - Record span named by an identifier, from here to the end
+                    of the enclosing block
+
+*******************************************************************************/
+
+#define LOGMSG_SPAN(name)                                       \
+    static const LOGMSG_SPAN_SITE logmsg_span_site_##name =     \
+        { #name, __FILE__, __LINE__, __func__ };                \
+    logmsg::span logmsg_span_##name(logmsg_span_site_##name)
+
+#endif // LOGMSG_HPP
@@ -0,0 +1,394 @@
+/*******************************************************************************
+
+    logmsg_parse.h - Interface file for log file parser
+
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#ifndef LOGMSG_PARSE_H
+
+#define LOGMSG_PARSE_H
+
+/*******************************************************************************
+*                                                                              *
+*                           Additional header files                            *
+*                                                                              *
+*******************************************************************************/
+
+#include <stddef.h>
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include <logmsg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*******************************************************************************
+
+    LOGMSG_UTC_TIME_LEN - Length of the UTC time which begins each log entry,
+                          e.g. 2018-09-22-22:08:42-086858743
+
+*******************************************************************************/
+
+#define LOGMSG_UTC_TIME_LEN 29
+
+/*******************************************************************************
+
+    LOGMSG_RECORD - Fields of a single log entry
+
+    Description
+    ===========
+
+    All pointers refer to the caller's buffer, which must outlive the record.
+    None of the fields are NULL terminated.
+
+    An entry consists of a line of the form written by logmsg_printf(),
+
+        <utc-time> <log-level> <host-name>:<program-name>[pid:tid] <message>
+
+    followed by any continuation lines, i.e. lines which do not begin with a
+    UTC time, such as those produced by a message containing newlines.
+
+*******************************************************************************/
+
+typedef struct LOGMSG_RECORD {
+
+    const char*  p_entry;       // Whole entry, including continuation lines
+
+    size_t       entry_len;     // and final newline, if any
+
+    int64_t      utc_time_ns;   // Nanoseconds since the Epoch
+
+    LOGMSG_LEVEL level;         // LOGMSG_LEVEL_UNDEFINED if not recognized
+
+    const char*  p_host;
+
+    size_t       host_len;
+
+    const char*  p_program;
+
+    size_t       program_len;
+
+    int32_t      pid;
+
+    int32_t      tid;
+
+    const char*  p_message;     // Message, including continuation lines but
+
+    size_t       message_len;   // excluding final newline
+
+} LOGMSG_RECORD;
+
+/*******************************************************************************
+
+    LOGMSG_PARSER - Iterator over the entries of a buffer
+
+*******************************************************************************/
+
+typedef struct LOGMSG_PARSER {
+
+    const char* p_next;         // Start of next entry
+
+    const char* p_end;          // End of buffer
+
+} LOGMSG_PARSER;
+
+/*******************************************************************************
+
+    logmsg_parser_init() - Prepare to parse the entries of a buffer, usually
+                           a mapped log file or a portion of one beginning at
+                           a line boundary
+
+*******************************************************************************/
+
+void logmsg_parser_init(LOGMSG_PARSER* p_parser,
+                        const void* p_buffer,
+                        size_t buffer_len);
+
+/*******************************************************************************
+
+    logmsg_parser_next() - Parse the next entry of the buffer
+
+    Description
+    ===========
+
+    Newlines and field delimiters are located using AVX2 or SSE2 where the
+    processor supports them, with a scalar fallback.
+
+    Return 1 if an entry was parsed into *p_record.
+
+    Return -1 if the text at the current position is not an entry - for
+    example text preceding the first entry of a file, or a torn write. Only
+    p_entry and entry_len of *p_record are set, and cover the lines up to
+    the next entry, so that the caller may skip or copy them.
+
+    Return 0 at the end of the buffer.
+
+*******************************************************************************/
+
+int logmsg_parser_next(LOGMSG_PARSER* p_parser, LOGMSG_RECORD* p_record);
+
+/*******************************************************************************
+
+    logmsg_parse_entry() - Parse the entry beginning at p_entry
+
+    Description
+    ===========
+
+    As logmsg_parser_next(), but for a single entry, which ends at the first
+    subsequent line beginning with a UTC time, or at p_end.
+
+    Return 0 on success, -1 if the text is not an entry.
+
+*******************************************************************************/
+
+int logmsg_parse_entry(const char* p_entry,
+                       const char* p_end,
+                       LOGMSG_RECORD* p_record);
+
+/*******************************************************************************
+
+    logmsg_parse_utc_time() - Convert the UTC time at the start of an entry to
+                              nanoseconds since the Epoch
+
+    Return 0 on success, -1 if the text does not begin with a UTC time.
+
+*******************************************************************************/
+
+int logmsg_parse_utc_time(const char* p_text,
+                          size_t text_len,
+                          int64_t* p_utc_time_ns);
+
+/*******************************************************************************
+
+    logmsg_parse_partial_utc_time() - Convert a leading portion of a UTC time,
+                                      such as a command line argument, to
+                                      nanoseconds since the Epoch
+
+    Description
+    ===========
+
+    Accept any leading portion of the UTC time format used in log entries,
+
+        2018-09-22-22:08:42-086858743
+
+    as long as it ends on a field boundary. *p_utc_time_ns is set to the
+    earliest time matching the text, and *p_span_ns to the length of the
+    interval it denotes (e.g. one second for 2018-09-22-22:08:42).
+
+    Return 0 on success, -1 if the text is not such a time.
+
+*******************************************************************************/
+
+int logmsg_parse_partial_utc_time(const char* p_text,
+                                  int64_t* p_utc_time_ns,
+                                  int64_t* p_span_ns);
+
+/*******************************************************************************
+
+    logmsg_find_newline() - Return pointer to the first newline at or after
+                            p_text, or p_end if there is none
+
+*******************************************************************************/
+
+const char* logmsg_find_newline(const char* p_text, const char* p_end);
+
+/*******************************************************************************
+
+    logmsg_find_entry() - Return pointer to the first entry which begins at
+                          or after p_text, or p_end if there is none
+
+    Description
+    ===========
+
+    p_text must be at the start of a line. Lines which do not begin with a 
+    UTC time are skipped.
+
+*******************************************************************************/
+
+const char* logmsg_find_entry(const char* p_text, const char* p_end);
+
+/*******************************************************************************
+
+    logmsg_level_from_string() - Convert log level from text to binary
+
+    Return LOGMSG_LEVEL_UNDEFINED if the text is not a level name.
+
+*******************************************************************************/
+
+LOGMSG_LEVEL logmsg_level_from_string(const char* p_text, size_t text_len);
+
+/*******************************************************************************
+
+    LOGMSG_BINARY_MAGIC, LOGMSG_BINARY_VERSION, LOGMSG_BINARY_HEADER_LEN,
+    LOGMSG_BINARY_TRAILER_LEN - 
+    
+    Constants of binary log records, written by logmsg_kv() when the format
+    is LOGMSG_KV_FORMAT_BINARY
+    
+*******************************************************************************/
+
+#define LOGMSG_BINARY_MAGIC 0x4B4C
+
+#define LOGMSG_BINARY_VERSION 2
+
+#define LOGMSG_BINARY_HEADER_LEN 42
+
+#define LOGMSG_BINARY_TRAILER_LEN 4
+
+/*******************************************************************************
+
+    logmsg_parse_binary() - Decode the binary log record at the start of a 
+                            buffer
+                            
+    Description
+    ===========
+    
+    A binary record has the following layout, in host byte order without
+    padding:
+    
+        uint32_t record_len     Length of the whole record
+        uint16_t magic          LOGMSG_BINARY_MAGIC
+        uint8_t  version        LOGMSG_BINARY_VERSION
+        uint8_t  level
+        uint64_t sequence       Consecutive within its process
+        int64_t  utc_time_ns
+        int32_t  pid
+        int32_t  tid
+        uint16_t host_len
+        uint16_t program_len
+        uint32_t message_len
+        uint16_t num_fields
+        char     host[host_len]
+        char     program[program_len]
+        char     message[message_len]
+        
+    followed by num_fields fields, each of the form
+    
+        uint8_t  type           LOGMSG_KV_TYPE
+        uint8_t  key_len
+        char     key[key_len], '\0'
+        
+    and then for an integer or double, its 8 bytes, or for a string
+    
+        uint32_t value_len
+        char     value[value_len], '\0'
+        
+    and finally
+    
+        uint32_t crc            logmsg_crc32c() of all preceding bytes
+        
+    so that a record torn by a crash, or damaged later, can be told from a
+    whole one (see logmsg_check_binary()).
+        
+    On entry *p_num_fields is the capacity of p_fields. On return it is the
+    number of fields of the record, of which only as many as fit are stored
+    in p_fields. The keys and string values of the fields, and the text 
+    fields of *p_record, point into the buffer; the former are NULL termi-
+    nated.
+    
+    Return the length of the record on success, 0 if the buffer does not 
+    contain a whole record, or -1 if the record is malformed or its CRC 
+    does not match.
+    
+*******************************************************************************/
+
+ssize_t logmsg_parse_binary(const void* p_buffer,
+                            size_t buffer_len,
+                            LOGMSG_RECORD* p_record,
+                            LOGMSG_KV* p_fields,
+                            size_t* p_num_fields);
+
+/*******************************************************************************
+
+    logmsg_check_binary() - Check the framing and CRC of the binary log 
+                            record at the start of a buffer, without 
+                            decoding its fields
+    
+    Description
+    ===========
+    
+    If p_sequence is not NULL, the sequence number of a whole record is 
+    stored in *p_sequence.
+    
+    Return the length of the record if it is whole, 0 if the buffer ends 
+    within it, or -1 if it is malformed or its CRC does not match.
+    
+*******************************************************************************/
+
+ssize_t logmsg_check_binary(const void* p_buffer,
+                            size_t buffer_len,
+                            uint64_t* p_sequence);
+
+/*******************************************************************************
+
+    logmsg_find_binary() - Find the next whole binary log record in a buffer
+    
+    Description
+    ===========
+    
+    Search for the first offset at which logmsg_check_binary() finds a 
+    whole record, so that a reader can resynchronize after a damaged 
+    region. Candidates are located by their magic and version bytes.
+    
+    Return the offset of the record, or buffer_len if there is none.
+    
+*******************************************************************************/
+
+size_t logmsg_find_binary(const void* p_buffer, size_t buffer_len);
+
+/*******************************************************************************
+
+    logmsg_crc32c() - Extend the CRC32C (Castagnoli) of some data with len 
+                      more bytes
+    
+    Description
+    ===========
+    
+    Pass crc as 0 for the first bytes. The SSE4.2 or ARMv8 CRC32 instruc-
+    tions are used if the processor supports them, and otherwise a table 
+    driven computation.
+    
+*******************************************************************************/
+
+uint32_t logmsg_crc32c(uint32_t crc, const void* p_data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // LOGMSG_PARSE_H
+
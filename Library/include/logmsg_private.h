@@ -0,0 +1,801 @@
+/*******************************************************************************
+
+    logmsg_private.h - Declarations shared between the modules of liblogmsg
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#ifndef LOGMSG_PRIVATE_H
+
+#define LOGMSG_PRIVATE_H
+
+/*******************************************************************************
+*                                                                              *
+*                           Additional header files                            *
+*                                                                              *
+*******************************************************************************/
+
+#include <stddef.h>
+
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <sys/types.h>
+
+#include <sys/uio.h>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+#endif
+
+#include <logmsg.h>
+
+#include <logmsg_parse.h>
+
+/*******************************************************************************
+
+    LOGMSG_PRIVATE - Keep library internal functions out of the dynamic 
+                     symbol table
+    
+*******************************************************************************/
+
+#define LOGMSG_PRIVATE __attribute__((visibility("hidden")))
+
+/*******************************************************************************
+*                                                                              *
+*                     Structured entry rendering - logmsg_kv.c                 *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_kv_text_max_len() - Return upper bound of the length of the text 
+                               written by logmsg_kv_write_text(), in either
+                               format
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE size_t logmsg_kv_text_max_len(const char* message,
+                                             const LOGMSG_KV* p_fields,
+                                             size_t num_fields);
+
+/*******************************************************************************
+
+    logmsg_kv_write_text() - Write message and fields as logfmt or JSON text
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_kv_write_text(char* p_write,
+                                          LOGMSG_KV_FORMAT format,
+                                          const char* message,
+                                          const LOGMSG_KV* p_fields,
+                                          size_t num_fields);
+
+/*******************************************************************************
+
+    logmsg_kv_write_quoted() - Write len characters of text in double quotes,
+                               escaped as in JSON, as far as fits in max_len
+                               characters
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_kv_write_quoted(char* p_write,
+                                            const char* p_text,
+                                            size_t len,
+                                            size_t max_len);
+
+/*******************************************************************************
+
+    logmsg_kv_binary_len() - Return length of the binary record written by
+                             logmsg_kv_write_binary(), or 0 if some field
+                             cannot be represented
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE size_t logmsg_kv_binary_len(const LOGMSG_RECORD* p_record,
+                                           const LOGMSG_KV* p_fields,
+                                           size_t num_fields);
+
+/*******************************************************************************
+
+    logmsg_kv_write_binary() - Write binary record for the time, level, 
+                               source and message of *p_record, and the 
+                               fields, numbered sequence
+    
+    Return pointer to the end of the record written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_kv_write_binary(char* p_write,
+                                            const LOGMSG_RECORD* p_record,
+                                            uint64_t sequence,
+                                            const LOGMSG_KV* p_fields,
+                                            size_t num_fields);
+
+/*******************************************************************************
+*                                                                              *
+*                      Number formatting - logmsg_format.c                     *
+*                                                                              *
+*******************************************************************************/
+
+// Longest text written by logmsg_format_i64() and logmsg_format_double()
+
+#define LOGMSG_INT_TEXT_MAX_LEN 20
+
+#define LOGMSG_DOUBLE_TEXT_MAX_LEN 25
+
+/*******************************************************************************
+
+    logmsg_format_i64() - Write decimal text of value
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_format_i64(char* p_write, int64_t value);
+
+/*******************************************************************************
+
+    logmsg_format_double() - Write shortest text which reads back as value
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_format_double(char* p_write, double value);
+
+/*******************************************************************************
+
+    logmsg_format_utc_time() - Write UTC time as at the start of each log
+                               entry, using only async-signal-safe code
+    
+    Return pointer to the end of the LOGMSG_UTC_TIME_LEN characters written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_format_utc_time(char* p_write, int64_t utc_time_ns);
+
+/*******************************************************************************
+
+    logmsg_vsnprintf_signal_safe() - Format text as vsnprintf() as far as 
+                                     possible, using only async-signal-safe
+                                     functions
+    
+    Return length of whole text.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_vsnprintf_signal_safe(char* p_buffer,
+                                                size_t buffer_len,
+                                                const char* format,
+                                                va_list ap);
+
+/*******************************************************************************
+
+    logmsg_capture_args() - Capture the arguments of a format, so that it
+                            may be formatted later
+    
+    Return the number of bytes captured, or -1 if the format has a conver-
+    sion which logmsg_vsnprintf() passes to vsnprintf(), or the buffer is 
+    too small.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE ssize_t logmsg_capture_args(char* p_buffer, 
+                                           size_t buffer_len, 
+                                           const char* format, 
+                                           va_list ap);
+
+/*******************************************************************************
+
+    logmsg_format_captured() - Format text as vsnprintf(), taking the argu-
+                               ments captured by logmsg_capture_args()
+    
+    Return length of whole text, or -1 on failure.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_format_captured(char* p_buffer,
+                                          size_t buffer_len,
+                                          const char* format,
+                                          const char* p_captured);
+
+/*******************************************************************************
+*                                                                              *
+*                          Log file access - logmsg.c                          *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_get_logger_fd() - Return FD of log file or log server connection,
+                             or -1 if not open
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_get_logger_fd(void);
+
+/*******************************************************************************
+
+    logmsg_write_log() - Write text to log file or log server connection, 
+                         using only async-signal-safe functions, returning 
+                         0 on success or -1 on failure
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_write_log(const char* p_text, size_t text_len);
+
+/*******************************************************************************
+
+    logmsg_deliver_entries() - Write complete log entries to log file or log 
+                               server connection if open, and to sinks
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_deliver_entries(const LOGMSG_LEVEL* p_levels, 
+                                           const struct iovec* p_entries, 
+                                           int num_entries);
+
+/*******************************************************************************
+*                                                                              *
+*                      Sinks and writer - logmsg_sink.c                        *
+*                                                                              *
+*******************************************************************************/
+
+// Most entries delivered together
+
+#define LOGMSG_BATCH_MAX_ENTRIES 64
+
+// # sinks added
+
+LOGMSG_PRIVATE extern int logmsg_num_sinks;
+
+/*******************************************************************************
+
+    logmsg_open_socket() - Connect to log server, returning FD or -1
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_open_socket(const char* server_spec);
+
+/*******************************************************************************
+
+    logmsg_write_entries() - Write entries to file or socket with a single
+                             call, returning 0 on success or -1 on failure
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_write_entries(int fd, 
+                                        int is_socket,
+                                        const struct iovec* p_entries, 
+                                        int num_entries);
+
+/*******************************************************************************
+
+    logmsg_sink_write() - Write entries to each sink whose level admits them,
+                          using only async-signal-safe functions if 
+                          signal_safe is set
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_sink_write(const LOGMSG_LEVEL* p_levels,
+                                      const struct iovec* p_entries,
+                                      int num_entries,
+                                      int signal_safe);
+
+/*******************************************************************************
+
+    logmsg_writer_is_started() - Return 1 if the writer thread has been 
+                                 started, else 0
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_writer_is_started(void);
+
+/*******************************************************************************
+
+    logmsg_queue_entry() - Copy entry, given in parts, to the writer queue,
+                           returning 0 if queued, or -1 if it is to be 
+                           delivered by the caller
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_queue_entry(LOGMSG_LEVEL level,
+                                      const struct iovec* p_parts,
+                                      int num_parts);
+
+/*******************************************************************************
+
+    logmsg_sink_prepare_fork() - Flush the writer queue, and hold the sink
+                                 and writer locks across fork()
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_sink_prepare_fork(void);
+
+/*******************************************************************************
+
+    logmsg_sink_after_fork_parent() - Release the locks held across fork()
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_sink_after_fork_parent(void);
+
+/*******************************************************************************
+
+    logmsg_sink_after_fork_child() - Release the locks held across fork(),
+                                     and restart the writer thread with an
+                                     empty queue
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_sink_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Flight recorder - logmsg_recorder.c                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_record_printf() - Record entry in ring of calling thread, for
+                             formatting if it is dumped
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_record_printf(LOGMSG_LEVEL level, 
+                                         const char* format, 
+                                         va_list ap);
+
+/*******************************************************************************
+
+    logmsg_record_text() - Record entry with preformatted message, given in
+                           parts, in ring of calling thread
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_record_text(LOGMSG_LEVEL level,
+                                       const struct iovec* p_parts,
+                                       int num_parts);
+
+/*******************************************************************************
+
+    logmsg_dump_recorder_fatal() - Write recorded entries, if recording, 
+                                   before a FATAL entry
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_dump_recorder_fatal(void);
+
+/*******************************************************************************
+
+    logmsg_recorder_after_fork_child() - Forget the parent's entries and
+                                         threads, in a child process
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_recorder_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Durability - logmsg_durability.c                        *
+*                                                                              *
+*******************************************************************************/
+
+// Durability modes in effect, as LOGMSG_DURABILITY flags
+
+LOGMSG_PRIVATE extern int logmsg_durability;
+
+// Set in a process forked from one in O_DIRECT mode, which appends to the
+// log file through logmsg_shared_write()
+
+LOGMSG_PRIVATE extern int logmsg_direct_shared;
+
+/*******************************************************************************
+
+    logmsg_direct_write() - Append entries to the log file in O_DIRECT mode,
+                            returning 0 on success or -1 on failure
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_direct_write(const struct iovec* p_entries,
+                                       int num_entries,
+                                       int signal_safe);
+
+/*******************************************************************************
+
+    logmsg_direct_flush() - Write out O_DIRECT staging buffer, if in use
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_direct_flush(void);
+
+/*******************************************************************************
+
+    logmsg_durable_flush() - Write out O_DIRECT staging buffer, and sync log
+                             file, if any durability mode is set
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_durable_flush(void);
+
+/*******************************************************************************
+
+    logmsg_shared_write() - Append entries to a log file written in O_DIRECT
+                            mode by a parent process, returning 0 on success
+                            or -1 on failure
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_shared_write(const struct iovec* p_entries,
+                                       int num_entries);
+
+/*******************************************************************************
+
+    logmsg_sync_after_write() - Account for entries written to the log file,
+                                syncing if need be
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_sync_after_write(const LOGMSG_LEVEL* p_levels,
+                                            const struct iovec* p_entries,
+                                            int num_entries);
+
+/*******************************************************************************
+
+    logmsg_durability_prepare_fork() - Write out the O_DIRECT staging
+                                       buffer, and hold the durability
+                                       locks across fork()
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_durability_prepare_fork(void);
+
+/*******************************************************************************
+
+    logmsg_durability_after_fork_parent() - Release the locks held across
+                                            fork()
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_durability_after_fork_parent(void);
+
+/*******************************************************************************
+
+    logmsg_durability_after_fork_child() - Release the locks held across
+                                           fork(), and leave syncing to the
+                                           parent
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_durability_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Per-CPU buffers - logmsg_percpu.c                       *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_percpu_init() - Allocate buffer for each CPU, returning 0 on 
+                           success, or -1 if rseq is not available or on 
+                           failure
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_percpu_init(size_t buffer_len);
+
+/*******************************************************************************
+
+    logmsg_percpu_append() - Append entry to buffer of the current CPU, 
+                             returning 0 if appended, 1 if the buffer is 
+                             full, or -1 if it is to be delivered by the
+                             caller
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_percpu_append(LOGMSG_LEVEL level,
+                                        const char* p_entry,
+                                        size_t entry_len);
+
+/*******************************************************************************
+
+    logmsg_percpu_is_empty() - Determine whether every buffer is empty
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_percpu_is_empty(void);
+
+/*******************************************************************************
+
+    logmsg_percpu_discard() - Discard the entries in the buffers, in a 
+                              child process
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_percpu_discard(void);
+
+/*******************************************************************************
+
+    logmsg_percpu_drain() - Deliver entries in buffers in the order they
+                            were appended, returning # delivered
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_percpu_drain(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Call site counters - logmsg_site.c                      *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_site_count() - Count call of site, which wrote entry_len bytes
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_site_count(LOGMSG_SITE* p_site, size_t entry_len);
+
+/*******************************************************************************
+
+    logmsg_site_after_fork_child() - Clear counts, in a child process
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_site_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Timing spans - logmsg_span.c                            *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_span_after_fork_child() - Forget the parent's events and
+                                     threads, in a child process
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_span_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Shard files - logmsg_shard.c                            *
+*                                                                              *
+*******************************************************************************/
+
+// Sharding of the log file, as a LOGMSG_SHARDING
+
+LOGMSG_PRIVATE extern int logmsg_sharding;
+
+/*******************************************************************************
+
+    logmsg_shard_open() - Open shard file of calling process, or thread, of
+                          the log file log_spec, returning FD or -1
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_shard_open(const char* log_spec);
+
+/*******************************************************************************
+
+    logmsg_shard_get_fd() - Return FD of shard file of calling thread, or 
+                            logger_fd if the log file is not sharded by 
+                            thread
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_shard_get_fd(int logger_fd);
+
+/*******************************************************************************
+
+    logmsg_shard_after_fork_child() - Switch to shard files of the child 
+                                      process
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_shard_after_fork_child(void);
+
+/*******************************************************************************
+*                                                                              *
+*                      Entry timestamps - logmsg_clock.c                       *
+*                                                                              *
+*******************************************************************************/
+
+// Set if timestamps are TSC readings rather than UTC nsecs
+
+LOGMSG_PRIVATE extern int logmsg_clock_is_tsc;
+
+/*******************************************************************************
+
+    logmsg_read_tsc() - Return TSC, or 0 where there is none
+    
+*******************************************************************************/
+
+static inline uint64_t logmsg_read_tsc(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    return __rdtsc();
+    
+#else
+
+    return 0;
+    
+#endif
+}
+
+/*******************************************************************************
+
+    logmsg_clock_now() - Return timestamp of the clock selected by 
+                         logmsg_set_clock(), for conversion by 
+                         logmsg_clock_to_utc_ns()
+    
+*******************************************************************************/
+
+static inline uint64_t logmsg_clock_now(void) {
+
+    if (logmsg_clock_is_tsc) {
+    
+        return logmsg_read_tsc();
+    }
+    
+    struct timespec system_time_ns;
+    
+    if (clock_gettime(CLOCK_REALTIME, &system_time_ns) != 0) {
+    
+        return 0;
+    }
+    
+    return (uint64_t)system_time_ns.tv_sec * 1000000000 + 
+               system_time_ns.tv_nsec;
+}
+
+/*******************************************************************************
+
+    logmsg_clock_to_utc_ns() - Convert timestamp to UTC nsecs since the Epoch
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int64_t logmsg_clock_to_utc_ns(uint64_t timestamp);
+
+/*******************************************************************************
+*                                                                              *
+*                     Text entry layout - logmsg_layout.c                      *
+*                                                                              *
+*******************************************************************************/
+
+// Longest text of a layout, excluding the message
+
+#define LOGMSG_LAYOUT_MAX_LEN 512
+
+/*******************************************************************************
+
+    LOGMSG_HEADER - Fields of a text entry other than the message
+    
+*******************************************************************************/
+
+typedef struct LOGMSG_HEADER {
+
+    const struct LAYOUT* p_layout;  // Layout in use when header was set
+    
+    LOGMSG_LEVEL level;
+    
+    int64_t      utc_time_ns;
+    
+    pid_t        tid;
+    
+    uint64_t     seq;           // Sequence number, if written by layout
+    
+} LOGMSG_HEADER;
+
+/*******************************************************************************
+
+    logmsg_layout_get_header() - Get the fields of a new entry
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_layout_get_header(LOGMSG_LEVEL level, 
+                                             LOGMSG_HEADER* p_header);
+
+/*******************************************************************************
+
+    logmsg_layout_set_header() - Set the fields of an entry
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE void logmsg_layout_set_header(LOGMSG_HEADER* p_header,
+                                             LOGMSG_LEVEL level,
+                                             int64_t utc_time_ns,
+                                             pid_t tid);
+
+/*******************************************************************************
+
+    logmsg_layout_max_len() - Return upper bound of the length of an entry
+                              with a message of message_len characters,
+                              including the newline
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE size_t logmsg_layout_max_len(const LOGMSG_HEADER* p_header,
+                                            size_t message_len);
+
+/*******************************************************************************
+
+    logmsg_layout_is_json() - Determine whether the message is written as a
+                              JSON string, rather than as it is
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE int logmsg_layout_is_json(const LOGMSG_HEADER* p_header);
+
+/*******************************************************************************
+
+    logmsg_layout_write_prefix(), logmsg_layout_write_message(),
+    logmsg_layout_write_suffix() -
+    
+    Write the text preceding the message, the message, in at most max_len
+    characters, and the text following the message, including the newline.
+    Only async-signal-safe functions are used.
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+LOGMSG_PRIVATE char* logmsg_layout_write_prefix(char* p_write, 
+                                                const LOGMSG_HEADER* p_header);
+
+LOGMSG_PRIVATE char* logmsg_layout_write_message(char* p_write,
+                                                 const LOGMSG_HEADER* p_header,
+                                                 const char* p_message,
+                                                 size_t message_len,
+                                                 size_t max_len);
+
+LOGMSG_PRIVATE char* logmsg_layout_write_suffix(char* p_write, 
+                                                const LOGMSG_HEADER* p_header);
+
+#endif // LOGMSG_PRIVATE_H
+
@@ -22,6 +22,20 @@ OUT_FILE=$(LIB_NAME).so
 INCLUDES=-I$(INTERFACE_DIR) -I$(INC_DIR)
 
 SRC_FILES=$(SRC_DIR)/logmsg.c \
+          $(SRC_DIR)/logmsg_parse.c \
+          $(SRC_DIR)/logmsg_kv.c \
+          $(SRC_DIR)/logmsg_format.c \
+          $(SRC_DIR)/logmsg_recorder.c \
+          $(SRC_DIR)/logmsg_clock.c \
+          $(SRC_DIR)/logmsg_layout.c \
+          $(SRC_DIR)/logmsg_sink.c \
+          $(SRC_DIR)/logmsg_durability.c \
+          $(SRC_DIR)/logmsg_percpu.c \
+          $(SRC_DIR)/logmsg_span.c \
+          $(SRC_DIR)/logmsg_site.c \
+          $(SRC_DIR)/logmsg_fork.c \
+          $(SRC_DIR)/logmsg_shard.c \
+          $(SRC_DIR)/logmsg_crc.c \
 
 CC = gcc
 
@@ -30,7 +44,7 @@ CFLAGS+=$(INCLUDES)
 
 LDFLAGS=-shared -Wl,--as-needed
 
-LIBS=
+LIBS=-lpthread
 
 all: $(OUT_FILE)
 
@@ -43,6 +57,7 @@ install:
 	cp $(OUT_FILE) $(PREFIX)/libd
 	mkdir -p $(PREFIX)/include
 	cp $(INTERFACE_DIR)/*.h $(PREFIX)/include
+	cp $(INTERFACE_DIR)/*.hpp $(PREFIX)/include
 	mkdir -p $(PREFIX)/libd/pkgconfig
 	cp $(LIB_NAME).pc $(PREFIX)/libd/pkgconfig
 	
@@ -52,6 +67,8 @@ clean:
 uninstall:
 	$(RM) $(PREFIX)/libd/$(OUT_FILE)
 	$(RM) $(PREFIX)/include/logmsg.h
+	$(RM) $(PREFIX)/include/logmsg_parse.h
+	$(RM) $(PREFIX)/include/logmsg.hpp
 	$(RM) $(PREFIX)/libd/pkgconfig/$(LIB_NAME).pc
 	
 .PHONY: install clean uninstall
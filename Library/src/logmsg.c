@@ -66,8 +66,18 @@
 
 #include <fcntl.h>
 
+#include <sys/stat.h>
+
+#include <sys/socket.h>
+
+#include <sys/uio.h>
+
 #include <logmsg.h>
 
+#include <logmsg_parse.h>
+
+#include <logmsg_private.h>
+
 /*******************************************************************************
 
     Program-wide variable declarations
@@ -96,6 +106,10 @@ LOGMSG_LEVEL logmsg_level = LOGMSG_LEVEL_NONE;
 
 static int logger_fd = -1;
 
+// Set if logger_fd is a log server connection
+
+static int logger_is_socket = 0;
+
 // # open log file failures
 
 uint64_t num_open_failures = 0;
@@ -108,6 +122,45 @@ uint64_t num_conn_failures = 0;
 
 uint64_t num_write_failures = 0;
 
+// Time index sidecar file FD
+
+static int index_fd = -1;
+
+// Write an index record every index_interval_entries entries or every
+// index_interval_bytes bytes, whichever comes first (0 disables either)
+
+static uint64_t index_interval_entries = 0;
+
+static uint64_t index_interval_bytes = 0;
+
+// # entries and bytes written since index was opened
+
+static uint64_t index_num_entries = 0;
+
+static uint64_t index_num_bytes = 0;
+
+// # write index file failures
+
+uint64_t num_index_failures = 0;
+
+// Rendering of structured log entries
+
+static LOGMSG_KV_FORMAT kv_format = LOGMSG_KV_FORMAT_LOGFMT;
+
+// Sequence number of the next binary record
+
+static uint64_t binary_sequence = 0;
+
+/*******************************************************************************
+
+    Constants
+    
+*******************************************************************************/
+
+// Longest entry written by logmsg_printf_signal_safe()
+
+#define SIGNAL_SAFE_ENTRY_MAX_LEN 1024
+
 /*******************************************************************************
 *                                                                              *
 *                           Private functions                                  *
@@ -116,11 +169,10 @@ uint64_t num_write_failures = 0;
 
 /*******************************************************************************
 
-    get_utc_time() - Get system time in printable UTC time format, with 
-                     nanosecond precision.
+    get_hostname() - Return host name of system
                      
     On success, *p_buffer will be written with a NULL terminated string
-    containing the formatted UTC time. The return value will be the num-
+    containing the system host name. The return value will be the num-
     ber of characters written, excluding the terminal NULL character.
     
     On failure, a negative value is returned, and the buffer contents is
@@ -128,518 +180,1297 @@ uint64_t num_write_failures = 0;
                      
 *******************************************************************************/
 
-static ssize_t get_utc_time(char* p_buffer, size_t buffer_len) {
+static ssize_t get_hostname(char* p_buffer, size_t buffer_len) {
 
     /*
-     *  Get system (wall clock) high precision time since the Epoch
+     *  Get hostname
      */
      
-    struct timespec system_time_ns;
-    
-    { 
-        int status = clock_gettime(CLOCK_REALTIME, &system_time_ns);
+    {
+        int status = gethostname(p_buffer, buffer_len);
         
-        if (status < 0) {
+        if (status != 0) {
         
             return -1;
         }
     }
     
     /*
-     *  Convert time in seconds since the Epoch to calendar time
+     *  Return number of characters written
+     */
+     
+    return (ssize_t)strlen(p_buffer);
+}
+
+/*******************************************************************************
+
+    update_index() - Account for a log entry about to be written, and append
+                     a record to the time index sidecar file when an index 
+                     interval has elapsed.
+                     
+    Description
+    ===========
+    
+    Each index record is a pair of 64-bit values in host byte order:
+    
+        <utc-time-ns> <file-offset>
+        
+    where <file-offset> is the size of the log file, and <utc-time-ns> the 
+    system time (nanoseconds since the Epoch) read immediately afterwards.
+    Since entries are stamped before they are appended, every entry which 
+    lies before <file-offset> carries a time no later than <utc-time-ns>, 
+    whichever process or thread wrote it. A reader looking for entries at
+    or after time T may therefore start at the greatest offset of any re-
+    cord whose time precedes T.
+    
+    Records are written with O_APPEND, so several processes may share one
+    index file. Records are not guaranteed to be in file order.
+    
+*******************************************************************************/
+
+static void update_index(size_t entry_len) {
+
+    /*
+     *  Count entry and bytes, and determine if an interval has elapsed
      */
      
-    struct tm gmt_time;
+    int write_record = 0;
     
     {
-        struct tm* p_tm = gmtime_r(&system_time_ns.tv_sec, &gmt_time);
+        uint64_t num_entries = 
+            __atomic_add_fetch(&index_num_entries, 1, __ATOMIC_RELAXED);
+        
+        uint64_t num_bytes = 
+            __atomic_add_fetch(&index_num_bytes, entry_len, __ATOMIC_RELAXED);
+        
+        if (index_interval_entries != 0 && 
+            num_entries % index_interval_entries == 1 % index_interval_entries) {
         
-        if (p_tm == NULL) {
+            write_record = 1;
+        }
+        
+        if (index_interval_bytes != 0 &&
+            num_bytes / index_interval_bytes != 
+                (num_bytes - entry_len) / index_interval_bytes) {
         
-            return -2;
+            write_record = 1;
         }
     }
     
-    /*
-     *  Write formatted UTC time string
-     */    
+    if (!write_record) {
+    
+        return;
+    }
     
-    size_t utc_time_len = 0;
+    /*
+     *  Get current size of log file, then current time
+     */
+     
+    int64_t record[2];
     
     {
-        utc_time_len = 
-            strftime(p_buffer, buffer_len, "%Y-%m-%d-%T", &gmt_time);
+        struct stat log_stat;
         
-        if (utc_time_len == 0) {
+        if (fstat(logger_fd, &log_stat) != 0) {
         
-            return -3;
+            num_index_failures++;
+            
+            return;
+        }
+        
+        struct timespec system_time_ns;
+        
+        if (clock_gettime(CLOCK_REALTIME, &system_time_ns) != 0) {
+        
+            num_index_failures++;
+            
+            return;
         }
+        
+        record[0] = (int64_t)system_time_ns.tv_sec * 1000000000 + 
+                        system_time_ns.tv_nsec;
+        
+        record[1] = (int64_t)log_stat.st_size;
     }
     
     /*
-     *  Append nanosecond portion of system time
+     *  Append record to index file
      */
      
     {
-        if (utc_time_len + 1 + 9 >= buffer_len) {
+        ssize_t n_written = write(index_fd, record, sizeof(record));
         
-            return -4;
-        }
-        
-        snprintf(p_buffer + utc_time_len, 
-                 1 + 9 + 1, 
-                 "-%09lu", 
-                 system_time_ns.tv_nsec);
+        if (n_written != sizeof(record)) {
         
-        utc_time_len += 1 + 9;
+            num_index_failures++;
+        }
     }
-    
-    return (ssize_t)utc_time_len;
 }
 
 /*******************************************************************************
 
-    get_hostname() - Return host name of system
+    deliver_entry_parts() - Write complete log entry, given in parts, to log
+                            file or log server connection if open, and to 
+                            sinks
                      
-    On success, *p_buffer will be written with a NULL terminated string
-    containing the system host name. The return value will be the num-
-    ber of characters written, excluding the terminal NULL character.
+    Description
+    ===========
     
-    On failure, a negative value is returned, and the buffer contents is
-    undefined.
+    The parts are written to each destination with a single call, so are 
+    appended together, as by logmsg_deliver_entries().
                      
 *******************************************************************************/
 
-static ssize_t get_hostname(char* p_buffer, size_t buffer_len) {
+static void deliver_entry_parts(LOGMSG_LEVEL level,
+                                const struct iovec* p_parts,
+                                int num_parts) {
 
-    /*
-     *  Get hostname
-     */
-     
+    if (num_parts == 1) {
+    
+        logmsg_deliver_entries(&level, p_parts, 1);
+        
+        return;
+    }
+    
+    LOGMSG_LEVEL levels[num_parts];
+    
+    size_t entry_len = 0;
+    
+    for (int i = 0; i < num_parts; i++) {
+    
+        levels[i] = level;
+        
+        entry_len += p_parts[i].iov_len;
+    }
+    
+    if (logger_fd >= 0)    
     {
-        int status = gethostname(p_buffer, buffer_len);
+        if (index_fd >= 0) {
+        
+            update_index(entry_len);
+        }
+    
+        int status;
+        
+        if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+        
+            status = logmsg_direct_write(p_parts, num_parts, 0);
+            
+        } else if (logmsg_direct_shared) {
+        
+            status = logmsg_shared_write(p_parts, num_parts);
+            
+        } else {
+        
+            status = logmsg_write_entries(logmsg_shard_get_fd(logger_fd), 
+                                          logger_is_socket, 
+                                          p_parts, 
+                                          num_parts);
+        }
         
         if (status != 0) {
         
-            return -1;
+            num_write_failures++;
+        }
+        
+        if (logmsg_durability != LOGMSG_DURABILITY_NONE) {
+        
+            logmsg_sync_after_write(levels, p_parts, num_parts);
         }
     }
     
-    /*
-     *  Return number of characters written
-     */
-     
-    return (ssize_t)strlen(p_buffer);
+    logmsg_sink_write(levels, p_parts, num_parts, 0);
 }
 
 /*******************************************************************************
 
-    get_process_and_thread_ids()
+    write_entry_parts() - Queue complete log entry, given in parts, for the 
+                          writer thread if running, otherwise deliver it
                      
-    On success, *p_buffer will be written with a NULL terminated string
-    containing the system assigned process and thread IDs for the exe-
-    cuting process and thread, respectively. The values will be written
-    in decimal notation, and separated by a colon. The return value will 
-    be the number of characters written, excluding the terminal NULL 
-    character.
+    Description
+    ===========
     
-    On failure, a negative value is returned, and the buffer contents is
-    undefined.
+    A FATAL entry is delivered by the calling thread, after the entries 
+    queued before it, since the process is about to exit, as is an ERROR
+    entry which is to be synced before the caller continues.
                      
 *******************************************************************************/
 
-static ssize_t get_process_and_thread_ids(char* p_buffer, size_t buffer_len) {
+static void write_entry_parts(LOGMSG_LEVEL level, 
+                              const struct iovec* p_parts,
+                              int num_parts) {
 
-    /*
-     *  Get process ID
-     */
-     
-    pid_t pid = getpid();
+    if (level == LOGMSG_LEVEL_FATAL ||
+        (level == LOGMSG_LEVEL_ERROR && 
+             (logmsg_durability & LOGMSG_DURABILITY_SYNC_ERRORS))) {
     
-    /*
-     *  Get thread ID
-     */
-     
-    pid_t tid = (pid_t)syscall(SYS_gettid);
+        logmsg_flush();
     
-    /*
-     *  Format the process and thread IDs
-     */
-
-    int copied_len = 0;
+    } else if (logmsg_queue_entry(level, p_parts, num_parts) == 0) {
     
-    {
-        copied_len = snprintf(p_buffer, buffer_len, "%d:%d", pid, tid);
-        
-        if (copied_len < 0 || copied_len >= buffer_len) {
-        
-            return -1;
-        }
+        return;
     }
     
-    /*
-     *  Return number of characters written
-     */
-     
-    return copied_len;
+    deliver_entry_parts(level, p_parts, num_parts);
 }
 
 /*******************************************************************************
-*                                                                              *
-*                            API functions                                     *
-*                                                                              *
+
+    write_entry() - Queue complete log entry for the writer thread if 
+                    running, otherwise deliver it
+                     
 *******************************************************************************/
 
-/*******************************************************************************
+static void write_entry(LOGMSG_LEVEL level, 
+                        const char* p_entry, 
+                        size_t entry_len) {
 
-    logmsg_open_file() - Open log file for concurrent writing.
+    struct iovec entry = { (void*)p_entry, entry_len };
     
-    Return 0 on success, -1 on failure.
+    write_entry_parts(level, &entry, 1);
+}
+
+/*******************************************************************************
+
+    write_text_entry() - Write text entry with preformatted message, laid 
+                         out according to the layout of the header
     
+    Return length of entry written, or 0 on failure.
+                     
 *******************************************************************************/
 
-int logmsg_open_file(const char* file_spec) {
+static size_t write_text_entry(const LOGMSG_HEADER* p_header,
+                               const char* p_message, 
+                               size_t message_len) {
 
     /*
-     *  Check for file or connection already open
+     *  Build entry on the stack unless it is large
      */
      
-    if (logger_fd >= 0) {
+    char entry_buf[1024];
     
-        num_open_failures++;
+    char* p_entry = entry_buf;
+    
+    size_t max_len = logmsg_layout_max_len(p_header, message_len);
+    
+    if (max_len > sizeof(entry_buf)) {
+    
+        p_entry = (char*)malloc(max_len);
         
-        return -1;
+        if (p_entry == NULL) {
+        
+            num_write_failures++;
+            
+            return 0;
+        }
     }
-
+    
+    char* p_write = logmsg_layout_write_prefix(p_entry, p_header);
+    
+    p_write = logmsg_layout_write_message(p_write, 
+                                          p_header, 
+                                          p_message, 
+                                          message_len, 
+                                          SIZE_MAX);
+    
+    p_write = logmsg_layout_write_suffix(p_write, p_header);
+    
     /*
-     *  Open existing file or create new file.
+     *  Write to log file or log server connection if open
      */
-     
-    mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
-
-    logger_fd = open(file_spec, O_CREAT | O_APPEND | O_WRONLY, mode);
 
-    /*
-     *  Check for open failure
-     */
-     
-    if (logger_fd < 0) {
+    size_t entry_len = p_write - p_entry;
     
-        num_open_failures++;
-        
-        return -1;
+    write_entry(p_header->level, p_entry, entry_len);
+    
+    if (p_entry != entry_buf) {
+    
+        free(p_entry);
     }
-
-    return 0;
+    
+    return entry_len;
 }
 
 /*******************************************************************************
 
-    logmsg_open_conn() - Open network connection to log recorder server.
+    is_recorded() - Determine whether entry is recorded by the flight recor-
+                    der, rather than written
     
-    Return 0 on success, -1 on failure.
+    Description
+    ===========
     
+    FATAL entries are always written, after a dump of the recorded entries.
+                     
 *******************************************************************************/
 
-int logmsg_open_conn(const char* server_spec) {
+static inline int is_recorded(LOGMSG_LEVEL level) {
 
-    // FIXME - To be supplied
-    
-    return 0;
+    return level > logmsg_level && 
+               level <= logmsg_recorder_level && 
+                   level != LOGMSG_LEVEL_FATAL;
 }
 
 /*******************************************************************************
 
-    logmsg_level_to_string() - Convert log level from binary to text
+    vprintf_entry() - Write log entry using printf style formatting, with
+                      the arguments in ap
+    
+    Return length of entry written, or 0 if recorded or on failure.
     
 *******************************************************************************/
 
-const char* logmsg_level_to_string(LOGMSG_LEVEL level) {
-
-    static const char* text[] = {
-    
-        "NONE", "FATAL", "ERROR", "WARN", "INFO", "DEBUG", "TRACE" 
-    };
-    
-    static const char* undef = "UNDEFINED";
+static size_t vprintf_entry(LOGMSG_LEVEL level, 
+                           const char* format, 
+                           va_list ap) {
 
-    if (level >= LOGMSG_LEVEL_MIN && level <= LOGMSG_LEVEL_MAX) {
+    /*
+     *  Keep entry in memory if too detailed for the log file
+     */
+     
+    if (is_recorded(level)) {
     
-        return text[level];
+        logmsg_record_printf(level, format, ap);
         
-    } else {
-    
-        return undef;
+        return 0;
     }
-}
-
-/*******************************************************************************
-
-    logmsg_printf - Write log entry using printf style formatting
     
-    See logmsg.h for more details.
+    if (level == LOGMSG_LEVEL_FATAL) {
     
-*******************************************************************************/
-
-void logmsg_printf(LOGMSG_LEVEL level, const char* format, ...) {
+        logmsg_dump_recorder_fatal();
+    }
 
     /*
-     *  Get current UTC time with nsec precision as formatted string
-     *
-     *  sample: 2018-09-22-22:08:42-086858743
+     *  Get time, level, and thread ID, and layout of entry
      */
-
-    char utc_time_buf[32+1];
+     
+    LOGMSG_HEADER header;
     
-    ssize_t utc_time_len = 0;
+    logmsg_layout_get_header(level, &header);
     
-    {
-        utc_time_len = get_utc_time(utc_time_buf, sizeof(utc_time_buf));
+    const char* format_error_text = "**** message formatting error ****";
     
-        if (utc_time_len < 0) {
+    if (logmsg_layout_is_json(&header)) {
+    
+        /*
+         *  Format message separately, to be escaped
+         */
+         
+        char message_buf[1024];
+        
+        char* p_message = message_buf;
+        
+        va_list message_ap;
         
-            const char* error_text = "**** unknown time ****";
+        va_copy(message_ap, ap);
+        
+        int message_len = logmsg_vsnprintf(message_buf, 
+                                           sizeof(message_buf), 
+                                           format, 
+                                           message_ap);
+        
+        va_end(message_ap);
+        
+        if (message_len >= (int)sizeof(message_buf)) {
+        
+            p_message = (char*)malloc(message_len + 1);
             
-            utc_time_len = strlen(error_text);
+            if (p_message == NULL) {
+            
+                num_write_failures++;
+                
+                return 0;
+            }
+            
+            logmsg_vsnprintf(p_message, message_len + 1, format, ap);
+        }
+        
+        size_t entry_len;
         
-            strncpy(utc_time_buf, error_text, utc_time_len + 1);
+        if (message_len < 0) {
+        
+            entry_len = write_text_entry(&header, 
+                                         format_error_text, 
+                                         strlen(format_error_text));
+        } else {
+        
+            entry_len = write_text_entry(&header, p_message, message_len);
         }
+        
+        if (p_message != message_buf) {
+        
+            free(p_message);
+        }
+        
+        return entry_len;
     }
     
     /*
-     *  Convert supplied log level to text
+     *  Format message directly after the prefix, in a buffer on the stack.
+     *  Only if the entry does not fit is it allocated and formatted again.
      */
      
-    const char* log_level_text = logmsg_level_to_string(level);
+    char entry_buf[1024];
     
-    size_t log_level_text_len = strlen(log_level_text);
+    char* p_entry = entry_buf;
     
-    /*
-     *  Get hostname of running system
-     */
-
-    char hostname_buf[64+1];
+    char* p_message = logmsg_layout_write_prefix(entry_buf, &header);
     
-    ssize_t hostname_len = 0;
+    size_t prefix_len = p_message - entry_buf;
     
-    {
-        hostname_len = get_hostname(hostname_buf, sizeof(hostname_buf));
+    size_t suffix_max_len = logmsg_layout_max_len(&header, 0) - prefix_len;
     
-        if (hostname_len < 0) {
-        
-            const char* error_text = "**** unknown hostname ****";
-            
-            hostname_len = strlen(error_text);
-        
-            strncpy(hostname_buf, error_text, hostname_len + 1);
-        }
+    size_t message_space = sizeof(entry_buf) - prefix_len - suffix_max_len;
+    
+    va_list message_ap;
+    
+    va_copy(message_ap, ap);
+    
+    int message_len = logmsg_vsnprintf(p_message, 
+                                       message_space + 1, 
+                                       format, 
+                                       message_ap);
+    
+    va_end(message_ap);
+    
+    int format_failed = message_len < 0;
+    
+    if (format_failed) {
+    
+        message_len = strlen(format_error_text);
+    }
+    
+    /*
+     *  Allocate memory for large entry, including terminal NULL
+     */
+    
+    if ((size_t)message_len > message_space) {
+    
+        p_entry = (char*)malloc(prefix_len + message_len + 1 + suffix_max_len);
+    
+        if (p_entry == NULL) {
+        
+            const char* malloc_error_text = "**** heap memory exhausted ****";
+            
+            write_entry(level, malloc_error_text, strlen(malloc_error_text));
+            
+            return strlen(malloc_error_text);
+        }
+        
+        memcpy(p_entry, entry_buf, prefix_len);
+        
+        p_message = p_entry + prefix_len;
+        
+        if (!format_failed) {
+        
+            logmsg_vsnprintf(p_message, message_len + 1, format, ap);
+        }
+    }
+    
+    if (format_failed) {
+    
+        memcpy(p_message, format_error_text, message_len);
     }
     
+    char* p_end = logmsg_layout_write_suffix(p_message + message_len, &header);
+    
     /*
-     *  Get name of running program
+     *  Write to log file or log server connection if open
      */
 
-    const char* program_name = program_invocation_short_name;
+    size_t entry_len = p_end - p_entry;
     
-    size_t program_name_len = strlen(program_name);
+    write_entry(level, p_entry, entry_len);
     
     /*
-     *  Get system assigned process and thread IDs of running process
-     *  and calling thread, respectively in formatted decimal
+     *  Release allocated memory
      */
+    
+    if (p_entry != entry_buf) {
+    
+        free(p_entry);
+    }
+    
+    return entry_len;
+}
+
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
 
-    char pid_tid_buf[32+1];
+/*******************************************************************************
+
+    logmsg_write_log() - Write text to log file or log server connection
+                     
+    Description
+    ===========
     
-    ssize_t pid_tid_len = 0;
+    Uses only async-signal-safe functions. In O_DIRECT mode, the text is 
+    written out at once, with any entries waiting to be.
     
+    Return 0 on success, -1 on failure.
+                     
+*******************************************************************************/
+
+int logmsg_write_log(const char* p_text, size_t text_len) {
+
+    struct iovec text = { (void*)p_text, text_len };
+    
+    if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+    
+        return logmsg_direct_write(&text, 1, 1);
+    }
+    
+    if (logmsg_direct_shared) {
+    
+        return logmsg_shared_write(&text, 1);
+    }
+    
+    return logmsg_write_entries(logger_fd, logger_is_socket, &text, 1);
+}
+
+/*******************************************************************************
+
+    logmsg_deliver_entries() - Write complete log entries to log file or log 
+                               server connection if open, and to sinks
+                     
+    Description
+    ===========
+    
+    The entries are written to each destination with a single call, so are
+    appended together, and the index is updated for each beforehand.
+                     
+*******************************************************************************/
+
+void logmsg_deliver_entries(const LOGMSG_LEVEL* p_levels, 
+                            const struct iovec* p_entries, 
+                            int num_entries) {
+
+    if (logger_fd >= 0)    
     {
-        pid_tid_len = 
-            get_process_and_thread_ids(pid_tid_buf, sizeof(pid_tid_buf));
+        if (index_fd >= 0) {
+        
+            for (int i = 0; i < num_entries; i++) {
+        
+                update_index(p_entries[i].iov_len);
+            }
+        }
     
-        if (pid_tid_len < 0) {
+        int status;
+        
+        if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+        
+            status = logmsg_direct_write(p_entries, num_entries, 0);
+            
+        } else if (logmsg_direct_shared) {
         
-            const char* error_text = "**** unknown pid and tid ****";
+            status = logmsg_shared_write(p_entries, num_entries);
             
-            pid_tid_len = strlen(error_text);
+        } else {
+        
+            status = logmsg_write_entries(logmsg_shard_get_fd(logger_fd), 
+                                          logger_is_socket, 
+                                          p_entries, 
+                                          num_entries);
+        }
         
-            strncpy(pid_tid_buf, error_text, pid_tid_len + 1);
+        if (status != 0) {
+        
+            num_write_failures++;
+        }
+        
+        if (logmsg_durability != LOGMSG_DURABILITY_NONE) {
+        
+            logmsg_sync_after_write(p_levels, p_entries, num_entries);
         }
     }
     
-    /*
-     *  Determine the length of the formatted message, not including the
-     *  terminal null character.
-     */    
+    logmsg_sink_write(p_levels, p_entries, num_entries, 0);
+}
+
+/*******************************************************************************
+
+    logmsg_get_logger_fd() - Return FD of log file or log server connection,
+                             or -1 if not open
+                     
+*******************************************************************************/
+
+int logmsg_get_logger_fd(void) {
+
+    return logger_fd;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_open_file() - Open log file for concurrent writing.
+    
+    Return 0 on success, -1 on failure.
     
-    char* p_message = NULL;
+*******************************************************************************/
 
-    char* format_error_text = "**** message formatting error ****";
-            
-    int message_len = 0;
+int logmsg_open_file(const char* file_spec) {
+
+    /*
+     *  Check for file or connection already open
+     */
+     
+    if (logger_fd >= 0) {
     
-    {
-        va_list ap;
+        num_open_failures++;
         
-        va_start(ap, format);
+        return -1;
+    }
+
+    /*
+     *  Open existing file or create new file.
+     */
+     
+    if (logmsg_sharding != LOGMSG_SHARDING_NONE) {
+    
+        logger_fd = logmsg_shard_open(file_spec);
         
-        message_len = vsnprintf(p_message, message_len, format, ap);
+    } else {
+    
+        mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+
+        logger_fd = open(file_spec, O_CREAT | O_APPEND | O_WRONLY, mode);
+    }
+
+    /*
+     *  Check for open failure
+     */
+     
+    if (logger_fd < 0) {
+    
+        num_open_failures++;
         
-        if (message_len < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_open_index() - Open time index sidecar file for the log file.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_open_index(const char* index_spec, 
+                      uint64_t interval_entries, 
+                      uint64_t interval_bytes) {
+
+    /*
+     *  Check for index already open, no interval specified, or a sharded
+     *  log file
+     */
+     
+    if (index_fd >= 0 || (interval_entries == 0 && interval_bytes == 0) ||
+        logmsg_sharding != LOGMSG_SHARDING_NONE) {
+    
+        num_open_failures++;
         
-            message_len = strlen(format_error_text);
-            
-            p_message = format_error_text;
-        }
+        return -1;
     }
 
     /*
-     *  Allocate memory for complete log entry, including terminal NULL
+     *  Open existing file or create new file.
+     */
+     
+    mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+
+    int fd = open(index_spec, O_CREAT | O_APPEND | O_WRONLY, mode);
+
+    /*
+     *  Check for open failure
      */
+     
+    if (fd < 0) {
+    
+        num_open_failures++;
+        
+        return -1;
+    }
+    
+    index_interval_entries = interval_entries;
     
-    char* p_log_message = NULL;
+    index_interval_bytes = interval_bytes;
+    
+    index_fd = fd;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_open_conn() - Open network connection to log recorder server.
+    
+    Return 0 on success, -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_open_conn(const char* server_spec) {
+
+    /*
+     *  Check for file or connection already open
+     */
      
-    char* malloc_error_text = "**** heap memory exhausted ****";
+    if (logger_fd >= 0) {
+    
+        num_conn_failures++;
+        
+        return -1;
+    }
     
-    size_t log_message_len = 
+    int fd = logmsg_open_socket(server_spec);
     
-        utc_time_len + 1 + 
+    if (fd < 0) {
+    
+        num_conn_failures++;
         
-            log_level_text_len + 1 +
-            
-                hostname_len + 1 +
-            
-                    program_name_len +
-                    
-                        1 + pid_tid_len + 1 + 1 +
-                        
-                            message_len + 1;
+        return -1;
+    }
+    
+    logger_is_socket = 1;
+    
+    logger_fd = fd;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_level_to_string() - Convert log level from binary to text
+    
+*******************************************************************************/
+
+const char* logmsg_level_to_string(LOGMSG_LEVEL level) {
+
+    static const char* text[] = {
+    
+        "NONE", "FATAL", "ERROR", "WARN", "INFO", "DEBUG", "TRACE" 
+    };
+    
+    static const char* undef = "UNDEFINED";
 
-    {                            
-        p_log_message = (char*)malloc(log_message_len + 1);
+    if (level >= LOGMSG_LEVEL_MIN && level <= LOGMSG_LEVEL_MAX) {
     
-        if (p_log_message == NULL) {
+        return text[level];
         
-            log_message_len = strlen(malloc_error_text);
-            
-            p_log_message = malloc_error_text;
-        }
+    } else {
+    
+        return undef;
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_printf - Write log entry using printf style formatting
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_printf(LOGMSG_LEVEL level, const char* format, ...) {
+
+    va_list ap;
+    
+    va_start(ap, format);
+    
+    vprintf_entry(level, format, ap);
+    
+    va_end(ap);
+}
+
+/*******************************************************************************
+
+    logmsg_printf_site() - Write log entry using printf style formatting, 
+                           counted for its call site
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_printf_site(LOGMSG_SITE* p_site, 
+                        LOGMSG_LEVEL level, 
+                        const char* format, 
+                        ...) {
+
+    va_list ap;
+    
+    va_start(ap, format);
+    
+    if (is_recorded(level)) {
+    
+        logmsg_record_printf(level, format, ap);
+        
+        va_end(ap);
+        
+        logmsg_site_suppressed(p_site);
+        
+        return;
+    }
+    
+    size_t entry_len = vprintf_entry(level, format, ap);
+    
+    va_end(ap);
+    
+    logmsg_site_count(p_site, entry_len);
+}
+
+/*******************************************************************************
+
+    logmsg_printf_signal_safe() - Write log entry using printf style for-
+                                  matting, from a signal handler
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_printf_signal_safe(LOGMSG_LEVEL level, const char* format, ...) {
+
+    int fd = logger_fd;
+    
+    if (fd < 0 && __atomic_load_n(&logmsg_num_sinks, __ATOMIC_ACQUIRE) == 0) {
+    
+        return;
     }
     
+    int saved_errno = errno;
+    
     /*
-     *  If memory allocation succeeded, construct the complete log message
+     *  Build entry on the stack, truncated to fit
      */
+     
+    char entry_buf[SIGNAL_SAFE_ENTRY_MAX_LEN];
     
-    if (p_log_message != malloc_error_text) {
-         
-        char* p_write = p_log_message;
-        
-        /*
-         *  Write UTC time string to log message buffer
-         */
+    char message_buf[SIGNAL_SAFE_ENTRY_MAX_LEN - LOGMSG_LAYOUT_MAX_LEN];
+    
+    LOGMSG_HEADER header;
+    
+    logmsg_layout_get_header(level, &header);
+    
+    va_list ap;
+    
+    va_start(ap, format);
+    
+    size_t message_len = logmsg_vsnprintf_signal_safe(message_buf, 
+                                                      sizeof(message_buf),
+                                                      format, 
+                                                      ap);
+    
+    va_end(ap);
+    
+    if (message_len >= sizeof(message_buf)) {
+    
+        message_len = sizeof(message_buf) - 1;
+    }
+    
+    char* p_write = logmsg_layout_write_prefix(entry_buf, &header);
+    
+    size_t suffix_max_len = 
+        logmsg_layout_max_len(&header, 0) - (p_write - entry_buf);
+    
+    p_write = logmsg_layout_write_message(p_write, 
+                                          &header, 
+                                          message_buf, 
+                                          message_len,
+                                          entry_buf + sizeof(entry_buf) - 
+                                              p_write - suffix_max_len);
+    
+    p_write = logmsg_layout_write_suffix(p_write, &header);
+    
+    /*
+     *  Write to log file or log server connection, and to sinks, bypassing
+     *  the writer thread
+     */
+     
+    size_t entry_len = p_write - entry_buf;
+    
+    if (fd >= 0 && logmsg_write_log(entry_buf, entry_len) != 0) {
+    
+        num_write_failures++;
+    }
+    
+    struct iovec entry = { entry_buf, entry_len };
+    
+    logmsg_sink_write(&level, &entry, 1, 1);
+    
+    errno = saved_errno;
+}
 
-        {
-            strncpy(p_write, utc_time_buf, utc_time_len + 1);
-            
-            p_write += utc_time_len;
-            
-            *p_write++ = ' ';
-        }
+/*******************************************************************************
 
+    logmsg_write() - Write log entry with preformatted message
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_write(LOGMSG_LEVEL level, const char* p_message, size_t message_len) {
+
+    struct iovec message = { (void*)p_message, message_len };
+    
+    logmsg_writev_raw(level, &message, 1);
+}
+
+/*******************************************************************************
+
+    logmsg_write_raw() - Write log entry with message bytes as they are
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_write_raw(LOGMSG_LEVEL level, 
+                      const void* p_message, 
+                      size_t message_len) {
+
+    struct iovec message = { (void*)p_message, message_len };
+    
+    logmsg_writev_raw(level, &message, 1);
+}
+
+/*******************************************************************************
+
+    logmsg_writev_raw() - Write log entry with message gathered from parts
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+int logmsg_writev_raw(LOGMSG_LEVEL level, 
+                      const struct iovec* p_parts, 
+                      int num_parts) {
+
+    if (num_parts < 0 || num_parts > LOGMSG_RAW_MAX_PARTS) {
+    
+        return -1;
+    }
+    
+    /*
+     *  Keep entry in memory if too detailed for the log file
+     */
+     
+    if (is_recorded(level)) {
+    
+        logmsg_record_text(level, p_parts, num_parts);
+        
+        return 0;
+    }
+    
+    if (level == LOGMSG_LEVEL_FATAL) {
+    
+        logmsg_dump_recorder_fatal();
+    }
+
+    LOGMSG_HEADER header;
+    
+    logmsg_layout_get_header(level, &header);
+    
+    if (logmsg_layout_is_json(&header)) {
+    
         /*
-         *  Write log level text string to log message buffer
+         *  Gather message, to be escaped
          */
          
-        {
-            strncpy(p_write, log_level_text, log_level_text_len + 1);
+        if (num_parts == 1) {
+        
+            write_text_entry(&header, 
+                             (const char*)p_parts[0].iov_base, 
+                             p_parts[0].iov_len);
             
-            p_write += log_level_text_len;
+            return 0;
+        }
+        
+        size_t message_len = 0;
+        
+        for (int i = 0; i < num_parts; i++) {
+        
+            message_len += p_parts[i].iov_len;
+        }
+        
+        char message_buf[1024];
+        
+        char* p_message = message_buf;
+        
+        if (message_len > sizeof(message_buf)) {
+        
+            p_message = (char*)malloc(message_len);
+            
+            if (p_message == NULL) {
             
-            *p_write++ = ' ';
+                num_write_failures++;
+                
+                return 0;
+            }
+        }
+        
+        char* p_write = p_message;
+        
+        for (int i = 0; i < num_parts; i++) {
+        
+            memcpy(p_write, p_parts[i].iov_base, p_parts[i].iov_len);
+            
+            p_write += p_parts[i].iov_len;
+        }
+        
+        write_text_entry(&header, p_message, message_len);
+        
+        if (p_message != message_buf) {
+        
+            free(p_message);
         }
+        
+        return 0;
+    }
+    
+    /*
+     *  Write prefix and suffix of entry around the caller's parts
+     */
+     
+    char prefix[LOGMSG_LAYOUT_MAX_LEN];
+    
+    char suffix[LOGMSG_LAYOUT_MAX_LEN + 1];
+    
+    struct iovec entry[LOGMSG_RAW_MAX_PARTS + 2];
+    
+    entry[0].iov_base = prefix;
+    
+    entry[0].iov_len = logmsg_layout_write_prefix(prefix, &header) - prefix;
+    
+    memcpy(&entry[1], p_parts, num_parts * sizeof(struct iovec));
+    
+    entry[num_parts + 1].iov_base = suffix;
+    
+    entry[num_parts + 1].iov_len = 
+        logmsg_layout_write_suffix(suffix, &header) - suffix;
+    
+    write_entry_parts(level, entry, num_parts + 2);
+    
+    return 0;
+}
 
-        /*
-         *  Write hostname string to log message buffer
-         */
-         
-        {
-            strncpy(p_write, hostname_buf, hostname_len + 1);
+/*******************************************************************************
+
+    logmsg_set_kv_format() - Select rendering of structured log entries
+    
+    Return 0 on success, -1 if the format is not recognized.
+    
+*******************************************************************************/
+
+int logmsg_set_kv_format(LOGMSG_KV_FORMAT format) {
+
+    if (format != LOGMSG_KV_FORMAT_LOGFMT &&
+        format != LOGMSG_KV_FORMAT_JSON &&
+        format != LOGMSG_KV_FORMAT_BINARY) {
+        
+        return -1;
+    }
+    
+    kv_format = format;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_kv() - Write structured log entry
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+void logmsg_kv(LOGMSG_LEVEL level, 
+               const char* message, 
+               const LOGMSG_KV* p_fields, 
+               size_t num_fields) {
+
+    /*
+     *  Entries are built on the stack unless they are large
+     */
+     
+    char entry_buf[1024];
+    
+    char* p_entry = entry_buf;
+    
+    size_t entry_len = 0;
+    
+    /*
+     *  Keep entry in memory, rendered as logfmt, if too detailed for the 
+     *  log file
+     */
+     
+    if (is_recorded(level)) {
+    
+        size_t max_len = logmsg_kv_text_max_len(message,
+                                                p_fields,
+                                                num_fields);
+        
+        if (max_len > sizeof(entry_buf)) {
+        
+            p_entry = (char*)malloc(max_len);
             
-            p_write += hostname_len;
+            if (p_entry == NULL) {
             
-            *p_write++ = ':';
+                num_write_failures++;
+                
+                return;
+            }
         }
-
+        
+        char* p_end = logmsg_kv_write_text(p_entry, 
+                                           LOGMSG_KV_FORMAT_LOGFMT, 
+                                           message, 
+                                           p_fields, 
+                                           num_fields);
+        
+        struct iovec text = { p_entry, p_end - p_entry };
+        
+        logmsg_record_text(level, &text, 1);
+        
+        if (p_entry != entry_buf) {
+        
+            free(p_entry);
+        }
+        
+        return;
+    }
+    
+    if (level == LOGMSG_LEVEL_FATAL) {
+    
+        logmsg_dump_recorder_fatal();
+    }
+    
+    LOGMSG_KV_FORMAT format = kv_format;
+    
+    if (format == LOGMSG_KV_FORMAT_BINARY) {
+    
         /*
-         *  Write program name string to log message buffer
+         *  Collect entry header, in binary
          */
-         
-        {
-            strncpy(p_write, program_name, program_name_len + 1);
-            
-            p_write += program_name_len;
-        }
-
+    
+        LOGMSG_RECORD record;
+        
+        memset(&record, 0, sizeof(record));
+        
+        record.utc_time_ns = logmsg_clock_to_utc_ns(logmsg_clock_now());
+        
+        record.level = level;
+        
+        char hostname_buf[64+1];
+        
+        ssize_t hostname_len = get_hostname(hostname_buf, 
+                                            sizeof(hostname_buf));
+        
+        record.p_host = hostname_buf;
+        
+        record.host_len = hostname_len < 0 ? 0 : hostname_len;
+        
+        record.p_program = program_invocation_short_name;
+        
+        record.program_len = strlen(program_invocation_short_name);
+        
+        record.pid = getpid();
+        
+        record.tid = (pid_t)syscall(SYS_gettid);
+        
+        record.p_message = message;
+        
+        record.message_len = strlen(message);
+        
         /*
-         *  Write process and thread ID string to log message buffer
+         *  Build binary record
          */
          
-        {
-            *p_write++ = '[';
-            
-            strncpy(p_write, pid_tid_buf, pid_tid_len + 1);
+        entry_len = logmsg_kv_binary_len(&record, p_fields, num_fields);
+        
+        if (entry_len == 0) {
+        
+            num_write_failures++;
             
-            p_write += pid_tid_len;
+            return;
+        }
+        
+        if (entry_len > sizeof(entry_buf)) {
+        
+            p_entry = (char*)malloc(entry_len);
             
-            *p_write++ = ']';
+            if (p_entry == NULL) {
             
-            *p_write++ = ' ';
+                num_write_failures++;
+                
+                return;
+            }
         }
-
-       /*
-        *   Format caller supplied message and write to log message buffer
-        */  
-
-        if (p_message != format_error_text) {
         
-            va_list ap;
-            
-            va_start(ap, format);
+        logmsg_kv_write_binary(p_entry, 
+                               &record, 
+                               __atomic_fetch_add(&binary_sequence, 1,
+                                                  __ATOMIC_RELAXED),
+                               p_fields, 
+                               num_fields);
+    
+    } else {
+    
+        /*
+         *  Render fields, then lay out as text entry
+         */
+         
+        size_t max_len = logmsg_kv_text_max_len(message,
+                                                p_fields,
+                                                num_fields);
+        
+        if (max_len > sizeof(entry_buf)) {
+        
+            p_entry = (char*)malloc(max_len);
             
-            vsnprintf(p_write, message_len + 1, format, ap);
+            if (p_entry == NULL) {
             
-        } else {
-        
-            strncpy(p_write, p_message, message_len + 1);
+                num_write_failures++;
+                
+                return;
+            }
         }
         
-        p_write += message_len;
+        char* p_write = logmsg_kv_write_text(p_entry, 
+                                             format, 
+                                             message, 
+                                             p_fields, 
+                                             num_fields);
         
-        *p_write++ = '\n';
-    }
+        LOGMSG_HEADER header;
     
-    /*
-     *  Write to log file or log server connection if open
-     */
-
-    if (logger_fd >= 0)    
-    {
-        ssize_t n_written = 
-            write(logger_fd, p_log_message, log_message_len);
+        logmsg_layout_get_header(level, &header);
         
-        if (n_written != log_message_len) {
+        write_text_entry(&header, p_entry, p_write - p_entry);
         
-            num_write_failures++;
+        if (p_entry != entry_buf) {
+        
+            free(p_entry);
         }
+        
+        return;
     }
     
     /*
-     *  Release allocated memory
+     *  Write to log file or log server connection if open
      */
+
+    write_entry(level, p_entry, entry_len);
     
-    if (p_log_message != malloc_error_text) {
+    if (p_entry != entry_buf) {
     
-        free(p_log_message);
+        free(p_entry);
     }
 }
-
-
@@ -0,0 +1,436 @@
+/*******************************************************************************
+
+    logmsg_clock.c - Clock sources for log entry timestamps
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+
+#endif
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Time over which the TSC frequency is first measured
+
+#define CALIBRATION_NS 20000000
+
+// Time after which the TSC is re-anchored against CLOCK_REALTIME
+
+#define REANCHOR_NS 1000000000
+
+/*******************************************************************************
+
+    ANCHOR - Simultaneous readings of TSC and CLOCK_REALTIME, and the TSC
+             period at that time, in 2^-32 nsecs
+
+*******************************************************************************/
+
+typedef struct ANCHOR {
+    
+    uint64_t tsc;
+    
+    int64_t  utc_time_ns;
+    
+    uint64_t tick_ns_frac;
+    
+} ANCHOR;
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// Set if timestamps are TSC readings rather than UTC nsecs
+
+int logmsg_clock_is_tsc = 0;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Anchor taken at calibration, from which the TSC frequency is refined
+
+static ANCHOR first_anchor;
+
+// Latest anchor is anchors[anchor_generation & 1]. A re-anchoring thread
+// fills in the other and then advances the generation, so that readers 
+// need never wait, even in signal handlers. A reader which finds that the
+// generation has advanced while it copied an anchor copies it again, since
+// a later re-anchoring may have rewritten the slot it was copying.
+
+static ANCHOR anchors[2];
+
+static uint32_t anchor_generation = 0;
+
+static int reanchoring = 0;
+
+static uint64_t reanchor_ticks = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    is_tsc_invariant() - Determine whether the TSC runs at a constant rate
+                         in all power states, according to CPUID
+
+*******************************************************************************/
+
+static int is_tsc_invariant(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    unsigned eax, ebx, ecx, edx;
+    
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+        eax < 0x80000007) {
+        
+        return 0;
+    }
+    
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    
+    return (edx & (1 << 8)) != 0;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+/*******************************************************************************
+
+    read_anchor() - Read TSC and CLOCK_REALTIME together
+    
+    Description
+    ===========
+    
+    The TSC is read either side of clock_gettime(), and the mean taken.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int read_anchor(ANCHOR* p_anchor) {
+    
+    struct timespec system_time_ns;
+    
+    uint64_t tsc_before = logmsg_read_tsc();
+    
+    if (clock_gettime(CLOCK_REALTIME, &system_time_ns) != 0) {
+        
+        return -1;
+    }
+    
+    uint64_t tsc_after = logmsg_read_tsc();
+    
+    p_anchor->tsc = tsc_before + (tsc_after - tsc_before) / 2;
+    
+    p_anchor->utc_time_ns = (int64_t)system_time_ns.tv_sec * 1000000000 +
+                                system_time_ns.tv_nsec;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    tick_ns_frac() - Return TSC period between anchors, in 2^-32 nsecs, or
+                     0 if the anchors are unusable
+
+*******************************************************************************/
+
+static uint64_t tick_ns_frac(const ANCHOR* p_from, const ANCHOR* p_to) {
+    
+    int64_t elapsed_ns = p_to->utc_time_ns - p_from->utc_time_ns;
+    
+    uint64_t elapsed_ticks = p_to->tsc - p_from->tsc;
+    
+    if (elapsed_ns <= 0 || elapsed_ticks == 0) {
+        
+        return 0;
+    }
+    
+    return (uint64_t)(((unsigned __int128)elapsed_ns << 32) / elapsed_ticks);
+}
+
+/*******************************************************************************
+
+    reanchor() - Take new anchor, if no other thread is doing so
+    
+    Description
+    ===========
+    
+    The offset from CLOCK_REALTIME is reset by each anchor, so that drift
+    is bounded by the error accumulated over REANCHOR_NS, and the TSC
+    period is refined over the whole time since calibration.
+
+*******************************************************************************/
+
+static void reanchor(void) {
+    
+    int idle = 0;
+    
+    if (!__atomic_compare_exchange_n(&reanchoring, &idle, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    uint32_t next =
+        __atomic_load_n(&anchor_generation, __ATOMIC_RELAXED) + 1;
+    
+    ANCHOR anchor;
+    
+    if (read_anchor(&anchor) == 0) {
+        
+        anchor.tick_ns_frac = tick_ns_frac(&first_anchor, &anchor);
+        
+        if (anchor.tick_ns_frac == 0) {
+            
+            anchor.tick_ns_frac = anchors[(next - 1) & 1].tick_ns_frac;
+        }
+        
+        /*
+         *  Order the slot's stores after the previous generation, so that
+         *  a reader which sees them sees that generation advanced
+         */
+        
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        
+        anchors[next & 1] = anchor;
+        
+        __atomic_store_n(&anchor_generation, next, __ATOMIC_RELEASE);
+    }
+    
+    __atomic_store_n(&reanchoring, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    load_anchor() - Copy latest anchor, retrying if it is re-anchored 
+                    meanwhile
+    
+    Description
+    ===========
+    
+    A retry happens only once a re-anchoring has completed, so never waits
+    on a re-anchoring interrupted by a signal handler.
+
+*******************************************************************************/
+
+static void load_anchor(ANCHOR* p_anchor) {
+    
+    uint32_t generation =
+        __atomic_load_n(&anchor_generation, __ATOMIC_ACQUIRE);
+    
+    for (;;) {
+        
+        *p_anchor = anchors[generation & 1];
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        
+        uint32_t latest =
+            __atomic_load_n(&anchor_generation, __ATOMIC_ACQUIRE);
+        
+        if (latest == generation) {
+            
+            return;
+        }
+        
+        generation = latest;
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_clock_to_utc_ns() - Convert timestamp to UTC nsecs since the
+                               Epoch
+    
+    Description
+    ===========
+    
+    Uses only async-signal-safe functions.
+
+*******************************************************************************/
+
+int64_t logmsg_clock_to_utc_ns(uint64_t timestamp) {
+    
+    if (!logmsg_clock_is_tsc) {
+        
+        return (int64_t)timestamp;
+    }
+    
+    ANCHOR anchor;
+    
+    load_anchor(&anchor);
+    
+    int64_t elapsed_ticks = (int64_t)(timestamp - anchor.tsc);
+    
+    if (elapsed_ticks > (int64_t)reanchor_ticks) {
+        
+        reanchor();
+        
+        load_anchor(&anchor);
+        
+        elapsed_ticks = (int64_t)(timestamp - anchor.tsc);
+    }
+    
+    return anchor.utc_time_ns +
+               (int64_t)(((__int128)elapsed_ticks *
+                              (__int128)anchor.tick_ns_frac) >> 32);
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_set_clock() - Select source of entry timestamps
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_set_clock(LOGMSG_CLOCK clock) {
+    
+    /*
+     *  Check for timestamps already being taken
+     */
+    
+    if (logmsg_get_logger_fd() >= 0 ||
+        logmsg_recorder_level != LOGMSG_LEVEL_NONE) {
+        
+        return -1;
+    }
+    
+    if (clock == LOGMSG_CLOCK_REALTIME) {
+        
+        logmsg_clock_is_tsc = 0;
+        
+        return 0;
+    }
+    
+    if (clock != LOGMSG_CLOCK_TSC || !is_tsc_invariant()) {
+        
+        logmsg_clock_is_tsc = 0;
+        
+        return -1;
+    }
+    
+    /*
+     *  Measure TSC frequency
+     */
+    
+    ANCHOR anchor;
+    
+    if (read_anchor(&first_anchor) != 0) {
+        
+        return -1;
+    }
+    
+    struct timespec delay = { 0, CALIBRATION_NS };
+    
+    nanosleep(&delay, NULL);
+    
+    if (read_anchor(&anchor) != 0) {
+        
+        return -1;
+    }
+    
+    anchor.tick_ns_frac = tick_ns_frac(&first_anchor, &anchor);
+    
+    if (anchor.tick_ns_frac == 0) {
+        
+        return -1;
+    }
+    
+    first_anchor.tick_ns_frac = anchor.tick_ns_frac;
+    
+    anchors[0] = anchor;
+    
+    anchors[1] = anchor;
+    
+    anchor_generation = 0;
+    
+    reanchor_ticks = (uint64_t)(((unsigned __int128)REANCHOR_NS << 32) /
+                                    anchor.tick_ns_frac);
+    
+    logmsg_clock_is_tsc = 1;
+    
+    return 0;
+}
@@ -0,0 +1,318 @@
+/*******************************************************************************
+
+    logmsg_crc.c - CRC32C of binary log records
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <logmsg_parse.h>
+
+#if defined(__x86_64__)
+
+#include <nmmintrin.h>
+
+#define LOGMSG_CRC_X86
+
+#elif defined(__aarch64__)
+
+#include <arm_acle.h>
+
+#include <sys/auxv.h>
+
+#include <asm/hwcap.h>
+
+#define LOGMSG_CRC_ARM
+
+#endif
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// CRC32C polynomial, bit reflected
+
+#define CRC32C_POLY 0x82F63B78
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Tables for the computation 8 bytes at a time, built at load time: entry
+// [k][b] is the CRC of byte b followed by k zero bytes
+
+static uint32_t crc_table[8][256];
+
+// Computation used by logmsg_crc32c(), on the inverted CRC
+
+static uint32_t (*p_crc_update)(uint32_t crc, const uint8_t* p, size_t len);
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    crc_update_table() - Update inverted CRC with len bytes at p, using the
+                         tables
+
+*******************************************************************************/
+
+static uint32_t crc_update_table(uint32_t crc, const uint8_t* p, size_t len) {
+    
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        
+        len--;
+    }
+    
+    while (len >= 8) {
+        
+        uint64_t word;
+        
+        memcpy(&word, p, 8);
+        
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        
+        word ^= crc;
+        
+        crc = crc_table[7][word & 0xFF] ^
+              crc_table[6][(word >> 8) & 0xFF] ^
+              crc_table[5][(word >> 16) & 0xFF] ^
+              crc_table[4][(word >> 24) & 0xFF] ^
+              crc_table[3][(word >> 32) & 0xFF] ^
+              crc_table[2][(word >> 40) & 0xFF] ^
+              crc_table[1][(word >> 48) & 0xFF] ^
+              crc_table[0][word >> 56];
+        
+        p += 8;
+        
+        len -= 8;
+    }
+    
+    while (len > 0) {
+        
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        
+        len--;
+    }
+    
+    return crc;
+}
+
+#ifdef LOGMSG_CRC_X86
+
+/*******************************************************************************
+
+    crc_update_sse42() - Update inverted CRC with len bytes at p, using the
+                         SSE4.2 CRC32 instruction
+
+*******************************************************************************/
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_update_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        
+        crc = _mm_crc32_u8(crc, *p++);
+        
+        len--;
+    }
+    
+    uint64_t crc64 = crc;
+    
+    while (len >= 8) {
+        
+        uint64_t word;
+        
+        memcpy(&word, p, 8);
+        
+        crc64 = _mm_crc32_u64(crc64, word);
+        
+        p += 8;
+        
+        len -= 8;
+    }
+    
+    crc = (uint32_t)crc64;
+    
+    while (len > 0) {
+        
+        crc = _mm_crc32_u8(crc, *p++);
+        
+        len--;
+    }
+    
+    return crc;
+}
+
+#endif
+
+#ifdef LOGMSG_CRC_ARM
+
+/*******************************************************************************
+
+    crc_update_armv8() - Update inverted CRC with len bytes at p, using the
+                         ARMv8 CRC32C instructions
+
+*******************************************************************************/
+
+__attribute__((target("+crc")))
+static uint32_t crc_update_armv8(uint32_t crc, const uint8_t* p, size_t len) {
+    
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        
+        crc = __crc32cb(crc, *p++);
+        
+        len--;
+    }
+    
+    while (len >= 8) {
+        
+        uint64_t word;
+        
+        memcpy(&word, p, 8);
+        
+        crc = __crc32cd(crc, word);
+        
+        p += 8;
+        
+        len -= 8;
+    }
+    
+    while (len > 0) {
+        
+        crc = __crc32cb(crc, *p++);
+        
+        len--;
+    }
+    
+    return crc;
+}
+
+#endif
+
+/*******************************************************************************
+
+    init_crc() - Build tables, and select computation, when library is 
+                 loaded
+
+*******************************************************************************/
+
+__attribute__((constructor))
+static void init_crc(void) {
+    
+    for (uint32_t b = 0; b < 256; b++) {
+        
+        uint32_t crc = b;
+        
+        for (int bit = 0; bit < 8; bit++) {
+            
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+        
+        crc_table[0][b] = crc;
+    }
+    
+    for (uint32_t b = 0; b < 256; b++) {
+        
+        for (int k = 1; k < 8; k++) {
+            
+            uint32_t crc = crc_table[k - 1][b];
+            
+            crc_table[k][b] = crc_table[0][crc & 0xFF] ^ (crc >> 8);
+        }
+    }
+    
+    p_crc_update = crc_update_table;
+    
+#ifdef LOGMSG_CRC_X86
+    
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("sse4.2")) {
+        
+        p_crc_update = crc_update_sse42;
+    }
+    
+#endif
+    
+#ifdef LOGMSG_CRC_ARM
+    
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        
+        p_crc_update = crc_update_armv8;
+    }
+    
+#endif
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_crc32c() - Extend the CRC32C of some data with len more bytes
+    
+    See logmsg_parse.h for more details.
+
+*******************************************************************************/
+
+uint32_t logmsg_crc32c(uint32_t crc, const void* p_data, size_t len) {
+    
+    return ~p_crc_update(~crc, (const uint8_t*)p_data, len);
+}
@@ -0,0 +1,1032 @@
+/*******************************************************************************
+
+    logmsg_durability.c - Syncing of the log file to storage, and direct
+                          I/O
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <errno.h>
+
+#include <time.h>
+
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sched.h>
+
+#include <fcntl.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/uio.h>
+
+#include <sys/file.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Alignment of O_DIRECT writes, in offset, length and memory
+
+#define DIRECT_BLOCK_LEN 4096
+
+// Length of the O_DIRECT staging buffer, written out whenever full. It is
+// allocated a block longer, to hold the entries not yet written after the
+// last partial block of the file, should another process have grown it.
+
+#define DIRECT_BUFFER_LEN (64 * 1024)
+
+// Default time between syncs by the sync thread
+
+#define DEFAULT_SYNC_INTERVAL_MS 1000
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// Durability modes in effect, as LOGMSG_DURABILITY flags
+
+int logmsg_durability = LOGMSG_DURABILITY_NONE;
+
+// # fdatasync() and O_DIRECT write failures
+
+uint64_t num_sync_failures = 0;
+
+// Set in a process forked from one in O_DIRECT mode
+
+int logmsg_direct_shared = 0;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Log file FD, as at logmsg_set_durability()
+
+static int log_fd = -1;
+
+// Sync thread, woken early when sync_interval_bytes have been written
+// since the last sync
+
+static pthread_t sync_thread;
+
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t sync_interval_ns = 0;
+
+static uint64_t sync_interval_bytes = 0;
+
+static uint64_t num_unsynced_bytes = 0;
+
+// O_DIRECT staging buffer, holding the last partial block of the file and
+// the entries which follow, which begin at direct_offset in the file. The
+// lock is taken by exchange, so that a signal handler need never wait.
+
+static char* p_direct_buffer = NULL;
+
+static uint64_t direct_offset = 0;
+
+static size_t direct_len = 0;
+
+static size_t direct_written_len = 0;  // Leading bytes already in the file
+
+static int direct_lock = 0;
+
+// Flags of the log file FD before it was switched to O_DIRECT
+
+static int direct_saved_flags = 0;
+
+// Set once a child process may append to the log file, which is then 
+// locked while blocks are written, and re-read if it has grown
+
+static int direct_forked = 0;
+
+// Latencies
+
+static LOGMSG_DURABILITY_STATS stats;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    get_time_ns() - Return monotonic clock time, in nsecs
+
+*******************************************************************************/
+
+static uint64_t get_time_ns(void) {
+    
+    struct timespec time_ns;
+    
+    clock_gettime(CLOCK_MONOTONIC, &time_ns);
+    
+    return (uint64_t)time_ns.tv_sec * 1000000000 + time_ns.tv_nsec;
+}
+
+/*******************************************************************************
+
+    add_latency() - Account for an operation taking latency_ns
+
+*******************************************************************************/
+
+static void add_latency(LOGMSG_LATENCY_STATS* p_stats, uint64_t latency_ns) {
+    
+    __atomic_add_fetch(&p_stats->count, 1, __ATOMIC_RELAXED);
+    
+    __atomic_add_fetch(&p_stats->total_ns, latency_ns, __ATOMIC_RELAXED);
+    
+    uint64_t max_ns = __atomic_load_n(&p_stats->max_ns, __ATOMIC_RELAXED);
+    
+    while (latency_ns > max_ns &&
+           !__atomic_compare_exchange_n(&p_stats->max_ns, &max_ns, latency_ns,
+                                        1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+/*******************************************************************************
+
+    sync_log() - Sync log file data to storage, accounting for the latency
+
+*******************************************************************************/
+
+static void sync_log(LOGMSG_LATENCY_STATS* p_stats) {
+    
+    uint64_t start_ns = get_time_ns();
+    
+    if (fdatasync(log_fd) != 0) {
+        
+        num_sync_failures++;
+        
+        return;
+    }
+    
+    add_latency(p_stats, get_time_ns() - start_ns);
+}
+
+/*******************************************************************************
+
+    lock_direct() - Take O_DIRECT staging buffer lock
+    
+    Return 0 on success, -1 if in a signal handler and the lock is held.
+
+*******************************************************************************/
+
+static int lock_direct(int signal_safe) {
+    
+    while (__atomic_exchange_n(&direct_lock, 1, __ATOMIC_ACQUIRE)) {
+        
+        if (signal_safe) {
+            
+            return -1;
+        }
+        
+        sched_yield();
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    unlock_direct() - Release O_DIRECT staging buffer lock
+
+*******************************************************************************/
+
+static void unlock_direct(void) {
+    
+    __atomic_store_n(&direct_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    write_blocks() - Write out O_DIRECT staging buffer, the lock being held
+    
+    See write_direct().
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int write_blocks(void) {
+    
+    size_t write_len = (direct_len + DIRECT_BLOCK_LEN - 1) &
+                           ~(size_t)(DIRECT_BLOCK_LEN - 1);
+    
+    memset(p_direct_buffer + direct_len, 0, write_len - direct_len);
+    
+    uint64_t start_ns = get_time_ns();
+    
+    ssize_t n_written = pwrite(log_fd,
+                               p_direct_buffer,
+                               write_len,
+                               (off_t)direct_offset);
+    
+    if (n_written != write_len ||
+        ftruncate(log_fd, (off_t)(direct_offset + direct_len)) != 0) {
+        
+        num_sync_failures++;
+        
+        return -1;
+    }
+    
+    add_latency(&stats.direct_writes, get_time_ns() - start_ns);
+    
+    size_t whole_len = direct_len & ~(size_t)(DIRECT_BLOCK_LEN - 1);
+    
+    memmove(p_direct_buffer,
+            p_direct_buffer + whole_len,
+            direct_len - whole_len);
+    
+    direct_offset += whole_len;
+    
+    direct_len -= whole_len;
+    
+    direct_written_len = direct_len;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    restage_direct() - Re-stage O_DIRECT staging buffer after the log file
+                       has grown, the lock being held
+    
+    Description
+    ===========
+    
+    If another process has appended to the file since the buffer was last
+    written, the entries not yet written are moved to follow the new last 
+    partial block of the file, which is read in ahead of them.
+    
+    Uses only async-signal-safe functions.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int restage_direct(void) {
+    
+    struct stat log_stat;
+    
+    if (fstat(log_fd, &log_stat) != 0) {
+        
+        num_sync_failures++;
+        
+        return -1;
+    }
+    
+    uint64_t file_len = (uint64_t)log_stat.st_size;
+    
+    if (file_len <= direct_offset + direct_written_len) {
+        
+        return 0;
+    }
+    
+    uint64_t offset = file_len & ~(uint64_t)(DIRECT_BLOCK_LEN - 1);
+    
+    size_t head_len = (size_t)(file_len - offset);
+    
+    size_t unwritten_len = direct_len - direct_written_len;
+    
+    memmove(p_direct_buffer + head_len,
+            p_direct_buffer + direct_written_len,
+            unwritten_len);
+    
+    char fd_spec[32];
+    
+    logmsg_snprintf(fd_spec, sizeof(fd_spec), "/proc/self/fd/%d", log_fd);
+    
+    int read_fd = head_len == 0 ? -1 : open(fd_spec, O_RDONLY | O_CLOEXEC);
+    
+    ssize_t n_read = head_len == 0 ? 0 : read_fd < 0 ? -1 :
+                         pread(read_fd, p_direct_buffer, head_len,
+                               (off_t)offset);
+    
+    if (read_fd >= 0) {
+        
+        close(read_fd);
+    }
+    
+    direct_offset = offset;
+    
+    direct_len = head_len + unwritten_len;
+    
+    direct_written_len = head_len;
+    
+    if (n_read != (ssize_t)head_len) {
+        
+        num_sync_failures++;
+        
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    write_direct() - Write out O_DIRECT staging buffer, the lock being held
+    
+    Description
+    ===========
+    
+    The buffer is written in whole blocks, the last padded with zeros, and
+    the file then truncated to its true length. Whole blocks are dropped
+    from the buffer, leaving the last partial block to be written again
+    when entries are added to it.
+    
+    Once a child process may append to the file, the file is locked mean-
+    while, the child taking a shared lock to append, and the buffer first
+    re-staged if the file has grown.
+    
+    Uses only async-signal-safe functions.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int write_direct(void) {
+    
+    if (direct_len == direct_written_len) {
+        
+        return 0;
+    }
+    
+    if (direct_forked) {
+        
+        flock(log_fd, LOCK_EX);
+        
+        int status = restage_direct() == 0 ? write_blocks() : -1;
+        
+        flock(log_fd, LOCK_UN);
+        
+        return status;
+    }
+    
+    return write_blocks();
+}
+
+/*******************************************************************************
+
+    start_direct() - Switch log file to O_DIRECT, staging its last partial
+                     block
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int start_direct(void) {
+    
+    if (posix_memalign((void**)&p_direct_buffer,
+                       DIRECT_BLOCK_LEN,
+                       DIRECT_BUFFER_LEN + DIRECT_BLOCK_LEN) != 0) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Drop O_APPEND, since blocks are written at known offsets
+     */
+    
+    struct stat log_stat;
+    
+    int flags = fcntl(log_fd, F_GETFL);
+    
+    if (flags < 0 || fstat(log_fd, &log_stat) != 0 ||
+        fcntl(log_fd, F_SETFL, (flags & ~O_APPEND) | O_DIRECT) != 0) {
+        
+        free(p_direct_buffer);
+        
+        p_direct_buffer = NULL;
+        
+        return -1;
+    }
+    
+    direct_saved_flags = flags;
+    
+    direct_offset = (uint64_t)log_stat.st_size &
+                        ~(uint64_t)(DIRECT_BLOCK_LEN - 1);
+    
+    direct_len = (size_t)((uint64_t)log_stat.st_size - direct_offset);
+    
+    direct_written_len = direct_len;
+    
+    /*
+     *  Read last partial block, through a new FD since the log file is
+     *  open for writing only
+     */
+    
+    if (direct_len > 0) {
+        
+        char fd_spec[32];
+        
+        snprintf(fd_spec, sizeof(fd_spec), "/proc/self/fd/%d", log_fd);
+        
+        int read_fd = open(fd_spec, O_RDONLY | O_CLOEXEC);
+        
+        ssize_t n_read = read_fd < 0 ? -1 : pread(read_fd,
+                                                  p_direct_buffer,
+                                                  direct_len,
+                                                  (off_t)direct_offset);
+        
+        if (read_fd >= 0) {
+            
+            close(read_fd);
+        }
+        
+        if (n_read != (ssize_t)direct_len) {
+            
+            fcntl(log_fd, F_SETFL, flags);
+            
+            free(p_direct_buffer);
+            
+            p_direct_buffer = NULL;
+            
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    stop_direct() - Restore the flags of the log file FD, and free the
+                    staging buffer, before any entry has been staged
+
+*******************************************************************************/
+
+static void stop_direct(void) {
+    
+    fcntl(log_fd, F_SETFL, direct_saved_flags);
+    
+    free(p_direct_buffer);
+    
+    p_direct_buffer = NULL;
+    
+    direct_offset = 0;
+    
+    direct_len = 0;
+    
+    direct_written_len = 0;
+}
+
+/*******************************************************************************
+
+    run_sync() - Write out O_DIRECT staging buffer and sync log file, every
+                 sync interval or sync_interval_bytes
+
+*******************************************************************************/
+
+static void* run_sync(void* p_arg) {
+    
+    for (;;) {
+        
+        /*
+         *  Wait for interval to elapse, or enough bytes to be written
+         */
+        
+        pthread_mutex_lock(&sync_mutex);
+        
+        if (sync_interval_bytes == 0 ||
+            __atomic_load_n(&num_unsynced_bytes, __ATOMIC_RELAXED) <
+                sync_interval_bytes) {
+            
+            struct timespec timeout;
+            
+            clock_gettime(CLOCK_REALTIME, &timeout);
+            
+            uint64_t timeout_ns = timeout.tv_nsec + sync_interval_ns;
+            
+            timeout.tv_sec += timeout_ns / 1000000000;
+            
+            timeout.tv_nsec = timeout_ns % 1000000000;
+            
+            pthread_cond_timedwait(&sync_cond, &sync_mutex, &timeout);
+        }
+        
+        pthread_mutex_unlock(&sync_mutex);
+        
+        if (__atomic_exchange_n(&num_unsynced_bytes, 0,
+                                __ATOMIC_RELAXED) == 0) {
+            
+            continue;
+        }
+        
+        /*
+         *  Write out and sync
+         */
+        
+        if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+            
+            lock_direct(0);
+            
+            write_direct();
+            
+            unlock_direct();
+        }
+        
+        if (logmsg_durability & LOGMSG_DURABILITY_GROUP_SYNC) {
+            
+            sync_log(&stats.group_syncs);
+        }
+    }
+    
+    return NULL;
+}
+
+/*******************************************************************************
+
+    flush_at_exit() - Write out O_DIRECT staging buffer when the process
+                      exits
+
+*******************************************************************************/
+
+static void flush_at_exit(void) {
+    
+    logmsg_direct_flush();
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_direct_write() - Append entries to the log file in O_DIRECT mode
+    
+    Description
+    ===========
+    
+    Entries are copied to the staging buffer, which is written out when
+    the next entry would not fit, and otherwise by the sync thread, or 
+    logmsg_flush(). With signal_safe set, it is written out at once, and 
+    the entries dropped if the buffer is in use by the interrupted thread.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+int logmsg_direct_write(const struct iovec* p_entries,
+                        int num_entries,
+                        int signal_safe) {
+    
+    if (lock_direct(signal_safe) != 0) {
+        
+        return -1;
+    }
+    
+    int status = 0;
+    
+    for (int i = 0; i < num_entries; i++) {
+        
+        const char* p_entry = (const char*)p_entries[i].iov_base;
+        
+        size_t entry_len = p_entries[i].iov_len;
+        
+        /*
+         *  Write out entries before one which would not fit, so that only
+         *  entries longer than the buffer are written in parts, between 
+         *  which a child process might append
+         */
+        
+        if (direct_len + entry_len > DIRECT_BUFFER_LEN &&
+            direct_len > direct_written_len &&
+            write_direct() != 0) {
+            
+            direct_len = direct_written_len;
+            
+            status = -1;
+        }
+        
+        while (entry_len > 0) {
+            
+            size_t len = DIRECT_BUFFER_LEN - direct_len;
+            
+            if (len > entry_len) {
+                
+                len = entry_len;
+            }
+            
+            memcpy(p_direct_buffer + direct_len, p_entry, len);
+            
+            direct_len += len;
+            
+            p_entry += len;
+            
+            entry_len -= len;
+            
+            if (direct_len == DIRECT_BUFFER_LEN && write_direct() != 0) {
+                
+                direct_len = direct_written_len;
+                
+                status = -1;
+            }
+        }
+    }
+    
+    if (signal_safe && write_direct() != 0) {
+        
+        direct_len = direct_written_len;
+        
+        status = -1;
+    }
+    
+    unlock_direct();
+    
+    return status;
+}
+
+/*******************************************************************************
+
+    logmsg_direct_flush() - Write out O_DIRECT staging buffer, if in use
+
+*******************************************************************************/
+
+void logmsg_direct_flush(void) {
+    
+    if (!(logmsg_durability & LOGMSG_DURABILITY_DIRECT)) {
+        
+        return;
+    }
+    
+    lock_direct(0);
+    
+    write_direct();
+    
+    unlock_direct();
+}
+
+/*******************************************************************************
+
+    logmsg_durable_flush() - Write out O_DIRECT staging buffer, and sync log
+                             file, if any durability mode is set
+    
+    Description
+    ===========
+    
+    Used to complete asynchronous flushes, so that entries are durable, not
+    merely written, when the caller is signalled.
+
+*******************************************************************************/
+
+void logmsg_durable_flush(void) {
+    
+    if (logmsg_durability == LOGMSG_DURABILITY_NONE) {
+        
+        return;
+    }
+    
+    logmsg_direct_flush();
+    
+    sync_log(&stats.flush_syncs);
+}
+
+/*******************************************************************************
+
+    logmsg_shared_write() - Append entries to a log file written in O_DIRECT
+                            mode by a parent process
+    
+    Description
+    ===========
+    
+    A shared lock is held while appending, so that the parent, which takes
+    an exclusive lock to write its last blocks, sees the entries and keeps 
+    them. Uses only async-signal-safe functions.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+int logmsg_shared_write(const struct iovec* p_entries, int num_entries) {
+    
+    flock(log_fd, LOCK_SH);
+    
+    int status = logmsg_write_entries(log_fd, 0, p_entries, num_entries);
+    
+    flock(log_fd, LOCK_UN);
+    
+    return status;
+}
+
+/*******************************************************************************
+
+    logmsg_sync_after_write() - Account for entries written to the log file,
+                                syncing if need be
+    
+    Description
+    ===========
+    
+    With LOGMSG_DURABILITY_SYNC_ERRORS, the log file is synced at once if
+    any of the entries is an ERROR or FATAL entry. Otherwise, the sync
+    thread is woken if sync_interval_bytes have been written.
+
+*******************************************************************************/
+
+void logmsg_sync_after_write(const LOGMSG_LEVEL* p_levels,
+                             const struct iovec* p_entries,
+                             int num_entries) {
+    
+    int is_error = 0;
+    
+    size_t len = 0;
+    
+    for (int i = 0; i < num_entries; i++) {
+        
+        is_error |= p_levels[i] <= LOGMSG_LEVEL_ERROR;
+        
+        len += p_entries[i].iov_len;
+    }
+    
+    if (is_error && (logmsg_durability & LOGMSG_DURABILITY_SYNC_ERRORS)) {
+        
+        logmsg_direct_flush();
+        
+        sync_log(&stats.error_syncs);
+        
+        return;
+    }
+    
+    uint64_t num_bytes =
+        __atomic_add_fetch(&num_unsynced_bytes, len, __ATOMIC_RELAXED);
+    
+    if (sync_interval_bytes != 0 &&
+        num_bytes >= sync_interval_bytes &&
+        num_bytes - len < sync_interval_bytes) {
+        
+        pthread_mutex_lock(&sync_mutex);
+        
+        pthread_cond_signal(&sync_cond);
+        
+        pthread_mutex_unlock(&sync_mutex);
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_durability_prepare_fork() - Write out the O_DIRECT staging
+                                       buffer, and hold the durability
+                                       locks across fork()
+
+*******************************************************************************/
+
+void logmsg_durability_prepare_fork(void) {
+    
+    pthread_mutex_lock(&sync_mutex);
+    
+    lock_direct(0);
+    
+    if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+        
+        write_direct();
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_durability_after_fork_parent() - Release the locks held across
+                                            fork()
+
+*******************************************************************************/
+
+void logmsg_durability_after_fork_parent(void) {
+    
+    if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+        
+        direct_forked = 1;
+    }
+    
+    unlock_direct();
+    
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+/*******************************************************************************
+
+    logmsg_durability_after_fork_child() - Release the locks held across
+                                           fork(), and leave syncing to the
+                                           parent
+    
+    Description
+    ===========
+    
+    The sync thread is not restarted, since the parent syncs the same file,
+    and O_DIRECT staging is dropped, since the parent alone may rewrite the
+    last block of the file. LOGMSG_DURABILITY_SYNC_ERRORS is kept.
+    
+    The log file description, shared with the parent, is in O_DIRECT mode
+    and not O_APPEND, so the file is reopened in its place for appending 
+    through logmsg_shared_write().
+
+*******************************************************************************/
+
+void logmsg_durability_after_fork_child(void) {
+    
+    if (logmsg_durability & LOGMSG_DURABILITY_DIRECT) {
+        
+        char fd_spec[32];
+        
+        snprintf(fd_spec, sizeof(fd_spec), "/proc/self/fd/%d", log_fd);
+        
+        int fd = open(fd_spec, O_WRONLY | O_APPEND | O_CLOEXEC);
+        
+        if (fd < 0 || dup3(fd, log_fd, O_CLOEXEC) < 0) {
+            
+            num_sync_failures++;
+        }
+        
+        if (fd >= 0) {
+            
+            close(fd);
+        }
+        
+        free(p_direct_buffer);
+        
+        p_direct_buffer = NULL;
+        
+        direct_forked = 0;
+        
+        logmsg_direct_shared = 1;
+    }
+    
+    logmsg_durability &= LOGMSG_DURABILITY_SYNC_ERRORS;
+    
+    sync_interval_bytes = 0;
+    
+    num_unsynced_bytes = 0;
+    
+    pthread_cond_init(&sync_cond, NULL);
+    
+    unlock_direct();
+    
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_set_durability() - Select when the log file is synced to storage
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_set_durability(int modes,
+                          uint64_t interval_ms,
+                          uint64_t interval_bytes) {
+    
+    /*
+     *  Check for an unsharded log file, and modes not already set
+     */
+    
+    int fd = logmsg_get_logger_fd();
+    
+    struct stat log_stat;
+    
+    if (logmsg_durability != LOGMSG_DURABILITY_NONE || fd < 0 ||
+        logmsg_sharding != LOGMSG_SHARDING_NONE ||
+        fstat(fd, &log_stat) != 0 || !S_ISREG(log_stat.st_mode) ||
+        (modes & ~(LOGMSG_DURABILITY_GROUP_SYNC |
+                   LOGMSG_DURABILITY_SYNC_ERRORS |
+                   LOGMSG_DURABILITY_DIRECT)) != 0) {
+        
+        return -1;
+    }
+    
+    log_fd = fd;
+    
+    sync_interval_ns =
+        (interval_ms != 0 ? interval_ms : DEFAULT_SYNC_INTERVAL_MS) * 1000000;
+    
+    sync_interval_bytes = interval_bytes;
+    
+    if ((modes & LOGMSG_DURABILITY_DIRECT) && start_direct() != 0) {
+        
+        log_fd = -1;
+        
+        sync_interval_ns = 0;
+        
+        sync_interval_bytes = 0;
+        
+        return -1;
+    }
+    
+    /*
+     *  Start sync thread if syncing or staging periodically, undoing the 
+     *  switch to O_DIRECT on failure
+     */
+    
+    if ((modes & (LOGMSG_DURABILITY_GROUP_SYNC | LOGMSG_DURABILITY_DIRECT)) &&
+        pthread_create(&sync_thread, NULL, run_sync, NULL) != 0) {
+        
+        if (modes & LOGMSG_DURABILITY_DIRECT) {
+            
+            stop_direct();
+        }
+        
+        log_fd = -1;
+        
+        sync_interval_ns = 0;
+        
+        sync_interval_bytes = 0;
+        
+        return -1;
+    }
+    
+    __atomic_store_n(&logmsg_durability, modes, __ATOMIC_RELEASE);
+    
+    if (modes & LOGMSG_DURABILITY_DIRECT) {
+        
+        atexit(flush_at_exit);
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_get_durability_stats() - Get sync and O_DIRECT write latencies
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_get_durability_stats(LOGMSG_DURABILITY_STATS* p_stats) {
+    
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    
+    *p_stats = stats;
+}
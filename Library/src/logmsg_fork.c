@@ -0,0 +1,141 @@
+/*******************************************************************************
+
+    logmsg_fork.c - Fork safety of the writer thread and buffers
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    prepare_fork() - Quiesce the library before fork()
+    
+    Description
+    ===========
+    
+    Entries queued so far are delivered, and the O_DIRECT staging buffer
+    written out, and then the locks of the library are held, so that the
+    child sees no state partly updated by another thread.
+
+*******************************************************************************/
+
+static void prepare_fork(void) {
+    
+    logmsg_sink_prepare_fork();
+    
+    logmsg_durability_prepare_fork();
+}
+
+/*******************************************************************************
+
+    after_fork_parent() - Release the locks held across fork(), in the 
+                          parent
+
+*******************************************************************************/
+
+static void after_fork_parent(void) {
+    
+    logmsg_durability_after_fork_parent();
+    
+    logmsg_sink_after_fork_parent();
+}
+
+/*******************************************************************************
+
+    after_fork_child() - Release the locks held across fork(), and set up
+                         the child's own threads and buffers
+    
+    Description
+    ===========
+    
+    Only the thread which called fork() exists in the child. The writer
+    thread is restarted, and the entries, events and counts of the parent
+    are dropped, so that none is written twice. The process and thread 
+    IDs of entries are refreshed by the layout's own handler. A sharded log
+    file is switched to the child's shard files before the writer thread
+    is restarted.
+
+*******************************************************************************/
+
+static void after_fork_child(void) {
+    
+    logmsg_durability_after_fork_child();
+    
+    logmsg_shard_after_fork_child();
+    
+    logmsg_sink_after_fork_child();
+    
+    logmsg_recorder_after_fork_child();
+    
+    logmsg_span_after_fork_child();
+    
+    logmsg_site_after_fork_child();
+}
+
+/*******************************************************************************
+
+    init_fork() - Register fork handlers when library is loaded
+
+*******************************************************************************/
+
+__attribute__((constructor))
+static void init_fork(void) {
+    
+    pthread_atfork(prepare_fork, after_fork_parent, after_fork_child);
+}
@@ -0,0 +1,2075 @@
+/*******************************************************************************
+
+    logmsg_format.c - printf style formatting without vsnprintf() for the
+                      common conversions
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+    
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <stddef.h>
+
+#include <limits.h>
+
+#include <sys/types.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+    
+*******************************************************************************/
+
+// Conversion flags
+
+#define FLAG_LEFT  0x01
+
+#define FLAG_ZERO  0x02
+
+#define FLAG_PLUS  0x04
+
+#define FLAG_SPACE 0x08
+
+#define FLAG_ALT   0x10
+
+// Largest precision of %f converted without snprintf(), such that the 
+// scaled significand of a double fits in 128 bits
+
+#define FIXED_MAX_PRECISION 22
+
+// Digit pairs "00" to "99"
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+static const uint64_t powers_of_10[] = {
+
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL, 
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/*******************************************************************************
+
+    OUTPUT - Destination of formatted text, which counts but discards text
+             beyond the end of the buffer, as vsnprintf() does
+    
+*******************************************************************************/
+
+typedef struct OUTPUT {
+
+    char*  p_write;
+    
+    char*  p_end;               // Excludes space for terminal NULL
+    
+    size_t len;                 // Length of whole text
+    
+    int    signal_safe;         // Use only async-signal-safe functions
+    
+} OUTPUT;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    put(), put_fill() - Append text to output
+    
+*******************************************************************************/
+
+static inline void put(OUTPUT* p_output, const char* p_text, size_t len) {
+
+    size_t space = p_output->p_end - p_output->p_write;
+    
+    size_t copy_len = len < space ? len : space;
+    
+    if (copy_len > 0) {
+    
+        memcpy(p_output->p_write, p_text, copy_len);
+    
+        p_output->p_write += copy_len;
+    }
+    
+    p_output->len += len;
+}
+
+static inline void put_fill(OUTPUT* p_output, char c, size_t len) {
+
+    size_t space = p_output->p_end - p_output->p_write;
+    
+    size_t fill_len = len < space ? len : space;
+    
+    if (fill_len > 0) {
+    
+        memset(p_output->p_write, c, fill_len);
+    
+        p_output->p_write += fill_len;
+    }
+    
+    p_output->len += len;
+}
+
+/*******************************************************************************
+
+    put_field() - Append prefix (sign or radix) and body of a conversion,
+                  padded to width, with zeros between prefix and body if
+                  zero_pad is set and otherwise with spaces
+    
+*******************************************************************************/
+
+static void put_field(OUTPUT* p_output,
+                      int flags,
+                      int width,
+                      const char* p_prefix,
+                      size_t prefix_len,
+                      const char* p_body,
+                      size_t body_len,
+                      int zero_pad) {
+
+    size_t len = prefix_len + body_len;
+    
+    size_t pad_len = width > 0 && (size_t)width > len ? width - len : 0;
+    
+    if (pad_len > 0 && !(flags & FLAG_LEFT) && !zero_pad) {
+    
+        put_fill(p_output, ' ', pad_len);
+    }
+    
+    put(p_output, p_prefix, prefix_len);
+    
+    if (pad_len > 0 && !(flags & FLAG_LEFT) && zero_pad) {
+    
+        put_fill(p_output, '0', pad_len);
+    }
+    
+    put(p_output, p_body, body_len);
+    
+    if (pad_len > 0 && (flags & FLAG_LEFT)) {
+    
+        put_fill(p_output, ' ', pad_len);
+    }
+}
+
+/*******************************************************************************
+
+    u64_backwards() - Write decimal digits of value, two at a time, ending 
+                      at p_end
+    
+    Return pointer to the first digit.
+    
+*******************************************************************************/
+
+static inline char* u64_backwards(char* p_end, uint64_t value) {
+
+    char* p = p_end;
+    
+    while (value >= 100) {
+    
+        unsigned pair = (unsigned)(value % 100);
+        
+        value /= 100;
+        
+        p -= 2;
+        
+        memcpy(p, &digit_pairs[2 * pair], 2);
+    }
+    
+    if (value >= 10) {
+    
+        p -= 2;
+        
+        memcpy(p, &digit_pairs[2 * value], 2);
+        
+    } else {
+    
+        *--p = (char)('0' + value);
+    }
+    
+    return p;
+}
+
+/*******************************************************************************
+
+    u128_backwards() - Write decimal digits of value ending at p_end, in
+                       blocks of 19 digits
+    
+    Return pointer to the first digit.
+    
+*******************************************************************************/
+
+static char* u128_backwards(char* p_end, unsigned __int128 value) {
+
+    const uint64_t block = powers_of_10[19];
+    
+    char* p = p_end;
+    
+    while (value > UINT64_MAX) {
+    
+        uint64_t low = (uint64_t)(value % block);
+        
+        value /= block;
+        
+        char* p_block = p - 19;
+        
+        char* p_digits = u64_backwards(p, low);
+        
+        memset(p_block, '0', p_digits - p_block);
+        
+        p = p_block;
+    }
+    
+    return u64_backwards(p, (uint64_t)value);
+}
+
+/*******************************************************************************
+
+    radix_backwards() - Write hexadecimal or octal digits of value ending at 
+                      p_end
+    
+    Return pointer to the first digit.
+    
+*******************************************************************************/
+
+static inline char* radix_backwards(char* p_end, 
+                                    uint64_t value, 
+                                    unsigned shift,
+                                    const char* p_digits) {
+
+    char* p = p_end;
+    
+    uint64_t mask = (1U << shift) - 1;
+    
+    do {
+    
+        *--p = p_digits[value & mask];
+        
+        value >>= shift;
+        
+    } while (value != 0);
+    
+    return p;
+}
+
+/*******************************************************************************
+
+    put_integer() - Append d, i, u, x, X or o conversion
+    
+*******************************************************************************/
+
+static void put_integer(OUTPUT* p_output,
+                        char conv,
+                        int flags,
+                        int width,
+                        int precision,
+                        uint64_t magnitude,
+                        int negative) {
+
+    char prefix[2];
+    
+    size_t prefix_len = 0;
+    
+    /*
+     *  Digits are written backwards into body, leaving room for precision
+     */
+     
+    char body[32 + 512];
+    
+    char* p_end = body + sizeof(body);
+    
+    char* p_digits = p_end;
+    
+    if (precision > 512) {
+    
+        precision = 512;
+    }
+    
+    if (!(precision == 0 && magnitude == 0)) {
+    
+        switch (conv) {
+        
+        case 'x':
+        
+            p_digits = radix_backwards(p_end, magnitude, 4, "0123456789abcdef");
+            
+            break;
+            
+        case 'X':
+        
+            p_digits = radix_backwards(p_end, magnitude, 4, "0123456789ABCDEF");
+            
+            break;
+            
+        case 'o':
+        
+            p_digits = radix_backwards(p_end, magnitude, 3, "01234567");
+            
+            break;
+            
+        default:
+        
+            p_digits = u64_backwards(p_end, magnitude);
+            
+            break;
+        }
+    }
+    
+    while (p_end - p_digits < precision) {
+    
+        *--p_digits = '0';
+    }
+    
+    /*
+     *  Sign or radix prefix
+     */
+     
+    if (conv == 'd' || conv == 'i') {
+    
+        if (negative) {
+        
+            prefix[prefix_len++] = '-';
+            
+        } else if (flags & FLAG_PLUS) {
+        
+            prefix[prefix_len++] = '+';
+            
+        } else if (flags & FLAG_SPACE) {
+        
+            prefix[prefix_len++] = ' ';
+        }
+        
+    } else if (flags & FLAG_ALT) {
+    
+        if ((conv == 'x' || conv == 'X') && magnitude != 0) {
+        
+            prefix[prefix_len++] = '0';
+            
+            prefix[prefix_len++] = conv;
+            
+        } else if (conv == 'o' && (p_digits == p_end || *p_digits != '0')) {
+        
+            *--p_digits = '0';
+        }
+    }
+    
+    put_field(p_output, flags, width, prefix, prefix_len, 
+              p_digits, p_end - p_digits,
+              (flags & FLAG_ZERO) && precision < 0);
+}
+
+/*******************************************************************************
+
+    put_fixed() - Append f or F conversion
+    
+    Description
+    ===========
+    
+    A finite double is m * 2^e for integer m < 2^53. If e >= 0 the value is
+    an integer, converted exactly in 128 bits when e <= 74. Otherwise the 
+    value scaled by 10^precision is m * 10^precision / 2^-e, whose numera-
+    tor fits in 128 bits for precision <= 22; it is rounded to the nearest
+    integer, ties to even, as glibc does in the default rounding mode.
+    
+    Other values, which are rare in log messages, are converted by 
+    snprintf().
+    
+*******************************************************************************/
+
+static void put_fixed(OUTPUT* p_output,
+                      char conv,
+                      int flags,
+                      int width,
+                      int precision,
+                      double value) {
+
+    if (precision < 0) {
+    
+        precision = 6;
+    }
+    
+    uint64_t bits;
+    
+    memcpy(&bits, &value, sizeof(bits));
+    
+    int negative = (int)(bits >> 63);
+    
+    int biased_exponent = (int)((bits >> 52) & 0x7FF);
+    
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+    
+    char prefix[1];
+    
+    size_t prefix_len = 0;
+    
+    if (negative) {
+    
+        prefix[prefix_len++] = '-';
+        
+    } else if (flags & FLAG_PLUS) {
+    
+        prefix[prefix_len++] = '+';
+        
+    } else if (flags & FLAG_SPACE) {
+    
+        prefix[prefix_len++] = ' ';
+    }
+    
+    /*
+     *  Infinity and NaN, which are never zero padded
+     */
+     
+    if (biased_exponent == 0x7FF) {
+    
+        const char* p_body = 
+            mantissa != 0 ? (conv == 'F' ? "NAN" : "nan")
+                          : (conv == 'F' ? "INF" : "inf");
+                          
+        put_field(p_output, flags, width, prefix, prefix_len, p_body, 3, 0);
+        
+        return;
+    }
+    
+    /*
+     *  Decompose value as m * 2^e
+     */
+     
+    int exponent = biased_exponent == 0 ? -1074 : biased_exponent - 1075;
+    
+    if (biased_exponent != 0) {
+    
+        mantissa |= 1ULL << 52;
+    }
+    
+    /*
+     *  Scaled value, as integer and fraction digits
+     */
+     
+    char body[64 + FIXED_MAX_PRECISION];
+    
+    char* p_end = body + sizeof(body);
+    
+    char* p_digits = NULL;
+    
+    int fraction_zeros = 0;     // Zeros appended to digits
+    
+    if (mantissa == 0) {
+    
+        p_digits = p_end - 1;
+        
+        *p_digits = '0';
+        
+        fraction_zeros = precision;
+        
+    } else if (exponent >= 0 && exponent <= 74) {
+    
+        p_digits = u128_backwards(p_end, (unsigned __int128)mantissa << exponent);
+        
+        fraction_zeros = precision;
+        
+    } else if (exponent < 0 && precision <= FIXED_MAX_PRECISION) {
+    
+        unsigned __int128 numerator = (unsigned __int128)mantissa * 
+                                          powers_of_10[precision > 19 ? 19 
+                                                                     : precision];
+        
+        if (precision > 19) {
+        
+            numerator *= powers_of_10[precision - 19];
+        }
+        
+        unsigned shift = -exponent;
+        
+        unsigned __int128 scaled = 0;
+        
+        if (shift < 128) {
+        
+            scaled = numerator >> shift;
+            
+            unsigned __int128 remainder = 
+                numerator & (((unsigned __int128)1 << shift) - 1);
+            
+            unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+            
+            if (remainder > half || (remainder == half && (scaled & 1))) {
+            
+                scaled++;
+            }
+        }
+        
+        p_digits = u128_backwards(p_end, scaled);
+        
+        /*
+         *  Ensure an integer digit precedes the fraction digits
+         */
+         
+        while (p_end - p_digits < precision + 1) {
+        
+            *--p_digits = '0';
+        }
+        
+    } else if (p_output->signal_safe) {
+    
+        /*
+         *  Out of range of the above, where snprintf() may not be used - 
+         *  write shortest text which reads back as value instead
+         */
+         
+        char shortest[LOGMSG_DOUBLE_TEXT_MAX_LEN];
+        
+        char* p_shortest_end = logmsg_format_double(shortest, 
+                                                    negative ? -value : value);
+        
+        put_field(p_output, flags, width, prefix, prefix_len, 
+                  shortest, p_shortest_end - shortest, 0);
+        
+        return;
+        
+    } else {
+    
+        /*
+         *  Out of range of the above - use snprintf()
+         */
+         
+        char fallback_format[] = { '%', '#', '*', '.', '*', conv, 0 };
+        
+        char fallback_buf[512];
+        
+        char* p_fallback = fallback_buf;
+        
+        if (!(flags & FLAG_ALT)) {
+        
+            memmove(fallback_format + 1, fallback_format + 2, 5);
+        }
+        
+        int body_len = snprintf(p_fallback, sizeof(fallback_buf), 
+                                fallback_format, 0, precision, 
+                                negative ? -value : value);
+        
+        if (body_len >= (int)sizeof(fallback_buf)) {
+        
+            p_fallback = (char*)malloc(body_len + 1);
+            
+            if (p_fallback == NULL) {
+            
+                return;
+            }
+            
+            snprintf(p_fallback, body_len + 1, fallback_format, 0, precision, 
+                     negative ? -value : value);
+        }
+        
+        if (body_len >= 0) {
+        
+            put_field(p_output, flags, width, prefix, prefix_len, 
+                      p_fallback, body_len, (flags & FLAG_ZERO) != 0);
+        }
+        
+        if (p_fallback != fallback_buf) {
+        
+            free(p_fallback);
+        }
+        
+        return;
+    }
+    
+    /*
+     *  Assemble integer digits, point and fraction digits
+     */
+     
+    size_t num_digits = p_end - p_digits;
+    
+    size_t integer_len = num_digits - (fraction_zeros ? 0 : precision);
+    
+    size_t fraction_len = precision;
+    
+    int point = precision > 0 || (flags & FLAG_ALT);
+    
+    size_t len = prefix_len + integer_len + point + fraction_len;
+    
+    size_t pad_len = width > 0 && (size_t)width > len ? width - len : 0;
+    
+    if (pad_len > 0 && !(flags & (FLAG_LEFT | FLAG_ZERO))) {
+    
+        put_fill(p_output, ' ', pad_len);
+    }
+    
+    put(p_output, prefix, prefix_len);
+    
+    if (pad_len > 0 && (flags & FLAG_ZERO) && !(flags & FLAG_LEFT)) {
+    
+        put_fill(p_output, '0', pad_len);
+    }
+    
+    put(p_output, p_digits, integer_len);
+    
+    if (point) {
+    
+        put(p_output, ".", 1);
+    }
+    
+    if (fraction_zeros) {
+    
+        put_fill(p_output, '0', fraction_zeros);
+        
+    } else {
+    
+        put(p_output, p_digits + integer_len, fraction_len);
+    }
+    
+    if (pad_len > 0 && (flags & FLAG_LEFT)) {
+    
+        put_fill(p_output, ' ', pad_len);
+    }
+}
+
+/*******************************************************************************
+
+    DIY_FP - Floating point number f * 2^e with 64-bit significand, for the
+             Grisu2 shortest conversion of doubles
+             
+    Description
+    ===========
+    
+    See F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+    with Integers", PLDI 2010.
+    
+*******************************************************************************/
+
+typedef struct DIY_FP {
+
+    uint64_t f;
+    
+    int      e;
+    
+} DIY_FP;
+
+// Normalized 10^k for k = -348, -340, ..., 340, rounded to nearest
+
+static const uint64_t cached_powers_f[] = {
+
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t cached_powers_e[] = {
+
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static inline DIY_FP diy_fp_multiply(DIY_FP x, DIY_FP y) {
+
+    unsigned __int128 product = (unsigned __int128)x.f * y.f;
+    
+    DIY_FP result;
+    
+    result.f = (uint64_t)(product >> 64) + (((uint64_t)product >> 63) & 1);
+    
+    result.e = x.e + y.e + 64;
+    
+    return result;
+}
+
+static inline DIY_FP diy_fp_normalize(DIY_FP x) {
+
+    int shift = __builtin_clzll(x.f);
+    
+    x.f <<= shift;
+    
+    x.e -= shift;
+    
+    return x;
+}
+
+/*******************************************************************************
+
+    grisu_round() - Adjust last digit towards the exact value
+    
+*******************************************************************************/
+
+static inline void grisu_round(char* p_digits,
+                               int len,
+                               uint64_t delta,
+                               uint64_t rest,
+                               uint64_t ten_kappa,
+                               uint64_t wp_w) {
+
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || 
+            wp_w - rest > rest + ten_kappa - wp_w)) {
+            
+        p_digits[len - 1]--;
+        
+        rest += ten_kappa;
+    }
+}
+
+/*******************************************************************************
+
+    grisu2() - Convert positive finite value to shortest (in practice) di-
+               gits which read back as value
+               
+    Return number of digits written to p_digits; the value is the digits
+    times 10^*p_k.
+    
+*******************************************************************************/
+
+static int grisu2(double value, char* p_digits, int* p_k) {
+
+    /*
+     *  Value and its rounding boundaries, normalized to the same exponent
+     */
+     
+    uint64_t bits;
+    
+    memcpy(&bits, &value, sizeof(bits));
+    
+    int biased_exponent = (int)((bits >> 52) & 0x7FF);
+    
+    DIY_FP v;
+    
+    v.f = bits & ((1ULL << 52) - 1);
+    
+    if (biased_exponent != 0) {
+    
+        v.f |= 1ULL << 52;
+        
+        v.e = biased_exponent - 1075;
+        
+    } else {
+    
+        v.e = -1074;
+    }
+    
+    DIY_FP plus = { (v.f << 1) + 1, v.e - 1 };
+    
+    plus = diy_fp_normalize(plus);
+    
+    DIY_FP minus;
+    
+    if (v.f == (1ULL << 52)) {
+    
+        minus.f = (v.f << 2) - 1;
+        
+        minus.e = v.e - 2;
+        
+    } else {
+    
+        minus.f = (v.f << 1) - 1;
+        
+        minus.e = v.e - 1;
+    }
+    
+    minus.f <<= minus.e - plus.e;
+    
+    minus.e = plus.e;
+    
+    /*
+     *  Cached power of ten which brings the upper boundary's exponent into
+     *  [-60, -32]
+     */
+     
+    DIY_FP c_mk;
+    
+    {
+        double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+        
+        int k = (int)dk;
+        
+        if (dk - k > 0.0) {
+        
+            k++;
+        }
+        
+        unsigned index = (unsigned)((k >> 3) + 1);
+        
+        *p_k = -(-348 + (int)(index << 3));
+        
+        c_mk.f = cached_powers_f[index];
+        
+        c_mk.e = cached_powers_e[index];
+    }
+    
+    DIY_FP w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    
+    DIY_FP wp = diy_fp_multiply(plus, c_mk);
+    
+    DIY_FP wm = diy_fp_multiply(minus, c_mk);
+    
+    wm.f++;
+    
+    wp.f--;
+    
+    /*
+     *  Generate digits of wp until within delta of it
+     */
+     
+    uint64_t delta = wp.f - wm.f;
+    
+    uint64_t wp_w = wp.f - w.f;
+    
+    int shift = -wp.e;
+    
+    uint64_t one = 1ULL << shift;
+    
+    uint32_t p1 = (uint32_t)(wp.f >> shift);
+    
+    uint64_t p2 = wp.f & (one - 1);
+    
+    int kappa = 1;
+    
+    while (kappa < 10 && p1 >= powers_of_10[kappa]) {
+    
+        kappa++;
+    }
+    
+    int len = 0;
+    
+    while (kappa > 0) {
+    
+        uint32_t divisor = (uint32_t)powers_of_10[kappa - 1];
+        
+        uint32_t d = p1 / divisor;
+        
+        p1 %= divisor;
+        
+        if (d || len) {
+        
+            p_digits[len++] = (char)('0' + d);
+        }
+        
+        kappa--;
+        
+        uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        
+        if (rest <= delta) {
+        
+            *p_k += kappa;
+            
+            grisu_round(p_digits, len, delta, rest, 
+                        powers_of_10[kappa] << shift, wp_w);
+            
+            return len;
+        }
+    }
+    
+    for (;;) {
+    
+        p2 *= 10;
+        
+        delta *= 10;
+        
+        char d = (char)(p2 >> shift);
+        
+        if (d || len) {
+        
+            p_digits[len++] = (char)('0' + d);
+        }
+        
+        p2 &= one - 1;
+        
+        kappa--;
+        
+        if (p2 < delta) {
+        
+            *p_k += kappa;
+            
+            grisu_round(p_digits, len, delta, p2, one, 
+                        -kappa < 10 ? wp_w * powers_of_10[-kappa] : 0);
+            
+            return len;
+        }
+    }
+}
+
+/*******************************************************************************
+
+    SPEC - Conversion specification, following '%' in a format
+    
+*******************************************************************************/
+
+typedef struct SPEC {
+
+    int  flags;
+    
+    int  width;
+    
+    int  width_arg;             // Width is next argument ('*')
+    
+    int  precision;             // -1 if not specified
+    
+    int  precision_arg;         // Precision is next argument ('*')
+    
+    int  size;                  // Number of 'h's (negative) or 'l's
+    
+    char conv;
+    
+} SPEC;
+
+/*******************************************************************************
+
+    parse_spec() - Parse conversion specification following '%'
+    
+    Return pointer to the character following the conversion.
+    
+*******************************************************************************/
+
+static inline const char* parse_spec(const char* p, SPEC* p_spec) {
+
+    /*
+     *  Flags
+     */
+     
+    int flags = 0;
+    
+    for (;; p++) {
+    
+        if (*p == '-') {
+        
+            flags |= FLAG_LEFT;
+            
+        } else if (*p == '0') {
+        
+            flags |= FLAG_ZERO;
+            
+        } else if (*p == '+') {
+        
+            flags |= FLAG_PLUS;
+            
+        } else if (*p == ' ') {
+        
+            flags |= FLAG_SPACE;
+            
+        } else if (*p == '#') {
+        
+            flags |= FLAG_ALT;
+            
+        } else {
+        
+            break;
+        }
+    }
+    
+    p_spec->flags = flags;
+    
+    /*
+     *  Width and precision
+     */
+     
+    p_spec->width = 0;
+    
+    p_spec->width_arg = 0;
+    
+    if (*p == '*') {
+    
+        p_spec->width_arg = 1;
+        
+        p++;
+        
+    } else {
+    
+        while (*p >= '0' && *p <= '9') {
+        
+            p_spec->width = 10 * p_spec->width + (*p++ - '0');
+        }
+    }
+    
+    p_spec->precision = -1;
+    
+    p_spec->precision_arg = 0;
+    
+    if (*p == '.') {
+    
+        p++;
+        
+        p_spec->precision = 0;
+        
+        if (*p == '*') {
+        
+            p_spec->precision_arg = 1;
+            
+            p++;
+            
+        } else {
+        
+            while (*p >= '0' && *p <= '9') {
+            
+                p_spec->precision = 10 * p_spec->precision + (*p++ - '0');
+            }
+        }
+    }
+    
+    /*
+     *  Length modifier
+     */
+     
+    p_spec->size = 0;
+    
+    if (*p == 'h') {
+    
+        p_spec->size = p[1] == 'h' ? -2 : -1;
+        
+        p -= p_spec->size;
+        
+    } else if (*p == 'l') {
+    
+        p_spec->size = p[1] == 'l' ? 2 : 1;
+        
+        p += p_spec->size;
+        
+    } else if (*p == 'z' || *p == 'j' || *p == 't') {
+    
+        p_spec->size = 2;
+        
+        p++;
+    }
+    
+    p_spec->conv = *p;
+    
+    return *p ? p + 1 : p;
+}
+
+/*******************************************************************************
+
+    is_supported() - Determine whether conversion is handled here, rather 
+                     than by vsnprintf()
+    
+*******************************************************************************/
+
+static inline int is_supported(const SPEC* p_spec, size_t spec_len) {
+
+    switch (p_spec->conv) {
+    
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+    
+        return 1;
+        
+    case 'f': case 'F':
+    
+        return p_spec->size == 0 || p_spec->size == 1;
+        
+    case 's': case 'c':
+    
+        return p_spec->size == 0;
+        
+    case '%':
+    
+        return spec_len == 1;
+        
+    default:
+    
+        return 0;
+    }
+}
+
+/*******************************************************************************
+
+    ARGS - Source of the arguments of a format: either a va_list, or values
+           captured by logmsg_capture_args()
+           
+    Description
+    ===========
+    
+    Captured values occupy 8 bytes each, as int64_t, uint64_t or double, 
+    converted as va_arg() would according to the conversion. A string is 
+    captured as its length including the terminal NULL, in 8 bytes, fol-
+    lowed by its characters and NULL, padded to a multiple of 8 bytes.
+    
+*******************************************************************************/
+
+typedef struct ARGS {
+
+    va_list*    p_ap;
+    
+    const char* p_captured;
+    
+} ARGS;
+
+static inline int64_t next_signed(ARGS* p_args, int size) {
+
+    int64_t value;
+    
+    if (p_args->p_ap == NULL) {
+    
+        memcpy(&value, p_args->p_captured, 8);
+        
+        p_args->p_captured += 8;
+        
+        return value;
+    }
+    
+    switch (size) {
+    
+    case -2: value = (signed char)va_arg(*p_args->p_ap, int); break;
+    
+    case -1: value = (short)va_arg(*p_args->p_ap, int);       break;
+    
+    case 0:  value = va_arg(*p_args->p_ap, int);              break;
+    
+    case 1:  value = va_arg(*p_args->p_ap, long);             break;
+    
+    default: value = va_arg(*p_args->p_ap, long long);        break;
+    }
+    
+    return value;
+}
+
+static inline uint64_t next_unsigned(ARGS* p_args, int size) {
+
+    uint64_t value;
+    
+    if (p_args->p_ap == NULL) {
+    
+        memcpy(&value, p_args->p_captured, 8);
+        
+        p_args->p_captured += 8;
+        
+        return value;
+    }
+    
+    switch (size) {
+    
+    case -2: value = (unsigned char)va_arg(*p_args->p_ap, unsigned);  break;
+    
+    case -1: value = (unsigned short)va_arg(*p_args->p_ap, unsigned); break;
+    
+    case 0:  value = va_arg(*p_args->p_ap, unsigned);                 break;
+    
+    case 1:  value = va_arg(*p_args->p_ap, unsigned long);            break;
+    
+    default: value = va_arg(*p_args->p_ap, unsigned long long);       break;
+    }
+    
+    return value;
+}
+
+static inline double next_double(ARGS* p_args) {
+
+    double value;
+    
+    if (p_args->p_ap == NULL) {
+    
+        memcpy(&value, p_args->p_captured, 8);
+        
+        p_args->p_captured += 8;
+        
+        return value;
+    }
+    
+    return va_arg(*p_args->p_ap, double);
+}
+
+static inline const char* next_string(ARGS* p_args) {
+
+    if (p_args->p_ap == NULL) {
+    
+        uint64_t len;
+        
+        memcpy(&len, p_args->p_captured, 8);
+        
+        const char* p_text = len > 0 ? p_args->p_captured + 8 : NULL;
+        
+        p_args->p_captured += 8 + ((len + 7) & ~7ULL);
+        
+        return p_text;
+    }
+    
+    return va_arg(*p_args->p_ap, const char*);
+}
+
+static inline const void* next_pointer(ARGS* p_args) {
+
+    const void* value;
+    
+    if (p_args->p_ap == NULL) {
+    
+        memcpy(&value, p_args->p_captured, sizeof(value));
+        
+        p_args->p_captured += 8;
+        
+        return value;
+    }
+    
+    return va_arg(*p_args->p_ap, const void*);
+}
+
+/*******************************************************************************
+
+    format_args() - Format text to output
+    
+    Description
+    ===========
+    
+    If the output is signal_safe, conversions which would otherwise not be
+    supported are approximated as far as possible instead - see 
+    logmsg_vsnprintf_signal_safe().
+    
+    Return 0 on success, -1 if the format has a conversion which is not
+    supported, in which case the output is incomplete.
+    
+*******************************************************************************/
+
+static int format_args(OUTPUT* p_output, const char* format, ARGS* p_args) {
+
+    const char* p = format;
+    
+    for (;;) {
+    
+        /*
+         *  Copy literal text up to next conversion
+         */
+         
+        const char* p_percent = strchrnul(p, '%');
+        
+        put(p_output, p, p_percent - p);
+        
+        if (*p_percent == 0) {
+        
+            return 0;
+        }
+        
+        SPEC spec;
+        
+        p = parse_spec(p_percent + 1, &spec);
+        
+        if (!is_supported(&spec, p - p_percent - 1)) {
+        
+            if (!p_output->signal_safe) {
+            
+                return -1;
+            }
+            
+            /*
+             *  Where vsnprintf() may not be used, approximate %p and the 
+             *  other double conversions, and otherwise, not knowing the 
+             *  types of the remaining arguments, copy the rest of the 
+             *  format
+             */
+             
+            if (spec.size != 0 || spec.conv == 0 || 
+                strchr("peEgGaA", spec.conv) == NULL) {
+            
+                put(p_output, p_percent, strlen(p_percent));
+                
+                return 0;
+            }
+        }
+        
+        /*
+         *  Width and precision arguments
+         */
+         
+        if (spec.width_arg) {
+        
+            spec.width = (int)next_signed(p_args, 0);
+            
+            if (spec.width < 0) {
+            
+                spec.flags |= FLAG_LEFT;
+                
+                spec.width = spec.width < -INT_MAX ? INT_MAX : -spec.width;
+            }
+        }
+        
+        if (spec.precision_arg) {
+        
+            spec.precision = (int)next_signed(p_args, 0);
+            
+            if (spec.precision < 0) {
+            
+                spec.precision = -1;
+            }
+        }
+        
+        /*
+         *  Conversion
+         */
+         
+        switch (spec.conv) {
+        
+        case 'd':
+        case 'i':
+        
+            {
+                int64_t value = next_signed(p_args, spec.size);
+                
+                uint64_t magnitude = value < 0 ? 0 - (uint64_t)value 
+                                               : (uint64_t)value;
+                
+                put_integer(p_output, spec.conv, spec.flags, spec.width, 
+                            spec.precision, magnitude, value < 0);
+            }
+            
+            break;
+            
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        
+            put_integer(p_output, spec.conv, spec.flags, spec.width, 
+                        spec.precision, next_unsigned(p_args, spec.size), 0);
+            
+            break;
+            
+        case 'f':
+        case 'F':
+        
+            put_fixed(p_output, spec.conv, spec.flags, spec.width, 
+                      spec.precision, next_double(p_args));
+                      
+            break;
+            
+        case 's':
+        
+            {
+                const char* p_text = next_string(p_args);
+                
+                if (p_text == NULL) {
+                
+                    p_text = spec.precision < 0 || spec.precision >= 6 ? 
+                                 "(null)" : "";
+                }
+                
+                size_t text_len = spec.precision < 0 ? 
+                                      strlen(p_text) :
+                                      strnlen(p_text, spec.precision);
+                
+                put_field(p_output, spec.flags, spec.width, "", 0, 
+                          p_text, text_len, 0);
+            }
+            
+            break;
+            
+        case 'c':
+        
+            {
+                char c = (char)next_signed(p_args, 0);
+                
+                put_field(p_output, spec.flags, spec.width, "", 0, &c, 1, 0);
+            }
+            
+            break;
+            
+        case '%':
+        
+            put(p_output, "%", 1);
+            
+            break;
+            
+        case 'p':
+        
+            {
+                const void* p_pointer = next_pointer(p_args);
+                
+                if (p_pointer == NULL) {
+                
+                    put_field(p_output, spec.flags, spec.width, "", 0, 
+                              "(nil)", 5, 0);
+                } else {
+                
+                    put_integer(p_output, 'x', spec.flags | FLAG_ALT, 
+                                spec.width, spec.precision, 
+                                (uintptr_t)p_pointer, 0);
+                }
+            }
+            
+            break;
+            
+        default:
+        
+            {
+                char shortest[LOGMSG_DOUBLE_TEXT_MAX_LEN];
+                
+                char* p_shortest_end = logmsg_format_double(shortest,
+                                                            next_double(p_args));
+                
+                put_field(p_output, spec.flags, spec.width, "", 0, 
+                          shortest, p_shortest_end - shortest, 0);
+            }
+            
+            break;
+        }
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_format_i64() - Write decimal text of value
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+char* logmsg_format_i64(char* p_write, int64_t value) {
+
+    uint64_t magnitude = (uint64_t)value;
+    
+    if (value < 0) {
+    
+        *p_write++ = '-';
+        
+        magnitude = 0 - magnitude;
+    }
+    
+    char digits[20];
+    
+    char* p_digits = u64_backwards(digits + sizeof(digits), magnitude);
+    
+    size_t len = digits + sizeof(digits) - p_digits;
+    
+    memcpy(p_write, p_digits, len);
+    
+    return p_write + len;
+}
+
+/*******************************************************************************
+
+    logmsg_format_double() - Write shortest text which reads back as value
+    
+    Description
+    ===========
+    
+    The notation is that of %g: fixed unless the decimal exponent is less
+    than -4 or at least 17, e.g. 0.1, 100, 1e+300, 2.5e-05. Infinity and NaN
+    are written as inf, -inf and nan.
+    
+    At most LOGMSG_DOUBLE_TEXT_MAX_LEN characters are written.
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+char* logmsg_format_double(char* p_write, double value) {
+
+    uint64_t bits;
+    
+    memcpy(&bits, &value, sizeof(bits));
+    
+    if (bits >> 63) {
+    
+        *p_write++ = '-';
+        
+        bits &= ~(1ULL << 63);
+        
+        memcpy(&value, &bits, sizeof(bits));
+    }
+    
+    if ((bits >> 52) == 0x7FF) {
+    
+        memcpy(p_write, (bits & ((1ULL << 52) - 1)) ? "nan" : "inf", 3);
+        
+        return p_write + 3;
+    }
+    
+    if (bits == 0) {
+    
+        *p_write++ = '0';
+        
+        return p_write;
+    }
+    
+    char digits[20];
+    
+    int k = 0;
+    
+    int len = grisu2(value, digits, &k);
+    
+    int exponent = len + k - 1;     // Decimal exponent of first digit
+    
+    if (exponent >= -4 && exponent < 17) {
+    
+        if (k >= 0) {
+        
+            /*
+             *  Integer: digits then zeros
+             */
+             
+            memcpy(p_write, digits, len);
+            
+            memset(p_write + len, '0', k);
+            
+            p_write += len + k;
+            
+        } else if (len + k > 0) {
+        
+            /*
+             *  Point within digits
+             */
+             
+            memcpy(p_write, digits, len + k);
+            
+            p_write += len + k;
+            
+            *p_write++ = '.';
+            
+            memcpy(p_write, digits + len + k, -k);
+            
+            p_write += -k;
+            
+        } else {
+        
+            /*
+             *  Point and zeros before digits
+             */
+             
+            *p_write++ = '0';
+            
+            *p_write++ = '.';
+            
+            memset(p_write, '0', -(len + k));
+            
+            p_write += -(len + k);
+            
+            memcpy(p_write, digits, len);
+            
+            p_write += len;
+        }
+        
+    } else {
+    
+        *p_write++ = digits[0];
+        
+        if (len > 1) {
+        
+            *p_write++ = '.';
+            
+            memcpy(p_write, digits + 1, len - 1);
+            
+            p_write += len - 1;
+        }
+        
+        *p_write++ = 'e';
+        
+        *p_write++ = exponent < 0 ? '-' : '+';
+        
+        unsigned magnitude = exponent < 0 ? -exponent : exponent;
+        
+        if (magnitude >= 100) {
+        
+            *p_write++ = (char)('0' + magnitude / 100);
+            
+            magnitude %= 100;
+        }
+        
+        memcpy(p_write, &digit_pairs[2 * magnitude], 2);
+        
+        p_write += 2;
+    }
+    
+    return p_write;
+}
+
+/*******************************************************************************
+
+    logmsg_format_utc_time() - Write UTC time in the form used at the start
+                               of each log entry
+                               
+    Description
+    ===========
+    
+    Writes LOGMSG_UTC_TIME_LEN characters, e.g. 2018-09-22-22:08:42-086858743,
+    using only arithmetic, so that it may be called from a signal handler.
+    The calendar conversion is that of H. Hinnant's civil_from_days().
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+char* logmsg_format_utc_time(char* p_write, int64_t utc_time_ns) {
+
+    int64_t secs = utc_time_ns / 1000000000;
+    
+    int64_t nsecs = utc_time_ns % 1000000000;
+    
+    if (nsecs < 0) {
+    
+        secs--;
+        
+        nsecs += 1000000000;
+    }
+    
+    int64_t days = secs / 86400;
+    
+    int64_t day_secs = secs % 86400;
+    
+    if (day_secs < 0) {
+    
+        days--;
+        
+        day_secs += 86400;
+    }
+    
+    /*
+     *  Days since 1970-01-01 to year, month and day
+     */
+     
+    days += 719468;
+    
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    
+    unsigned day_of_era = (unsigned)(days - era * 146097);
+    
+    unsigned year_of_era = (day_of_era - day_of_era / 1460 + 
+                               day_of_era / 36524 - day_of_era / 146096) / 365;
+    
+    unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - 
+                                             year_of_era / 100);
+    
+    unsigned mp = (5 * day_of_year + 2) / 153;
+    
+    unsigned day = day_of_year - (153 * mp + 2) / 5 + 1;
+    
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    
+    int64_t year = (int64_t)year_of_era + era * 400 + (month <= 2);
+    
+    /*
+     *  Write fields
+     */
+     
+    unsigned year_digits = (unsigned)(year < 0 ? 0 : year % 10000);
+    
+    memcpy(p_write, &digit_pairs[2 * (year_digits / 100)], 2);
+    
+    memcpy(p_write + 2, &digit_pairs[2 * (year_digits % 100)], 2);
+    
+    p_write[4] = '-';
+    
+    memcpy(p_write + 5, &digit_pairs[2 * month], 2);
+    
+    p_write[7] = '-';
+    
+    memcpy(p_write + 8, &digit_pairs[2 * day], 2);
+    
+    p_write[10] = '-';
+    
+    memcpy(p_write + 11, &digit_pairs[2 * (day_secs / 3600)], 2);
+    
+    p_write[13] = ':';
+    
+    memcpy(p_write + 14, &digit_pairs[2 * (day_secs / 60 % 60)], 2);
+    
+    p_write[16] = ':';
+    
+    memcpy(p_write + 17, &digit_pairs[2 * (day_secs % 60)], 2);
+    
+    p_write[19] = '-';
+    
+    char* p_nsecs = u64_backwards(p_write + 29, (uint64_t)nsecs);
+    
+    memset(p_write + 20, '0', p_nsecs - (p_write + 20));
+    
+    return p_write + 29;
+}
+
+/*******************************************************************************
+
+    logmsg_vsnprintf_signal_safe() - Format text as vsnprintf(), using only 
+                                     async-signal-safe functions
+                                     
+    Description
+    ===========
+    
+    Conversions d i u x X o c s f F and %% are formatted as by vsnprintf(),
+    except that %f of values of 2^127 or more, or with precision over 22, is
+    written as %g is below. Otherwise:
+    
+        %p              - as %#x, or (nil)
+        
+        %e %E %g %G %a %A 
+                        - shortest text which reads back as the value,
+                          as for structured entries, ignoring precision
+                          
+    Any other conversion, such as %Lf, %ls or %m, and the rest of the for-
+    mat after it, are copied as they are.
+    
+    Return length of whole text.
+    
+*******************************************************************************/
+
+int logmsg_vsnprintf_signal_safe(char* p_buffer,
+                                 size_t buffer_len,
+                                 const char* format,
+                                 va_list ap) {
+
+    OUTPUT output;
+    
+    output.p_write = p_buffer;
+    
+    output.p_end = buffer_len > 0 ? p_buffer + buffer_len - 1 : p_buffer;
+    
+    output.len = 0;
+    
+    output.signal_safe = 1;
+    
+    va_list args_ap;
+    
+    va_copy(args_ap, ap);
+    
+    ARGS args = { &args_ap, NULL };
+    
+    format_args(&output, format, &args);
+    
+    va_end(args_ap);
+    
+    if (buffer_len > 0) {
+    
+        *output.p_write = 0;
+    }
+    
+    return output.len > INT32_MAX ? INT32_MAX : (int)output.len;
+}
+
+/*******************************************************************************
+
+    logmsg_capture_args() - Capture the arguments of a format, for later
+                            formatting by logmsg_format_captured()
+                            
+    Description
+    ===========
+    
+    Strings are copied, truncated to their precision if any.
+    
+    Return the number of bytes captured, or -1 if the format has a conver-
+    sion which is not supported or the buffer is too small.
+    
+*******************************************************************************/
+
+ssize_t logmsg_capture_args(char* p_buffer, 
+                            size_t buffer_len, 
+                            const char* format, 
+                            va_list ap) {
+
+    char* p_write = p_buffer;
+    
+    char* p_end = p_buffer + buffer_len;
+    
+    va_list args_ap;
+    
+    va_copy(args_ap, ap);
+    
+    ARGS args = { &args_ap, NULL };
+    
+    ssize_t status = -1;
+    
+    const char* p = format;
+    
+    for (;;) {
+    
+        const char* p_percent = strchr(p, '%');
+        
+        if (p_percent == NULL) {
+        
+            status = p_write - p_buffer;
+            
+            break;
+        }
+        
+        SPEC spec;
+        
+        p = parse_spec(p_percent + 1, &spec);
+        
+        if (!is_supported(&spec, p - p_percent - 1) || 
+            p_end - p_write < 24) {
+        
+            break;
+        }
+        
+        /*
+         *  Width and precision arguments, then the value
+         */
+         
+        if (spec.width_arg) {
+        
+            int64_t width = next_signed(&args, 0);
+            
+            memcpy(p_write, &width, 8);
+            
+            p_write += 8;
+        }
+        
+        if (spec.precision_arg) {
+        
+            int64_t precision = next_signed(&args, 0);
+            
+            spec.precision = precision < 0 ? -1 : (int)precision;
+            
+            memcpy(p_write, &precision, 8);
+            
+            p_write += 8;
+        }
+        
+        if (spec.conv == 'd' || spec.conv == 'i' || spec.conv == 'c') {
+        
+            int64_t value = next_signed(&args, spec.size);
+            
+            memcpy(p_write, &value, 8);
+            
+            p_write += 8;
+            
+        } else if (spec.conv == 'f' || spec.conv == 'F') {
+        
+            double value = next_double(&args);
+            
+            memcpy(p_write, &value, 8);
+            
+            p_write += 8;
+            
+        } else if (spec.conv == 's') {
+        
+            const char* p_text = next_string(&args);
+            
+            uint64_t len = 0;
+            
+            if (p_text != NULL) {
+            
+                len = (spec.precision < 0 ? 
+                           strlen(p_text) : 
+                           strnlen(p_text, spec.precision)) + 1;
+            }
+            
+            uint64_t padded_len = (len + 7) & ~7ULL;
+            
+            if ((uint64_t)(p_end - p_write) < 8 + padded_len) {
+            
+                break;
+            }
+            
+            memcpy(p_write, &len, 8);
+            
+            if (len > 0) {
+            
+                memcpy(p_write + 8, p_text, len - 1);
+                
+                memset(p_write + 8 + len - 1, 0, padded_len - len + 1);
+            }
+            
+            p_write += 8 + padded_len;
+            
+        } else if (spec.conv != '%') {
+        
+            uint64_t value = next_unsigned(&args, spec.size);
+            
+            memcpy(p_write, &value, 8);
+            
+            p_write += 8;
+        }
+    }
+    
+    va_end(args_ap);
+    
+    return status;
+}
+
+/*******************************************************************************
+
+    logmsg_format_captured() - Format text as vsnprintf(), taking the argu-
+                               ments captured by logmsg_capture_args()
+    
+    Return length of whole text, or -1 on failure.
+    
+*******************************************************************************/
+
+int logmsg_format_captured(char* p_buffer,
+                           size_t buffer_len,
+                           const char* format,
+                           const char* p_captured) {
+
+    OUTPUT output;
+    
+    output.p_write = p_buffer;
+    
+    output.p_end = buffer_len > 0 ? p_buffer + buffer_len - 1 : p_buffer;
+    
+    output.len = 0;
+    
+    output.signal_safe = 1;
+    
+    ARGS args = { NULL, p_captured };
+    
+    int status = format_args(&output, format, &args);
+    
+    if (buffer_len > 0) {
+    
+        *output.p_write = 0;
+    }
+    
+    return status != 0 || output.len > INT32_MAX ? -1 : (int)output.len;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_vsnprintf() - Format text as vsnprintf()
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+int logmsg_vsnprintf(char* p_buffer, 
+                     size_t buffer_len, 
+                     const char* format, 
+                     va_list ap) {
+
+    OUTPUT output;
+    
+    output.p_write = p_buffer;
+    
+    output.p_end = buffer_len > 0 ? p_buffer + buffer_len - 1 : p_buffer;
+    
+    output.len = 0;
+    
+    output.signal_safe = 0;
+    
+    /*
+     *  Walk a copy of the arguments, keeping the original in case of a 
+     *  conversion only vsnprintf() can handle, such as %e, %g, %p, %n, %m,
+     *  %ls or positional arguments
+     */
+     
+    va_list args_ap;
+    
+    va_copy(args_ap, ap);
+    
+    ARGS args = { &args_ap, NULL };
+    
+    int status = format_args(&output, format, &args);
+    
+    va_end(args_ap);
+    
+    if (status != 0) {
+    
+        return vsnprintf(p_buffer, buffer_len, format, ap);
+    }
+    
+    if (buffer_len > 0) {
+    
+        *output.p_write = 0;
+    }
+    
+    return output.len > INT32_MAX ? -1 : (int)output.len;
+}
+
+/*******************************************************************************
+
+    logmsg_snprintf() - Format text as snprintf()
+    
+    See logmsg.h for more details.
+    
+*******************************************************************************/
+
+int logmsg_snprintf(char* p_buffer, size_t buffer_len, const char* format, ...) {
+
+    va_list ap;
+    
+    va_start(ap, format);
+    
+    int len = logmsg_vsnprintf(p_buffer, buffer_len, format, ap);
+    
+    va_end(ap);
+    
+    return len;
+}
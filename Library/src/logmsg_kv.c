@@ -0,0 +1,625 @@
+/*******************************************************************************
+
+    logmsg_kv.c - Rendering of structured log entries
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+    
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <math.h>
+
+#include <logmsg.h>
+
+#include <logmsg_parse.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+    
+*******************************************************************************/
+
+// Longest escaped form of a single character, e.g. \u001f
+
+#define ESCAPE_MAX_LEN 6
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    write_double() - Write shortest text which reads back as value
+    
+    Description
+    ===========
+    
+    JSON has no representation of infinity or NaN, for which null is
+    written in that format.
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+static char* write_double(char* p_write, double value, LOGMSG_KV_FORMAT format) {
+
+    if (!isfinite(value)) {
+    
+        const char* text = 
+            format == LOGMSG_KV_FORMAT_JSON ? "null" :
+                isnan(value) ? "NaN" : value > 0 ? "+Inf" : "-Inf";
+        
+        size_t len = strlen(text);
+        
+        memcpy(p_write, text, len);
+        
+        return p_write + len;
+    }
+    
+    return logmsg_format_double(p_write, value);
+}
+
+/*******************************************************************************
+
+    needs_quotes() - Determine whether a logfmt value must be quoted
+    
+*******************************************************************************/
+
+static int needs_quotes(const char* text) {
+
+    if (*text == 0) {
+    
+        return 1;
+    }
+    
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+    
+        if (*p <= ' ' || *p == '=' || *p == '"' || *p == '\\' || *p == 0x7F) {
+        
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    write_quoted() - Write text in double quotes, escaping quotes, back-
+                     slashes and control characters as in JSON
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+static inline char* write_quoted(char* p_write, const char* text) {
+
+    return logmsg_kv_write_quoted(p_write, text, strlen(text), SIZE_MAX);
+}
+
+/*******************************************************************************
+
+    write_raw() - Write text without escaping
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+static inline char* write_raw(char* p_write, const char* text) {
+
+    size_t len = strlen(text);
+    
+    memcpy(p_write, text, len);
+    
+    return p_write + len;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_kv_write_quoted() - Write len characters of text in double quotes,
+                               escaped as in JSON, as far as fits in max_len
+                               characters
+    
+    Description
+    ===========
+    
+    Quotes, backslashes and control characters are escaped. If the text
+    does not fit, it is truncated, still followed by the closing quote, 
+    unless max_len is less than 2.
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+char* logmsg_kv_write_quoted(char* p_write, 
+                             const char* p_text, 
+                             size_t len, 
+                             size_t max_len) {
+
+    static const char hex_digits[] = "0123456789abcdef";
+    
+    if (max_len < 2) {
+    
+        return p_write;
+    }
+    
+    size_t space = max_len - 2;     // Excluding quotes
+    
+    *p_write++ = '"';
+    
+    for (size_t i = 0; i < len; i++) {
+    
+        unsigned char c = (unsigned char)p_text[i];
+        
+        if (c >= ' ' && c != '"' && c != '\\' && c != 0x7F) {
+        
+            if (space < 1) {
+            
+                break;
+            }
+            
+            *p_write++ = c;
+            
+            space--;
+            
+            continue;
+        }
+        
+        size_t escape_len = 
+            c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t' ? 
+                2 : ESCAPE_MAX_LEN;
+        
+        if (space < escape_len) {
+        
+            break;
+        }
+        
+        space -= escape_len;
+        
+        *p_write++ = '\\';
+        
+        switch (c) {
+        
+        case '"':  *p_write++ = '"';  break;
+        
+        case '\\': *p_write++ = '\\'; break;
+        
+        case '\n': *p_write++ = 'n';  break;
+        
+        case '\r': *p_write++ = 'r';  break;
+        
+        case '\t': *p_write++ = 't';  break;
+        
+        default:
+        
+            *p_write++ = 'u';
+            
+            *p_write++ = '0';
+            
+            *p_write++ = '0';
+            
+            *p_write++ = hex_digits[c >> 4];
+            
+            *p_write++ = hex_digits[c & 0xF];
+            
+            break;
+        }
+    }
+    
+    *p_write++ = '"';
+    
+    return p_write;
+}
+
+/*******************************************************************************
+
+    logmsg_kv_text_max_len() - Return upper bound of the length of the text 
+                               written by logmsg_kv_write_text(), in either
+                               format
+    
+*******************************************************************************/
+
+size_t logmsg_kv_text_max_len(const char* message,
+                              const LOGMSG_KV* p_fields,
+                              size_t num_fields) {
+
+    /*
+     *  Allow for escaping every character of every string, plus quotes
+     *  and separators
+     */
+     
+    size_t max_len = 2 + strlen("\"msg\":") + 
+                         ESCAPE_MAX_LEN * strlen(message) + 2;
+    
+    for (size_t i = 0; i < num_fields; i++) {
+    
+        const LOGMSG_KV* p_kv = &p_fields[i];
+        
+        max_len += 1 + ESCAPE_MAX_LEN * strlen(p_kv->key) + 3;
+        
+        switch (p_kv->type) {
+        
+        case LOGMSG_KV_TYPE_INT:
+        
+            max_len += LOGMSG_INT_TEXT_MAX_LEN;
+            
+            break;
+            
+        case LOGMSG_KV_TYPE_DOUBLE:
+        
+            max_len += LOGMSG_DOUBLE_TEXT_MAX_LEN;
+            
+            break;
+            
+        case LOGMSG_KV_TYPE_STRING:
+        
+            max_len += ESCAPE_MAX_LEN * strlen(p_kv->value.s ? 
+                                               p_kv->value.s : "") + 2;
+            
+            break;
+            
+        default:
+        
+            max_len += 4;
+            
+            break;
+        }
+    }
+    
+    return max_len;
+}
+
+/*******************************************************************************
+
+    logmsg_kv_write_text() - Write message and fields as logfmt or JSON text
+    
+    Description
+    ===========
+    
+    logfmt:     msg=<message> <key>=<value> ...
+    
+    JSON:       {"msg":"<message>","<key>":<value>,...}
+    
+    Return pointer to the end of the text written.
+    
+*******************************************************************************/
+
+char* logmsg_kv_write_text(char* p_write,
+                           LOGMSG_KV_FORMAT format,
+                           const char* message,
+                           const LOGMSG_KV* p_fields,
+                           size_t num_fields) {
+
+    int json = format == LOGMSG_KV_FORMAT_JSON;
+    
+    /*
+     *  Write message
+     */
+     
+    if (json) {
+    
+        p_write = write_raw(p_write, "{\"msg\":");
+        
+        p_write = write_quoted(p_write, message);
+        
+    } else {
+    
+        p_write = write_raw(p_write, "msg=");
+        
+        p_write = needs_quotes(message) ? write_quoted(p_write, message) 
+                                        : write_raw(p_write, message);
+    }
+    
+    /*
+     *  Write fields
+     */
+     
+    for (size_t i = 0; i < num_fields; i++) {
+    
+        const LOGMSG_KV* p_kv = &p_fields[i];
+        
+        if (json) {
+        
+            *p_write++ = ',';
+            
+            p_write = write_quoted(p_write, p_kv->key);
+            
+            *p_write++ = ':';
+            
+        } else {
+        
+            *p_write++ = ' ';
+            
+            p_write = write_raw(p_write, p_kv->key);
+            
+            *p_write++ = '=';
+        }
+        
+        switch (p_kv->type) {
+        
+        case LOGMSG_KV_TYPE_INT:
+        
+            p_write = logmsg_format_i64(p_write, p_kv->value.i);
+            
+            break;
+            
+        case LOGMSG_KV_TYPE_DOUBLE:
+        
+            p_write = write_double(p_write, p_kv->value.d, format);
+            
+            break;
+            
+        case LOGMSG_KV_TYPE_STRING:
+        
+            {
+                const char* text = p_kv->value.s ? p_kv->value.s : "";
+                
+                p_write = json || needs_quotes(text) ? 
+                              write_quoted(p_write, text) : 
+                              write_raw(p_write, text);
+            }
+            
+            break;
+            
+        default:
+        
+            p_write = write_raw(p_write, "null");
+            
+            break;
+        }
+    }
+    
+    if (json) {
+    
+        *p_write++ = '}';
+    }
+    
+    return p_write;
+}
+
+/*******************************************************************************
+
+    logmsg_kv_binary_len() - Return length of the binary record written by
+                             logmsg_kv_write_binary(), or 0 if some field
+                             cannot be represented
+    
+*******************************************************************************/
+
+size_t logmsg_kv_binary_len(const LOGMSG_RECORD* p_record,
+                            const LOGMSG_KV* p_fields,
+                            size_t num_fields) {
+
+    if (p_record->host_len > UINT16_MAX || 
+        p_record->program_len > UINT16_MAX ||
+        p_record->message_len > UINT32_MAX / 2 ||
+        num_fields > UINT16_MAX) {
+        
+        return 0;
+    }
+    
+    uint64_t len = LOGMSG_BINARY_HEADER_LEN + LOGMSG_BINARY_TRAILER_LEN +
+                       p_record->host_len + 
+                           p_record->program_len + 
+                               p_record->message_len;
+    
+    for (size_t i = 0; i < num_fields; i++) {
+    
+        const LOGMSG_KV* p_kv = &p_fields[i];
+        
+        size_t key_len = strlen(p_kv->key);
+        
+        if (key_len > UINT8_MAX) {
+        
+            return 0;
+        }
+        
+        len += 2 + key_len + 1;
+        
+        switch (p_kv->type) {
+        
+        case LOGMSG_KV_TYPE_INT:
+        case LOGMSG_KV_TYPE_DOUBLE:
+        
+            len += 8;
+            
+            break;
+            
+        case LOGMSG_KV_TYPE_STRING:
+        
+            len += 4 + strlen(p_kv->value.s ? p_kv->value.s : "") + 1;
+            
+            break;
+            
+        default:
+        
+            return 0;
+        }
+    }
+    
+    return len <= UINT32_MAX ? (size_t)len : 0;
+}
+
+/*******************************************************************************
+
+    logmsg_kv_write_binary() - Write binary record for the time, level, 
+                               source and message of *p_record, and the 
+                               fields, numbered sequence
+                               
+    See logmsg_parse.h for the record layout.
+    
+    Return pointer to the end of the record written.
+    
+*******************************************************************************/
+
+char* logmsg_kv_write_binary(char* p_write,
+                             const LOGMSG_RECORD* p_record,
+                             uint64_t sequence,
+                             const LOGMSG_KV* p_fields,
+                             size_t num_fields) {
+    
+    char* p_record_start = p_write;
+
+    /*
+     *  Write fixed length header
+     */
+     
+    {
+        uint32_t record_len = 
+            (uint32_t)logmsg_kv_binary_len(p_record, p_fields, num_fields);
+        
+        uint16_t magic = LOGMSG_BINARY_MAGIC;
+        
+        uint16_t host_len = (uint16_t)p_record->host_len;
+        
+        uint16_t program_len = (uint16_t)p_record->program_len;
+        
+        uint32_t message_len = (uint32_t)p_record->message_len;
+        
+        uint16_t field_count = (uint16_t)num_fields;
+        
+        memcpy(p_write, &record_len, 4);
+        
+        memcpy(p_write + 4, &magic, 2);
+        
+        p_write[6] = LOGMSG_BINARY_VERSION;
+        
+        p_write[7] = (char)p_record->level;
+        
+        memcpy(p_write + 8, &sequence, 8);
+        
+        memcpy(p_write + 16, &p_record->utc_time_ns, 8);
+        
+        memcpy(p_write + 24, &p_record->pid, 4);
+        
+        memcpy(p_write + 28, &p_record->tid, 4);
+        
+        memcpy(p_write + 32, &host_len, 2);
+        
+        memcpy(p_write + 34, &program_len, 2);
+        
+        memcpy(p_write + 36, &message_len, 4);
+        
+        memcpy(p_write + 40, &field_count, 2);
+        
+        p_write += LOGMSG_BINARY_HEADER_LEN;
+    }
+    
+    /*
+     *  Write text fields
+     */
+     
+    memcpy(p_write, p_record->p_host, p_record->host_len);
+    
+    p_write += p_record->host_len;
+    
+    memcpy(p_write, p_record->p_program, p_record->program_len);
+    
+    p_write += p_record->program_len;
+    
+    memcpy(p_write, p_record->p_message, p_record->message_len);
+    
+    p_write += p_record->message_len;
+    
+    /*
+     *  Write fields
+     */
+     
+    for (size_t i = 0; i < num_fields; i++) {
+    
+        const LOGMSG_KV* p_kv = &p_fields[i];
+        
+        size_t key_len = strlen(p_kv->key);
+        
+        *p_write++ = (char)p_kv->type;
+        
+        *p_write++ = (char)key_len;
+        
+        memcpy(p_write, p_kv->key, key_len + 1);
+        
+        p_write += key_len + 1;
+        
+        if (p_kv->type == LOGMSG_KV_TYPE_STRING) {
+        
+            const char* text = p_kv->value.s ? p_kv->value.s : "";
+            
+            uint32_t value_len = (uint32_t)strlen(text);
+            
+            memcpy(p_write, &value_len, 4);
+            
+            memcpy(p_write + 4, text, value_len + 1);
+            
+            p_write += 4 + value_len + 1;
+            
+        } else {
+        
+            memcpy(p_write, &p_kv->value, 8);
+            
+            p_write += 8;
+        }
+    }
+    
+    /*
+     *  Write CRC of all the above
+     */
+    
+    uint32_t crc = logmsg_crc32c(0, p_record_start, p_write - p_record_start);
+    
+    memcpy(p_write, &crc, LOGMSG_BINARY_TRAILER_LEN);
+    
+    return p_write + LOGMSG_BINARY_TRAILER_LEN;
+}
@@ -0,0 +1,791 @@
+/*******************************************************************************
+
+    logmsg_layout.c - Layout of text log entries
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <sys/syscall.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define DEFAULT_PATTERN "%d %l %h:%p[%P:%t] %m"
+
+#define LAYOUT_MAX_OPS 64
+
+// Longest text of each variable field
+
+#define LEVEL_MAX_LEN    9      // UNDEFINED
+
+#define ISO_TIME_LEN     (LOGMSG_UTC_TIME_LEN + 1)
+
+#define TID_MAX_LEN      11
+
+/*******************************************************************************
+
+    Program-wide variable declarations
+
+*******************************************************************************/
+
+extern char *program_invocation_short_name;
+
+/*******************************************************************************
+
+    LAYOUT_OP_TYPE - Operations of a compiled layout
+
+*******************************************************************************/
+
+typedef enum LAYOUT_OP_TYPE {
+    
+    OP_TEXT     = 0,            // Constant text, pre-rendered
+    
+    OP_UTC_TIME = 1,            // %d
+    
+    OP_ISO_TIME = 2,            // %D
+    
+    OP_EPOCH_NS = 3,            // %e
+    
+    OP_LEVEL    = 4,            // %l
+    
+    OP_TID      = 5,            // %t
+    
+    OP_SEQ      = 6,            // %s
+    
+    OP_MESSAGE  = 7,            // %m or %j
+    
+} LAYOUT_OP_TYPE;
+
+/*******************************************************************************
+
+    LAYOUT_OP - Operation of a compiled layout
+
+*******************************************************************************/
+
+typedef struct LAYOUT_OP {
+    
+    LAYOUT_OP_TYPE type;
+    
+    uint32_t       text_offset; // OP_TEXT: position of text in LAYOUT.text
+    
+    uint32_t       text_len;
+    
+} LAYOUT_OP;
+
+/*******************************************************************************
+
+    LAYOUT - Compiled layout
+    
+    Description
+    ===========
+    
+    The operations before message_op write the text preceding the message,
+    and those after it the text following. Host name, program name and
+    process ID are rendered with the literal text of the pattern, adjacent
+    constants being merged into a single OP_TEXT.
+
+*******************************************************************************/
+
+typedef struct LAYOUT {
+    
+    LAYOUT_OP ops[LAYOUT_MAX_OPS];
+    
+    size_t    num_ops;
+    
+    size_t    message_op;
+    
+    int       json_message;     // Message written as JSON string
+    
+    int       has_seq;
+    
+    size_t    max_len;          // Longest text excluding message and newline
+    
+    size_t    text_len;
+    
+    char      text[LOGMSG_LAYOUT_MAX_LEN];
+    
+    char      pattern[LOGMSG_LAYOUT_MAX_LEN];
+    
+} LAYOUT;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Layout in use. A new layout is compiled into a new heap object and then
+// switched to, so that entries being written by other threads, or signal
+// handlers, never see a partly compiled layout. Layouts replaced are never
+// freed or reused, as such entries may still be sized and written by them.
+
+static LAYOUT default_layout;
+
+static LAYOUT* p_current_layout = &default_layout;
+
+// Sequence number of last entry
+
+static uint64_t entry_seq = 0;
+
+// Thread ID of calling thread, obtained on its first entry
+
+static __thread pid_t thread_tid = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    add_text() - Append constant text to layout being compiled
+    
+    Return 0 on success, -1 if the layout is too long.
+
+*******************************************************************************/
+
+static int add_text(LAYOUT* p_layout, const char* p_text, size_t len) {
+    
+    if (len == 0) {
+        
+        return 0;
+    }
+    
+    if (p_layout->text_len + len > sizeof(p_layout->text)) {
+        
+        return -1;
+    }
+    
+    memcpy(p_layout->text + p_layout->text_len, p_text, len);
+    
+    /*
+     *  Extend preceding text, else start new
+     */
+    
+    LAYOUT_OP* p_last = p_layout->num_ops > 0 ?
+                            &p_layout->ops[p_layout->num_ops - 1] : NULL;
+    
+    if (p_last != NULL && p_last->type == OP_TEXT) {
+        
+        p_last->text_len += len;
+        
+    } else {
+        
+        if (p_layout->num_ops == LAYOUT_MAX_OPS) {
+            
+            return -1;
+        }
+        
+        LAYOUT_OP* p_op = &p_layout->ops[p_layout->num_ops++];
+        
+        p_op->type = OP_TEXT;
+        
+        p_op->text_offset = p_layout->text_len;
+        
+        p_op->text_len = len;
+    }
+    
+    p_layout->text_len += len;
+    
+    p_layout->max_len += len;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    add_op() - Append variable field to layout being compiled
+    
+    Return 0 on success, -1 if the layout has too many fields.
+
+*******************************************************************************/
+
+static int add_op(LAYOUT* p_layout, LAYOUT_OP_TYPE type, size_t max_len) {
+    
+    if (p_layout->num_ops == LAYOUT_MAX_OPS) {
+        
+        return -1;
+    }
+    
+    LAYOUT_OP* p_op = &p_layout->ops[p_layout->num_ops++];
+    
+    p_op->type = type;
+    
+    p_op->text_offset = 0;
+    
+    p_op->text_len = 0;
+    
+    p_layout->max_len += max_len;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    compile_layout() - Compile pattern
+    
+    Return 0 on success, -1 if the pattern is invalid or too long.
+
+*******************************************************************************/
+
+static int compile_layout(LAYOUT* p_layout, const char* pattern) {
+    
+    size_t pattern_len = strlen(pattern);
+    
+    if (pattern_len >= sizeof(p_layout->pattern)) {
+        
+        return -1;
+    }
+    
+    memcpy(p_layout->pattern, pattern, pattern_len + 1);
+    
+    p_layout->num_ops = 0;
+    
+    p_layout->message_op = LAYOUT_MAX_OPS;
+    
+    p_layout->json_message = 0;
+    
+    p_layout->has_seq = 0;
+    
+    p_layout->max_len = 0;
+    
+    p_layout->text_len = 0;
+    
+    /*
+     *  Constant fields
+     */
+    
+    char hostname_buf[64+1];
+    
+    const char* hostname = "**** unknown hostname ****";
+    
+    if (gethostname(hostname_buf, sizeof(hostname_buf) - 1) == 0) {
+        
+        hostname_buf[sizeof(hostname_buf) - 1] = 0;
+        
+        hostname = hostname_buf;
+    }
+    
+    char pid_buf[LOGMSG_INT_TEXT_MAX_LEN];
+    
+    size_t pid_len = logmsg_format_i64(pid_buf, getpid()) - pid_buf;
+    
+    /*
+     *  Literal text and directives
+     */
+    
+    const char* p = pattern;
+    
+    while (*p) {
+        
+        const char* p_percent = strchrnul(p, '%');
+        
+        int status = add_text(p_layout, p, p_percent - p);
+        
+        if (*p_percent == 0) {
+            
+            break;
+        }
+        
+        p = p_percent + 2;
+        
+        switch (p_percent[1]) {
+        
+        case 'd':
+            
+            status |= add_op(p_layout, OP_UTC_TIME, LOGMSG_UTC_TIME_LEN);
+            
+            break;
+        
+        case 'D':
+            
+            status |= add_op(p_layout, OP_ISO_TIME, ISO_TIME_LEN);
+            
+            break;
+        
+        case 'e':
+            
+            status |= add_op(p_layout, OP_EPOCH_NS, LOGMSG_INT_TEXT_MAX_LEN);
+            
+            break;
+        
+        case 'l':
+            
+            status |= add_op(p_layout, OP_LEVEL, LEVEL_MAX_LEN);
+            
+            break;
+        
+        case 't':
+            
+            status |= add_op(p_layout, OP_TID, TID_MAX_LEN);
+            
+            break;
+        
+        case 's':
+            
+            status |= add_op(p_layout, OP_SEQ, LOGMSG_INT_TEXT_MAX_LEN);
+            
+            p_layout->has_seq = 1;
+            
+            break;
+        
+        case 'h':
+            
+            status |= add_text(p_layout, hostname, strlen(hostname));
+            
+            break;
+        
+        case 'p':
+            
+            status |= add_text(p_layout,
+                               program_invocation_short_name,
+                               strlen(program_invocation_short_name));
+            
+            break;
+        
+        case 'P':
+            
+            status |= add_text(p_layout, pid_buf, pid_len);
+            
+            break;
+        
+        case '%':
+            
+            status |= add_text(p_layout, "%", 1);
+            
+            break;
+        
+        case 'm':
+        case 'j':
+            
+            if (p_layout->message_op != LAYOUT_MAX_OPS) {
+                
+                return -1;
+            }
+            
+            p_layout->message_op = p_layout->num_ops;
+            
+            p_layout->json_message = p_percent[1] == 'j';
+            
+            status |= add_op(p_layout, OP_MESSAGE, 0);
+            
+            break;
+        
+        default:
+            
+            return -1;
+        }
+        
+        if (status != 0) {
+            
+            return -1;
+        }
+    }
+    
+    if (p_layout->message_op == LAYOUT_MAX_OPS ||
+        p_layout->max_len > LOGMSG_LAYOUT_MAX_LEN) {
+        
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    write_ops() - Write text of layout operations first to last - 1
+    
+    Return pointer to the end of the text written.
+
+*******************************************************************************/
+
+static char* write_ops(char* p_write,
+                       const LAYOUT* p_layout,
+                       size_t first,
+                       size_t last,
+                       const LOGMSG_HEADER* p_header) {
+    
+    for (size_t i = first; i < last; i++) {
+        
+        const LAYOUT_OP* p_op = &p_layout->ops[i];
+        
+        switch (p_op->type) {
+        
+        case OP_TEXT:
+            
+            memcpy(p_write, p_layout->text + p_op->text_offset, p_op->text_len);
+            
+            p_write += p_op->text_len;
+            
+            break;
+        
+        case OP_UTC_TIME:
+            
+            p_write = logmsg_format_utc_time(p_write, p_header->utc_time_ns);
+            
+            break;
+        
+        case OP_ISO_TIME:
+            
+            /*
+             *  2018-09-22-22:08:42-086858743 to 2018-09-22T22:08:42.086858743Z
+             */
+            
+            p_write = logmsg_format_utc_time(p_write, p_header->utc_time_ns);
+            
+            p_write[10 - LOGMSG_UTC_TIME_LEN] = 'T';
+            
+            p_write[19 - LOGMSG_UTC_TIME_LEN] = '.';
+            
+            *p_write++ = 'Z';
+            
+            break;
+        
+        case OP_EPOCH_NS:
+            
+            p_write = logmsg_format_i64(p_write, p_header->utc_time_ns);
+            
+            break;
+        
+        case OP_LEVEL:
+            
+            {
+                const char* text = logmsg_level_to_string(p_header->level);
+                
+                size_t len = strlen(text);
+                
+                memcpy(p_write, text, len);
+                
+                p_write += len;
+            }
+            
+            break;
+        
+        case OP_TID:
+            
+            p_write = logmsg_format_i64(p_write, p_header->tid);
+            
+            break;
+        
+        case OP_SEQ:
+            
+            p_write = logmsg_format_i64(p_write, (int64_t)p_header->seq);
+            
+            break;
+        
+        case OP_MESSAGE:
+            
+            break;
+        }
+    }
+    
+    return p_write;
+}
+
+/*******************************************************************************
+
+    refresh_after_fork() - Render process ID of child in layout, and forget
+                           thread ID of the thread which forked
+
+*******************************************************************************/
+
+static void refresh_after_fork(void) {
+    
+    thread_tid = 0;
+    
+    LAYOUT* p_next = malloc(sizeof(LAYOUT));
+    
+    if (p_next == NULL) {
+        
+        return;
+    }
+    
+    if (compile_layout(p_next, p_current_layout->pattern) != 0) {
+        
+        free(p_next);
+        
+        return;
+    }
+    
+    p_current_layout = p_next;
+}
+
+/*******************************************************************************
+
+    init_layout() - Compile default layout when library is loaded
+
+*******************************************************************************/
+
+__attribute__((constructor))
+static void init_layout(void) {
+    
+    compile_layout(&default_layout, DEFAULT_PATTERN);
+    
+    pthread_atfork(NULL, NULL, refresh_after_fork);
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_layout_get_header() - Get the fields of a new entry
+    
+    Description
+    ===========
+    
+    The time is that of the clock selected by logmsg_set_clock(), converted
+    to UTC here rather than by the writer thread, since the time is written
+    into the entry text by the caller.
+
+*******************************************************************************/
+
+void logmsg_layout_get_header(LOGMSG_LEVEL level, LOGMSG_HEADER* p_header) {
+    
+    if (thread_tid == 0) {
+        
+        thread_tid = (pid_t)syscall(SYS_gettid);
+    }
+    
+    logmsg_layout_set_header(p_header,
+                             level,
+                             logmsg_clock_to_utc_ns(logmsg_clock_now()),
+                             thread_tid);
+}
+
+/*******************************************************************************
+
+    logmsg_layout_set_header() - Set the fields of an entry
+    
+    Description
+    ===========
+    
+    The entry will be written with the current layout, taking a sequence
+    number only if the layout writes it.
+
+*******************************************************************************/
+
+void logmsg_layout_set_header(LOGMSG_HEADER* p_header,
+                              LOGMSG_LEVEL level,
+                              int64_t utc_time_ns,
+                              pid_t tid) {
+    
+    p_header->p_layout = __atomic_load_n(&p_current_layout, __ATOMIC_ACQUIRE);
+    
+    p_header->level = level;
+    
+    p_header->utc_time_ns = utc_time_ns;
+    
+    p_header->tid = tid;
+    
+    p_header->seq = 0;
+    
+    if (p_header->p_layout->has_seq) {
+        
+        p_header->seq = __atomic_add_fetch(&entry_seq, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_layout_max_len() - Return upper bound of the length of an entry
+                              with a message of message_len characters,
+                              including the newline
+
+*******************************************************************************/
+
+size_t logmsg_layout_max_len(const LOGMSG_HEADER* p_header,
+                             size_t message_len) {
+    
+    const LAYOUT* p_layout = p_header->p_layout;
+    
+    return p_layout->max_len +
+               (p_layout->json_message ? 6 * message_len + 2 : message_len) +
+                   1;
+}
+
+/*******************************************************************************
+
+    logmsg_layout_is_json() - Determine whether the message is written as a
+                              JSON string, rather than as it is
+
+*******************************************************************************/
+
+int logmsg_layout_is_json(const LOGMSG_HEADER* p_header) {
+    
+    return p_header->p_layout->json_message;
+}
+
+/*******************************************************************************
+
+    logmsg_layout_write_prefix() - Write the text which precedes the message
+    
+    Return pointer to the end of the text written.
+
+*******************************************************************************/
+
+char* logmsg_layout_write_prefix(char* p_write, const LOGMSG_HEADER* p_header) {
+    
+    const LAYOUT* p_layout = p_header->p_layout;
+    
+    return write_ops(p_write, p_layout, 0, p_layout->message_op, p_header);
+}
+
+/*******************************************************************************
+
+    logmsg_layout_write_message() - Write message, as a JSON string if the
+                                    layout requires, in at most max_len
+                                    characters
+    
+    Return pointer to the end of the text written.
+
+*******************************************************************************/
+
+char* logmsg_layout_write_message(char* p_write,
+                                  const LOGMSG_HEADER* p_header,
+                                  const char* p_message,
+                                  size_t message_len,
+                                  size_t max_len) {
+    
+    if (p_header->p_layout->json_message) {
+        
+        return logmsg_kv_write_quoted(p_write, p_message, message_len, max_len);
+    }
+    
+    if (message_len > max_len) {
+        
+        message_len = max_len;
+    }
+    
+    memcpy(p_write, p_message, message_len);
+    
+    return p_write + message_len;
+}
+
+/*******************************************************************************
+
+    logmsg_layout_write_suffix() - Write the text which follows the message,
+                                   and the terminal newline
+    
+    Return pointer to the end of the text written.
+
+*******************************************************************************/
+
+char* logmsg_layout_write_suffix(char* p_write, const LOGMSG_HEADER* p_header) {
+    
+    const LAYOUT* p_layout = p_header->p_layout;
+    
+    p_write = write_ops(p_write,
+                        p_layout,
+                        p_layout->message_op + 1,
+                        p_layout->num_ops,
+                        p_header);
+    
+    *p_write++ = '\n';
+    
+    return p_write;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_set_layout() - Select layout of text log entries
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_set_layout(const char* pattern) {
+    
+    if (pattern == NULL) {
+        
+        pattern = DEFAULT_PATTERN;
+    }
+    
+    LAYOUT* p_next = malloc(sizeof(LAYOUT));
+    
+    if (p_next == NULL) {
+        
+        return -1;
+    }
+    
+    if (compile_layout(p_next, pattern) != 0) {
+        
+        free(p_next);
+        
+        return -1;
+    }
+    
+    __atomic_store_n(&p_current_layout, p_next, __ATOMIC_RELEASE);
+    
+    return 0;
+}
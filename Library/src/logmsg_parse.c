@@ -0,0 +1,1296 @@
+/*******************************************************************************
+
+    logmsg_parse.c - Implementation file for log file parser
+
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <logmsg_parse.h>
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define LOGMSG_PARSE_X86
+
+#endif
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define NSECS_PER_SEC 1000000000LL
+
+// Number of header bytes following the UTC time which are classified in a
+// single pass - enough for the level, host, program and IDs of most entries
+
+#define HEADER_BLOCK_LEN 64
+
+/*******************************************************************************
+
+    DELIMITERS - Bit masks of delimiter positions within a header block,
+                 bit n corresponding to byte n
+
+*******************************************************************************/
+
+typedef struct DELIMITERS {
+
+    uint64_t space;
+
+    uint64_t colon;
+
+    uint64_t open_bracket;
+
+    uint64_t close_bracket;
+
+    uint64_t newline;
+
+} DELIMITERS;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+#ifdef LOGMSG_PARSE_X86
+
+// Non-zero if the processor supports AVX2, determined at load time
+
+static int have_avx2 = 0;
+
+#endif
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+#ifdef LOGMSG_PARSE_X86
+
+/*******************************************************************************
+
+    init_parse() - Determine instruction set support when library is loaded
+
+*******************************************************************************/
+
+__attribute__((constructor))
+static void init_parse(void) {
+
+    __builtin_cpu_init();
+
+    have_avx2 = __builtin_cpu_supports("avx2");
+}
+
+/*******************************************************************************
+
+    find_newline_avx2() - logmsg_find_newline() using 32 byte vectors
+
+*******************************************************************************/
+
+__attribute__((target("avx2")))
+static const char* find_newline_avx2(const char* p, const char* p_end) {
+
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    while (p_end - p >= 64) {
+
+        __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+        uint64_t mask =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(hi, newline)) << 32;
+
+        if (mask != 0) {
+
+            return p + __builtin_ctzll(mask);
+        }
+
+        p += 64;
+    }
+
+    const char* p_newline = memchr(p, '\n', p_end - p);
+
+    return p_newline ? p_newline : p_end;
+}
+
+/*******************************************************************************
+
+    find_newline_sse2() - logmsg_find_newline() using 16 byte vectors
+
+*******************************************************************************/
+
+static const char* find_newline_sse2(const char* p, const char* p_end) {
+
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    while (p_end - p >= 32) {
+
+        __m128i lo = _mm_loadu_si128((const __m128i*)p);
+
+        __m128i hi = _mm_loadu_si128((const __m128i*)(p + 16));
+
+        uint32_t mask =
+            (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, newline)) |
+            (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, newline)) << 16;
+
+        if (mask != 0) {
+
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    const char* p_newline = memchr(p, '\n', p_end - p);
+
+    return p_newline ? p_newline : p_end;
+}
+
+/*******************************************************************************
+
+    classify_avx2() - Find delimiters in HEADER_BLOCK_LEN bytes at p
+
+*******************************************************************************/
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* p, DELIMITERS* p_delimiters) {
+
+    __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+    #define CLASSIFY_AVX2(c)                                                  \
+        ((uint32_t)_mm256_movemask_epi8(                                      \
+             _mm256_cmpeq_epi8(lo, _mm256_set1_epi8(c))) |                    \
+         (uint64_t)(uint32_t)_mm256_movemask_epi8(                            \
+             _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(c))) << 32)
+
+    p_delimiters->space         = CLASSIFY_AVX2(' ');
+    p_delimiters->colon         = CLASSIFY_AVX2(':');
+    p_delimiters->open_bracket  = CLASSIFY_AVX2('[');
+    p_delimiters->close_bracket = CLASSIFY_AVX2(']');
+    p_delimiters->newline       = CLASSIFY_AVX2('\n');
+
+    #undef CLASSIFY_AVX2
+}
+
+/*******************************************************************************
+
+    classify_sse2() - Find delimiters in HEADER_BLOCK_LEN bytes at p
+
+*******************************************************************************/
+
+static void classify_sse2(const char* p, DELIMITERS* p_delimiters) {
+
+    __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+
+    __m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+
+    __m128i v3 = _mm_loadu_si128((const __m128i*)(p + 48));
+
+    #define CLASSIFY_SSE2(c)                                                  \
+        ((uint64_t)(uint16_t)_mm_movemask_epi8(                               \
+             _mm_cmpeq_epi8(v0, _mm_set1_epi8(c))) |                          \
+         (uint64_t)(uint16_t)_mm_movemask_epi8(                               \
+             _mm_cmpeq_epi8(v1, _mm_set1_epi8(c))) << 16 |                    \
+         (uint64_t)(uint16_t)_mm_movemask_epi8(                               \
+             _mm_cmpeq_epi8(v2, _mm_set1_epi8(c))) << 32 |                    \
+         (uint64_t)(uint16_t)_mm_movemask_epi8(                               \
+             _mm_cmpeq_epi8(v3, _mm_set1_epi8(c))) << 48)
+
+    p_delimiters->space         = CLASSIFY_SSE2(' ');
+    p_delimiters->colon         = CLASSIFY_SSE2(':');
+    p_delimiters->open_bracket  = CLASSIFY_SSE2('[');
+    p_delimiters->close_bracket = CLASSIFY_SSE2(']');
+    p_delimiters->newline       = CLASSIFY_SSE2('\n');
+
+    #undef CLASSIFY_SSE2
+}
+
+/*******************************************************************************
+
+    check_utc_time_sse2() - Check that the LOGMSG_UTC_TIME_LEN bytes at p
+                            have the form of a UTC time, i.e. digits and
+                            separators as in 2018-09-22-22:08:42-086858743
+
+    Return non-zero if so.
+
+*******************************************************************************/
+
+static int check_utc_time_sse2(const char* p) {
+
+    /*
+     *  Bytes 0..15 and 13..28, with separators in place and zero at digit
+     *  positions
+     */
+
+    const __m128i template_lo = _mm_setr_epi8(
+        0, 0, 0, 0, '-', 0, 0, '-', 0, 0, '-', 0, 0, ':', 0, 0);
+
+    const __m128i template_hi = _mm_setr_epi8(
+        ':', 0, 0, ':', 0, 0, '-', 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    const __m128i zero = _mm_setzero_si128();
+
+    const __m128i nine = _mm_set1_epi8(9);
+
+    const __m128i ascii_zero = _mm_set1_epi8('0');
+
+    __m128i lo = _mm_loadu_si128((const __m128i*)p);
+
+    __m128i hi = _mm_loadu_si128((const __m128i*)(p + 13));
+
+    /*
+     *  A byte is a digit if subtracting '0' and then saturating-subtracting
+     *  9 leaves zero. Characters below '0' wrap to large values.
+     */
+
+    __m128i lo_digit = _mm_cmpeq_epi8(
+        _mm_subs_epu8(_mm_sub_epi8(lo, ascii_zero), nine), zero);
+
+    __m128i hi_digit = _mm_cmpeq_epi8(
+        _mm_subs_epu8(_mm_sub_epi8(hi, ascii_zero), nine), zero);
+
+    __m128i lo_is_sep = _mm_cmpeq_epi8(template_lo, zero);
+
+    __m128i hi_is_sep = _mm_cmpeq_epi8(template_hi, zero);
+
+    __m128i lo_ok = _mm_or_si128(
+        _mm_and_si128(lo_is_sep, lo_digit),
+        _mm_andnot_si128(lo_is_sep, _mm_cmpeq_epi8(lo, template_lo)));
+
+    __m128i hi_ok = _mm_or_si128(
+        _mm_and_si128(hi_is_sep, hi_digit),
+        _mm_andnot_si128(hi_is_sep, _mm_cmpeq_epi8(hi, template_hi)));
+
+    return (_mm_movemask_epi8(_mm_and_si128(lo_ok, hi_ok)) == 0xFFFF);
+}
+
+#endif // LOGMSG_PARSE_X86
+
+/*******************************************************************************
+
+    check_utc_time_scalar() - As check_utc_time_sse2()
+
+*******************************************************************************/
+
+static int check_utc_time_scalar(const char* p) {
+
+    static const char template[] = "0000-00-00-00:00:00-000000000";
+
+    for (size_t i = 0; i < LOGMSG_UTC_TIME_LEN; i++) {
+
+        if (template[i] == '0') {
+
+            if ((unsigned)(p[i] - '0') > 9) {
+
+                return 0;
+            }
+
+        } else if (p[i] != template[i]) {
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+
+    is_utc_time() - Return non-zero if the text at p begins with a UTC time
+
+*******************************************************************************/
+
+static inline int is_utc_time(const char* p, const char* p_end) {
+
+    if (p_end - p < LOGMSG_UTC_TIME_LEN) {
+
+        return 0;
+    }
+
+    /*
+     *  Reject most continuation lines on their first character
+     */
+
+    if ((unsigned)(*p - '0') > 9) {
+
+        return 0;
+    }
+
+#ifdef LOGMSG_PARSE_X86
+
+    if (p_end - p >= 32) {
+
+        return check_utc_time_sse2(p);
+    }
+
+#endif
+
+    return check_utc_time_scalar(p);
+}
+
+/*******************************************************************************
+
+    days_from_civil() - Number of days since 1970-01-01 of a Gregorian date
+
+*******************************************************************************/
+
+static inline int64_t days_from_civil(int64_t year,
+                                      unsigned month,
+                                      unsigned day) {
+
+    year -= month <= 2;
+
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+
+    unsigned year_of_era = (unsigned)(year - era * 400);
+
+    unsigned day_of_year =
+        (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+
+    unsigned day_of_era =
+        year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+/*******************************************************************************
+
+    decode_utc_time() - Convert a UTC time already checked by is_utc_time()
+
+    Return 0 on success, -1 if a field is out of range.
+
+*******************************************************************************/
+
+static inline int decode_utc_time(const char* p, int64_t* p_utc_time_ns) {
+
+    #define DIGIT(i) ((unsigned)(p[i] - '0'))
+
+    unsigned year   = DIGIT(0) * 1000 + DIGIT(1) * 100 + DIGIT(2) * 10 +
+                          DIGIT(3);
+    unsigned month  = DIGIT(5) * 10 + DIGIT(6);
+    unsigned day    = DIGIT(8) * 10 + DIGIT(9);
+    unsigned hour   = DIGIT(11) * 10 + DIGIT(12);
+    unsigned minute = DIGIT(14) * 10 + DIGIT(15);
+    unsigned second = DIGIT(17) * 10 + DIGIT(18);
+
+    /*
+     *  Convert the first 8 nanosecond digits at once - each step combines
+     *  adjacent pairs of the previous step's values
+     */
+
+    uint64_t chunk;
+
+    memcpy(&chunk, p + 20, sizeof(chunk));
+
+    chunk -= 0x3030303030303030ULL;
+
+    chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFULL;
+
+    chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+
+    chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFFULL;
+
+    uint64_t nsec = chunk * 10 + DIGIT(28);
+
+    #undef DIGIT
+
+    if (month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour > 23 || minute > 59 || second > 60) {
+
+        return -1;
+    }
+
+    int64_t secs = days_from_civil(year, month, day) * 86400 +
+                       hour * 3600 + minute * 60 + second;
+
+    *p_utc_time_ns = secs * NSECS_PER_SEC + (int64_t)nsec;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    parse_decimal() - Convert decimal digits p .. p_end (exclusive)
+
+    Return 0 on success, -1 if empty or not all digits.
+
+*******************************************************************************/
+
+static inline int parse_decimal(const char* p,
+                                const char* p_end,
+                                int32_t* p_value) {
+
+    if (p == p_end || p_end - p > 10) {
+
+        return -1;
+    }
+
+    int64_t value = 0;
+
+    for (; p < p_end; p++) {
+
+        unsigned digit = (unsigned)(*p - '0');
+
+        if (digit > 9) {
+
+            return -1;
+        }
+
+        value = value * 10 + digit;
+    }
+
+    *p_value = (int32_t)value;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    next_bit() - Return position of first set bit of mask at or after
+                 position, or HEADER_BLOCK_LEN if none
+
+*******************************************************************************/
+
+static inline unsigned next_bit(uint64_t mask, unsigned position) {
+
+    if (position >= HEADER_BLOCK_LEN) {
+
+        return HEADER_BLOCK_LEN;
+    }
+
+    mask &= ~0ULL << position;
+
+    return mask ? (unsigned)__builtin_ctzll(mask) : HEADER_BLOCK_LEN;
+}
+
+/*******************************************************************************
+
+    split_header_block() - Locate header fields using delimiter masks
+
+    Description
+    ===========
+
+    p points just past the space following the UTC time. On success, the
+    level, host, program and IDs of *p_record are set and a pointer to the
+    character following "]" is returned. NULL is returned if the fields do
+    not all lie within the block, or a newline intervenes.
+
+    If the line ends within the block, *pp_eol is set to its newline, 
+    otherwise to NULL.
+
+*******************************************************************************/
+
+static const char* split_header_block(const char* p,
+                                      const DELIMITERS* p_delimiters,
+                                      LOGMSG_RECORD* p_record,
+                                      const char** pp_eol) {
+
+    unsigned level_end = next_bit(p_delimiters->space, 0);
+
+    unsigned host_end = next_bit(p_delimiters->colon, level_end + 1);
+
+    unsigned program_end = next_bit(p_delimiters->open_bracket, host_end + 1);
+
+    unsigned pid_end = next_bit(p_delimiters->colon, program_end + 1);
+
+    unsigned tid_end = next_bit(p_delimiters->close_bracket, pid_end + 1);
+
+    unsigned eol = next_bit(p_delimiters->newline, 0);
+
+    if (tid_end >= HEADER_BLOCK_LEN || eol < tid_end) {
+
+        return NULL;
+    }
+
+    if (parse_decimal(p + program_end + 1, p + pid_end, &p_record->pid) ||
+        parse_decimal(p + pid_end + 1, p + tid_end, &p_record->tid)) {
+
+        return NULL;
+    }
+
+    p_record->level = logmsg_level_from_string(p, level_end);
+
+    p_record->p_host = p + level_end + 1;
+
+    p_record->host_len = host_end - level_end - 1;
+
+    p_record->p_program = p + host_end + 1;
+
+    p_record->program_len = program_end - host_end - 1;
+
+    *pp_eol = eol < HEADER_BLOCK_LEN ? p + eol : NULL;
+
+    return p + tid_end + 1;
+}
+
+/*******************************************************************************
+
+    split_header_scalar() - As split_header_block(), for headers which extend
+                            beyond HEADER_BLOCK_LEN or the end of the buffer
+
+*******************************************************************************/
+
+static const char* split_header_scalar(const char* p,
+                                       const char* p_end,
+                                       LOGMSG_RECORD* p_record) {
+
+    const char* p_eol = logmsg_find_newline(p, p_end);
+
+    const char* p_level_end = memchr(p, ' ', p_eol - p);
+
+    if (p_level_end == NULL) {
+
+        return NULL;
+    }
+
+    const char* p_host_end = memchr(p_level_end + 1, ':',
+                                    p_eol - p_level_end - 1);
+
+    if (p_host_end == NULL) {
+
+        return NULL;
+    }
+
+    const char* p_program_end = memchr(p_host_end + 1, '[',
+                                       p_eol - p_host_end - 1);
+
+    if (p_program_end == NULL) {
+
+        return NULL;
+    }
+
+    const char* p_pid_end = memchr(p_program_end + 1, ':',
+                                   p_eol - p_program_end - 1);
+
+    if (p_pid_end == NULL) {
+
+        return NULL;
+    }
+
+    const char* p_tid_end = memchr(p_pid_end + 1, ']',
+                                   p_eol - p_pid_end - 1);
+
+    if (p_tid_end == NULL) {
+
+        return NULL;
+    }
+
+    if (parse_decimal(p_program_end + 1, p_pid_end, &p_record->pid) ||
+        parse_decimal(p_pid_end + 1, p_tid_end, &p_record->tid)) {
+
+        return NULL;
+    }
+
+    p_record->level = logmsg_level_from_string(p, p_level_end - p);
+
+    p_record->p_host = p_level_end + 1;
+
+    p_record->host_len = p_host_end - p_level_end - 1;
+
+    p_record->p_program = p_host_end + 1;
+
+    p_record->program_len = p_program_end - p_host_end - 1;
+
+    return p_tid_end + 1;
+}
+
+/*******************************************************************************
+
+    end_of_entry() - Return pointer past the entry whose first line ends with
+                     the newline at p_eol (or p_end), i.e. past any
+                     continuation lines
+
+*******************************************************************************/
+
+static inline const char* end_of_entry(const char* p_eol, const char* p_end) {
+
+    while (p_eol < p_end) {
+
+        const char* p_next = p_eol + 1;
+
+        if (p_next == p_end || is_utc_time(p_next, p_end)) {
+
+            return p_next;
+        }
+
+        p_eol = logmsg_find_newline(p_next, p_end);
+    }
+
+    return p_end;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_find_newline() - Return pointer to the first newline at or after
+                            p_text, or p_end if there is none
+
+*******************************************************************************/
+
+const char* logmsg_find_newline(const char* p_text, const char* p_end) {
+
+#ifdef LOGMSG_PARSE_X86
+
+    if (have_avx2) {
+
+        return find_newline_avx2(p_text, p_end);
+    }
+
+    return find_newline_sse2(p_text, p_end);
+
+#else
+
+    const char* p_newline = memchr(p_text, '\n', p_end - p_text);
+
+    return p_newline ? p_newline : p_end;
+
+#endif
+}
+
+/*******************************************************************************
+
+    logmsg_find_entry() - Return pointer to the first entry which begins at
+                          or after p_text, or p_end if there is none
+
+*******************************************************************************/
+
+const char* logmsg_find_entry(const char* p_text, const char* p_end) {
+
+    while (p_text < p_end && !is_utc_time(p_text, p_end)) {
+
+        p_text = logmsg_find_newline(p_text, p_end);
+
+        if (p_text < p_end) {
+
+            p_text++;
+        }
+    }
+
+    return p_text;
+}
+
+/*******************************************************************************
+
+    logmsg_parse_utc_time() - Convert the UTC time at the start of an entry to
+                              nanoseconds since the Epoch
+
+*******************************************************************************/
+
+int logmsg_parse_utc_time(const char* p_text,
+                          size_t text_len,
+                          int64_t* p_utc_time_ns) {
+
+    if (!is_utc_time(p_text, p_text + text_len)) {
+
+        return -1;
+    }
+
+    return decode_utc_time(p_text, p_utc_time_ns);
+}
+
+/*******************************************************************************
+
+    logmsg_parse_partial_utc_time() - Convert a leading portion of a UTC time
+                                      to nanoseconds since the Epoch
+
+*******************************************************************************/
+
+int logmsg_parse_partial_utc_time(const char* p_text,
+                                  int64_t* p_utc_time_ns,
+                                  int64_t* p_span_ns) {
+
+    /*
+     *  Field end positions and the interval denoted by a time ending there
+     */
+
+    static const struct {
+
+        size_t len;
+
+        int64_t span_ns;
+
+    } fields[] = {
+
+        { 10, 86400 * NSECS_PER_SEC },  // 2018-09-22
+        { 13,  3600 * NSECS_PER_SEC },  // 2018-09-22-22
+        { 16,    60 * NSECS_PER_SEC },  // 2018-09-22-22:08
+        { 19,         NSECS_PER_SEC },  // 2018-09-22-22:08:42
+        { 29,                     1 },  // 2018-09-22-22:08:42-086858743
+    };
+
+    size_t text_len = strlen(p_text);
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+
+        if (text_len != fields[i].len) {
+
+            continue;
+        }
+
+        char full_time[] = "0000-01-01-00:00:00-000000000";
+
+        memcpy(full_time, p_text, text_len);
+
+        if (logmsg_parse_utc_time(full_time,
+                                  LOGMSG_UTC_TIME_LEN,
+                                  p_utc_time_ns) != 0) {
+
+            return -1;
+        }
+
+        *p_span_ns = fields[i].span_ns;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+
+    logmsg_level_from_string() - Convert log level from text to binary
+
+*******************************************************************************/
+
+LOGMSG_LEVEL logmsg_level_from_string(const char* p_text, size_t text_len) {
+
+    /*
+     *  Level names all have different initials - index them by the low 
+     *  five bits of the initial, then check the whole name
+     */
+
+    static const struct {
+
+        char name[8];
+
+        size_t len;
+
+        LOGMSG_LEVEL level;
+
+    } by_initial[32] = {
+
+        ['D' & 0x1F] = { "DEBUG", 5, LOGMSG_LEVEL_DEBUG },
+        ['E' & 0x1F] = { "ERROR", 5, LOGMSG_LEVEL_ERROR },
+        ['F' & 0x1F] = { "FATAL", 5, LOGMSG_LEVEL_FATAL },
+        ['I' & 0x1F] = { "INFO",  4, LOGMSG_LEVEL_INFO  },
+        ['N' & 0x1F] = { "NONE",  4, LOGMSG_LEVEL_NONE  },
+        ['T' & 0x1F] = { "TRACE", 5, LOGMSG_LEVEL_TRACE },
+        ['W' & 0x1F] = { "WARN",  4, LOGMSG_LEVEL_WARN  },
+    };
+
+    if (text_len < 4) {
+
+        return LOGMSG_LEVEL_UNDEFINED;
+    }
+
+    unsigned initial = (unsigned char)p_text[0] & 0x1F;
+
+    uint32_t head;
+
+    uint32_t name_head;
+
+    memcpy(&head, p_text, sizeof(head));
+
+    memcpy(&name_head, by_initial[initial].name, sizeof(name_head));
+
+    if (text_len != by_initial[initial].len || head != name_head ||
+        (text_len == 5 && p_text[4] != by_initial[initial].name[4])) {
+
+        return LOGMSG_LEVEL_UNDEFINED;
+    }
+
+    return by_initial[initial].level;
+}
+
+/*******************************************************************************
+
+    logmsg_parse_entry() - Parse the entry beginning at p_entry
+
+*******************************************************************************/
+
+int logmsg_parse_entry(const char* p_entry,
+                       const char* p_end,
+                       LOGMSG_RECORD* p_record) {
+
+    p_record->p_entry = p_entry;
+
+    /*
+     *  UTC time and following space
+     */
+
+    const char* p = p_entry;
+
+    const char* p_message = NULL;
+
+    const char* p_eol = NULL;
+
+    if (is_utc_time(p, p_end) &&
+        p_end - p > LOGMSG_UTC_TIME_LEN &&
+        p[LOGMSG_UTC_TIME_LEN] == ' ' &&
+        decode_utc_time(p, &p_record->utc_time_ns) == 0) {
+
+        p += LOGMSG_UTC_TIME_LEN + 1;
+
+        /*
+         *  Level, host, program and IDs
+         */
+
+#ifdef LOGMSG_PARSE_X86
+
+        if (p_end - p >= HEADER_BLOCK_LEN) {
+
+            DELIMITERS delimiters;
+
+            if (have_avx2) {
+
+                classify_avx2(p, &delimiters);
+
+            } else {
+
+                classify_sse2(p, &delimiters);
+            }
+
+            p_message = split_header_block(p, &delimiters, p_record, &p_eol);
+        }
+
+#endif
+
+        if (p_message == NULL) {
+
+            p_message = split_header_scalar(p, p_end, p_record);
+        }
+    }
+
+    /*
+     *  On failure, report the lines up to the next entry
+     */
+
+    if (p_message == NULL) {
+
+        const char* p_next = logmsg_find_newline(p_entry, p_end);
+
+        if (p_next < p_end) {
+
+            p_next = logmsg_find_entry(p_next + 1, p_end);
+        }
+
+        p_record->entry_len = p_next - p_entry;
+
+        return -1;
+    }
+
+    /*
+     *  Message, which runs to the end of the entry
+     */
+
+    if (p_message < p_end && *p_message == ' ') {
+
+        p_message++;
+    }
+
+    if (p_eol == NULL) {
+
+        p_eol = logmsg_find_newline(p_message, p_end);
+    }
+
+    const char* p_entry_end = end_of_entry(p_eol, p_end);
+
+    p_record->p_message = p_message;
+
+    p_record->message_len = p_entry_end - p_message;
+
+    if (p_record->message_len > 0 && p_entry_end[-1] == '\n') {
+
+        p_record->message_len--;
+    }
+
+    p_record->entry_len = p_entry_end - p_entry;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_parser_init() - Prepare to parse the entries of a buffer
+
+*******************************************************************************/
+
+void logmsg_parser_init(LOGMSG_PARSER* p_parser,
+                        const void* p_buffer,
+                        size_t buffer_len) {
+
+    p_parser->p_next = (const char*)p_buffer;
+
+    p_parser->p_end = (const char*)p_buffer + buffer_len;
+}
+
+/*******************************************************************************
+
+    logmsg_parser_next() - Parse the next entry of the buffer
+
+*******************************************************************************/
+
+int logmsg_parser_next(LOGMSG_PARSER* p_parser, LOGMSG_RECORD* p_record) {
+
+    if (p_parser->p_next >= p_parser->p_end) {
+
+        return 0;
+    }
+
+    int status = logmsg_parse_entry(p_parser->p_next,
+                                    p_parser->p_end,
+                                    p_record);
+
+    p_parser->p_next += p_record->entry_len;
+
+    return status == 0 ? 1 : -1;
+}
+
+
+/*******************************************************************************
+
+    logmsg_parse_binary() - Decode the binary log record at the start of a 
+                            buffer
+
+    See logmsg_parse.h for the record layout.
+
+*******************************************************************************/
+
+ssize_t logmsg_parse_binary(const void* p_buffer,
+                            size_t buffer_len,
+                            LOGMSG_RECORD* p_record,
+                            LOGMSG_KV* p_fields,
+                            size_t* p_num_fields) {
+
+    const char* p = (const char*)p_buffer;
+
+    ssize_t record_len = logmsg_check_binary(p_buffer, buffer_len, NULL);
+
+    if (record_len <= 0) {
+
+        return record_len;
+    }
+
+    /*
+     *  Decode fixed length header
+     */
+
+    uint16_t host_len;
+
+    uint16_t program_len;
+
+    uint32_t message_len;
+
+    uint16_t num_fields;
+
+    memset(p_record, 0, sizeof(LOGMSG_RECORD));
+
+    p_record->p_entry = p;
+
+    p_record->entry_len = record_len;
+
+    p_record->level = (LOGMSG_LEVEL)(uint8_t)p[7];
+
+    memcpy(&p_record->utc_time_ns, p + 16, 8);
+
+    memcpy(&p_record->pid, p + 24, 4);
+
+    memcpy(&p_record->tid, p + 28, 4);
+
+    memcpy(&host_len, p + 32, 2);
+
+    memcpy(&program_len, p + 34, 2);
+
+    memcpy(&message_len, p + 36, 4);
+
+    memcpy(&num_fields, p + 40, 2);
+
+    /*
+     *  Locate text fields
+     */
+
+    const char* p_end = p + record_len - LOGMSG_BINARY_TRAILER_LEN;
+
+    const char* p_read = p + LOGMSG_BINARY_HEADER_LEN;
+
+    if ((uint64_t)host_len + program_len + message_len > 
+            (uint64_t)(p_end - p_read)) {
+
+        return -1;
+    }
+
+    p_record->p_host = p_read;
+
+    p_record->host_len = host_len;
+
+    p_read += host_len;
+
+    p_record->p_program = p_read;
+
+    p_record->program_len = program_len;
+
+    p_read += program_len;
+
+    p_record->p_message = p_read;
+
+    p_record->message_len = message_len;
+
+    p_read += message_len;
+
+    /*
+     *  Decode fields
+     */
+
+    size_t max_fields = *p_num_fields;
+
+    for (size_t i = 0; i < num_fields; i++) {
+
+        LOGMSG_KV kv;
+
+        if (p_end - p_read < 2) {
+
+            return -1;
+        }
+
+        kv.type = (LOGMSG_KV_TYPE)(uint8_t)p_read[0];
+
+        size_t key_len = (uint8_t)p_read[1];
+
+        p_read += 2;
+
+        if ((size_t)(p_end - p_read) < key_len + 1 || p_read[key_len] != 0) {
+
+            return -1;
+        }
+
+        kv.key = p_read;
+
+        p_read += key_len + 1;
+
+        switch (kv.type) {
+
+        case LOGMSG_KV_TYPE_INT:
+        case LOGMSG_KV_TYPE_DOUBLE:
+
+            if (p_end - p_read < 8) {
+
+                return -1;
+            }
+
+            memcpy(&kv.value, p_read, 8);
+
+            p_read += 8;
+
+            break;
+
+        case LOGMSG_KV_TYPE_STRING:
+
+            {
+                uint32_t value_len;
+
+                if (p_end - p_read < 4) {
+
+                    return -1;
+                }
+
+                memcpy(&value_len, p_read, 4);
+
+                p_read += 4;
+
+                if ((uint64_t)(p_end - p_read) < (uint64_t)value_len + 1 ||
+                    p_read[value_len] != 0) {
+
+                    return -1;
+                }
+
+                kv.value.s = p_read;
+
+                p_read += value_len + 1;
+            }
+
+            break;
+
+        default:
+
+            return -1;
+        }
+
+        if (i < max_fields) {
+
+            p_fields[i] = kv;
+        }
+    }
+
+    *p_num_fields = num_fields;
+
+    return record_len;
+}
+
+/*******************************************************************************
+
+    logmsg_check_binary() - Check the framing and CRC of the binary log 
+                            record at the start of a buffer
+
+    See logmsg_parse.h for more details.
+
+*******************************************************************************/
+
+ssize_t logmsg_check_binary(const void* p_buffer,
+                            size_t buffer_len,
+                            uint64_t* p_sequence) {
+
+    const char* p = (const char*)p_buffer;
+
+    if (buffer_len < LOGMSG_BINARY_HEADER_LEN) {
+
+        return 0;
+    }
+
+    uint32_t record_len;
+
+    uint16_t magic;
+
+    memcpy(&record_len, p, 4);
+
+    memcpy(&magic, p + 4, 2);
+
+    if (magic != LOGMSG_BINARY_MAGIC ||
+        (uint8_t)p[6] != LOGMSG_BINARY_VERSION ||
+        record_len < LOGMSG_BINARY_HEADER_LEN + LOGMSG_BINARY_TRAILER_LEN) {
+
+        return -1;
+    }
+
+    if (buffer_len < record_len) {
+
+        return 0;
+    }
+
+    size_t crc_offset = record_len - LOGMSG_BINARY_TRAILER_LEN;
+
+    uint32_t crc;
+
+    memcpy(&crc, p + crc_offset, LOGMSG_BINARY_TRAILER_LEN);
+
+    if (logmsg_crc32c(0, p, crc_offset) != crc) {
+
+        return -1;
+    }
+
+    if (p_sequence != NULL) {
+
+        memcpy(p_sequence, p + 8, 8);
+    }
+
+    return record_len;
+}
+
+/*******************************************************************************
+
+    logmsg_find_binary() - Find the next whole binary log record in a buffer
+
+    See logmsg_parse.h for more details.
+
+*******************************************************************************/
+
+size_t logmsg_find_binary(const void* p_buffer, size_t buffer_len) {
+
+    const char* p = (const char*)p_buffer;
+
+    /*
+     *  Look for magic and version, which follow the record length
+     */
+
+    char key[3];
+
+    uint16_t magic = LOGMSG_BINARY_MAGIC;
+
+    memcpy(key, &magic, 2);
+
+    key[2] = LOGMSG_BINARY_VERSION;
+
+    size_t offset = 0;
+
+    while (buffer_len - offset >= LOGMSG_BINARY_HEADER_LEN) {
+
+        const char* p_key = memmem(p + offset + 4,
+                                   buffer_len - offset - 4,
+                                   key,
+                                   sizeof(key));
+
+        if (p_key == NULL) {
+
+            break;
+        }
+
+        offset = p_key - 4 - p;
+
+        if (logmsg_check_binary(p + offset, buffer_len - offset, NULL) > 0) {
+
+            return offset;
+        }
+
+        offset++;
+    }
+
+    return buffer_len;
+}
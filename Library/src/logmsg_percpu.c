@@ -0,0 +1,739 @@
+/*******************************************************************************
+
+    logmsg_percpu.c - Per-CPU entry buffers, appended to by restartable
+                      sequences
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <stddef.h>
+
+#include <sched.h>
+
+#include <sys/sysinfo.h>
+
+#include <sys/uio.h>
+
+#if defined(__x86_64__) && defined(__has_include)
+
+#if __has_include(<sys/rseq.h>)
+
+#include <sys/rseq.h>
+
+#define HAVE_RSEQ 1
+
+#endif
+
+#endif
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Default length of each CPU buffer
+
+#define DEFAULT_BUFFER_LEN (256 * 1024)
+
+// Length of record header: level and entry length, then TSC
+
+#define RECORD_HEADER_LEN 16
+
+/*******************************************************************************
+
+    CPU_BUFFER - Ring of records appended by threads running on one CPU
+    
+    Description
+    ===========
+    
+    Each record is a header of two 64-bit words, the level in the low half
+    of the first and the entry length in the high half, then the TSC read
+    in the restartable sequence which appended it, followed by the entry
+    padded to a multiple of 8 bytes. Records may wrap around the end of the
+    ring. As the TSC is read after any earlier record on the CPU has been
+    committed, the TSCs of each ring are in order.
+    
+    head is advanced only by the store which commits a restartable sequence
+    on the CPU, and tail only by the writer thread, each counting bytes
+    ever used. They are kept on separate cache lines, so that the writer
+    does not disturb the CPU's producers.
+
+*******************************************************************************/
+
+typedef struct CPU_BUFFER {
+    
+    uint64_t head;
+    
+    uint64_t mask;              // Length of ring - 1
+    
+    char*    p_ring;
+    
+    char     padding[40];
+    
+    uint64_t tail;
+    
+    char     tail_padding[56];
+    
+} CPU_BUFFER;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+static CPU_BUFFER* p_buffers = NULL;
+
+static int num_buffers = 0;
+
+// Longest record, so that one in each buffer leaves room for another
+
+static size_t record_max_len = 0;
+
+// Copy of a record which wraps around the end of its ring, made by the
+// writer thread so that it is written in one piece
+
+static char* p_wrapped_record = NULL;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+#ifdef HAVE_RSEQ
+
+/*******************************************************************************
+
+    get_rseq() - Return the calling thread's rseq area, registered by glibc
+
+*******************************************************************************/
+
+static inline struct rseq* get_rseq(void) {
+    
+    return (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+}
+
+/*******************************************************************************
+
+    append_record() - Append record to buffer of CPU, in a restartable
+                      sequence
+    
+    Description
+    ===========
+    
+    The sequence checks that the thread is still on the CPU and that the
+    head is unchanged, copies the header word p_extra[0] and the TSC, len8
+    bytes of the entry and the last partial word p_extra[1], and commits
+    by storing new_head. It is aborted by the kernel if the thread is pre-
+    empted, migrated or signalled before the commit, so that it needs no
+    atomic instructions. The final word is always stored, so the caller
+    must leave room for it.
+    
+    Return 0 if committed, -1 if aborted, to be retried.
+
+*******************************************************************************/
+
+static inline int append_record(struct rseq* p_rseq,
+                                uint32_t cpu,
+                                CPU_BUFFER* p_buffer,
+                                uint64_t head,
+                                const char* p_src,
+                                uint64_t len8,
+                                const uint64_t* p_extra,
+                                uint64_t new_head) {
+    
+    __asm__ __volatile__ goto (
+        
+        /*
+         *  Critical section descriptor, and its registration
+         */
+        
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %c[rseq_cs](%[rseq])\n\t"
+        
+        /*
+         *  Check CPU and head
+         */
+        
+        "1:\n\t"
+        "cmpl %[cpu], %c[cpu_id](%[rseq])\n\t"
+        "jnz 4f\n\t"
+        "cmpq %[head], %c[head_offset](%[buffer])\n\t"
+        "jnz 4f\n\t"
+        "movq %c[ring_offset](%[buffer]), %%r11\n\t"
+        
+        /*
+         *  Header words
+         */
+        
+        "movq %[head], %%rax\n\t"
+        "andq %c[mask_offset](%[buffer]), %%rax\n\t"
+        "movq 0(%[extra]), %%r9\n\t"
+        "movq %%r9, (%%r11, %%rax)\n\t"
+        "rdtsc\n\t"
+        "shlq $32, %%rdx\n\t"
+        "orq %%rax, %%rdx\n\t"
+        "leaq 8(%[head]), %%rax\n\t"
+        "andq %c[mask_offset](%[buffer]), %%rax\n\t"
+        "movq %%rdx, (%%r11, %%rax)\n\t"
+        
+        /*
+         *  Entry words, then last partial word
+         */
+        
+        "xorl %%r10d, %%r10d\n\t"
+        "5:\n\t"
+        "cmpq %[len8], %%r10\n\t"
+        "jae 6f\n\t"
+        "movq (%[src], %%r10), %%r9\n\t"
+        "leaq 16(%[head], %%r10), %%rax\n\t"
+        "andq %c[mask_offset](%[buffer]), %%rax\n\t"
+        "movq %%r9, (%%r11, %%rax)\n\t"
+        "addq $8, %%r10\n\t"
+        "jmp 5b\n\t"
+        "6:\n\t"
+        "leaq 16(%[head], %%r10), %%rax\n\t"
+        "andq %c[mask_offset](%[buffer]), %%rax\n\t"
+        "movq 8(%[extra]), %%r9\n\t"
+        "movq %%r9, (%%r11, %%rax)\n\t"
+        
+        /*
+         *  Commit
+         */
+        
+        "movq %[new_head], %c[head_offset](%[buffer])\n\t"
+        "2:\n\t"
+        
+        /*
+         *  Abort handler, preceded by the signature
+         */
+        
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp %l[aborted]\n\t"
+        ".popsection\n\t"
+        
+        :
+        : [rseq]        "r" (p_rseq),
+          [cpu]         "r" (cpu),
+          [buffer]      "r" (p_buffer),
+          [head]        "r" (head),
+          [src]         "r" (p_src),
+          [len8]        "r" (len8),
+          [extra]       "r" (p_extra),
+          [new_head]    "r" (new_head),
+          [rseq_cs]     "i" (offsetof(struct rseq, rseq_cs)),
+          [cpu_id]      "i" (offsetof(struct rseq, cpu_id)),
+          [head_offset] "i" (offsetof(CPU_BUFFER, head)),
+          [mask_offset] "i" (offsetof(CPU_BUFFER, mask)),
+          [ring_offset] "i" (offsetof(CPU_BUFFER, p_ring))
+        : "rax", "rdx", "r9", "r10", "r11", "memory", "cc"
+        : aborted);
+    
+    return 0;
+
+aborted:
+    
+    return -1;
+}
+
+#endif
+
+/*******************************************************************************
+
+    record_tsc() - Return TSC of record at position in buffer
+
+*******************************************************************************/
+
+static inline uint64_t record_tsc(const CPU_BUFFER* p_buffer,
+                                  uint64_t position) {
+    
+    return *(uint64_t*)(p_buffer->p_ring + ((position + 8) & p_buffer->mask));
+}
+
+/*******************************************************************************
+
+    record_is_due() - Determine whether the buffer has a record at position
+                      appended at or before cutoff
+
+*******************************************************************************/
+
+static inline int record_is_due(const CPU_BUFFER* p_buffer,
+                                uint64_t position,
+                                uint64_t head,
+                                uint64_t cutoff) {
+    
+    return position != head && record_tsc(p_buffer, position) <= cutoff;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_percpu_init() - Allocate a buffer of buffer_len bytes (256 KiB if
+                           0) for each CPU
+    
+    Description
+    ===========
+    
+    Requires x86-64, and glibc to have registered rseq for each thread.
+    
+    Return 0 on success, -1 if not supported or on failure.
+
+*******************************************************************************/
+
+int logmsg_percpu_init(size_t buffer_len) {
+
+#ifdef HAVE_RSEQ
+
+    if (__rseq_size == 0 ||
+        (int32_t)get_rseq()->cpu_id < 0) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Allocate rings, rounding length up to a power of 2
+     */
+    
+    size_t required_len = buffer_len != 0 ? buffer_len : DEFAULT_BUFFER_LEN;
+    
+    size_t ring_len = 4096;
+    
+    while (ring_len < required_len) {
+        
+        ring_len *= 2;
+    }
+    
+    int num_cpus = get_nprocs_conf();
+    
+    CPU_BUFFER* p_new_buffers = NULL;
+    
+    if (posix_memalign((void**)&p_new_buffers,
+                       64,
+                       num_cpus * sizeof(CPU_BUFFER)) != 0) {
+        
+        return -1;
+    }
+    
+    memset(p_new_buffers, 0, num_cpus * sizeof(CPU_BUFFER));
+    
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+        
+        p_new_buffers[cpu].mask = ring_len - 1;
+        
+        p_new_buffers[cpu].p_ring = (char*)malloc(ring_len);
+        
+        if (p_new_buffers[cpu].p_ring == NULL) {
+            
+            while (--cpu >= 0) {
+                
+                free(p_new_buffers[cpu].p_ring);
+            }
+            
+            free(p_new_buffers);
+            
+            return -1;
+        }
+    }
+    
+    char* p_new_wrapped_record = (char*)malloc(ring_len / 2);
+    
+    if (p_new_wrapped_record == NULL) {
+        
+        for (int cpu = 0; cpu < num_cpus; cpu++) {
+            
+            free(p_new_buffers[cpu].p_ring);
+        }
+        
+        free(p_new_buffers);
+        
+        return -1;
+    }
+    
+    record_max_len = ring_len / 2;
+    
+    p_wrapped_record = p_new_wrapped_record;
+    
+    p_buffers = p_new_buffers;
+    
+    num_buffers = num_cpus;
+    
+    return 0;
+
+#else
+
+    return -1;
+
+#endif
+}
+
+/*******************************************************************************
+
+    logmsg_percpu_append() - Append entry to the buffer of the CPU the
+                             calling thread is running on
+    
+    Description
+    ===========
+    
+    Return 0 on success, 1 if the buffer is full, in which case the caller
+    is to wait for the writer thread to free space, or -1 if the entry is
+    too large or the CPU unknown, in which case the caller is to deliver
+    it.
+
+*******************************************************************************/
+
+int logmsg_percpu_append(LOGMSG_LEVEL level,
+                         const char* p_entry,
+                         size_t entry_len) {
+
+#ifdef HAVE_RSEQ
+
+    /*
+     *  Prepare header, and last partial word of entry
+     */
+    
+    uint64_t len8 = entry_len & ~(uint64_t)7;
+    
+    uint64_t extra[2];
+    
+    extra[0] = (uint32_t)level | ((uint64_t)entry_len << 32);
+    
+    extra[1] = 0;
+    
+    memcpy(&extra[1], p_entry + len8, entry_len - len8);
+    
+    uint64_t record_len =
+        RECORD_HEADER_LEN + ((entry_len + 7) & ~(uint64_t)7);
+    
+    if (record_len + 8 > record_max_len) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Append, retrying on abort
+     */
+    
+    struct rseq* p_rseq = get_rseq();
+    
+    for (;;) {
+        
+        uint32_t cpu = __atomic_load_n(&p_rseq->cpu_id, __ATOMIC_RELAXED);
+        
+        if (cpu >= (uint32_t)num_buffers) {
+            
+            return -1;
+        }
+        
+        CPU_BUFFER* p_buffer = &p_buffers[cpu];
+        
+        uint64_t head = __atomic_load_n(&p_buffer->head, __ATOMIC_RELAXED);
+        
+        uint64_t tail = __atomic_load_n(&p_buffer->tail, __ATOMIC_ACQUIRE);
+        
+        if (head - tail + record_len + 8 > p_buffer->mask + 1) {
+            
+            return 1;
+        }
+        
+        if (append_record(p_rseq,
+                          cpu,
+                          p_buffer,
+                          head,
+                          p_entry,
+                          len8,
+                          extra,
+                          head + record_len) == 0) {
+            return 0;
+        }
+    }
+
+#else
+
+    return -1;
+
+#endif
+}
+
+/*******************************************************************************
+
+    logmsg_percpu_is_empty() - Determine whether every buffer is empty
+
+*******************************************************************************/
+
+int logmsg_percpu_is_empty(void) {
+    
+    for (int cpu = 0; cpu < num_buffers; cpu++) {
+        
+        if (__atomic_load_n(&p_buffers[cpu].head, __ATOMIC_ACQUIRE) !=
+                p_buffers[cpu].tail) {
+            
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+/*******************************************************************************
+
+    logmsg_percpu_discard() - Discard the entries in the buffers, in a
+                              child process, as the parent delivers them
+
+*******************************************************************************/
+
+void logmsg_percpu_discard(void) {
+    
+    for (int cpu = 0; cpu < num_buffers; cpu++) {
+        
+        p_buffers[cpu].tail = p_buffers[cpu].head;
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_percpu_drain() - Deliver entries in the buffers, merged in the
+                            order they were appended
+    
+    Description
+    ===========
+    
+    Entries appended before a cutoff TSC, read before the heads of the
+    buffers, are delivered, in batches, taking the entry with the earliest
+    TSC among the next of each CPU. Buffer space is freed once each batch
+    has been delivered.
+    
+    An entry appended after the cutoff, though committed before the head
+    of its CPU is read, is left for the next call, as an earlier entry of
+    its thread may have been committed on another CPU after that CPU's 
+    head was read. The entries of each thread are thus delivered in order.
+    
+    Entries are ordered by the TSC read when appended, rather than by the
+    timestamps in their text, which are taken when the entries are built, 
+    so that entries of different threads are only approximately in the 
+    order of their timestamps.
+    
+    Return number of entries delivered.
+
+*******************************************************************************/
+
+int logmsg_percpu_drain(void) {
+    
+    /*
+     *  Read cutoff, completing the read before the heads are read
+     */
+    
+    uint64_t cutoff = logmsg_read_tsc();
+    
+#ifdef HAVE_RSEQ
+
+    _mm_lfence();
+    
+#endif
+    
+    /*
+     *  Find CPUs with entries appended by then
+     */
+    
+    uint64_t heads[num_buffers];
+    
+    uint64_t positions[num_buffers];
+    
+    int active[num_buffers];
+    
+    int num_active = 0;
+    
+    for (int cpu = 0; cpu < num_buffers; cpu++) {
+        
+        heads[cpu] = __atomic_load_n(&p_buffers[cpu].head, __ATOMIC_ACQUIRE);
+        
+        positions[cpu] = p_buffers[cpu].tail;
+        
+        if (record_is_due(&p_buffers[cpu],
+                          positions[cpu],
+                          heads[cpu],
+                          cutoff)) {
+            
+            active[num_active++] = cpu;
+        }
+    }
+    
+    int num_delivered = 0;
+    
+    while (num_active > 0) {
+        
+        /*
+         *  Collect batch of entries
+         */
+        
+        LOGMSG_LEVEL levels[LOGMSG_BATCH_MAX_ENTRIES];
+        
+        struct iovec entries[LOGMSG_BATCH_MAX_ENTRIES];
+        
+        int num_entries = 0;
+        
+        int has_wrapped = 0;
+        
+        while (num_active > 0 &&
+               num_entries < LOGMSG_BATCH_MAX_ENTRIES &&
+               !has_wrapped) {
+            
+            int earliest = 0;
+            
+            uint64_t earliest_tsc = UINT64_MAX;
+            
+            for (int i = 0; i < num_active; i++) {
+                
+                uint64_t tsc = record_tsc(&p_buffers[active[i]],
+                                          positions[active[i]]);
+                
+                if (tsc < earliest_tsc) {
+                    
+                    earliest = i;
+                    
+                    earliest_tsc = tsc;
+                }
+            }
+            
+            int cpu = active[earliest];
+            
+            CPU_BUFFER* p_buffer = &p_buffers[cpu];
+            
+            uint64_t offset = positions[cpu] & p_buffer->mask;
+            
+            uint64_t header = *(uint64_t*)(p_buffer->p_ring + offset);
+            
+            size_t entry_len = header >> 32;
+            
+            size_t entry_offset =
+                (offset + RECORD_HEADER_LEN) & p_buffer->mask;
+            
+            levels[num_entries] = (LOGMSG_LEVEL)(uint32_t)header;
+            
+            entries[num_entries].iov_len = entry_len;
+            
+            if (entry_offset + entry_len <= p_buffer->mask + 1) {
+                
+                entries[num_entries].iov_base =
+                    p_buffer->p_ring + entry_offset;
+                    
+            } else {
+                
+                /*
+                 *  Copy entry which wraps, and end batch with it
+                 */
+                
+                size_t first_len = p_buffer->mask + 1 - entry_offset;
+                
+                memcpy(p_wrapped_record,
+                       p_buffer->p_ring + entry_offset,
+                       first_len);
+                
+                memcpy(p_wrapped_record + first_len,
+                       p_buffer->p_ring,
+                       entry_len - first_len);
+                
+                entries[num_entries].iov_base = p_wrapped_record;
+                
+                has_wrapped = 1;
+            }
+            
+            num_entries++;
+            
+            positions[cpu] +=
+                RECORD_HEADER_LEN + ((entry_len + 7) & ~(size_t)7);
+            
+            if (!record_is_due(p_buffer,
+                               positions[cpu],
+                               heads[cpu],
+                               cutoff)) {
+                
+                active[earliest] = active[--num_active];
+            }
+        }
+        
+        logmsg_deliver_entries(levels, entries, num_entries);
+        
+        num_delivered += num_entries;
+        
+        /*
+         *  Free space
+         */
+        
+        for (int cpu = 0; cpu < num_buffers; cpu++) {
+            
+            __atomic_store_n(&p_buffers[cpu].tail,
+                             positions[cpu],
+                             __ATOMIC_RELEASE);
+        }
+    }
+    
+    return num_delivered;
+}
@@ -0,0 +1,945 @@
+/*******************************************************************************
+
+    logmsg_recorder.c - In-memory flight recorder of log entries
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <time.h>
+
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Size of each recorded entry in a ring
+
+#define SLOT_LEN 256
+
+// Default size of each per-thread ring
+
+#define DEFAULT_RING_LEN (64 * 1024)
+
+// Longest message written for a recorded entry by a dump
+
+#define DUMP_MESSAGE_MAX_LEN 1024
+
+// Longest entry written by a dump, with layout text and newline
+
+#define DUMP_ENTRY_MAX_LEN (LOGMSG_LAYOUT_MAX_LEN + DUMP_MESSAGE_MAX_LEN + 1)
+
+// Kinds of recorded entry
+
+#define SLOT_KIND_TEXT     1    // Payload is formatted message
+
+#define SLOT_KIND_DEFERRED 2    // Payload is captured arguments, then format
+
+/*******************************************************************************
+
+    SLOT - One recorded entry
+    
+    Description
+    ===========
+    
+    seq is odd while the owning thread writes the slot for its n'th entry,
+    and 2 * n + 2 once written, so that a dump can detect a slot which is
+    overwritten while it is being copied.
+
+*******************************************************************************/
+
+typedef struct SLOT {
+    
+    uint64_t seq;
+    
+    uint64_t timestamp;         // As logmsg_clock_now()
+    
+    int32_t  tid;
+    
+    uint8_t  level;
+    
+    uint8_t  kind;
+    
+    uint16_t args_len;          // SLOT_KIND_DEFERRED only
+    
+    uint16_t text_len;          // Message, or format including NULL
+    
+    char     payload[SLOT_LEN - 26];
+    
+} __attribute__((aligned(8))) SLOT;
+
+#define PAYLOAD_LEN sizeof(((SLOT*)0)->payload)
+
+/*******************************************************************************
+
+    RING - Fixed size ring of the entries recorded by one thread
+    
+    Description
+    ===========
+    
+    Rings are never freed. When a thread exits its ring is released for
+    reuse by a later thread, keeping the entries recorded so far.
+
+*******************************************************************************/
+
+typedef struct RING {
+    
+    struct RING* p_next;
+    
+    int          in_use;
+    
+    uint64_t     num_slots;
+    
+    uint64_t     num_entries;   // # entries ever recorded
+    
+    uint64_t     num_dumped;    // # entries already dumped, or overwritten
+    
+    SLOT         slots[];
+    
+} RING;
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// logmsg_recorder_level - Process wide recording level - Part of public API
+
+LOGMSG_LEVEL logmsg_recorder_level = LOGMSG_LEVEL_NONE;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// List of all rings
+
+static RING* p_rings = NULL;
+
+static uint64_t ring_num_slots = 0;
+
+// Ring of calling thread
+
+static __thread RING* p_thread_ring = NULL;
+
+static __thread pid_t thread_tid = 0;
+
+// Releases ring on thread exit
+
+static pthread_key_t ring_key;
+
+// Dump file FD, or -1 to dump to log file
+
+static int dump_fd = -1;
+
+// Thread ID of thread dumping rings, or 0
+
+static pid_t dumping_tid = 0;
+
+// Signal dispositions replaced by the recorder
+
+static const int dump_signals[] = { SIGSEGV, SIGABRT, SIGBUS };
+
+#define NUM_DUMP_SIGNALS (sizeof(dump_signals) / sizeof(dump_signals[0]))
+
+static struct sigaction old_actions[NUM_DUMP_SIGNALS];
+
+// # ring allocation failures
+
+uint64_t num_record_failures = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    release_ring() - Release ring of exiting thread for reuse
+
+*******************************************************************************/
+
+static void release_ring(void* p_ring) {
+    
+    __atomic_store_n(&((RING*)p_ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    get_thread_ring() - Return ring of calling thread, obtaining one on its
+                        first recorded entry
+    
+    Return NULL on failure.
+
+*******************************************************************************/
+
+static RING* get_thread_ring(void) {
+    
+    if (p_thread_ring != NULL) {
+        
+        return p_thread_ring;
+    }
+    
+    /*
+     *  Reuse ring of exited thread, else allocate and publish new ring
+     */
+    
+    RING* p_ring = __atomic_load_n(&p_rings, __ATOMIC_ACQUIRE);
+    
+    for (; p_ring != NULL; p_ring = p_ring->p_next) {
+        
+        int in_use = 0;
+        
+        if (__atomic_compare_exchange_n(&p_ring->in_use, &in_use, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    
+    if (p_ring == NULL) {
+        
+        p_ring = (RING*)calloc(1, sizeof(RING) +
+                                      ring_num_slots * sizeof(SLOT));
+        
+        if (p_ring == NULL) {
+            
+            num_record_failures++;
+            
+            return NULL;
+        }
+        
+        p_ring->in_use = 1;
+        
+        p_ring->num_slots = ring_num_slots;
+        
+        p_ring->p_next = __atomic_load_n(&p_rings, __ATOMIC_RELAXED);
+        
+        while (!__atomic_compare_exchange_n(&p_rings, &p_ring->p_next, p_ring,
+                                            0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    
+    pthread_setspecific(ring_key, p_ring);
+    
+    p_thread_ring = p_ring;
+    
+    thread_tid = (pid_t)syscall(SYS_gettid);
+    
+    return p_ring;
+}
+
+/*******************************************************************************
+
+    begin_slot() - Claim the next slot of the calling thread's ring and
+                   fill in its header
+    
+    Return NULL on failure.
+
+*******************************************************************************/
+
+static SLOT* begin_slot(LOGMSG_LEVEL level, RING** pp_ring) {
+    
+    RING* p_ring = get_thread_ring();
+    
+    if (p_ring == NULL) {
+        
+        return NULL;
+    }
+    
+    uint64_t n = p_ring->num_entries;
+    
+    SLOT* p_slot = &p_ring->slots[n % p_ring->num_slots];
+    
+    __atomic_store_n(&p_slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    p_slot->timestamp = logmsg_clock_now();
+    
+    p_slot->tid = thread_tid;
+    
+    p_slot->level = (uint8_t)level;
+    
+    *pp_ring = p_ring;
+    
+    return p_slot;
+}
+
+/*******************************************************************************
+
+    end_slot() - Publish slot filled in after begin_slot()
+
+*******************************************************************************/
+
+static void end_slot(RING* p_ring, SLOT* p_slot) {
+    
+    uint64_t n = p_ring->num_entries;
+    
+    __atomic_store_n(&p_slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    
+    __atomic_store_n(&p_ring->num_entries, n + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    copy_slot() - Copy entry n of ring, if it has not been overwritten
+    
+    Return 0 on success, -1 if the entry is no longer in the ring.
+
+*******************************************************************************/
+
+static int copy_slot(const RING* p_ring, uint64_t n, SLOT* p_copy) {
+    
+    const SLOT* p_slot = &p_ring->slots[n % p_ring->num_slots];
+    
+    uint64_t seq = __atomic_load_n(&p_slot->seq, __ATOMIC_ACQUIRE);
+    
+    if (seq != 2 * n + 2) {
+        
+        return -1;
+    }
+    
+    memcpy(p_copy, p_slot, sizeof(SLOT));
+    
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    
+    return __atomic_load_n(&p_slot->seq, __ATOMIC_RELAXED) == seq ? 0 : -1;
+}
+
+/*******************************************************************************
+
+    put_entry() - Append log entry to dump buffer
+    
+    Description
+    ===========
+    
+    The entry is laid out like any other, according to the current layout.
+    The buffer must have room for DUMP_ENTRY_MAX_LEN characters; longer 
+    messages are truncated.
+    
+    Return pointer to the end of the entry.
+
+*******************************************************************************/
+
+static char* put_entry(char* p_write, const SLOT* p_slot, const char* message) {
+    
+    LOGMSG_HEADER header;
+    
+    logmsg_layout_set_header(&header,
+                             p_slot->level,
+                             logmsg_clock_to_utc_ns(p_slot->timestamp),
+                             p_slot->tid);
+    
+    /*
+     *  Message
+     */
+    
+    char message_buf[DUMP_MESSAGE_MAX_LEN + 1];
+    
+    const char* p_message = message;
+    
+    size_t message_len = 0;
+    
+    if (message != NULL) {
+        
+        message_len = strlen(message);
+        
+    } else if (p_slot->kind == SLOT_KIND_DEFERRED) {
+        
+        int len = logmsg_format_captured(message_buf,
+                                         sizeof(message_buf),
+                                         p_slot->payload + p_slot->args_len,
+                                         p_slot->payload);
+        
+        p_message = message_buf;
+        
+        message_len = len < 0 ? 0 :
+                          len > DUMP_MESSAGE_MAX_LEN ? DUMP_MESSAGE_MAX_LEN :
+                              len;
+                              
+    } else {
+        
+        p_message = (const char*)p_slot->payload;
+        
+        message_len = p_slot->text_len;
+    }
+    
+    p_write = logmsg_layout_write_prefix(p_write, &header);
+    
+    p_write = logmsg_layout_write_message(p_write, 
+                                          &header, 
+                                          p_message, 
+                                          message_len,
+                                          DUMP_MESSAGE_MAX_LEN);
+    
+    return logmsg_layout_write_suffix(p_write, &header);
+}
+
+/*******************************************************************************
+
+    flush_dump() - Write dump buffer to dump file, or log file or log server
+                   connection
+
+*******************************************************************************/
+
+static void flush_dump(int fd, const char* p_buffer, size_t len) {
+    
+    if (fd != dump_fd) {
+        
+        logmsg_write_log(p_buffer, len);
+        
+        return;
+    }
+    
+    while (len > 0) {
+        
+        ssize_t n_written = write(fd, p_buffer, len);
+        
+        if (n_written <= 0) {
+            
+            return;
+        }
+        
+        p_buffer += n_written;
+        
+        len -= n_written;
+    }
+}
+
+/*******************************************************************************
+
+    dump() - Write entries recorded since the previous dump, merged in time
+             order, between marker entries
+    
+    Description
+    ===========
+    
+    Uses only async-signal-safe functions, and no heap memory, so that it
+    may be called from a signal handler.
+
+*******************************************************************************/
+
+static void dump(LOGMSG_LEVEL marker_level, const char* reason) {
+    
+    /*
+     *  Let one thread dump at a time, and a thread which faults while
+     *  dumping not dump again
+     */
+    
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    
+    for (;;) {
+        
+        pid_t none = 0;
+        
+        if (__atomic_compare_exchange_n(&dumping_tid, &none, tid, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        
+        if (none == tid) {
+            
+            return;
+        }
+        
+        struct timespec delay = { 0, 1000000 };
+        
+        nanosleep(&delay, NULL);
+    }
+    
+    int fd = dump_fd >= 0 ? dump_fd : logmsg_get_logger_fd();
+    
+    if (fd >= 0) {
+        
+        char buffer[4096];
+        
+        char* p_write = buffer;
+        
+        char* p_end = buffer + sizeof(buffer);
+        
+        /*
+         *  Begin marker
+         */
+        
+        SLOT marker;
+        
+        marker.timestamp = logmsg_clock_now();
+        
+        marker.tid = tid;
+        
+        marker.level = (uint8_t)marker_level;
+        
+        marker.kind = SLOT_KIND_TEXT;
+        
+        char message[128];
+        
+        strcpy(message, "**** flight recorder dump begins: ");
+        
+        strncat(message, reason, 64);
+        
+        strcat(message, " ****");
+        
+        p_write = put_entry(p_write, &marker, message);
+        
+        /*
+         *  Start each ring at its oldest entry not yet dumped
+         */
+        
+        RING* p_list = __atomic_load_n(&p_rings, __ATOMIC_ACQUIRE);
+        
+        for (RING* p_ring = p_list; p_ring != NULL; p_ring = p_ring->p_next) {
+            
+            uint64_t num_entries =
+                __atomic_load_n(&p_ring->num_entries, __ATOMIC_ACQUIRE);
+            
+            if (num_entries > p_ring->num_slots &&
+                p_ring->num_dumped < num_entries - p_ring->num_slots) {
+                
+                p_ring->num_dumped = num_entries - p_ring->num_slots;
+            }
+        }
+        
+        /*
+         *  Repeatedly write the earliest next entry of all rings
+         */
+        
+        uint64_t num_written = 0;
+        
+        for (;;) {
+            
+            RING* p_earliest = NULL;
+            
+            SLOT earliest;
+            
+            for (RING* p_ring = p_list; p_ring != NULL; p_ring = p_ring->p_next) {
+                
+                SLOT slot;
+                
+                while (p_ring->num_dumped <
+                           __atomic_load_n(&p_ring->num_entries,
+                                           __ATOMIC_ACQUIRE)) {
+                    
+                    if (copy_slot(p_ring, p_ring->num_dumped, &slot) == 0) {
+                        
+                        if (p_earliest == NULL ||
+                            slot.timestamp < earliest.timestamp) {
+                            
+                            p_earliest = p_ring;
+                            
+                            earliest = slot;
+                        }
+                        
+                        break;
+                    }
+                    
+                    p_ring->num_dumped++;
+                }
+            }
+            
+            if (p_earliest == NULL) {
+                
+                break;
+            }
+            
+            p_earliest->num_dumped++;
+            
+            if (p_end - p_write < DUMP_ENTRY_MAX_LEN) {
+                
+                flush_dump(fd, buffer, p_write - buffer);
+                
+                p_write = buffer;
+            }
+            
+            p_write = put_entry(p_write, &earliest, NULL);
+            
+            num_written++;
+        }
+        
+        /*
+         *  End marker
+         */
+        
+        if (p_end - p_write < DUMP_ENTRY_MAX_LEN) {
+            
+            flush_dump(fd, buffer, p_write - buffer);
+            
+            p_write = buffer;
+        }
+        
+        strcpy(message, "**** flight recorder dump ends: ");
+        
+        char* p_count = logmsg_format_i64(message + strlen(message),
+                                          (int64_t)num_written);
+        
+        strcpy(p_count, " entries ****");
+        
+        p_write = put_entry(p_write, &marker, message);
+        
+        flush_dump(fd, buffer, p_write - buffer);
+    }
+    
+    __atomic_store_n(&dumping_tid, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    dump_signal_handler() - Dump rings, then let the signal take the effect
+                            it would have had without the recorder
+
+*******************************************************************************/
+
+static void dump_signal_handler(int sig, siginfo_t* p_info, void* p_context) {
+    
+    const char* reason = sig == SIGSEGV ? "SIGSEGV" :
+                             sig == SIGABRT ? "SIGABRT" : "SIGBUS";
+    
+    dump(LOGMSG_LEVEL_FATAL, reason);
+    
+    for (size_t i = 0; i < NUM_DUMP_SIGNALS; i++) {
+        
+        if (dump_signals[i] == sig) {
+            
+            sigaction(sig, &old_actions[i], NULL);
+        }
+    }
+    
+    raise(sig);
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_record_printf() - Record entry formatted by logmsg_printf()
+    
+    Description
+    ===========
+    
+    The arguments are captured, and the format copied, for formatting only
+    if the entry is dumped. Formats with conversions which cannot be cap-
+    tured, or which with their arguments do not fit in a slot, are for-
+    matted straight away, truncated if need be.
+
+*******************************************************************************/
+
+void logmsg_record_printf(LOGMSG_LEVEL level, const char* format, va_list ap) {
+    
+    RING* p_ring;
+    
+    SLOT* p_slot = begin_slot(level, &p_ring);
+    
+    if (p_slot == NULL) {
+        
+        return;
+    }
+    
+    va_list text_ap;
+    
+    va_copy(text_ap, ap);
+    
+    size_t format_len = strlen(format) + 1;
+    
+    ssize_t args_len = -1;
+    
+    if (format_len <= PAYLOAD_LEN) {
+        
+        args_len = logmsg_capture_args(p_slot->payload,
+                                       PAYLOAD_LEN - format_len,
+                                       format,
+                                       ap);
+    }
+    
+    if (args_len >= 0) {
+        
+        memcpy(p_slot->payload + args_len, format, format_len);
+        
+        p_slot->kind = SLOT_KIND_DEFERRED;
+        
+        p_slot->args_len = (uint16_t)args_len;
+        
+        p_slot->text_len = (uint16_t)format_len;
+        
+    } else {
+        
+        int len = logmsg_vsnprintf(p_slot->payload, PAYLOAD_LEN, format, text_ap);
+        
+        p_slot->kind = SLOT_KIND_TEXT;
+        
+        p_slot->text_len = len < 0 ? 0 :
+                               len >= PAYLOAD_LEN ? PAYLOAD_LEN - 1 : len;
+    }
+    
+    va_end(text_ap);
+    
+    end_slot(p_ring, p_slot);
+}
+
+/*******************************************************************************
+
+    logmsg_record_text() - Record entry with preformatted message, given in
+                           parts, truncated to fit a slot
+
+*******************************************************************************/
+
+void logmsg_record_text(LOGMSG_LEVEL level,
+                        const struct iovec* p_parts,
+                        int num_parts) {
+    
+    RING* p_ring;
+    
+    SLOT* p_slot = begin_slot(level, &p_ring);
+    
+    if (p_slot == NULL) {
+        
+        return;
+    }
+    
+    size_t message_len = 0;
+    
+    for (int i = 0; i < num_parts && message_len < PAYLOAD_LEN; i++) {
+        
+        size_t len = p_parts[i].iov_len;
+        
+        if (len > PAYLOAD_LEN - message_len) {
+            
+            len = PAYLOAD_LEN - message_len;
+        }
+        
+        memcpy(p_slot->payload + message_len, p_parts[i].iov_base, len);
+        
+        message_len += len;
+    }
+    
+    p_slot->kind = SLOT_KIND_TEXT;
+    
+    p_slot->text_len = (uint16_t)message_len;
+    
+    end_slot(p_ring, p_slot);
+}
+
+/*******************************************************************************
+
+    logmsg_dump_recorder_fatal() - Write recorded entries, if recording, 
+                                   before a FATAL entry
+    
+*******************************************************************************/
+
+void logmsg_dump_recorder_fatal(void) {
+    
+    if (ring_num_slots > 0) {
+    
+        logmsg_flush();
+        
+        dump(LOGMSG_LEVEL_FATAL, "FATAL entry");
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_recorder_after_fork_child() - Forget the parent's entries and
+                                         threads, in a child process
+    
+    Description
+    ===========
+    
+    The entries recorded before fork() are left for the parent to dump,
+    and the rings of threads which do not exist in the child are released
+    for reuse. The calling thread keeps its ring, with its new thread ID.
+
+*******************************************************************************/
+
+void logmsg_recorder_after_fork_child(void) {
+    
+    for (RING* p_ring = p_rings; p_ring != NULL; p_ring = p_ring->p_next) {
+        
+        p_ring->num_dumped = p_ring->num_entries;
+        
+        p_ring->in_use = p_ring == p_thread_ring;
+    }
+    
+    if (p_thread_ring != NULL) {
+        
+        thread_tid = (pid_t)syscall(SYS_gettid);
+    }
+    
+    dumping_tid = 0;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_start_recorder() - Start recording entries too detailed for the
+                              log file
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_start_recorder(LOGMSG_LEVEL level,
+                          size_t ring_len,
+                          const char* dump_spec) {
+    
+    /*
+     *  Check for recorder already started, or invalid arguments
+     */
+    
+    if (ring_num_slots > 0 ||
+        level <= LOGMSG_LEVEL_NONE || level > LOGMSG_LEVEL_MAX) {
+        
+        return -1;
+    }
+    
+    if (ring_len == 0) {
+        
+        ring_len = DEFAULT_RING_LEN;
+    }
+    
+    if (ring_len / sizeof(SLOT) < 2) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Open dump file, if not dumping to the log file
+     */
+    
+    if (dump_spec != NULL) {
+        
+        mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+        
+        dump_fd = open(dump_spec, O_CREAT | O_APPEND | O_WRONLY, mode);
+        
+        if (dump_fd < 0) {
+            
+            return -1;
+        }
+    }
+    
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Dump on crash
+     */
+    
+    struct sigaction action;
+    
+    memset(&action, 0, sizeof(action));
+    
+    action.sa_sigaction = dump_signal_handler;
+    
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    
+    sigemptyset(&action.sa_mask);
+    
+    for (size_t i = 0; i < NUM_DUMP_SIGNALS; i++) {
+        
+        sigaction(dump_signals[i], &action, &old_actions[i]);
+    }
+    
+    ring_num_slots = ring_len / sizeof(SLOT);
+    
+    logmsg_recorder_level = level;
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_dump_recorder() - Write recorded entries
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_dump_recorder(void) {
+    
+    if (ring_num_slots > 0) {
+        
+        logmsg_flush();
+        
+        dump(LOGMSG_LEVEL_INFO, "requested");
+    }
+}
@@ -0,0 +1,429 @@
+/*******************************************************************************
+
+    logmsg_shard.c - Shard files, written without contention between writers
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <limits.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    SHARD - Shard file of one thread
+    
+    Description
+    ===========
+    
+    Shards are never freed. When a thread exits its shard file is closed, 
+    and the shard released for reuse by a later thread.
+
+*******************************************************************************/
+
+typedef struct SHARD {
+    
+    struct SHARD* p_next;
+    
+    int           in_use;
+    
+    int           fd;           // Shard file FD, or -1 if not open
+    
+} SHARD;
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// Sharding of the log file, as a LOGMSG_SHARDING
+
+int logmsg_sharding = LOGMSG_SHARDING_NONE;
+
+// # shard allocation and open failures
+
+uint64_t num_shard_failures = 0;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Log file spec, to which shard suffixes are added, or NULL if not open
+
+static char* p_log_spec = NULL;
+
+// List of all shards
+
+static SHARD* p_shards = NULL;
+
+// Shard of calling thread
+
+static __thread SHARD* p_thread_shard = NULL;
+
+// Releases shard on thread exit
+
+static pthread_key_t shard_key;
+
+static int shard_key_created = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    open_shard_file() - Open shard file of calling process, or thread
+    
+    Return FD on success, -1 on failure.
+
+*******************************************************************************/
+
+static int open_shard_file(void) {
+    
+    char shard_spec[PATH_MAX];
+    
+    int len;
+    
+    if (logmsg_sharding == LOGMSG_SHARDING_THREAD) {
+        
+        len = snprintf(shard_spec, sizeof(shard_spec), "%s.%d.%d",
+                       p_log_spec, (int)getpid(), (int)syscall(SYS_gettid));
+        
+    } else {
+        
+        len = snprintf(shard_spec, sizeof(shard_spec), "%s.%d",
+                       p_log_spec, (int)getpid());
+    }
+    
+    if (len < 0 || len >= (int)sizeof(shard_spec)) {
+        
+        return -1;
+    }
+    
+    mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+    
+    return open(shard_spec, O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC, mode);
+}
+
+/*******************************************************************************
+
+    release_shard() - Close shard file of exiting thread, and release shard
+                      for reuse
+
+*******************************************************************************/
+
+static void release_shard(void* p_shard) {
+    
+    SHARD* p_released = (SHARD*)p_shard;
+    
+    if (p_released->fd >= 0) {
+        
+        close(p_released->fd);
+        
+        p_released->fd = -1;
+    }
+    
+    __atomic_store_n(&p_released->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    get_thread_shard() - Return shard of calling thread, obtaining one on
+                         its first write
+    
+    Return NULL on failure.
+
+*******************************************************************************/
+
+static SHARD* get_thread_shard(void) {
+    
+    if (p_thread_shard != NULL) {
+        
+        return p_thread_shard;
+    }
+    
+    /*
+     *  Reuse shard of exited thread, else allocate and publish new shard
+     */
+    
+    SHARD* p_shard = __atomic_load_n(&p_shards, __ATOMIC_ACQUIRE);
+    
+    for (; p_shard != NULL; p_shard = p_shard->p_next) {
+        
+        int in_use = 0;
+        
+        if (__atomic_compare_exchange_n(&p_shard->in_use, &in_use, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    
+    if (p_shard == NULL) {
+        
+        p_shard = (SHARD*)calloc(1, sizeof(SHARD));
+        
+        if (p_shard == NULL) {
+            
+            return NULL;
+        }
+        
+        p_shard->in_use = 1;
+        
+        p_shard->fd = -1;
+        
+        p_shard->p_next = __atomic_load_n(&p_shards, __ATOMIC_RELAXED);
+        
+        while (!__atomic_compare_exchange_n(&p_shards, &p_shard->p_next,
+                                            p_shard, 0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    
+    pthread_setspecific(shard_key, p_shard);
+    
+    p_thread_shard = p_shard;
+    
+    return p_shard;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_shard_open() - Open shard file of calling process, or thread, of
+                          the log file log_spec
+    
+    Return FD on success, -1 on failure.
+
+*******************************************************************************/
+
+int logmsg_shard_open(const char* log_spec) {
+    
+    if (!shard_key_created) {
+        
+        if (pthread_key_create(&shard_key, release_shard) != 0) {
+            
+            return -1;
+        }
+        
+        shard_key_created = 1;
+    }
+    
+    char* p_spec = strdup(log_spec);
+    
+    if (p_spec == NULL) {
+        
+        return -1;
+    }
+    
+    free(p_log_spec);
+    
+    p_log_spec = p_spec;
+    
+    int fd = open_shard_file();
+    
+    if (fd < 0) {
+        
+        free(p_log_spec);
+        
+        p_log_spec = NULL;
+    }
+    
+    return fd;
+}
+
+/*******************************************************************************
+
+    logmsg_shard_get_fd() - Return FD of shard file of calling thread, or 
+                            logger_fd if the log file is not sharded by 
+                            thread
+    
+    Description
+    ===========
+    
+    The shard file is opened on the first write of each thread. Should that
+    fail, logger_fd is returned, so that the entries are written to the 
+    shard file of the thread which opened the log file.
+
+*******************************************************************************/
+
+int logmsg_shard_get_fd(int logger_fd) {
+    
+    if (logmsg_sharding != LOGMSG_SHARDING_THREAD || p_log_spec == NULL) {
+        
+        return logger_fd;
+    }
+    
+    SHARD* p_shard = get_thread_shard();
+    
+    if (p_shard == NULL) {
+        
+        num_shard_failures++;
+        
+        return logger_fd;
+    }
+    
+    if (p_shard->fd < 0) {
+        
+        p_shard->fd = open_shard_file();
+        
+        if (p_shard->fd < 0) {
+            
+            num_shard_failures++;
+            
+            return logger_fd;
+        }
+    }
+    
+    return p_shard->fd;
+}
+
+/*******************************************************************************
+
+    logmsg_shard_after_fork_child() - Switch to shard files of the child 
+                                      process
+    
+    Description
+    ===========
+    
+    The log file FD is pointed at a shard file named for the child, and the 
+    shard files of the parent's threads are closed, the calling thread's 
+    being reopened on its next write.
+
+*******************************************************************************/
+
+void logmsg_shard_after_fork_child(void) {
+    
+    int logger_fd = logmsg_get_logger_fd();
+    
+    if (p_log_spec == NULL || logger_fd < 0) {
+        
+        return;
+    }
+    
+    int fd = open_shard_file();
+    
+    if (fd < 0 || dup3(fd, logger_fd, O_CLOEXEC) < 0) {
+        
+        num_shard_failures++;
+    }
+    
+    if (fd >= 0) {
+        
+        close(fd);
+    }
+    
+    for (SHARD* p_shard = p_shards;
+         p_shard != NULL;
+         p_shard = p_shard->p_next) {
+        
+        if (p_shard->fd >= 0) {
+            
+            close(p_shard->fd);
+            
+            p_shard->fd = -1;
+        }
+        
+        p_shard->in_use = (p_shard == p_thread_shard);
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_set_sharding() - Select sharding of the log file
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_set_sharding(LOGMSG_SHARDING sharding) {
+    
+    if (logmsg_get_logger_fd() >= 0 ||
+        (sharding != LOGMSG_SHARDING_NONE &&
+         sharding != LOGMSG_SHARDING_PROCESS &&
+         sharding != LOGMSG_SHARDING_THREAD) ||
+        (sharding == LOGMSG_SHARDING_THREAD && logmsg_writer_is_started())) {
+        
+        return -1;
+    }
+    
+    logmsg_sharding = sharding;
+    
+    return 0;
+}
@@ -0,0 +1,1906 @@
+/*******************************************************************************
+
+    logmsg_sink.c - Additional log destinations, and the writer thread which
+                    delivers entries to them
+    
+    -----------------------------------------------------------------------
+    
+    Copyright 2018 Paul Alexander
+    
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+    
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+    
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+    
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+    
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <errno.h>
+
+#include <time.h>
+
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sched.h>
+
+#include <fcntl.h>
+
+#include <netdb.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/socket.h>
+
+#include <sys/uio.h>
+
+#include <sys/un.h>
+
+#include <sys/syscall.h>
+
+#include <sys/sysinfo.h>
+
+#include <linux/futex.h>
+
+#include <linux/membarrier.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Default length of each memory sink
+
+#define DEFAULT_MEMORY_SINK_LEN (64 * 1024)
+
+// Default length of the writer queue
+
+#define DEFAULT_QUEUE_LEN (1024 * 1024)
+
+// Longest time the writer thread sleeps without checking the queue
+
+#define WRITER_TIMEOUT_NS 100000000
+
+// Longest time the writer thread polls for entries before sleeping
+
+#define WRITER_SPIN_MAX_NS 50000
+
+// Batch of entries the writer thread lingers for, when entries arrive in
+// a steady stream, and the longest time it lingers
+
+#define WRITER_LINGER_ENTRIES 16
+
+#define WRITER_LINGER_MAX_NS 20000
+
+// Longest entry in parts gathered to be appended to a per-CPU buffer
+
+#define PER_CPU_GATHER_MAX_LEN 4096
+
+// Kinds of sink
+
+#define SINK_KIND_FD     1      // File, or stderr
+
+#define SINK_KIND_SOCKET 2      // Connection to log server
+
+#define SINK_KIND_MEMORY 3      // Ring in memory
+
+// States of queued record
+
+#define RECORD_EMPTY   0
+
+#define RECORD_ENTRY   1        // Entry, to be delivered
+
+#define RECORD_PADDING 2        // Unused space at the end of the queue
+
+/*******************************************************************************
+
+    SINK - Log destination, in addition to the log file
+
+*******************************************************************************/
+
+typedef struct SINK {
+    
+    int          kind;
+    
+    LOGMSG_LEVEL level;         // Highest level of entry written
+    
+    int          fd;
+    
+    char*        p_ring;        // SINK_KIND_MEMORY: ring, and its length
+    
+    size_t       ring_len;
+    
+    uint64_t     ring_pos;      // # bytes ever written to ring
+    
+    int          ring_lock;
+    
+} SINK;
+
+/*******************************************************************************
+
+    ASYNC_FLUSH - Flush requested by logmsg_flush_async(), complete once 
+                  the writer's progress reaches end_progress
+
+*******************************************************************************/
+
+typedef struct ASYNC_FLUSH {
+    
+    uint64_t end_progress;
+    
+    int      fd;                // Duplicate of caller's eventfd
+    
+} ASYNC_FLUSH;
+
+/*******************************************************************************
+
+    RECORD_HEADER - Header of entry in writer queue, followed by the entry,
+                    padded to a multiple of 8 bytes
+
+*******************************************************************************/
+
+typedef struct RECORD_HEADER {
+    
+    uint32_t state;
+    
+    uint32_t level;
+    
+    uint64_t entry_len;
+    
+} RECORD_HEADER;
+
+/*******************************************************************************
+
+    Program-wide variable declarations
+
+*******************************************************************************/
+
+// # open log file failures, and # log server connect failures, in logmsg.c
+
+extern uint64_t num_open_failures;
+
+extern uint64_t num_conn_failures;
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// # sinks added
+
+int logmsg_num_sinks = 0;
+
+// # sink write failures
+
+uint64_t num_sink_failures = 0;
+
+// # times a caller waited for the writer thread to free queue space
+
+uint64_t num_queue_overflows = 0;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// Sinks. Each is filled in before logmsg_num_sinks is raised to include it,
+// so that entries being written by other threads never see a partly added
+// sink.
+
+static SINK sinks[LOGMSG_MAX_SINKS];
+
+static pthread_mutex_t sinks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Writer queue. Producers reserve space by advancing reserve_pos, and the
+// writer thread frees it by advancing read_pos; both count bytes ever
+// used, and the queue is indexed by their low bits.
+
+static char* p_queue = NULL;
+
+static size_t queue_len = 0;
+
+static uint64_t reserve_pos = 0;
+
+static uint64_t read_pos = 0;
+
+static int writer_started = 0;
+
+static pthread_t writer_thread;
+
+// Set if entries are appended to per-CPU buffers instead of the queue, in
+// which case logmsg_flush() waits for num_passes, the # times the writer
+// thread has drained the buffers, to advance.
+
+static int writer_per_cpu = 0;
+
+// Set if the writer thread, having set writer_parked, orders it before
+// the commits of per-CPU producers with membarrier(), so that they need
+// only a compiler barrier before checking it
+
+static int writer_membarrier = 0;
+
+static uint64_t num_passes = 0;
+
+// When the queue is empty, the writer thread polls briefly, then sleeps
+// on the writer_parked futex, having set it, and producers wake it only
+// if it is set. logmsg_flush() waits on flushed_cond.
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t flushed_cond = PTHREAD_COND_INITIALIZER;
+
+static uint32_t writer_parked = 0;
+
+static int num_flush_waiters = 0;
+
+// Set if the writer thread may poll by spinning, rather than yielding
+
+static int writer_may_spin = 0;
+
+// Pending flushes requested by logmsg_flush_async(), in order of
+// end_progress, guarded by writer_mutex
+
+static ASYNC_FLUSH async_flushes[LOGMSG_MAX_ASYNC_FLUSHES];
+
+static int num_async_flushes = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    add_sink() - Add sink, filled in from *p_sink
+    
+    Return number of the sink on success, -1 if there are too many.
+
+*******************************************************************************/
+
+static int add_sink(const SINK* p_sink) {
+    
+    pthread_mutex_lock(&sinks_mutex);
+    
+    int sink = logmsg_num_sinks;
+    
+    if (sink < LOGMSG_MAX_SINKS) {
+        
+        sinks[sink] = *p_sink;
+        
+        __atomic_store_n(&logmsg_num_sinks, sink + 1, __ATOMIC_RELEASE);
+        
+    } else {
+        
+        sink = -1;
+    }
+    
+    pthread_mutex_unlock(&sinks_mutex);
+    
+    return sink;
+}
+
+/*******************************************************************************
+
+    append_memory() - Append text to ring of memory sink, which is locked
+
+*******************************************************************************/
+
+static void append_memory(SINK* p_sink, const char* p_entry, size_t entry_len) {
+    
+    if (entry_len > p_sink->ring_len) {
+        
+        p_entry += entry_len - p_sink->ring_len;
+        
+        entry_len = p_sink->ring_len;
+    }
+    
+    size_t offset = p_sink->ring_pos % p_sink->ring_len;
+    
+    size_t first_len = p_sink->ring_len - offset;
+    
+    if (first_len > entry_len) {
+        
+        first_len = entry_len;
+    }
+    
+    memcpy(p_sink->p_ring + offset, p_entry, first_len);
+    
+    memcpy(p_sink->p_ring, p_entry + first_len, entry_len - first_len);
+    
+    p_sink->ring_pos += entry_len;
+}
+
+/*******************************************************************************
+
+    write_memory() - Append entries to ring of memory sink, together
+    
+    Description
+    ===========
+    
+    In a signal handler, the entries are dropped if the ring is in use, 
+    rather than risk waiting for the interrupted thread.
+
+*******************************************************************************/
+
+static void write_memory(SINK* p_sink,
+                         const struct iovec* p_entries,
+                         int num_entries,
+                         int signal_safe) {
+    
+    while (__atomic_exchange_n(&p_sink->ring_lock, 1, __ATOMIC_ACQUIRE)) {
+        
+        if (signal_safe) {
+            
+            return;
+        }
+        
+        sched_yield();
+    }
+    
+    for (int i = 0; i < num_entries; i++) {
+        
+        append_memory(p_sink, 
+                      (const char*)p_entries[i].iov_base, 
+                      p_entries[i].iov_len);
+    }
+    
+    __atomic_store_n(&p_sink->ring_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    deliver_queued() - Deliver entries in the queue, up to end_pos
+    
+    Return number of entries delivered.
+
+*******************************************************************************/
+
+static int deliver_queued(uint64_t end_pos) {
+    
+    int num_delivered = 0;
+    
+    uint64_t pos = read_pos;
+    
+    while (pos != end_pos) {
+        
+        /*
+         *  Collect batch of entries
+         */
+        
+        LOGMSG_LEVEL levels[LOGMSG_BATCH_MAX_ENTRIES];
+        
+        struct iovec entries[LOGMSG_BATCH_MAX_ENTRIES];
+        
+        int num_entries = 0;
+        
+        uint64_t batch_pos = pos;
+        
+        while (pos != end_pos && num_entries < LOGMSG_BATCH_MAX_ENTRIES) {
+        
+            RECORD_HEADER* p_record =
+                (RECORD_HEADER*)(p_queue + (pos & (queue_len - 1)));
+            
+            /*
+             *  Wait for producer to finish copying entry in, if need be
+             */
+            
+            uint32_t state;
+            
+            for (;;) {
+                
+                state = __atomic_load_n(&p_record->state, __ATOMIC_ACQUIRE);
+                
+                if (state != RECORD_EMPTY) {
+                    
+                    break;
+                }
+                
+                sched_yield();
+            }
+            
+            if (state == RECORD_PADDING) {
+                
+                pos += queue_len - (pos & (queue_len - 1));
+                
+                continue;
+            }
+            
+            levels[num_entries] = (LOGMSG_LEVEL)p_record->level;
+            
+            entries[num_entries].iov_base = p_record + 1;
+            
+            entries[num_entries].iov_len = p_record->entry_len;
+            
+            num_entries++;
+            
+            pos += sizeof(RECORD_HEADER) + 
+                       ((p_record->entry_len + 7) & ~(uint64_t)7);
+        }
+        
+        logmsg_deliver_entries(levels, entries, num_entries);
+        
+        num_delivered += num_entries;
+        
+        /*
+         *  Clear records, so that no later header is found already set,
+         *  and free their space
+         */
+        
+        while (batch_pos != pos) {
+        
+            size_t offset = batch_pos & (queue_len - 1);
+            
+            size_t len = pos - batch_pos;
+            
+            if (len > queue_len - offset) {
+            
+                len = queue_len - offset;
+            }
+            
+            memset(p_queue + offset, 0, len);
+            
+            batch_pos += len;
+        }
+        
+        __atomic_store_n(&read_pos, pos, __ATOMIC_RELEASE);
+    }
+    
+    return num_delivered;
+}
+
+/*******************************************************************************
+
+    get_time_ns() - Return monotonic clock time, in nsecs
+
+*******************************************************************************/
+
+static uint64_t get_time_ns(void) {
+    
+    struct timespec time_ns;
+    
+    clock_gettime(CLOCK_MONOTONIC, &time_ns);
+    
+    return (uint64_t)time_ns.tv_sec * 1000000000 + time_ns.tv_nsec;
+}
+
+/*******************************************************************************
+
+    wake_writer() - Wake writer thread if parked
+    
+    Description
+    ===========
+    
+    The futex is only woken by the producer which clears writer_parked, so
+    that a burst of entries costs one system call.
+
+*******************************************************************************/
+
+static void wake_writer(void) {
+    
+    if (__atomic_load_n(&writer_parked, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&writer_parked, 0, __ATOMIC_SEQ_CST)) {
+        
+        syscall(SYS_futex, &writer_parked, FUTEX_WAKE_PRIVATE, 1,
+                NULL, NULL, 0);
+    }
+}
+
+/*******************************************************************************
+
+    writer_is_idle() - Determine whether the writer thread has nothing to
+                       do, with no entries to deliver and no flush pending
+
+*******************************************************************************/
+
+static int writer_is_idle(void) {
+    
+    if (__atomic_load_n(&num_flush_waiters, __ATOMIC_SEQ_CST) > 0 ||
+        __atomic_load_n(&num_async_flushes, __ATOMIC_SEQ_CST) > 0) {
+        
+        return 0;
+    }
+    
+    return writer_per_cpu ?
+        logmsg_percpu_is_empty() :
+        __atomic_load_n(&reserve_pos, __ATOMIC_SEQ_CST) == read_pos;
+}
+
+/*******************************************************************************
+
+    deliver_pending() - Deliver entries queued so far
+    
+    Return number of entries delivered.
+
+*******************************************************************************/
+
+static int deliver_pending(void) {
+    
+    if (writer_per_cpu) {
+        
+        int num_delivered = logmsg_percpu_drain();
+        
+        __atomic_store_n(&num_passes, num_passes + 1, __ATOMIC_RELEASE);
+        
+        return num_delivered;
+    }
+    
+    uint64_t end_pos = __atomic_load_n(&reserve_pos, __ATOMIC_ACQUIRE);
+    
+    return end_pos != read_pos ? deliver_queued(end_pos) : 0;
+}
+
+/*******************************************************************************
+
+    get_flush_end() - Return the writer's progress at which entries already
+                      written are flushed
+    
+    Description
+    ===========
+    
+    Progress is the read position of the queue or, with per-CPU buffers,
+    the number of passes, of which two more are needed, the second
+    starting after the entries to be flushed were committed.
+
+*******************************************************************************/
+
+static uint64_t get_flush_end(void) {
+    
+    return writer_per_cpu ?
+        __atomic_load_n(&num_passes, __ATOMIC_ACQUIRE) + 2 :
+        __atomic_load_n(&reserve_pos, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+
+    is_flushed() - Determine whether the writer's progress has reached
+                   end_progress
+
+*******************************************************************************/
+
+static int is_flushed(uint64_t end_progress) {
+    
+    uint64_t progress = writer_per_cpu ?
+        __atomic_load_n(&num_passes, __ATOMIC_ACQUIRE) :
+        __atomic_load_n(&read_pos, __ATOMIC_ACQUIRE);
+    
+    return (int64_t)(progress - end_progress) >= 0;
+}
+
+/*******************************************************************************
+
+    signal_flushed() - Signal eventfd of completed asynchronous flush, and
+                       close the library's duplicate of it
+
+*******************************************************************************/
+
+static void signal_flushed(int fd) {
+    
+    uint64_t count = 1;
+    
+    if (write(fd, &count, sizeof(count)) != sizeof(count)) {
+        
+        num_sink_failures++;
+    }
+    
+    close(fd);
+}
+
+/*******************************************************************************
+
+    complete_async_flushes() - Signal the asynchronous flushes which the
+                               writer's progress has reached
+
+*******************************************************************************/
+
+static void complete_async_flushes(void) {
+    
+    int fds[LOGMSG_MAX_ASYNC_FLUSHES];
+    
+    int num_completed = 0;
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    while (num_completed < num_async_flushes &&
+           is_flushed(async_flushes[num_completed].end_progress)) {
+        
+        fds[num_completed] = async_flushes[num_completed].fd;
+        
+        num_completed++;
+    }
+    
+    memmove(async_flushes,
+            async_flushes + num_completed,
+            (num_async_flushes - num_completed) * sizeof(ASYNC_FLUSH));
+    
+    __atomic_store_n(&num_async_flushes,
+                     num_async_flushes - num_completed,
+                     __ATOMIC_RELAXED);
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    if (num_completed > 0) {
+        
+        logmsg_durable_flush();
+        
+        for (int i = 0; i < num_completed; i++) {
+            
+            signal_flushed(fds[i]);
+        }
+    }
+}
+
+/*******************************************************************************
+
+    poll_writer() - Wait up to wait_ns for the writer thread to have work,
+                    or, with wait_for_work clear, for wait_ns unless a flush
+                    is waiting
+    
+    Return 1 if there is work, 0 if not.
+
+*******************************************************************************/
+
+static int poll_writer(uint64_t wait_ns, int wait_for_work) {
+    
+    uint64_t start_ns = get_time_ns();
+    
+    for (;;) {
+        
+        if (wait_for_work ?
+                !writer_is_idle() :
+                __atomic_load_n(&num_flush_waiters, __ATOMIC_RELAXED) > 0) {
+            
+            return 1;
+        }
+        
+        if (get_time_ns() - start_ns >= wait_ns) {
+            
+            return 0;
+        }
+        
+        /*
+         *  Spin if producers may run meanwhile on other CPUs, else give
+         *  way to them
+         */
+        
+        if (writer_may_spin) {
+
+#if defined(__x86_64__) || defined(__i386__)
+
+            __builtin_ia32_pause();
+
+#endif
+
+        } else {
+            
+            sched_yield();
+        }
+    }
+}
+
+/*******************************************************************************
+
+    park_writer() - Sleep until woken by a producer or a flush, or the
+                    timeout expires, unless work arrives meanwhile
+
+*******************************************************************************/
+
+static void park_writer(void) {
+    
+    __atomic_store_n(&writer_parked, 1, __ATOMIC_SEQ_CST);
+    
+    if (writer_membarrier) {
+        
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    }
+    
+    if (writer_is_idle()) {
+        
+        struct timespec timeout;
+        
+        timeout.tv_sec = 0;
+        
+        timeout.tv_nsec = WRITER_TIMEOUT_NS;
+        
+        syscall(SYS_futex, &writer_parked, FUTEX_WAIT_PRIVATE, 1,
+                &timeout, NULL, 0);
+    }
+    
+    __atomic_store_n(&writer_parked, 0, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+
+    run_writer() - Deliver queued entries, until the process exits
+    
+    Description
+    ===========
+    
+    The writer thread keeps an average of the time between entries. While
+    entries arrive in a steady stream, it lingers after a small batch for
+    the next WRITER_LINGER_ENTRIES to arrive, so that they are written
+    together. When the queue empties, it polls for about two average gaps
+    before parking, so that a burst costs no wakeups, but parks at once
+    when logging is idle.
+
+*******************************************************************************/
+
+static void* run_writer(void* p_arg) {
+    
+    uint64_t arrival_gap_ns = WRITER_TIMEOUT_NS;
+    
+    uint64_t last_delivery_ns = get_time_ns();
+    
+    for (;;) {
+        
+        int num_delivered = deliver_pending();
+        
+        if (__atomic_load_n(&num_async_flushes, __ATOMIC_RELAXED) > 0) {
+            
+            complete_async_flushes();
+        }
+        
+        if (num_delivered > 0) {
+            
+            /*
+             *  Update average gap, over the time since the last entries
+             *  were delivered, including any time parked, up to the
+             *  timeout
+             */
+            
+            uint64_t now_ns = get_time_ns();
+            
+            uint64_t gap_ns = (now_ns - last_delivery_ns) / num_delivered;
+            
+            if (gap_ns > WRITER_TIMEOUT_NS) {
+                
+                gap_ns = WRITER_TIMEOUT_NS;
+            }
+            
+            arrival_gap_ns += ((int64_t)gap_ns - (int64_t)arrival_gap_ns) / 4;
+            
+            last_delivery_ns = now_ns;
+            
+            if (__atomic_load_n(&num_flush_waiters, __ATOMIC_RELAXED) > 0) {
+                
+                pthread_mutex_lock(&writer_mutex);
+                
+                pthread_cond_broadcast(&flushed_cond);
+                
+                pthread_mutex_unlock(&writer_mutex);
+                
+            } else if (num_delivered < WRITER_LINGER_ENTRIES &&
+                       arrival_gap_ns * WRITER_LINGER_ENTRIES <=
+                           WRITER_LINGER_MAX_NS) {
+                
+                poll_writer(arrival_gap_ns *
+                                (WRITER_LINGER_ENTRIES - num_delivered),
+                            0);
+            }
+            
+            continue;
+        }
+        
+        /*
+         *  Queue is empty: wake any flushing threads, giving way to them,
+         *  then poll while entries are expected soon, else park until a
+         *  producer wakes the thread
+         */
+        
+        if (__atomic_load_n(&num_flush_waiters, __ATOMIC_RELAXED) > 0) {
+            
+            pthread_mutex_lock(&writer_mutex);
+            
+            pthread_cond_broadcast(&flushed_cond);
+            
+            pthread_mutex_unlock(&writer_mutex);
+            
+            sched_yield();
+            
+            continue;
+        }
+        
+        if (2 * arrival_gap_ns <= WRITER_SPIN_MAX_NS &&
+            poll_writer(2 * arrival_gap_ns, 1)) {
+            
+            continue;
+        }
+        
+        park_writer();
+    }
+    
+    return NULL;
+}
+
+/*******************************************************************************
+
+    flush_at_exit() - Deliver entries still queued when the process exits
+
+*******************************************************************************/
+
+static void flush_at_exit(void) {
+    
+    logmsg_flush();
+}
+
+/*******************************************************************************
+
+    start_writer_thread() - Start writer thread, with writer_mutex held
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int start_writer_thread(void) {
+    
+    writer_may_spin = get_nprocs() > 1;
+    
+    if (pthread_create(&writer_thread, NULL, run_writer, NULL) != 0) {
+        
+        return -1;
+    }
+    
+    atexit(flush_at_exit);
+    
+    __atomic_store_n(&writer_started, 1, __ATOMIC_RELEASE);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    queue_per_cpu() - Append entry to buffer of current CPU, waiting for 
+                      space if need be
+    
+    Return 0 if queued, -1 if the entry is to be delivered by the caller.
+
+*******************************************************************************/
+
+static int queue_per_cpu(LOGMSG_LEVEL level,
+                         const char* p_entry,
+                         size_t entry_len) {
+    
+    for (;;) {
+        
+        int status = logmsg_percpu_append(level, p_entry, entry_len);
+        
+        if (status == 0) {
+            
+            /*
+             *  The entry is committed with a release store, which may be
+             *  ordered after the load of writer_parked, so that the writer
+             *  thread could park without seeing it and without being woken;
+             *  it sets writer_parked before checking the buffers in turn.
+             *  Unless the writer thread then forces a barrier on every 
+             *  thread with membarrier(), a full fence is needed here.
+             */
+            
+            if (writer_membarrier) {
+                
+                __atomic_signal_fence(__ATOMIC_SEQ_CST);
+                
+            } else {
+                
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            }
+            
+            wake_writer();
+            
+            return 0;
+        }
+        
+        if (status < 0) {
+            
+            logmsg_flush();
+            
+            return -1;
+        }
+        
+        num_queue_overflows++;
+        
+        wake_writer();
+        
+        sched_yield();
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_open_socket() - Connect to log server
+    
+    Description
+    ===========
+    
+    The server is given as <host>:<port> for TCP, or by the path of a UNIX
+    domain stream socket, recognized by containing a '/'.
+    
+    Return FD of the connection on success, -1 on failure.
+
+*******************************************************************************/
+
+int logmsg_open_socket(const char* server_spec) {
+    
+    if (strchr(server_spec, '/') != NULL) {
+        
+        struct sockaddr_un address;
+        
+        memset(&address, 0, sizeof(address));
+        
+        address.sun_family = AF_UNIX;
+        
+        if (strlen(server_spec) >= sizeof(address.sun_path)) {
+            
+            return -1;
+        }
+        
+        strcpy(address.sun_path, server_spec);
+        
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        
+        if (fd < 0) {
+            
+            return -1;
+        }
+        
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            
+            close(fd);
+            
+            return -1;
+        }
+        
+        return fd;
+    }
+    
+    /*
+     *  Split <host>:<port>, and resolve
+     */
+    
+    const char* p_colon = strrchr(server_spec, ':');
+    
+    if (p_colon == NULL || p_colon == server_spec ||
+        p_colon - server_spec >= NI_MAXHOST) {
+        
+        return -1;
+    }
+    
+    char host[NI_MAXHOST];
+    
+    memcpy(host, server_spec, p_colon - server_spec);
+    
+    host[p_colon - server_spec] = '\0';
+    
+    struct addrinfo hints;
+    
+    memset(&hints, 0, sizeof(hints));
+    
+    hints.ai_family = AF_UNSPEC;
+    
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo* p_addresses;
+    
+    if (getaddrinfo(host, p_colon + 1, &hints, &p_addresses) != 0) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Connect to first address which accepts
+     */
+    
+    int fd = -1;
+    
+    for (struct addrinfo* p_address = p_addresses;
+         p_address != NULL;
+         p_address = p_address->ai_next) {
+        
+        fd = socket(p_address->ai_family,
+                    p_address->ai_socktype | SOCK_CLOEXEC,
+                    p_address->ai_protocol);
+        
+        if (fd < 0) {
+            
+            continue;
+        }
+        
+        if (connect(fd, p_address->ai_addr, p_address->ai_addrlen) == 0) {
+            
+            break;
+        }
+        
+        close(fd);
+        
+        fd = -1;
+    }
+    
+    freeaddrinfo(p_addresses);
+    
+    return fd;
+}
+
+/*******************************************************************************
+
+    logmsg_write_entries() - Write entries to file or socket with a single
+                             writev(), or sendmsg()
+    
+    Description
+    ===========
+    
+    Uses only async-signal-safe functions.
+    
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+int logmsg_write_entries(int fd, 
+                         int is_socket,
+                         const struct iovec* p_entries, 
+                         int num_entries) {
+    
+    size_t len = 0;
+    
+    for (int i = 0; i < num_entries; i++) {
+        
+        len += p_entries[i].iov_len;
+    }
+    
+    ssize_t n_written;
+    
+    if (is_socket) {
+        
+        struct msghdr message;
+        
+        memset(&message, 0, sizeof(message));
+        
+        message.msg_iov = (struct iovec*)p_entries;
+        
+        message.msg_iovlen = num_entries;
+        
+        n_written = sendmsg(fd, &message, MSG_NOSIGNAL);
+        
+    } else {
+        
+        n_written = writev(fd, p_entries, num_entries);
+    }
+    
+    return n_written == len ? 0 : -1;
+}
+
+/*******************************************************************************
+
+    logmsg_sink_write() - Write entries to each sink whose level admits them
+    
+    Description
+    ===========
+    
+    Entries are written to each file or socket with a single call. With 
+    signal_safe set, uses only async-signal-safe functions.
+
+*******************************************************************************/
+
+void logmsg_sink_write(const LOGMSG_LEVEL* p_levels,
+                       const struct iovec* p_entries,
+                       int num_entries,
+                       int signal_safe) {
+    
+    int num_sinks = __atomic_load_n(&logmsg_num_sinks, __ATOMIC_ACQUIRE);
+    
+    for (int sink = 0; sink < num_sinks; sink++) {
+        
+        SINK* p_sink = &sinks[sink];
+        
+        LOGMSG_LEVEL level = __atomic_load_n(&p_sink->level, __ATOMIC_RELAXED);
+        
+        /*
+         *  Select entries
+         */
+        
+        struct iovec selected[LOGMSG_BATCH_MAX_ENTRIES];
+        
+        int num_selected = 0;
+        
+        for (int i = 0; i < num_entries; i++) {
+            
+            if (p_levels[i] <= level) {
+                
+                selected[num_selected++] = p_entries[i];
+            }
+        }
+        
+        if (num_selected == 0) {
+            
+            continue;
+        }
+        
+        /*
+         *  Write them
+         */
+        
+        if (p_sink->kind == SINK_KIND_MEMORY) {
+            
+            write_memory(p_sink, selected, num_selected, signal_safe);
+            
+        } else if (logmsg_write_entries(p_sink->fd, 
+                                        p_sink->kind == SINK_KIND_SOCKET,
+                                        selected,
+                                        num_selected) != 0) {
+            
+            num_sink_failures++;
+        }
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_writer_is_started() - Determine whether the writer thread has 
+                                 been started
+
+*******************************************************************************/
+
+int logmsg_writer_is_started(void) {
+    
+    return __atomic_load_n(&writer_started, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+
+    logmsg_queue_entry() - Copy entry to the writer queue, for delivery by
+                           the writer thread
+    
+    Description
+    ===========
+    
+    Producers reserve space with a compare-and-swap of reserve_pos, so that
+    each entry is copied exactly once and never waits for another producer.
+    An entry which does not fit before the end of the queue is preceded by
+    a padding record covering the remainder.
+    
+    If the queue is full, the caller waits for the writer thread to free
+    space, so that entries are neither lost nor reordered. An entry too 
+    large for the queue is left to the caller, after the queue is flushed.
+    
+    The entry is given in parts, copied into the queue one after another,
+    so the caller need not assemble it first. With per-CPU buffers, an
+    entry in several parts is first gathered on the stack, unless larger
+    than PER_CPU_GATHER_MAX_LEN, in which case it is left to the caller.
+    
+    Return 0 if queued, -1 if the writer thread is not running or the
+    entry is too large, in which case the caller is to deliver the entry.
+
+*******************************************************************************/
+
+int logmsg_queue_entry(LOGMSG_LEVEL level,
+                       const struct iovec* p_parts,
+                       int num_parts) {
+    
+    if (!__atomic_load_n(&writer_started, __ATOMIC_ACQUIRE)) {
+        
+        return -1;
+    }
+    
+    size_t entry_len = 0;
+    
+    for (int i = 0; i < num_parts; i++) {
+        
+        entry_len += p_parts[i].iov_len;
+    }
+    
+    if (writer_per_cpu) {
+        
+        if (num_parts == 1) {
+            
+            return queue_per_cpu(level, 
+                                 (const char*)p_parts[0].iov_base, 
+                                 entry_len);
+        }
+        
+        /*
+         *  Gather parts, since a restartable sequence copies from one 
+         *  buffer
+         */
+        
+        char entry_buf[PER_CPU_GATHER_MAX_LEN];
+        
+        if (entry_len > sizeof(entry_buf)) {
+            
+            logmsg_flush();
+            
+            return -1;
+        }
+        
+        char* p_write = entry_buf;
+        
+        for (int i = 0; i < num_parts; i++) {
+            
+            memcpy(p_write, p_parts[i].iov_base, p_parts[i].iov_len);
+            
+            p_write += p_parts[i].iov_len;
+        }
+        
+        return queue_per_cpu(level, entry_buf, entry_len);
+    }
+    
+    size_t record_len = sizeof(RECORD_HEADER) + ((entry_len + 7) & ~(size_t)7);
+    
+    if (record_len > queue_len / 2) {
+        
+        logmsg_flush();
+        
+        return -1;
+    }
+    
+    /*
+     *  Reserve space
+     */
+    
+    uint64_t pos = __atomic_load_n(&reserve_pos, __ATOMIC_RELAXED);
+    
+    size_t padding_len;
+    
+    for (;;) {
+        
+        size_t offset = pos & (queue_len - 1);
+        
+        padding_len = offset + record_len > queue_len ? queue_len - offset : 0;
+        
+        uint64_t end_pos = pos + padding_len + record_len;
+        
+        uint64_t free_pos = __atomic_load_n(&read_pos, __ATOMIC_ACQUIRE);
+        
+        if (end_pos - free_pos > queue_len) {
+            
+            /*
+             *  Queue full: give way to writer thread
+             */
+            
+            num_queue_overflows++;
+            
+            wake_writer();
+            
+            sched_yield();
+            
+            pos = __atomic_load_n(&reserve_pos, __ATOMIC_RELAXED);
+            
+            continue;
+        }
+        
+        if (__atomic_compare_exchange_n(&reserve_pos, &pos, end_pos, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    
+    /*
+     *  Fill in padding record and entry
+     */
+    
+    if (padding_len > 0) {
+        
+        RECORD_HEADER* p_padding =
+            (RECORD_HEADER*)(p_queue + (pos & (queue_len - 1)));
+        
+        __atomic_store_n(&p_padding->state, RECORD_PADDING, __ATOMIC_RELEASE);
+        
+        pos += padding_len;
+    }
+    
+    RECORD_HEADER* p_record =
+        (RECORD_HEADER*)(p_queue + (pos & (queue_len - 1)));
+    
+    p_record->level = level;
+    
+    p_record->entry_len = entry_len;
+    
+    char* p_write = (char*)(p_record + 1);
+    
+    for (int i = 0; i < num_parts; i++) {
+        
+        memcpy(p_write, p_parts[i].iov_base, p_parts[i].iov_len);
+        
+        p_write += p_parts[i].iov_len;
+    }
+    
+    __atomic_store_n(&p_record->state, RECORD_ENTRY, __ATOMIC_RELEASE);
+    
+    wake_writer();
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_sink_prepare_fork() - Flush the writer queue, and hold the sink
+                                 and writer locks across fork()
+    
+    Description
+    ===========
+    
+    Entries queued by other threads after the flush are delivered by the
+    parent's writer thread, and discarded in the child, so that each is
+    written once.
+
+*******************************************************************************/
+
+void logmsg_sink_prepare_fork(void) {
+    
+    logmsg_flush();
+    
+    pthread_mutex_lock(&sinks_mutex);
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    for (int sink = 0; sink < logmsg_num_sinks; sink++) {
+        
+        if (sinks[sink].kind == SINK_KIND_MEMORY) {
+            
+            while (__atomic_exchange_n(&sinks[sink].ring_lock, 1,
+                                       __ATOMIC_ACQUIRE)) {
+                
+                sched_yield();
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+
+    logmsg_sink_after_fork_parent() - Release the locks held across fork()
+
+*******************************************************************************/
+
+void logmsg_sink_after_fork_parent(void) {
+    
+    for (int sink = logmsg_num_sinks - 1; sink >= 0; sink--) {
+        
+        if (sinks[sink].kind == SINK_KIND_MEMORY) {
+            
+            __atomic_store_n(&sinks[sink].ring_lock, 0, __ATOMIC_RELEASE);
+        }
+    }
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    pthread_mutex_unlock(&sinks_mutex);
+}
+
+/*******************************************************************************
+
+    logmsg_sink_after_fork_child() - Release the locks held across fork(),
+                                     and restart the writer thread with an
+                                     empty queue
+    
+    Description
+    ===========
+    
+    The parent's writer thread does not exist in the child, and the
+    entries left in the queue, and pending asynchronous flushes, are the
+    parent's to complete. The condition
+    variable is initialized again, since threads of the parent may have
+    been waiting on it.
+    
+    If the writer thread cannot be started, entries are written by the
+    calling threads, as before logmsg_start_writer().
+
+*******************************************************************************/
+
+void logmsg_sink_after_fork_child(void) {
+    
+    for (int sink = logmsg_num_sinks - 1; sink >= 0; sink--) {
+        
+        if (sinks[sink].kind == SINK_KIND_MEMORY) {
+            
+            sinks[sink].ring_lock = 0;
+        }
+    }
+    
+    pthread_cond_init(&flushed_cond, NULL);
+    
+    writer_parked = 0;
+    
+    num_flush_waiters = 0;
+    
+    for (int i = 0; i < num_async_flushes; i++) {
+        
+        close(async_flushes[i].fd);
+    }
+    
+    num_async_flushes = 0;
+    
+    if (writer_started) {
+        
+        if (writer_per_cpu) {
+            
+            logmsg_percpu_discard();
+            
+            if (writer_membarrier) {
+                
+                writer_membarrier =
+                    syscall(SYS_membarrier,
+                            MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+                            0, 0) == 0;
+            }
+            
+        } else {
+            
+            memset(p_queue, 0, queue_len);
+            
+            reserve_pos = 0;
+            
+            read_pos = 0;
+        }
+        
+        num_passes = 0;
+        
+        if (pthread_create(&writer_thread, NULL, run_writer, NULL) != 0) {
+            
+            writer_started = 0;
+        }
+    }
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    pthread_mutex_unlock(&sinks_mutex);
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_add_file_sink() - Add log file sink
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_add_file_sink(const char* file_spec, LOGMSG_LEVEL level) {
+    
+    mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+    
+    SINK sink = { .kind = SINK_KIND_FD, .level = level };
+    
+    sink.fd = open(file_spec, O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC, mode);
+    
+    if (sink.fd < 0) {
+        
+        num_open_failures++;
+        
+        return -1;
+    }
+    
+    int sink_num = add_sink(&sink);
+    
+    if (sink_num < 0) {
+        
+        close(sink.fd);
+        
+        num_open_failures++;
+    }
+    
+    return sink_num;
+}
+
+/*******************************************************************************
+
+    logmsg_add_conn_sink() - Add log server connection sink
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_add_conn_sink(const char* server_spec, LOGMSG_LEVEL level) {
+    
+    SINK sink = { .kind = SINK_KIND_SOCKET, .level = level };
+    
+    sink.fd = logmsg_open_socket(server_spec);
+    
+    if (sink.fd < 0) {
+        
+        num_conn_failures++;
+        
+        return -1;
+    }
+    
+    int sink_num = add_sink(&sink);
+    
+    if (sink_num < 0) {
+        
+        close(sink.fd);
+        
+        num_conn_failures++;
+    }
+    
+    return sink_num;
+}
+
+/*******************************************************************************
+
+    logmsg_add_stderr_sink() - Add standard error sink
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_add_stderr_sink(LOGMSG_LEVEL level) {
+    
+    SINK sink = { .kind = SINK_KIND_FD, .level = level, .fd = STDERR_FILENO };
+    
+    return add_sink(&sink);
+}
+
+/*******************************************************************************
+
+    logmsg_add_memory_sink() - Add sink keeping the latest entries in memory
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_add_memory_sink(size_t ring_len, LOGMSG_LEVEL level) {
+    
+    SINK sink = { .kind = SINK_KIND_MEMORY, .level = level, .fd = -1 };
+    
+    sink.ring_len = ring_len != 0 ? ring_len : DEFAULT_MEMORY_SINK_LEN;
+    
+    sink.p_ring = (char*)malloc(sink.ring_len);
+    
+    if (sink.p_ring == NULL) {
+        
+        return -1;
+    }
+    
+    int sink_num = add_sink(&sink);
+    
+    if (sink_num < 0) {
+        
+        free(sink.p_ring);
+    }
+    
+    return sink_num;
+}
+
+/*******************************************************************************
+
+    logmsg_set_sink_level() - Set highest level of entry written to sink
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_set_sink_level(int sink, LOGMSG_LEVEL level) {
+    
+    if (sink < 0 ||
+        sink >= __atomic_load_n(&logmsg_num_sinks, __ATOMIC_ACQUIRE)) {
+        
+        return -1;
+    }
+    
+    __atomic_store_n(&sinks[sink].level, level, __ATOMIC_RELAXED);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_read_memory_sink() - Copy latest entries held by memory sink
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+ssize_t logmsg_read_memory_sink(int sink, char* p_buffer, size_t buffer_len) {
+    
+    if (sink < 0 ||
+        sink >= __atomic_load_n(&logmsg_num_sinks, __ATOMIC_ACQUIRE) ||
+        sinks[sink].kind != SINK_KIND_MEMORY) {
+        
+        return -1;
+    }
+    
+    SINK* p_sink = &sinks[sink];
+    
+    while (__atomic_exchange_n(&p_sink->ring_lock, 1, __ATOMIC_ACQUIRE)) {
+        
+        sched_yield();
+    }
+    
+    /*
+     *  Take latest bytes which fit, then drop any partial first entry
+     */
+    
+    size_t len = p_sink->ring_pos < p_sink->ring_len ?
+                     p_sink->ring_pos : p_sink->ring_len;
+    
+    if (len > buffer_len) {
+        
+        len = buffer_len;
+    }
+    
+    uint64_t start_pos = p_sink->ring_pos - len;
+    
+    for (size_t i = 0; i < len; i++) {
+        
+        p_buffer[i] = p_sink->p_ring[(start_pos + i) % p_sink->ring_len];
+    }
+    
+    int partial = 0;
+    
+    if (start_pos != 0) {
+        
+        char previous = p_sink->p_ring[(start_pos - 1) % p_sink->ring_len];
+        
+        partial = len == p_sink->ring_len || previous != '\n';
+    }
+    
+    __atomic_store_n(&p_sink->ring_lock, 0, __ATOMIC_RELEASE);
+    
+    if (partial) {
+        
+        char* p_newline = (char*)memchr(p_buffer, '\n', len);
+        
+        size_t skip_len = p_newline != NULL ? p_newline + 1 - p_buffer : len;
+        
+        memmove(p_buffer, p_buffer + skip_len, len - skip_len);
+        
+        len -= skip_len;
+    }
+    
+    return (ssize_t)len;
+}
+
+/*******************************************************************************
+
+    logmsg_start_writer() - Start writer thread
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_start_writer(size_t len) {
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    if (writer_started || logmsg_sharding == LOGMSG_SHARDING_THREAD) {
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        return -1;
+    }
+    
+    /*
+     *  Allocate queue, rounding length up to a power of 2
+     */
+    
+    size_t required_len = len != 0 ? len : DEFAULT_QUEUE_LEN;
+    
+    queue_len = 4096;
+    
+    while (queue_len < required_len) {
+        
+        queue_len *= 2;
+    }
+    
+    p_queue = (char*)calloc(1, queue_len);
+    
+    if (p_queue == NULL) {
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        return -1;
+    }
+    
+    if (start_writer_thread() != 0) {
+        
+        free(p_queue);
+        
+        p_queue = NULL;
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        return -1;
+    }
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_start_writer_per_cpu() - Start writer thread, draining per-CPU 
+                                    buffers
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_start_writer_per_cpu(size_t buffer_len) {
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    if (writer_started || logmsg_sharding == LOGMSG_SHARDING_THREAD ||
+        logmsg_percpu_init(buffer_len) != 0) {
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        return -1;
+    }
+    
+    writer_per_cpu = 1;
+    
+    writer_membarrier =
+        syscall(SYS_membarrier,
+                MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+    
+    if (start_writer_thread() != 0) {
+        
+        writer_per_cpu = 0;
+        
+        writer_membarrier = 0;
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        return -1;
+    }
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_flush() - Wait for entries queued for the writer thread to be
+                     delivered, and write out O_DIRECT staging buffer
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_flush(void) {
+    
+    if (!__atomic_load_n(&writer_started, __ATOMIC_ACQUIRE)) {
+        
+        logmsg_direct_flush();
+        
+        return;
+    }
+    
+    /*
+     *  Wait for the writer to deliver the entries written so far
+     */
+    
+    uint64_t end_progress = get_flush_end();
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    __atomic_add_fetch(&num_flush_waiters, 1, __ATOMIC_SEQ_CST);
+    
+    while (!is_flushed(end_progress)) {
+        
+        wake_writer();
+        
+        pthread_cond_wait(&flushed_cond, &writer_mutex);
+    }
+    
+    __atomic_sub_fetch(&num_flush_waiters, 1, __ATOMIC_RELAXED);
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    logmsg_direct_flush();
+}
+
+/*******************************************************************************
+
+    logmsg_flush_async() - Signal an eventfd once the entries already written
+                           have been flushed, without waiting
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_flush_async(int event_fd) {
+    
+    int fd = fcntl(event_fd, F_DUPFD_CLOEXEC, 0);
+    
+    if (fd < 0) {
+        
+        return -1;
+    }
+    
+    if (!__atomic_load_n(&writer_started, __ATOMIC_ACQUIRE)) {
+        
+        logmsg_durable_flush();
+        
+        signal_flushed(fd);
+        
+        return 0;
+    }
+    
+    /*
+     *  Add to pending flushes, in order, and wake the writer thread to
+     *  make progress
+     */
+    
+    pthread_mutex_lock(&writer_mutex);
+    
+    if (num_async_flushes == LOGMSG_MAX_ASYNC_FLUSHES) {
+        
+        pthread_mutex_unlock(&writer_mutex);
+        
+        close(fd);
+        
+        return -1;
+    }
+    
+    async_flushes[num_async_flushes].end_progress = get_flush_end();
+    
+    async_flushes[num_async_flushes].fd = fd;
+    
+    __atomic_store_n(&num_async_flushes,
+                     num_async_flushes + 1,
+                     __ATOMIC_SEQ_CST);
+    
+    pthread_mutex_unlock(&writer_mutex);
+    
+    wake_writer();
+    
+    return 0;
+}
@@ -0,0 +1,434 @@
+/*******************************************************************************
+
+    logmsg_site.c - Per call site volume counters
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <errno.h>
+
+#include <signal.h>
+
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Most sites in a report
+
+#define REPORT_MAX_SITES 32
+
+// Longest line of a report
+
+#define REPORT_LINE_MAX_LEN 1024
+
+/*******************************************************************************
+
+    Program-wide variable definitions
+
+*******************************************************************************/
+
+// logmsg_site_stats_enabled - Set if sites are counted - Part of public API
+
+int logmsg_site_stats_enabled = 0;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// List of sites counted so far
+
+static LOGMSG_SITE* p_sites = NULL;
+
+// Report file FD
+
+static int report_fd = -1;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    register_site() - Add site to list of sites, on its first count
+
+*******************************************************************************/
+
+static void register_site(LOGMSG_SITE* p_site) {
+    
+    int is_registered = 0;
+    
+    if (!__atomic_compare_exchange_n(&p_site->is_registered,
+                                     &is_registered,
+                                     1,
+                                     0,
+                                     __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    p_site->p_next = __atomic_load_n(&p_sites, __ATOMIC_RELAXED);
+    
+    while (!__atomic_compare_exchange_n(&p_sites, &p_site->p_next, p_site,
+                                        0, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+/*******************************************************************************
+
+    write_report() - Write report to report file
+
+*******************************************************************************/
+
+static void write_report(void) {
+    
+    logmsg_write_site_report(report_fd);
+}
+
+/*******************************************************************************
+
+    report_signal_handler() - Write report to report file
+
+*******************************************************************************/
+
+static void report_signal_handler(int sig) {
+    
+    int saved_errno = errno;
+    
+    logmsg_write_site_report(report_fd);
+    
+    errno = saved_errno;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_site_count() - Count call of site, which wrote entry_len bytes
+
+*******************************************************************************/
+
+void logmsg_site_count(LOGMSG_SITE* p_site, size_t entry_len) {
+    
+    if (!__atomic_load_n(&p_site->is_registered, __ATOMIC_RELAXED)) {
+        
+        register_site(p_site);
+    }
+    
+    __atomic_fetch_add(&p_site->num_calls, 1, __ATOMIC_RELAXED);
+    
+    __atomic_fetch_add(&p_site->num_bytes, entry_len, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+
+    logmsg_site_after_fork_child() - Clear counts, in a child process, so
+                                     that its report covers only its calls
+
+*******************************************************************************/
+
+void logmsg_site_after_fork_child(void) {
+    
+    for (LOGMSG_SITE* p_site = p_sites;
+         p_site != NULL;
+         p_site = p_site->p_next) {
+        
+        p_site->num_calls = 0;
+        
+        p_site->num_bytes = 0;
+        
+        p_site->num_suppressed = 0;
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_start_site_stats() - Start counting calls of each site
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_start_site_stats(const char* report_spec, int report_signal) {
+    
+    if (logmsg_site_stats_enabled) {
+        
+        return -1;
+    }
+    
+    /*
+     *  Open report file, or use standard error
+     */
+    
+    if (report_spec != NULL) {
+        
+        mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+        
+        report_fd = open(report_spec,
+                         O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC,
+                         mode);
+        
+        if (report_fd < 0) {
+            
+            return -1;
+        }
+        
+    } else {
+        
+        report_fd = STDERR_FILENO;
+    }
+    
+    /*
+     *  Report on signal, and at exit
+     */
+    
+    if (report_signal > 0) {
+        
+        struct sigaction action;
+        
+        memset(&action, 0, sizeof(action));
+        
+        action.sa_handler = report_signal_handler;
+        
+        action.sa_flags = SA_RESTART;
+        
+        sigemptyset(&action.sa_mask);
+        
+        if (sigaction(report_signal, &action, NULL) != 0) {
+            
+            return -1;
+        }
+    }
+    
+    atexit(write_report);
+    
+    __atomic_store_n(&logmsg_site_stats_enabled, 1, __ATOMIC_RELEASE);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_site_suppressed() - Count call of site suppressed by level
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_site_suppressed(LOGMSG_SITE* p_site) {
+    
+    if (!__atomic_load_n(&p_site->is_registered, __ATOMIC_RELAXED)) {
+        
+        register_site(p_site);
+    }
+    
+    __atomic_fetch_add(&p_site->num_suppressed, 1, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+
+    logmsg_get_site_stats() - Get counts of the sites which wrote most
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+size_t logmsg_get_site_stats(LOGMSG_SITE_STATS* p_stats, size_t max_stats) {
+    
+    size_t num_stats = 0;
+    
+    for (LOGMSG_SITE* p_site = __atomic_load_n(&p_sites, __ATOMIC_ACQUIRE);
+         p_site != NULL;
+         p_site = p_site->p_next) {
+        
+        LOGMSG_SITE_STATS stats;
+        
+        stats.file = p_site->file;
+        
+        stats.line = p_site->line;
+        
+        stats.function = p_site->function;
+        
+        stats.level = p_site->level;
+        
+        stats.num_calls = __atomic_load_n(&p_site->num_calls,
+                                          __ATOMIC_RELAXED);
+        
+        stats.num_bytes = __atomic_load_n(&p_site->num_bytes,
+                                          __ATOMIC_RELAXED);
+        
+        stats.num_suppressed = __atomic_load_n(&p_site->num_suppressed,
+                                               __ATOMIC_RELAXED);
+        
+        /*
+         *  Insert in order of bytes, then calls, dropping the last if full
+         */
+        
+        size_t i = num_stats;
+        
+        while (i > 0 &&
+               (p_stats[i - 1].num_bytes < stats.num_bytes ||
+                (p_stats[i - 1].num_bytes == stats.num_bytes &&
+                 p_stats[i - 1].num_calls < stats.num_calls))) {
+            
+            if (i < max_stats) {
+                
+                p_stats[i] = p_stats[i - 1];
+            }
+            
+            i--;
+        }
+        
+        if (i < max_stats) {
+            
+            p_stats[i] = stats;
+            
+            if (num_stats < max_stats) {
+                
+                num_stats++;
+            }
+        }
+    }
+    
+    return num_stats;
+}
+
+/*******************************************************************************
+
+    logmsg_write_site_report() - Write report of the sites which wrote most
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_write_site_report(int fd) {
+    
+    LOGMSG_SITE_STATS stats[REPORT_MAX_SITES];
+    
+    size_t num_stats = logmsg_get_site_stats(stats, REPORT_MAX_SITES);
+    
+    char line[REPORT_LINE_MAX_LEN];
+    
+    int status = 0;
+    
+    int len = logmsg_snprintf(line,
+                              sizeof(line),
+                              "**** log volume by site: %d sites ****\n"
+                              "%14s %12s %12s %-5s %s\n",
+                              (int)num_stats,
+                              "bytes", "calls", "suppressed", "level",
+                              "site");
+    
+    if (len < 0 || write(fd, line, len) != len) {
+        
+        status = -1;
+    }
+    
+    for (size_t i = 0; i < num_stats; i++) {
+        
+        len = logmsg_snprintf(line,
+                              sizeof(line),
+                              "%14llu %12llu %12llu %-5s %s:%d:%s()\n",
+                              (unsigned long long)stats[i].num_bytes,
+                              (unsigned long long)stats[i].num_calls,
+                              (unsigned long long)stats[i].num_suppressed,
+                              logmsg_level_to_string(stats[i].level),
+                              stats[i].file,
+                              stats[i].line,
+                              stats[i].function);
+        
+        if (len < 0) {
+            
+            status = -1;
+            
+            continue;
+        }
+        
+        if (len >= (int)sizeof(line)) {
+            
+            len = sizeof(line) - 1;
+            
+            line[len - 1] = '\n';
+        }
+        
+        if (write(fd, line, len) != len) {
+            
+            status = -1;
+        }
+    }
+    
+    return status;
+}
@@ -0,0 +1,589 @@
+/*******************************************************************************
+
+    logmsg_span.c - Timing spans, recorded per thread and exported as
+                    Chrome trace events
+    
+    -----------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+
+    Header files
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <inttypes.h>
+
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include <logmsg.h>
+
+#include <logmsg_private.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Default # events kept per thread
+
+#define DEFAULT_NUM_EVENTS 65536
+
+// Phases of event, as in the trace event format
+
+#define PHASE_BEGIN 'B'
+
+#define PHASE_END   'E'
+
+// Size of export buffer, and space kept for one event
+
+#define EXPORT_BUFFER_LEN 65536
+
+#define EXPORT_EVENT_MAX_LEN 4096
+
+// Longest name, file or function written for an event, quoted
+
+#define SITE_TEXT_MAX_LEN 256
+
+/*******************************************************************************
+
+    EVENT - Beginning or end of a span
+
+*******************************************************************************/
+
+typedef struct EVENT {
+    
+    uint64_t                timestamp;      // As logmsg_clock_now()
+    
+    const LOGMSG_SPAN_SITE* p_site;
+    
+    int32_t                 tid;
+    
+    int32_t                 phase;
+    
+} EVENT;
+
+/*******************************************************************************
+
+    EVENT_RING - Ring of the latest events of one thread
+    
+    Description
+    ===========
+    
+    num_events is advanced with a release store after each event is
+    written, so that an export can tell which events it copied may have
+    been overwritten meanwhile. Rings are never freed, and are reused by
+    later threads, as in the flight recorder.
+
+*******************************************************************************/
+
+typedef struct EVENT_RING {
+    
+    struct EVENT_RING* p_next;
+    
+    int                in_use;
+    
+    uint64_t           num_events;  // # events ever recorded
+    
+    EVENT              events[];
+    
+} EVENT_RING;
+
+/*******************************************************************************
+
+    Private variable definitions
+
+*******************************************************************************/
+
+// # events kept per thread, or 0 if spans are not recorded
+
+static uint64_t ring_num_events = 0;
+
+// List of all rings
+
+static EVENT_RING* p_rings = NULL;
+
+// Ring of calling thread
+
+static __thread EVENT_RING* p_thread_ring = NULL;
+
+static __thread pid_t thread_tid = 0;
+
+// Releases ring on thread exit
+
+static pthread_key_t ring_key;
+
+// # ring allocation failures
+
+uint64_t num_span_failures = 0;
+
+/*******************************************************************************
+*                                                                              *
+*                           Private functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    release_ring() - Release ring of exiting thread for reuse
+
+*******************************************************************************/
+
+static void release_ring(void* p_ring) {
+    
+    __atomic_store_n(&((EVENT_RING*)p_ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    get_thread_ring() - Return ring of calling thread, obtaining one on its
+                        first event
+    
+    Return NULL on failure.
+
+*******************************************************************************/
+
+static EVENT_RING* get_thread_ring(void) {
+    
+    if (p_thread_ring != NULL) {
+        
+        return p_thread_ring;
+    }
+    
+    /*
+     *  Reuse ring of exited thread, else allocate and publish new ring
+     */
+    
+    EVENT_RING* p_ring = __atomic_load_n(&p_rings, __ATOMIC_ACQUIRE);
+    
+    for (; p_ring != NULL; p_ring = p_ring->p_next) {
+        
+        int in_use = 0;
+        
+        if (__atomic_compare_exchange_n(&p_ring->in_use, &in_use, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    
+    if (p_ring == NULL) {
+        
+        p_ring = (EVENT_RING*)calloc(1, sizeof(EVENT_RING) +
+                                            ring_num_events * sizeof(EVENT));
+        
+        if (p_ring == NULL) {
+            
+            num_span_failures++;
+            
+            return NULL;
+        }
+        
+        p_ring->in_use = 1;
+        
+        p_ring->p_next = __atomic_load_n(&p_rings, __ATOMIC_RELAXED);
+        
+        while (!__atomic_compare_exchange_n(&p_rings, &p_ring->p_next, p_ring,
+                                            0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    
+    pthread_setspecific(ring_key, p_ring);
+    
+    p_thread_ring = p_ring;
+    
+    thread_tid = (pid_t)syscall(SYS_gettid);
+    
+    return p_ring;
+}
+
+/*******************************************************************************
+
+    record_event() - Record beginning or end of span in ring of calling
+                     thread
+
+*******************************************************************************/
+
+static void record_event(const LOGMSG_SPAN_SITE* p_site, int phase) {
+    
+    if (ring_num_events == 0) {
+        
+        return;
+    }
+    
+    uint64_t timestamp = logmsg_clock_now();
+    
+    EVENT_RING* p_ring = get_thread_ring();
+    
+    if (p_ring == NULL) {
+        
+        return;
+    }
+    
+    uint64_t n = p_ring->num_events;
+    
+    EVENT* p_event = &p_ring->events[n % ring_num_events];
+    
+    p_event->timestamp = timestamp;
+    
+    p_event->p_site = p_site;
+    
+    p_event->tid = thread_tid;
+    
+    p_event->phase = phase;
+    
+    __atomic_store_n(&p_ring->num_events, n + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+
+    write_event() - Write trace event object, preceded by a comma unless
+                    first
+    
+    Return pointer to the end of the text written.
+
+*******************************************************************************/
+
+static char* write_event(char* p_write,
+                         const EVENT* p_event,
+                         pid_t pid,
+                         int is_first) {
+    
+    const LOGMSG_SPAN_SITE* p_site = p_event->p_site;
+    
+    int64_t utc_time_ns = logmsg_clock_to_utc_ns(p_event->timestamp);
+    
+    if (!is_first) {
+        
+        *p_write++ = ',';
+    }
+    
+    p_write += sprintf(p_write, "\n{\"name\":");
+    
+    p_write = logmsg_kv_write_quoted(p_write,
+                                     p_site->name,
+                                     strlen(p_site->name),
+                                     SITE_TEXT_MAX_LEN);
+    
+    p_write += sprintf(p_write,
+                       ",\"cat\":\"logmsg\",\"ph\":\"%c\","
+                       "\"ts\":%" PRId64 ".%03d,\"pid\":%d,\"tid\":%d",
+                       p_event->phase,
+                       utc_time_ns / 1000,
+                       (int)(utc_time_ns % 1000),
+                       (int)pid,
+                       (int)p_event->tid);
+    
+    /*
+     *  Call site, with the beginning of the span
+     */
+    
+    if (p_event->phase == PHASE_BEGIN) {
+        
+        p_write += sprintf(p_write, ",\"args\":{\"file\":");
+        
+        p_write = logmsg_kv_write_quoted(p_write,
+                                         p_site->file,
+                                         strlen(p_site->file),
+                                         SITE_TEXT_MAX_LEN);
+        
+        p_write += sprintf(p_write, ",\"line\":%d,\"function\":", p_site->line);
+        
+        p_write = logmsg_kv_write_quoted(p_write,
+                                         p_site->function,
+                                         strlen(p_site->function),
+                                         SITE_TEXT_MAX_LEN);
+        
+        *p_write++ = '}';
+    }
+    
+    *p_write++ = '}';
+    
+    return p_write;
+}
+
+/*******************************************************************************
+*                                                                              *
+*                           Library functions                                  *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_span_after_fork_child() - Forget the parent's events and
+                                     threads, in a child process
+    
+    Description
+    ===========
+    
+    The events recorded before fork() are left for the parent to export,
+    and the rings of threads which do not exist in the child are released
+    for reuse.
+
+*******************************************************************************/
+
+void logmsg_span_after_fork_child(void) {
+    
+    for (EVENT_RING* p_ring = p_rings;
+         p_ring != NULL;
+         p_ring = p_ring->p_next) {
+        
+        p_ring->num_events = 0;
+        
+        p_ring->in_use = p_ring == p_thread_ring;
+    }
+    
+    if (p_thread_ring != NULL) {
+        
+        thread_tid = (pid_t)syscall(SYS_gettid);
+    }
+}
+
+/*******************************************************************************
+*                                                                              *
+*                            API functions                                     *
+*                                                                              *
+*******************************************************************************/
+
+/*******************************************************************************
+
+    logmsg_start_spans() - Start recording spans
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_start_spans(size_t num_events) {
+    
+    if (ring_num_events > 0) {
+        
+        return -1;
+    }
+    
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
+        
+        return -1;
+    }
+    
+    __atomic_store_n(&ring_num_events,
+                     num_events != 0 ? num_events : DEFAULT_NUM_EVENTS,
+                     __ATOMIC_RELEASE);
+    
+    return 0;
+}
+
+/*******************************************************************************
+
+    logmsg_span_begin() - Record beginning of span
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_span_begin(const LOGMSG_SPAN_SITE* p_site) {
+    
+    record_event(p_site, PHASE_BEGIN);
+}
+
+/*******************************************************************************
+
+    logmsg_span_end() - Record end of span
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+void logmsg_span_end(const LOGMSG_SPAN_SITE* p_site) {
+    
+    record_event(p_site, PHASE_END);
+}
+
+/*******************************************************************************
+
+    logmsg_export_trace() - Write recorded spans as Chrome trace events
+    
+    See logmsg.h for more details.
+
+*******************************************************************************/
+
+int logmsg_export_trace(const char* file_spec) {
+    
+    mode_t mode = S_IRWXU | S_IRWXG | S_IROTH;
+    
+    int fd = open(file_spec, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, mode);
+    
+    if (fd < 0) {
+        
+        return -1;
+    }
+    
+    char* p_buffer = (char*)malloc(EXPORT_BUFFER_LEN);
+    
+    EVENT* p_events = (EVENT*)malloc(ring_num_events * sizeof(EVENT));
+    
+    if (p_buffer == NULL || (ring_num_events > 0 && p_events == NULL)) {
+        
+        free(p_buffer);
+        
+        free(p_events);
+        
+        close(fd);
+        
+        return -1;
+    }
+    
+    pid_t pid = getpid();
+    
+    int status = 0;
+    
+    int is_first = 1;
+    
+    char* p_write = p_buffer;
+    
+    p_write += sprintf(p_write,
+                       "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    
+    for (EVENT_RING* p_ring = __atomic_load_n(&p_rings, __ATOMIC_ACQUIRE);
+         p_ring != NULL;
+         p_ring = p_ring->p_next) {
+        
+        /*
+         *  Copy ring, then drop events overwritten while copying, including
+         *  the slot of event new_end, which may be being written
+         */
+        
+        uint64_t end = __atomic_load_n(&p_ring->num_events, __ATOMIC_ACQUIRE);
+        
+        uint64_t begin = end > ring_num_events ? end - ring_num_events : 0;
+        
+        for (uint64_t n = begin; n < end; n++) {
+            
+            p_events[n - begin] = p_ring->events[n % ring_num_events];
+        }
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        
+        uint64_t new_end = __atomic_load_n(&p_ring->num_events,
+                                           __ATOMIC_RELAXED);
+        
+        uint64_t first = new_end >= ring_num_events ?
+                             new_end - ring_num_events + 1 : 0;
+        
+        if (first < begin) {
+            
+            first = begin;
+        }
+        
+        /*
+         *  Write events, skipping ends whose beginning was overwritten
+         */
+        
+        int depth = 0;
+        
+        for (uint64_t n = first; n < end; n++) {
+            
+            const EVENT* p_event = &p_events[n - begin];
+            
+            if (p_event->phase == PHASE_BEGIN) {
+                
+                depth++;
+                
+            } else if (depth > 0) {
+                
+                depth--;
+                
+            } else {
+                
+                continue;
+            }
+            
+            p_write = write_event(p_write, p_event, pid, is_first);
+            
+            is_first = 0;
+            
+            ssize_t len = p_write - p_buffer;
+            
+            if (len > EXPORT_BUFFER_LEN - EXPORT_EVENT_MAX_LEN) {
+                
+                if (write(fd, p_buffer, len) != len) {
+                    
+                    status = -1;
+                }
+                
+                p_write = p_buffer;
+            }
+        }
+    }
+    
+    p_write += sprintf(p_write, "\n]}\n");
+    
+    ssize_t len = p_write - p_buffer;
+    
+    if (write(fd, p_buffer, len) != len) {
+        
+        status = -1;
+    }
+    
+    if (close(fd) != 0) {
+        
+        status = -1;
+    }
+    
+    free(p_buffer);
+    
+    free(p_events);
+    
+    return status;
+}
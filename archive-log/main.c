@@ -0,0 +1,2772 @@
+/*******************************************************************************
+
+    archive-log
+
+    Convert log files to columnar archives, and read entries from them
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <inttypes.h>
+
+#include <unistd.h>
+
+#include <time.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include <fcntl.h>
+
+#include <zlib.h>
+
+#include <logmsg_parse.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define NSECS_PER_SEC 1000000000LL
+
+// Magic number at the start and end of an archive, and format version
+
+#define ARCHIVE_MAGIC "LOGMSGAR"
+
+#define ARCHIVE_VERSION 3
+
+// Default length of log text in each block, and most entries in a block
+
+#define DEFAULT_BLOCK_KIB 1024
+
+#define MAX_BLOCK_KIB (256 * 1024)
+
+#define BLOCK_MAX_ENTRIES 65536
+
+// Level code of text which is not an entry, or is not in the default 
+// layout, and so is stored verbatim
+
+#define LEVEL_RAW 7
+
+// Longest host or program name stored in the dictionary
+
+#define DICT_MAX_TEXT_LEN 65535
+
+// Bloom filter of the words of each block: bits per distinct word, and 
+// bits set for each word, giving about 1% false positives
+
+#define FILTER_BITS_PER_WORD 10
+
+#define FILTER_NUM_HASHES 7
+
+// Marker of each variable of a message template, and most templates
+
+#define TEMPLATE_MARKER '\x01'
+
+#define MAX_TEMPLATES 65536
+
+/*******************************************************************************
+
+    COLUMN - Columns of each block of an archive
+
+    Description
+    ===========
+
+    Each column of a block is deflated separately, so that it may be read
+    without the others. Entries stored verbatim, with level LEVEL_RAW, have 
+    no host, program, PID, TID or template values; their message is their
+    whole text.
+
+    If a message matches a template, its template value is the dictionary
+    index of the template plus 1, and only its variables are stored in the
+    message column, each followed by a NULL; otherwise the value is 0.
+
+*******************************************************************************/
+
+typedef enum COLUMN {
+
+    COLUMN_TIME = 0,            // Zigzag varint delta from preceding time
+
+    COLUMN_LEVEL,               // Level code, one byte
+
+    COLUMN_HOST,                // Varint dictionary index
+
+    COLUMN_PROGRAM,             // Varint dictionary index
+
+    COLUMN_PID,                 // Zigzag varint
+
+    COLUMN_TID,                 // Zigzag varint
+
+    COLUMN_TEMPLATE,            // Varint dictionary index + 1, or 0
+
+    COLUMN_MESSAGE_LEN,         // Varint
+
+    COLUMN_MESSAGE,             // Message text, without final newlines
+
+    NUM_COLUMNS
+
+} COLUMN;
+
+static const char* column_names[NUM_COLUMNS] = {
+
+    "time", "level", "host", "program", "pid", "tid", "template",
+    "message-len", "message"
+};
+
+/*******************************************************************************
+
+    ARCHIVE_HEADER - Start of archive file
+
+    Description
+    ===========
+
+    An archive consists of this header, the columns of each block, then a
+    deflated dictionary of host and program names and message templates, 
+    each a uint16_t length followed by the text, then the BLOCK_INFO of 
+    each block, and an ARCHIVE_TRAILER. All values are in host byte order.
+
+    Optionally, each block also has a Bloom filter of the words of its 
+    messages, stored after its columns without deflation, which rules out 
+    most blocks not containing a word searched for. A word is a maximal 
+    run of letters, digits and underscores.
+
+*******************************************************************************/
+
+typedef struct ARCHIVE_HEADER {
+
+    char magic[8];
+
+    uint32_t version;
+
+    uint32_t num_columns;
+
+} ARCHIVE_HEADER;
+
+/*******************************************************************************
+
+    COLUMN_INFO - Location of one column of a block
+
+*******************************************************************************/
+
+typedef struct COLUMN_INFO {
+
+    uint64_t offset;
+
+    uint32_t stored_len;        // Deflated length, in the file
+
+    uint32_t raw_len;           // Inflated length
+
+} COLUMN_INFO;
+
+/*******************************************************************************
+
+    BLOCK_INFO - Directory entry of one block
+
+*******************************************************************************/
+
+typedef struct BLOCK_INFO {
+
+    uint32_t num_entries;
+
+    uint32_t level_mask;        // Bit of the code of each level present
+
+    int64_t first_time_ns;      // Base of the time deltas
+
+    int64_t min_time_ns;
+
+    int64_t max_time_ns;
+
+    COLUMN_INFO columns[NUM_COLUMNS];
+
+    COLUMN_INFO filter;         // Bloom filter, or stored_len 0 if none
+
+} BLOCK_INFO;
+
+/*******************************************************************************
+
+    ARCHIVE_TRAILER - End of archive file
+
+*******************************************************************************/
+
+typedef struct ARCHIVE_TRAILER {
+
+    uint64_t dict_offset;
+
+    uint64_t dict_raw_len;      // Inflated length of dictionary
+
+    uint64_t directory_offset;
+
+    uint32_t num_texts;         // # dictionary texts
+
+    uint32_t num_blocks;
+
+    char magic[8];
+
+} ARCHIVE_TRAILER;
+
+/*******************************************************************************
+
+    BUFFER - Growable byte buffer
+
+*******************************************************************************/
+
+typedef struct BUFFER {
+
+    uint8_t* p_data;
+
+    size_t len;
+
+    size_t max_len;
+
+} BUFFER;
+
+/*******************************************************************************
+
+    DICT - Dictionary of host and program names and templates, hashed for
+           lookup
+
+*******************************************************************************/
+
+typedef struct DICT {
+
+    const char** pp_texts;      // By index, pointing into the log file,
+                                // or copied
+
+    uint16_t* p_lens;
+
+    uint32_t num_texts;
+
+    uint32_t max_texts;
+
+    uint32_t* p_slots;          // Index + 1 of each text, or 0 if empty
+
+    uint32_t num_slots;
+
+} DICT;
+
+/*******************************************************************************
+
+    BLOCK - Block being built
+
+*******************************************************************************/
+
+typedef struct BLOCK {
+
+    BLOCK_INFO info;
+
+    int64_t prev_time_ns;
+
+    size_t text_len;            // Length of log text of its entries
+
+    BUFFER columns[NUM_COLUMNS];
+
+    int has_filter;
+
+    BUFFER word_hashes;         // Hash of each word of its messages
+
+} BLOCK;
+
+/*******************************************************************************
+
+    ARCHIVE - Archive opened for reading
+
+*******************************************************************************/
+
+typedef struct ARCHIVE {
+
+    int fd;
+
+    uint64_t file_len;
+
+    uint64_t bytes_read;
+
+    ARCHIVE_TRAILER trailer;
+
+    BUFFER dict;                // Inflated dictionary
+
+    const char** pp_texts;      // By index, pointing into dictionary
+
+    uint16_t* p_lens;
+
+    BLOCK_INFO* p_blocks;
+
+} ARCHIVE;
+
+/*******************************************************************************
+
+    reserve() - Make room for len more bytes in buffer
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int reserve(BUFFER* p_buffer, size_t len) {
+
+    if (p_buffer->len + len <= p_buffer->max_len) {
+
+        return 0;
+    }
+
+    size_t max_len = p_buffer->max_len ? 2 * p_buffer->max_len : 4096;
+
+    while (max_len < p_buffer->len + len) {
+
+        max_len *= 2;
+    }
+
+    uint8_t* p_data = realloc(p_buffer->p_data, max_len);
+
+    if (p_data == NULL) {
+
+        return -1;
+    }
+
+    p_buffer->p_data = p_data;
+
+    p_buffer->max_len = max_len;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    append() - Append bytes to buffer
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int append(BUFFER* p_buffer, const void* p_bytes, size_t len) {
+
+    if (reserve(p_buffer, len) != 0) {
+
+        return -1;
+    }
+
+    memcpy(p_buffer->p_data + p_buffer->len, p_bytes, len);
+
+    p_buffer->len += len;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    append_varint() - Append value to buffer, 7 bits per byte, least sig-
+                      nificant first, the top bit of each byte but the last
+                      being set
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int append_varint(BUFFER* p_buffer, uint64_t value) {
+
+    if (reserve(p_buffer, 10) != 0) {
+
+        return -1;
+    }
+
+    uint8_t* p_write = p_buffer->p_data + p_buffer->len;
+
+    while (value >= 0x80) {
+
+        *p_write++ = (uint8_t)value | 0x80;
+
+        value >>= 7;
+    }
+
+    *p_write++ = (uint8_t)value;
+
+    p_buffer->len = p_write - p_buffer->p_data;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    get_varint() - Read value appended by append_varint()
+
+    Return 0 on success, -1 if the value overruns p_end.
+
+*******************************************************************************/
+
+static int get_varint(const uint8_t** pp_next,
+                      const uint8_t* p_end,
+                      uint64_t* p_value) {
+
+    const uint8_t* p_next = *pp_next;
+
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+
+        if (p_next == p_end) {
+
+            return -1;
+        }
+
+        uint8_t byte = *p_next++;
+
+        value |= (uint64_t)(byte & 0x7F) << shift;
+
+        if (byte < 0x80) {
+
+            *pp_next = p_next;
+
+            *p_value = value;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+
+    zigzag(), unzigzag() - Map signed values to unsigned, small magnitudes
+                           to small values
+
+*******************************************************************************/
+
+static inline uint64_t zigzag(int64_t value) {
+
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) {
+
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/*******************************************************************************
+
+    is_word_char() - Return non-zero if character may be part of a word
+
+*******************************************************************************/
+
+static inline int is_word_char(char c) {
+
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+/*******************************************************************************
+
+    hash_word() - Return 64 bit hash of word
+
+*******************************************************************************/
+
+static uint64_t hash_word(const char* p_word, size_t len) {
+
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; i++) {
+
+        hash = (hash ^ (uint8_t)p_word[i]) * 1099511628211ull;
+    }
+
+    hash ^= hash >> 31;
+
+    hash *= 0x9E3779B97F4A7C15ull;
+
+    return hash ^ (hash >> 29);
+}
+
+/*******************************************************************************
+
+    add_words() - Append hash of each word of text to buffer
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int add_words(BUFFER* p_hashes, const char* p_text, size_t len) {
+
+    const char* p_end = p_text + len;
+
+    while (p_text < p_end) {
+
+        if (!is_word_char(*p_text)) {
+
+            p_text++;
+
+            continue;
+        }
+
+        const char* p_word = p_text;
+
+        while (p_text < p_end && is_word_char(*p_text)) {
+
+            p_text++;
+        }
+
+        uint64_t hash = hash_word(p_word, p_text - p_word);
+
+        if (append(p_hashes, &hash, sizeof(hash)) != 0) {
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    filter_bit() - Return bit of Bloom filter of num_bits bits (a power of 
+                   2) set for the i-th hash of a word
+
+*******************************************************************************/
+
+static inline uint64_t filter_bit(uint64_t hash, int i, uint64_t num_bits) {
+
+    uint64_t step = (hash >> 32) | 1;
+
+    return ((hash & 0xFFFFFFFF) + i * step) & (num_bits - 1);
+}
+
+/*******************************************************************************
+
+    filter_may_contain() - Return non-zero unless Bloom filter rules out 
+                           word with given hash
+
+*******************************************************************************/
+
+static int filter_may_contain(const uint8_t* p_filter,
+                              size_t filter_len,
+                              uint64_t hash) {
+
+    uint64_t num_bits = (uint64_t)filter_len * 8;
+
+    for (int i = 0; i < FILTER_NUM_HASHES; i++) {
+
+        uint64_t bit = filter_bit(hash, i, num_bits);
+
+        if ((p_filter[bit / 8] & (1 << (bit % 8))) == 0) {
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+
+    contains_words() - Return non-zero if text contains term, and the term 
+                       neither begins nor ends within a word of the text
+
+*******************************************************************************/
+
+static int contains_words(const char* p_text,
+                          size_t len,
+                          const char* p_term,
+                          size_t term_len) {
+
+    const char* p_end = p_text + len;
+
+    const char* p_next = p_text;
+
+    while ((size_t)(p_end - p_next) >= term_len) {
+
+        const char* p_match = memmem(p_next, p_end - p_next, p_term, term_len);
+
+        if (p_match == NULL) {
+
+            return 0;
+        }
+
+        const char* p_after = p_match + term_len;
+
+        if ((p_match == p_text || !is_word_char(p_term[0]) ||
+             !is_word_char(p_match[-1])) &&
+            (p_after == p_end || !is_word_char(p_term[term_len - 1]) ||
+             !is_word_char(*p_after))) {
+
+            return 1;
+        }
+
+        p_next = p_match + 1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    compare_hashes() - qsort() comparison of word hashes
+
+*******************************************************************************/
+
+static int compare_hashes(const void* p_a, const void* p_b) {
+
+    uint64_t hash_a = *(const uint64_t*)p_a;
+
+    uint64_t hash_b = *(const uint64_t*)p_b;
+
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+/*******************************************************************************
+
+    format_entry() - Append entry to buffer, in the default layout
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int format_entry(BUFFER* p_buffer, const LOGMSG_RECORD* p_record) {
+
+    int64_t secs = p_record->utc_time_ns / NSECS_PER_SEC;
+
+    int64_t nsecs = p_record->utc_time_ns % NSECS_PER_SEC;
+
+    if (nsecs < 0) {
+
+        secs--;
+
+        nsecs += NSECS_PER_SEC;
+    }
+
+    time_t time_secs = (time_t)secs;
+
+    struct tm fields;
+
+    if (gmtime_r(&time_secs, &fields) == NULL) {
+
+        return -1;
+    }
+
+    const char* level = logmsg_level_to_string(p_record->level);
+
+    size_t max_len = LOGMSG_UTC_TIME_LEN + strlen(level) +
+                     p_record->host_len + p_record->program_len +
+                     p_record->message_len + 64;
+
+    if (reserve(p_buffer, max_len) != 0) {
+
+        return -1;
+    }
+
+    char* p_write = (char*)p_buffer->p_data + p_buffer->len;
+
+    int len = sprintf(p_write,
+                      "%04d-%02d-%02d-%02d:%02d:%02d-%09d %s %.*s:%.*s[%d:%d] ",
+                      fields.tm_year + 1900,
+                      fields.tm_mon + 1,
+                      fields.tm_mday,
+                      fields.tm_hour,
+                      fields.tm_min,
+                      fields.tm_sec,
+                      (int)nsecs,
+                      level,
+                      (int)p_record->host_len,
+                      p_record->p_host,
+                      (int)p_record->program_len,
+                      p_record->p_program,
+                      (int)p_record->pid,
+                      (int)p_record->tid);
+
+    if (len < 0) {
+
+        return -1;
+    }
+
+    p_write += len;
+
+    memcpy(p_write, p_record->p_message, p_record->message_len);
+
+    p_write[p_record->message_len] = '\n';
+
+    p_buffer->len += len + p_record->message_len + 1;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    find_slot() - Return slot of hash table holding text, or the empty slot
+                  at which to add it
+
+*******************************************************************************/
+
+static uint32_t find_slot(const DICT* p_dict, const char* p_text, size_t len) {
+
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+
+        hash = (hash ^ (uint8_t)p_text[i]) * 16777619u;
+    }
+
+    uint32_t slot = hash & (p_dict->num_slots - 1);
+
+    while (p_dict->p_slots[slot] != 0) {
+
+        uint32_t index = p_dict->p_slots[slot] - 1;
+
+        if (p_dict->p_lens[index] == len &&
+            memcmp(p_dict->pp_texts[index], p_text, len) == 0) {
+
+            break;
+        }
+
+        slot = (slot + 1) & (p_dict->num_slots - 1);
+    }
+
+    return slot;
+}
+
+/*******************************************************************************
+
+    find_text() - Find text in dictionary
+
+    Return 0 on success, -1 if absent.
+
+*******************************************************************************/
+
+static int find_text(const DICT* p_dict,
+                     const char* p_text,
+                     size_t len,
+                     uint32_t* p_index) {
+
+    if (p_dict->num_slots == 0) {
+
+        return -1;
+    }
+
+    uint32_t slot = find_slot(p_dict, p_text, len);
+
+    if (p_dict->p_slots[slot] == 0) {
+
+        return -1;
+    }
+
+    *p_index = p_dict->p_slots[slot] - 1;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    add_text() - Find text in dictionary, adding it if absent, as a copy
+                 if copy is set
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int add_text(DICT* p_dict,
+                    const char* p_text,
+                    size_t len,
+                    int copy,
+                    uint32_t* p_index) {
+
+    /*
+     *  Grow hash table once half full
+     */
+
+    if (2 * (p_dict->num_texts + 1) > p_dict->num_slots) {
+
+        uint32_t num_slots = p_dict->num_slots ? 2 * p_dict->num_slots : 256;
+
+        uint32_t* p_slots = calloc(num_slots, sizeof(uint32_t));
+
+        if (p_slots == NULL) {
+
+            return -1;
+        }
+
+        free(p_dict->p_slots);
+
+        p_dict->p_slots = p_slots;
+
+        p_dict->num_slots = num_slots;
+
+        for (uint32_t i = 0; i < p_dict->num_texts; i++) {
+
+            uint32_t slot = find_slot(p_dict,
+                                      p_dict->pp_texts[i],
+                                      p_dict->p_lens[i]);
+
+            p_dict->p_slots[slot] = i + 1;
+        }
+    }
+
+    /*
+     *  Find text, else add it
+     */
+
+    uint32_t slot = find_slot(p_dict, p_text, len);
+
+    if (p_dict->p_slots[slot] != 0) {
+
+        *p_index = p_dict->p_slots[slot] - 1;
+
+        return 0;
+    }
+
+    if (p_dict->num_texts == p_dict->max_texts) {
+
+        uint32_t max_texts = p_dict->max_texts ? 2 * p_dict->max_texts : 256;
+
+        const char** pp_texts = realloc(p_dict->pp_texts,
+                                        max_texts * sizeof(char*));
+
+        if (pp_texts == NULL) {
+
+            return -1;
+        }
+
+        p_dict->pp_texts = pp_texts;
+
+        uint16_t* p_lens = realloc(p_dict->p_lens,
+                                   max_texts * sizeof(uint16_t));
+
+        if (p_lens == NULL) {
+
+            return -1;
+        }
+
+        p_dict->p_lens = p_lens;
+
+        p_dict->max_texts = max_texts;
+    }
+
+    if (copy) {
+
+        char* p_copy = malloc(len + 1);
+
+        if (p_copy == NULL) {
+
+            return -1;
+        }
+
+        memcpy(p_copy, p_text, len);
+
+        p_text = p_copy;
+    }
+
+    *p_index = p_dict->num_texts++;
+
+    p_dict->pp_texts[*p_index] = p_text;
+
+    p_dict->p_lens[*p_index] = (uint16_t)len;
+
+    p_dict->p_slots[slot] = *p_index + 1;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    is_variable() - Return non-zero if word of a message is taken to vary
+                    between entries written by the same call, i.e. it con-
+                    tains a digit or is a long hexadecimal number
+
+*******************************************************************************/
+
+static int is_variable(const char* p_word, size_t len) {
+
+    int is_hex = len >= 8;
+
+    for (size_t i = 0; i < len; i++) {
+
+        char c = p_word[i];
+
+        if (c >= '0' && c <= '9') {
+
+            return 1;
+        }
+
+        is_hex &= (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    return is_hex;
+}
+
+/*******************************************************************************
+
+    make_template() - Split message into a template and its variables
+
+    Description
+    ===========
+
+    Each variable word of the message is replaced in the template by a 
+    TEMPLATE_MARKER, and appended to the variables followed by a NULL, so
+    that messages written by the same call usually share a template.
+
+    Return 1 on success, 0 if the message contains a marker or NULL, or is
+    too long, or -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int make_template(BUFFER* p_template,
+                         BUFFER* p_variables,
+                         const char* p_message,
+                         size_t message_len) {
+
+    p_template->len = 0;
+
+    p_variables->len = 0;
+
+    if (message_len > DICT_MAX_TEXT_LEN ||
+        memchr(p_message, TEMPLATE_MARKER, message_len) != NULL ||
+        memchr(p_message, '\0', message_len) != NULL) {
+
+        return 0;
+    }
+
+    const char* p_end = p_message + message_len;
+
+    const char* p_next = p_message;
+
+    int status = 0;
+
+    while (p_next < p_end) {
+
+        const char* p_word = p_next;
+
+        while (p_next < p_end && is_word_char(*p_next)) {
+
+            p_next++;
+        }
+
+        if (p_next > p_word && is_variable(p_word, p_next - p_word)) {
+
+            char marker = TEMPLATE_MARKER;
+
+            status |= append(p_template, &marker, 1);
+
+            status |= append(p_variables, p_word, p_next - p_word);
+
+            status |= append(p_variables, "", 1);
+
+        } else {
+
+            while (p_next < p_end && !is_word_char(*p_next)) {
+
+                p_next++;
+            }
+
+            status |= append(p_template, p_word, p_next - p_word);
+        }
+    }
+
+    return status == 0 ? 1 : -1;
+}
+
+/*******************************************************************************
+
+    expand_template() - Append message made of template and its variables
+                        to buffer
+
+    Return 0 on success, -1 if the variables do not match the template, or
+    on memory exhaustion.
+
+*******************************************************************************/
+
+static int expand_template(BUFFER* p_message,
+                           const char* p_template,
+                           size_t template_len,
+                           const char* p_variables,
+                           size_t variables_len) {
+
+    const char* p_end = p_variables + variables_len;
+
+    if (reserve(p_message, template_len + variables_len) != 0) {
+
+        return -1;
+    }
+
+    char* p_write = (char*)p_message->p_data + p_message->len;
+
+    for (size_t i = 0; i < template_len; i++) {
+
+        if (p_template[i] != TEMPLATE_MARKER) {
+
+            *p_write++ = p_template[i];
+
+            continue;
+        }
+
+        const char* p_null = memchr(p_variables, '\0', p_end - p_variables);
+
+        if (p_null == NULL) {
+
+            return -1;
+        }
+
+        memcpy(p_write, p_variables, p_null - p_variables);
+
+        p_write += p_null - p_variables;
+
+        p_variables = p_null + 1;
+    }
+
+    if (p_variables != p_end) {
+
+        return -1;
+    }
+
+    p_message->len = p_write - (char*)p_message->p_data;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    add_entry() - Add entry to block, with the variables of its message if
+                  it has a template
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int add_entry(BLOCK* p_block,
+                     int level_code,
+                     int64_t utc_time_ns,
+                     const LOGMSG_RECORD* p_record,
+                     uint32_t host_index,
+                     uint32_t program_index,
+                     uint32_t template_code,
+                     const BUFFER* p_variables) {
+
+    BLOCK_INFO* p_info = &p_block->info;
+
+    BUFFER* p_columns = p_block->columns;
+
+    if (p_info->num_entries == 0) {
+
+        p_info->first_time_ns = utc_time_ns;
+
+        p_info->min_time_ns = utc_time_ns;
+
+        p_info->max_time_ns = utc_time_ns;
+
+        p_block->prev_time_ns = utc_time_ns;
+    }
+
+    if (utc_time_ns < p_info->min_time_ns) {
+
+        p_info->min_time_ns = utc_time_ns;
+    }
+
+    if (utc_time_ns > p_info->max_time_ns) {
+
+        p_info->max_time_ns = utc_time_ns;
+    }
+
+    uint8_t level_byte = (uint8_t)level_code;
+
+    int status = append_varint(&p_columns[COLUMN_TIME],
+                               zigzag(utc_time_ns - p_block->prev_time_ns));
+
+    status |= append(&p_columns[COLUMN_LEVEL], &level_byte, 1);
+
+    if (level_code == LEVEL_RAW) {
+
+        status |= append_varint(&p_columns[COLUMN_MESSAGE_LEN],
+                                p_record->entry_len);
+
+        status |= append(&p_columns[COLUMN_MESSAGE],
+                         p_record->p_entry,
+                         p_record->entry_len);
+
+        if (p_block->has_filter) {
+
+            status |= add_words(&p_block->word_hashes,
+                                p_record->p_entry,
+                                p_record->entry_len);
+        }
+
+    } else {
+
+        status |= append_varint(&p_columns[COLUMN_HOST], host_index);
+
+        status |= append_varint(&p_columns[COLUMN_PROGRAM], program_index);
+
+        status |= append_varint(&p_columns[COLUMN_PID],
+                                zigzag(p_record->pid));
+
+        status |= append_varint(&p_columns[COLUMN_TID],
+                                zigzag(p_record->tid));
+
+        status |= append_varint(&p_columns[COLUMN_TEMPLATE], template_code);
+
+        if (template_code != 0) {
+
+            status |= append_varint(&p_columns[COLUMN_MESSAGE_LEN],
+                                    p_variables->len);
+
+            status |= append(&p_columns[COLUMN_MESSAGE],
+                             p_variables->p_data,
+                             p_variables->len);
+
+        } else {
+
+            status |= append_varint(&p_columns[COLUMN_MESSAGE_LEN],
+                                    p_record->message_len);
+
+            status |= append(&p_columns[COLUMN_MESSAGE],
+                             p_record->p_message,
+                             p_record->message_len);
+        }
+
+        if (p_block->has_filter) {
+
+            status |= add_words(&p_block->word_hashes,
+                                p_record->p_message,
+                                p_record->message_len);
+        }
+    }
+
+    p_block->prev_time_ns = utc_time_ns;
+
+    p_info->level_mask |= 1u << level_code;
+
+    p_info->num_entries++;
+
+    p_block->text_len += p_record->entry_len;
+
+    return status;
+}
+
+/*******************************************************************************
+
+    write_filter() - Write Bloom filter of the words of block
+
+    Description
+    ===========
+
+    The filter has FILTER_BITS_PER_WORD bits for each distinct word, 
+    rounded up to a power of 2.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int write_filter(FILE* p_file,
+                        uint64_t* p_offset,
+                        BLOCK* p_block,
+                        BUFFER* p_filter) {
+
+    uint64_t* p_hashes = (uint64_t*)p_block->word_hashes.p_data;
+
+    size_t num_hashes = p_block->word_hashes.len / sizeof(uint64_t);
+
+    size_t num_words = 0;
+
+    if (num_hashes > 0) {
+
+        qsort(p_hashes, num_hashes, sizeof(uint64_t), compare_hashes);
+
+        num_words = 1;
+
+        for (size_t i = 1; i < num_hashes; i++) {
+
+            if (p_hashes[i] != p_hashes[num_words - 1]) {
+
+                p_hashes[num_words++] = p_hashes[i];
+            }
+        }
+    }
+
+    uint64_t num_bits = 64;
+
+    while (num_bits < num_words * FILTER_BITS_PER_WORD) {
+
+        num_bits *= 2;
+    }
+
+    p_filter->len = 0;
+
+    if (reserve(p_filter, num_bits / 8) != 0) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    memset(p_filter->p_data, 0, num_bits / 8);
+
+    for (size_t i = 0; i < num_words; i++) {
+
+        for (int j = 0; j < FILTER_NUM_HASHES; j++) {
+
+            uint64_t bit = filter_bit(p_hashes[i], j, num_bits);
+
+            p_filter->p_data[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    if (fwrite(p_filter->p_data, 1, num_bits / 8, p_file) != num_bits / 8) {
+
+        fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+
+        return -1;
+    }
+
+    p_block->info.filter.offset = *p_offset;
+
+    p_block->info.filter.stored_len = num_bits / 8;
+
+    p_block->info.filter.raw_len = num_bits / 8;
+
+    *p_offset += num_bits / 8;
+
+    p_block->word_hashes.len = 0;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    write_block() - Deflate and write each column of block, and its filter
+                    if any, add block to directory, and empty it
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int write_block(FILE* p_file,
+                       uint64_t* p_offset,
+                       BLOCK* p_block,
+                       BUFFER* p_directory,
+                       BUFFER* p_deflated,
+                       uint64_t* p_column_lens,
+                       uint64_t* p_filters_len) {
+
+    for (int i = 0; i < NUM_COLUMNS; i++) {
+
+        BUFFER* p_column = &p_block->columns[i];
+
+        uLongf stored_len = compressBound(p_column->len);
+
+        p_deflated->len = 0;
+
+        if (reserve(p_deflated, stored_len) != 0) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        if (compress2(p_deflated->p_data,
+                      &stored_len,
+                      p_column->p_data,
+                      p_column->len,
+                      Z_DEFAULT_COMPRESSION) != Z_OK) {
+
+            fprintf(stderr, "Could not deflate %s column\n", column_names[i]);
+
+            return -1;
+        }
+
+        if (fwrite(p_deflated->p_data, 1, stored_len, p_file) != stored_len) {
+
+            fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+
+            return -1;
+        }
+
+        p_block->info.columns[i].offset = *p_offset;
+
+        p_block->info.columns[i].stored_len = (uint32_t)stored_len;
+
+        p_block->info.columns[i].raw_len = (uint32_t)p_column->len;
+
+        *p_offset += stored_len;
+
+        p_column_lens[i] += stored_len;
+
+        p_column->len = 0;
+    }
+
+    if (p_block->has_filter) {
+
+        if (write_filter(p_file, p_offset, p_block, p_deflated) != 0) {
+
+            return -1;
+        }
+
+        *p_filters_len += p_block->info.filter.stored_len;
+    }
+
+    if (append(p_directory, &p_block->info, sizeof(BLOCK_INFO)) != 0) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    memset(&p_block->info, 0, sizeof(BLOCK_INFO));
+
+    p_block->text_len = 0;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    map_file() - Map whole file for reading
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int map_file(const char* file_spec, const char** pp_map, size_t* p_len) {
+
+    int fd = open(file_spec, O_RDONLY);
+
+    if (fd < 0) {
+
+        fprintf(stderr, "Could not open %s: %s\n", file_spec, strerror(errno));
+
+        return -1;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+
+        fprintf(stderr, "Could not stat %s: %s\n", file_spec, strerror(errno));
+
+        close(fd);
+
+        return -1;
+    }
+
+    *pp_map = NULL;
+
+    *p_len = file_stat.st_size;
+
+    if (*p_len > 0) {
+
+        *pp_map = mmap(NULL, *p_len, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (*pp_map == MAP_FAILED) {
+
+            fprintf(stderr, "Could not map %s: %s\n",
+                    file_spec, strerror(errno));
+
+            close(fd);
+
+            return -1;
+        }
+
+        madvise((void*)*pp_map, *p_len, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    create_archive() - Convert log file to archive
+
+    Description
+    ===========
+
+    Each entry is parsed, and stored by column if formatting its fields in
+    the default layout reproduces its text exactly. Otherwise it is stored
+    verbatim, as is text which is not an entry, with the time of the pre-
+    ceding entry. Reading the archive therefore reproduces the log file.
+
+    If filter is set, a Bloom filter of the words of each block is written
+    with it. If templates is set, messages are split into templates, kept
+    in the dictionary, and their variables, for up to MAX_TEMPLATES tem-
+    plates.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int create_archive(const char* log_spec,
+                          const char* archive_spec,
+                          size_t block_len,
+                          int filter,
+                          int templates,
+                          int verbose) {
+
+    const char* p_map;
+
+    size_t map_len;
+
+    if (map_file(log_spec, &p_map, &map_len) != 0) {
+
+        return -1;
+    }
+
+    FILE* p_file = fopen(archive_spec, "w");
+
+    if (p_file == NULL) {
+
+        fprintf(stderr, "Could not create %s: %s\n",
+                archive_spec, strerror(errno));
+
+        return -1;
+    }
+
+    ARCHIVE_HEADER header;
+
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+
+    header.version = ARCHIVE_VERSION;
+
+    header.num_columns = NUM_COLUMNS;
+
+    if (fwrite(&header, sizeof(header), 1, p_file) != 1) {
+
+        fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+
+        return -1;
+    }
+
+    uint64_t offset = sizeof(header);
+
+    /*
+     *  Add each entry to the current block, writing it when full
+     */
+
+    static BLOCK block;
+
+    static DICT dict;
+
+    BUFFER directory = { NULL, 0, 0 };
+
+    BUFFER deflated = { NULL, 0, 0 };
+
+    BUFFER formatted = { NULL, 0, 0 };
+
+    BUFFER template_text = { NULL, 0, 0 };
+
+    BUFFER variables = { NULL, 0, 0 };
+
+    uint32_t num_templates = 0;
+
+    uint64_t column_lens[NUM_COLUMNS] = { 0 };
+
+    uint64_t filters_len = 0;
+
+    block.has_filter = filter;
+
+    uint64_t num_entries = 0;
+
+    uint64_t num_raw = 0;
+
+    int64_t prev_time_ns = 0;
+
+    LOGMSG_PARSER parser;
+
+    logmsg_parser_init(&parser, p_map, map_len);
+
+    for (;;) {
+
+        LOGMSG_RECORD record;
+
+        int status = logmsg_parser_next(&parser, &record);
+
+        if (status == 0) {
+
+            break;
+        }
+
+        int level_code = LEVEL_RAW;
+
+        uint32_t host_index = 0;
+
+        uint32_t program_index = 0;
+
+        if (status > 0) {
+
+            prev_time_ns = record.utc_time_ns;
+
+            formatted.len = 0;
+
+            if (record.level >= LOGMSG_LEVEL_MIN &&
+                record.level <= LOGMSG_LEVEL_MAX &&
+                record.host_len <= DICT_MAX_TEXT_LEN &&
+                record.program_len <= DICT_MAX_TEXT_LEN &&
+                format_entry(&formatted, &record) == 0 &&
+                formatted.len == record.entry_len &&
+                memcmp(formatted.p_data, record.p_entry,
+                       record.entry_len) == 0) {
+
+                level_code = record.level;
+            }
+        }
+
+        if (level_code != LEVEL_RAW &&
+            (add_text(&dict, record.p_host, record.host_len, 0,
+                      &host_index) != 0 ||
+             add_text(&dict, record.p_program, record.program_len, 0,
+                      &program_index) != 0)) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        /*
+         *  Find or add template of message
+         */
+
+        uint32_t template_code = 0;
+
+        if (templates && level_code != LEVEL_RAW) {
+
+            uint32_t template_index;
+
+            int template_status = make_template(&template_text,
+                                                &variables,
+                                                record.p_message,
+                                                record.message_len);
+
+            if (template_status > 0 &&
+                find_text(&dict, (const char*)template_text.p_data,
+                          template_text.len, &template_index) == 0) {
+
+                template_code = template_index + 1;
+
+            } else if (template_status > 0 && num_templates < MAX_TEMPLATES) {
+
+                template_status = add_text(&dict,
+                                           (const char*)template_text.p_data,
+                                           template_text.len,
+                                           1,
+                                           &template_index);
+
+                num_templates++;
+
+                template_code = template_index + 1;
+            }
+
+            if (template_status < 0) {
+
+                fprintf(stderr, "Heap memory exhausted\n");
+
+                return -1;
+            }
+        }
+
+        if (add_entry(&block, level_code, prev_time_ns, &record,
+                      host_index, program_index, template_code,
+                      &variables) != 0) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        num_entries++;
+
+        num_raw += (level_code == LEVEL_RAW);
+
+        if (block.info.num_entries == BLOCK_MAX_ENTRIES ||
+            block.text_len >= block_len) {
+
+            if (write_block(p_file, &offset, &block, &directory, &deflated,
+                            column_lens, &filters_len) != 0) {
+
+                return -1;
+            }
+        }
+    }
+
+    if (block.info.num_entries > 0 &&
+        write_block(p_file, &offset, &block, &directory, &deflated,
+                    column_lens, &filters_len) != 0) {
+
+        return -1;
+    }
+
+    /*
+     *  Write dictionary, directory and trailer
+     */
+
+    ARCHIVE_TRAILER trailer;
+
+    memset(&trailer, 0, sizeof(trailer));
+
+    trailer.dict_offset = offset;
+
+    trailer.num_texts = dict.num_texts;
+
+    trailer.num_blocks = directory.len / sizeof(BLOCK_INFO);
+
+    memcpy(trailer.magic, ARCHIVE_MAGIC, sizeof(trailer.magic));
+
+    BUFFER dict_text = { NULL, 0, 0 };
+
+    int status = 0;
+
+    for (uint32_t i = 0; i < dict.num_texts; i++) {
+
+        status |= append(&dict_text, &dict.p_lens[i], sizeof(uint16_t));
+
+        status |= append(&dict_text, dict.pp_texts[i], dict.p_lens[i]);
+    }
+
+    uLongf dict_len = compressBound(dict_text.len);
+
+    deflated.len = 0;
+
+    if (status != 0 || reserve(&deflated, dict_len) != 0) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    if (compress2(deflated.p_data,
+                  &dict_len,
+                  dict_text.p_data,
+                  dict_text.len,
+                  Z_DEFAULT_COMPRESSION) != Z_OK) {
+
+        fprintf(stderr, "Could not deflate dictionary\n");
+
+        return -1;
+    }
+
+    trailer.dict_raw_len = dict_text.len;
+
+    trailer.directory_offset = offset + dict_len;
+
+    status |= fwrite(deflated.p_data, 1, dict_len, p_file) != dict_len;
+
+    status |= fwrite(directory.p_data, 1, directory.len, p_file) !=
+                  directory.len;
+
+    status |= fwrite(&trailer, sizeof(trailer), 1, p_file) != 1;
+
+    status |= fclose(p_file) != 0;
+
+    if (status != 0) {
+
+        fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+
+        return -1;
+    }
+
+    offset += dict_len + directory.len + sizeof(trailer);
+
+    if (verbose) {
+
+        fprintf(stderr,
+                "%llu entries (%llu verbatim), %u blocks, "
+                "%u names and templates\n"
+                "%llu bytes of log text, %llu bytes of archive (%.1f%%)\n",
+                (unsigned long long)num_entries,
+                (unsigned long long)num_raw,
+                trailer.num_blocks,
+                trailer.num_texts,
+                (unsigned long long)map_len,
+                (unsigned long long)offset,
+                map_len ? 100.0 * offset / map_len : 0.0);
+
+        for (int i = 0; i < NUM_COLUMNS; i++) {
+
+            fprintf(stderr, "%14llu bytes of %s column\n",
+                    (unsigned long long)column_lens[i], column_names[i]);
+        }
+
+        fprintf(stderr, "%14llu bytes of filters\n",
+                (unsigned long long)filters_len);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    read_column() - Read and inflate one column of a block
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int read_column(int fd,
+                       const COLUMN_INFO* p_info,
+                       BUFFER* p_column,
+                       BUFFER* p_deflated,
+                       uint64_t* p_bytes_read) {
+
+    p_column->len = 0;
+
+    p_deflated->len = 0;
+
+    if (reserve(p_column, p_info->raw_len) != 0 ||
+        reserve(p_deflated, p_info->stored_len) != 0) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    if (pread(fd, p_deflated->p_data, p_info->stored_len, p_info->offset) !=
+            p_info->stored_len) {
+
+        fprintf(stderr, "Could not read archive\n");
+
+        return -1;
+    }
+
+    *p_bytes_read += p_info->stored_len;
+
+    uLongf raw_len = p_info->raw_len;
+
+    if (uncompress(p_column->p_data,
+                   &raw_len,
+                   p_deflated->p_data,
+                   p_info->stored_len) != Z_OK ||
+        raw_len != p_info->raw_len) {
+
+        fprintf(stderr, "Corrupt archive column\n");
+
+        return -1;
+    }
+
+    p_column->len = raw_len;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    open_archive() - Open archive, and read its dictionary and directory
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int open_archive(ARCHIVE* p_archive, const char* archive_spec) {
+
+    memset(p_archive, 0, sizeof(ARCHIVE));
+
+    p_archive->fd = open(archive_spec, O_RDONLY);
+
+    if (p_archive->fd < 0) {
+
+        fprintf(stderr, "Could not open %s: %s\n",
+                archive_spec, strerror(errno));
+
+        return -1;
+    }
+
+    int fd = p_archive->fd;
+
+    struct stat file_stat;
+
+    ARCHIVE_HEADER header;
+
+    ARCHIVE_TRAILER* p_trailer = &p_archive->trailer;
+
+    if (fstat(fd, &file_stat) != 0 ||
+        file_stat.st_size < (off_t)(sizeof(header) + sizeof(*p_trailer)) ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        pread(fd, p_trailer, sizeof(*p_trailer),
+              file_stat.st_size - sizeof(*p_trailer)) != sizeof(*p_trailer) ||
+        memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 ||
+        memcmp(p_trailer->magic, ARCHIVE_MAGIC, sizeof(p_trailer->magic)) ||
+        header.version != ARCHIVE_VERSION ||
+        header.num_columns != NUM_COLUMNS ||
+        p_trailer->dict_offset > p_trailer->directory_offset ||
+        p_trailer->directory_offset +
+            (uint64_t)p_trailer->num_blocks * sizeof(BLOCK_INFO) !=
+                file_stat.st_size - sizeof(*p_trailer)) {
+
+        fprintf(stderr, "%s is not an archive\n", archive_spec);
+
+        return -1;
+    }
+
+    p_archive->file_len = file_stat.st_size;
+
+    p_archive->bytes_read = sizeof(header) + sizeof(*p_trailer);
+
+    /*
+     *  Read dictionary and directory
+     */
+
+    COLUMN_INFO dict_info;
+
+    dict_info.offset = p_trailer->dict_offset;
+
+    dict_info.stored_len = p_trailer->directory_offset -
+                               p_trailer->dict_offset;
+
+    dict_info.raw_len = p_trailer->dict_raw_len;
+
+    size_t directory_len = p_trailer->num_blocks * sizeof(BLOCK_INFO);
+
+    BUFFER deflated = { NULL, 0, 0 };
+
+    p_archive->pp_texts = calloc(p_trailer->num_texts + 1, sizeof(char*));
+
+    p_archive->p_lens = calloc(p_trailer->num_texts + 1, sizeof(uint16_t));
+
+    p_archive->p_blocks = malloc(directory_len + 1);
+
+    if (p_archive->pp_texts == NULL || p_archive->p_lens == NULL ||
+        p_archive->p_blocks == NULL) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    if (read_column(fd, &dict_info, &p_archive->dict, &deflated,
+                    &p_archive->bytes_read) != 0) {
+
+        return -1;
+    }
+
+    free(deflated.p_data);
+
+    if (pread(fd, p_archive->p_blocks, directory_len,
+              p_trailer->directory_offset) != (ssize_t)directory_len) {
+
+        fprintf(stderr, "Could not read archive\n");
+
+        return -1;
+    }
+
+    p_archive->bytes_read += directory_len;
+
+    const uint8_t* p_next = p_archive->dict.p_data;
+
+    const uint8_t* p_end = p_next + p_archive->dict.len;
+
+    for (uint32_t i = 0; i < p_trailer->num_texts; i++) {
+
+        uint16_t len;
+
+        if (p_end - p_next < (ssize_t)sizeof(uint16_t)) {
+
+            fprintf(stderr, "Corrupt archive dictionary\n");
+
+            return -1;
+        }
+
+        memcpy(&len, p_next, sizeof(uint16_t));
+
+        p_next += sizeof(uint16_t);
+
+        if (p_end - p_next < len) {
+
+            fprintf(stderr, "Corrupt archive dictionary\n");
+
+            return -1;
+        }
+
+        p_archive->pp_texts[i] = (const char*)p_next;
+
+        p_archive->p_lens[i] = len;
+
+        p_next += len;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    read_archive() - Write entries of archive to standard output, in their
+                     original text
+
+    Description
+    ===========
+
+    Only entries stamped from start_time_ns through end_time_ns, at levels 
+    up to max_level, whose messages match template_id unless it is -1, and
+    whose messages contain the words of p_term unless it is NULL, are 
+    written. Text stored verbatim has the time of the preceding entry, is 
+    written only if max_level is LOGMSG_LEVEL_MAX and template_id is -1, 
+    and is searched whole.
+
+    Blocks are skipped if their time range or levels exclude all entries,
+    or their filter excludes a word of p_term, and otherwise their time, 
+    level and, if selecting by template, template columns are read first,
+    so that the others are read only if some entry is selected.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int read_archive(const char* archive_spec,
+                        LOGMSG_LEVEL max_level,
+                        int64_t start_time_ns,
+                        int64_t end_time_ns,
+                        int64_t template_id,
+                        const char* p_term,
+                        int verbose) {
+
+    ARCHIVE archive;
+
+    if (open_archive(&archive, archive_spec) != 0) {
+
+        return -1;
+    }
+
+    int fd = archive.fd;
+
+    uint32_t num_texts = archive.trailer.num_texts;
+
+    /*
+     *  Select entries of each block
+     */
+
+    uint32_t level_mask = 0;
+
+    for (int level = LOGMSG_LEVEL_MIN; level <= max_level; level++) {
+
+        level_mask |= 1u << level;
+    }
+
+    if (max_level == LOGMSG_LEVEL_MAX && template_id < 0) {
+
+        level_mask |= 1u << LEVEL_RAW;
+    }
+
+    size_t term_len = p_term != NULL ? strlen(p_term) : 0;
+
+    BUFFER term_hashes = { NULL, 0, 0 };
+
+    if (add_words(&term_hashes, p_term, term_len) != 0) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    static BUFFER columns[NUM_COLUMNS];
+
+    BUFFER deflated = { NULL, 0, 0 };
+
+    BUFFER filter = { NULL, 0, 0 };
+
+    BUFFER output = { NULL, 0, 0 };
+
+    BUFFER expanded = { NULL, 0, 0 };
+
+    BUFFER selected = { NULL, 0, 0 };
+
+    BUFFER times = { NULL, 0, 0 };
+
+    uint32_t num_blocks_read = 0;
+
+    uint32_t num_blocks_filtered = 0;
+
+    for (uint32_t b = 0; b < archive.trailer.num_blocks; b++) {
+
+        BLOCK_INFO info;
+
+        memcpy(&info, &archive.p_blocks[b], sizeof(info));
+
+        if (info.max_time_ns < start_time_ns ||
+            info.min_time_ns > end_time_ns ||
+            (info.level_mask & level_mask) == 0) {
+
+            continue;
+        }
+
+        /*
+         *  Check filter for each word of term
+         */
+
+        if (term_hashes.len > 0 && info.filter.stored_len > 0) {
+
+            filter.len = 0;
+
+            if (reserve(&filter, info.filter.stored_len) != 0) {
+
+                fprintf(stderr, "Heap memory exhausted\n");
+
+                return -1;
+            }
+
+            if (pread(fd, filter.p_data, info.filter.stored_len,
+                      info.filter.offset) != info.filter.stored_len) {
+
+                fprintf(stderr, "Could not read archive\n");
+
+                return -1;
+            }
+
+            archive.bytes_read += info.filter.stored_len;
+
+            const uint64_t* p_hashes = (const uint64_t*)term_hashes.p_data;
+
+            size_t num_hashes = term_hashes.len / sizeof(uint64_t);
+
+            size_t i = 0;
+
+            while (i < num_hashes &&
+                   filter_may_contain(filter.p_data,
+                                      info.filter.stored_len,
+                                      p_hashes[i])) {
+                i++;
+            }
+
+            if (i < num_hashes) {
+
+                num_blocks_filtered++;
+
+                continue;
+            }
+        }
+
+        num_blocks_read++;
+
+        int is_read[NUM_COLUMNS] = { 0 };
+
+        for (int c = COLUMN_TIME; c < NUM_COLUMNS; c++) {
+
+            if (c == COLUMN_TIME || c == COLUMN_LEVEL ||
+                (c == COLUMN_TEMPLATE && template_id >= 0)) {
+
+                if (read_column(fd, &info.columns[c], &columns[c], &deflated,
+                                &archive.bytes_read) != 0) {
+
+                    return -1;
+                }
+
+                is_read[c] = 1;
+            }
+        }
+
+        if (columns[COLUMN_LEVEL].len != info.num_entries) {
+
+            fprintf(stderr, "Corrupt archive block\n");
+
+            return -1;
+        }
+
+        /*
+         *  Decode times, and check for any entry selected
+         */
+
+        times.len = 0;
+
+        selected.len = 0;
+
+        if (reserve(&times, info.num_entries * sizeof(int64_t)) != 0 ||
+            reserve(&selected, info.num_entries) != 0) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        int64_t* p_times = (int64_t*)times.p_data;
+
+        uint8_t* p_selected = selected.p_data;
+
+        const uint8_t* p_levels = columns[COLUMN_LEVEL].p_data;
+
+        const uint8_t* p_time = columns[COLUMN_TIME].p_data;
+
+        const uint8_t* p_time_end = p_time + columns[COLUMN_TIME].len;
+
+        const uint8_t* p_template = columns[COLUMN_TEMPLATE].p_data;
+
+        const uint8_t* p_template_end = p_template +
+                                            columns[COLUMN_TEMPLATE].len;
+
+        int64_t time_ns = info.first_time_ns;
+
+        uint32_t num_selected = 0;
+
+        for (uint32_t i = 0; i < info.num_entries; i++) {
+
+            uint64_t delta;
+
+            uint64_t template_code = 0;
+
+            if (get_varint(&p_time, p_time_end, &delta) != 0 ||
+                p_levels[i] > LEVEL_RAW ||
+                (template_id >= 0 && p_levels[i] != LEVEL_RAW &&
+                 get_varint(&p_template, p_template_end,
+                            &template_code) != 0)) {
+
+                fprintf(stderr, "Corrupt archive block\n");
+
+                return -1;
+            }
+
+            time_ns += unzigzag(delta);
+
+            p_times[i] = time_ns;
+
+            p_selected[i] = time_ns >= start_time_ns &&
+                            time_ns <= end_time_ns &&
+                            (level_mask & (1u << p_levels[i])) != 0 &&
+                            (template_id < 0 ||
+                             template_code == (uint64_t)template_id + 1);
+
+            num_selected += p_selected[i];
+        }
+
+        if (num_selected == 0) {
+
+            continue;
+        }
+
+        /*
+         *  Read other columns, and write selected entries
+         */
+
+        for (int c = COLUMN_HOST; c < NUM_COLUMNS; c++) {
+
+            if (!is_read[c] &&
+                read_column(fd, &info.columns[c], &columns[c], &deflated,
+                            &archive.bytes_read) != 0) {
+
+                return -1;
+            }
+        }
+
+        const uint8_t* p_next_values[NUM_COLUMNS];
+
+        const uint8_t* p_end_values[NUM_COLUMNS];
+
+        for (int c = 0; c < NUM_COLUMNS; c++) {
+
+            p_next_values[c] = columns[c].p_data;
+
+            p_end_values[c] = columns[c].p_data + columns[c].len;
+        }
+
+        output.len = 0;
+
+        for (uint32_t i = 0; i < info.num_entries; i++) {
+
+            LOGMSG_RECORD record;
+
+            uint64_t values[NUM_COLUMNS] = { 0 };
+
+            int status = 0;
+
+            int is_raw = p_levels[i] == LEVEL_RAW;
+
+            for (int c = COLUMN_HOST; c <= COLUMN_MESSAGE_LEN; c++) {
+
+                if (!is_raw || c == COLUMN_MESSAGE_LEN) {
+
+                    status |= get_varint(&p_next_values[c], p_end_values[c],
+                                         &values[c]);
+                }
+            }
+
+            uint64_t message_len = values[COLUMN_MESSAGE_LEN];
+
+            if (status != 0 ||
+                message_len > (uint64_t)(p_end_values[COLUMN_MESSAGE] -
+                                         p_next_values[COLUMN_MESSAGE]) ||
+                (!is_raw && (values[COLUMN_HOST] >= num_texts ||
+                             values[COLUMN_PROGRAM] >= num_texts ||
+                             values[COLUMN_TEMPLATE] > num_texts))) {
+
+                fprintf(stderr, "Corrupt archive block\n");
+
+                return -1;
+            }
+
+            const char* p_message = (const char*)p_next_values[COLUMN_MESSAGE];
+
+            p_next_values[COLUMN_MESSAGE] += message_len;
+
+            if (!p_selected[i]) {
+
+                continue;
+            }
+
+            /*
+             *  Rebuild message from its template
+             */
+
+            if (values[COLUMN_TEMPLATE] != 0) {
+
+                uint64_t index = values[COLUMN_TEMPLATE] - 1;
+
+                expanded.len = 0;
+
+                if (expand_template(&expanded,
+                                    archive.pp_texts[index],
+                                    archive.p_lens[index],
+                                    p_message,
+                                    message_len) != 0) {
+
+                    fprintf(stderr, "Corrupt archive block\n");
+
+                    return -1;
+                }
+
+                p_message = (const char*)expanded.p_data;
+
+                message_len = expanded.len;
+            }
+
+            if (p_term != NULL &&
+                !contains_words(p_message, message_len, p_term, term_len)) {
+
+                continue;
+            }
+
+            if (is_raw) {
+
+                status = append(&output, p_message, message_len);
+
+            } else {
+
+                record.utc_time_ns = p_times[i];
+
+                record.level = (LOGMSG_LEVEL)p_levels[i];
+
+                record.p_host = archive.pp_texts[values[COLUMN_HOST]];
+
+                record.host_len = archive.p_lens[values[COLUMN_HOST]];
+
+                record.p_program = archive.pp_texts[values[COLUMN_PROGRAM]];
+
+                record.program_len = archive.p_lens[values[COLUMN_PROGRAM]];
+
+                record.pid = (int32_t)unzigzag(values[COLUMN_PID]);
+
+                record.tid = (int32_t)unzigzag(values[COLUMN_TID]);
+
+                record.p_message = p_message;
+
+                record.message_len = message_len;
+
+                status = format_entry(&output, &record);
+            }
+
+            if (status != 0) {
+
+                fprintf(stderr, "Heap memory exhausted\n");
+
+                return -1;
+            }
+        }
+
+        fwrite(output.p_data, 1, output.len, stdout);
+    }
+
+    fflush(stdout);
+
+    close(fd);
+
+    if (verbose) {
+
+        fprintf(stderr,
+                "%llu of %llu bytes read, %u of %u blocks, "
+                "%u ruled out by filters\n",
+                (unsigned long long)archive.bytes_read,
+                (unsigned long long)archive.file_len,
+                num_blocks_read,
+                archive.trailer.num_blocks,
+                num_blocks_filtered);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    TEMPLATE_COUNT - Number of entries whose messages match a template
+
+*******************************************************************************/
+
+typedef struct TEMPLATE_COUNT {
+
+    uint64_t num_entries;
+
+    uint32_t index;
+
+} TEMPLATE_COUNT;
+
+/*******************************************************************************
+
+    compare_template_counts() - qsort() comparison by decreasing number of
+                                entries
+
+*******************************************************************************/
+
+static int compare_template_counts(const void* p_a, const void* p_b) {
+
+    const TEMPLATE_COUNT* p_count_a = (const TEMPLATE_COUNT*)p_a;
+
+    const TEMPLATE_COUNT* p_count_b = (const TEMPLATE_COUNT*)p_b;
+
+    return (p_count_a->num_entries < p_count_b->num_entries) -
+               (p_count_a->num_entries > p_count_b->num_entries);
+}
+
+/*******************************************************************************
+
+    list_templates() - Write templates of archive to standard output, with
+                       their IDs and numbers of entries, most used first
+
+    Description
+    ===========
+
+    Only the level and template columns of each block are read. Variables
+    are shown as <*>.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int list_templates(const char* archive_spec, int verbose) {
+
+    ARCHIVE archive;
+
+    if (open_archive(&archive, archive_spec) != 0) {
+
+        return -1;
+    }
+
+    uint32_t num_texts = archive.trailer.num_texts;
+
+    TEMPLATE_COUNT* p_counts = calloc(num_texts + 1, sizeof(TEMPLATE_COUNT));
+
+    if (p_counts == NULL) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_texts; i++) {
+
+        p_counts[i].index = i;
+    }
+
+    BUFFER levels = { NULL, 0, 0 };
+
+    BUFFER templates = { NULL, 0, 0 };
+
+    BUFFER deflated = { NULL, 0, 0 };
+
+    for (uint32_t b = 0; b < archive.trailer.num_blocks; b++) {
+
+        const BLOCK_INFO* p_info = &archive.p_blocks[b];
+
+        if (read_column(archive.fd, &p_info->columns[COLUMN_LEVEL], &levels,
+                        &deflated, &archive.bytes_read) != 0 ||
+            read_column(archive.fd, &p_info->columns[COLUMN_TEMPLATE],
+                        &templates, &deflated, &archive.bytes_read) != 0) {
+
+            return -1;
+        }
+
+        const uint8_t* p_next = templates.p_data;
+
+        const uint8_t* p_end = p_next + templates.len;
+
+        for (size_t i = 0; i < levels.len; i++) {
+
+            uint64_t template_code;
+
+            if (levels.p_data[i] == LEVEL_RAW) {
+
+                continue;
+            }
+
+            if (get_varint(&p_next, p_end, &template_code) != 0 ||
+                template_code > num_texts) {
+
+                fprintf(stderr, "Corrupt archive block\n");
+
+                return -1;
+            }
+
+            if (template_code != 0) {
+
+                p_counts[template_code - 1].num_entries++;
+            }
+        }
+    }
+
+    qsort(p_counts, num_texts, sizeof(TEMPLATE_COUNT),
+          compare_template_counts);
+
+    for (uint32_t i = 0; i < num_texts && p_counts[i].num_entries > 0; i++) {
+
+        const char* p_text = archive.pp_texts[p_counts[i].index];
+
+        size_t len = archive.p_lens[p_counts[i].index];
+
+        printf("%12llu %8u ",
+               (unsigned long long)p_counts[i].num_entries,
+               p_counts[i].index);
+
+        for (size_t j = 0; j < len; j++) {
+
+            if (p_text[j] == TEMPLATE_MARKER) {
+
+                fputs("<*>", stdout);
+
+            } else {
+
+                putchar(p_text[j]);
+            }
+        }
+
+        putchar('\n');
+    }
+
+    fflush(stdout);
+
+    close(archive.fd);
+
+    if (verbose) {
+
+        fprintf(stderr, "%llu of %llu bytes read\n",
+                (unsigned long long)archive.bytes_read,
+                (unsigned long long)archive.file_len);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        archive-log [-b <block-kib>] [-f] [-T] [-v] <log-file> <archive-file>
+
+        archive-log -x [-l <level>] [-g <term>] [-t <template-id>] [-v]
+                    <archive-file> [<start-time> [<end-time>]]
+
+        archive-log -p [-v] <archive-file>
+
+    In the first form, convert <log-file>, which is no longer being written, 
+    to a columnar archive. The entries are divided into blocks holding up 
+    to <block-kib> KiB (default 1024) of log text. Within each block, the 
+    times, levels, host and program names, PIDs, TIDs and messages of the
+    entries are stored as separate columns, deflated separately: times as 
+    deltas, host and program names as indexes into a dictionary, and 
+    integers as varints. The time range and levels of each block are kept
+    in a directory at the end of the archive. With -f, a Bloom filter of 
+    the words of the messages of each block is added, costing about 10 
+    bits per distinct word. With -T, each message is split into a template,
+    its constant words, kept once in the dictionary, and its variables -
+    the words holding digits, and long hex strings - which alone are kept
+    in the message column.
+
+    In the second form, write the entries of <archive-file> to standard 
+    output, in their original text. With <level>, only entries at that 
+    level or more severe are written. With <start-time>, only entries 
+    stamped from <start-time> through <end-time> are written; times are as
+    for seek-log. With <term>, only entries whose messages contain <term>,
+    not beginning or ending within a word, are written - e.g. a request 
+    ID. Only the blocks which may hold such entries are read, consulting 
+    their filters for the words of <term>, and of those only the time and 
+    level columns unless an entry is selected. With <template-id>, only 
+    entries whose messages match that template are written.
+
+    In the third form, write the templates of <archive-file>, with their 
+    IDs and numbers of entries, most used first.
+
+    With -v, sizes of the archive and its columns, or the amount of the
+    archive read, are written to standard error.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    const char* invocation_message =
+        "Invocation: ./archive-log [-b <block-kib>] [-f] [-T] [-v] "
+        "<log-file> <archive-file>\n"
+        "            ./archive-log -x [-l <level>] [-g <term>] "
+        "[-t <template-id>] [-v] <archive-file> [<start-time> [<end-time>]]\n"
+        "            ./archive-log -p [-v] <archive-file>";
+
+    /***************************************************************************
+
+        Get program arguments
+
+    ***************************************************************************/
+
+    int extract = 0;
+
+    int verbose = 0;
+
+    int filter = 0;
+
+    int templates = 0;
+
+    int list = 0;
+
+    int64_t template_id = -1;
+
+    const char* p_term = NULL;
+
+    size_t block_kib = DEFAULT_BLOCK_KIB;
+
+    LOGMSG_LEVEL max_level = LOGMSG_LEVEL_MAX;
+
+    {
+        int option;
+
+        while ((option = getopt(argc, argv, "b:fg:l:pTt:vx")) != -1) {
+
+            switch (option) {
+
+            case 'b':
+
+                if (sscanf(optarg, "%zu", &block_kib) != 1 ||
+                    block_kib == 0 || block_kib > MAX_BLOCK_KIB) {
+
+                    printf("\n%s\n", invocation_message);
+
+                    return 1;
+                }
+
+                break;
+
+            case 'f':
+
+                filter = 1;
+
+                break;
+
+            case 'g':
+
+                p_term = optarg;
+
+                break;
+
+            case 'l':
+
+                max_level = logmsg_level_from_string(optarg, strlen(optarg));
+
+                if (max_level == LOGMSG_LEVEL_UNDEFINED) {
+
+                    printf("\nInvalid level: %s\n", optarg);
+
+                    return 1;
+                }
+
+                break;
+
+            case 'p':
+
+                list = 1;
+
+                break;
+
+            case 'T':
+
+                templates = 1;
+
+                break;
+
+            case 't':
+
+                if (sscanf(optarg, "%" SCNd64, &template_id) != 1 ||
+                    template_id < 0 || template_id >= UINT32_MAX) {
+
+                    printf("\nInvalid template ID: %s\n", optarg);
+
+                    return 1;
+                }
+
+                break;
+
+            case 'v':
+
+                verbose = 1;
+
+                break;
+
+            case 'x':
+
+                extract = 1;
+
+                break;
+
+            default:
+
+                printf("\n%s\n", invocation_message);
+
+                return 1;
+            }
+        }
+    }
+
+    /***************************************************************************
+
+        Convert log file
+
+    ***************************************************************************/
+
+    if (!extract && !list) {
+
+        if (argc - optind != 2) {
+
+            printf("\n%s\n", invocation_message);
+
+            return 1;
+        }
+
+        if (create_archive(argv[optind],
+                           argv[optind + 1],
+                           block_kib * 1024,
+                           filter,
+                           templates,
+                           verbose) != 0) {
+
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /***************************************************************************
+
+        List templates
+
+    ***************************************************************************/
+
+    if (list) {
+
+        if (extract || argc - optind != 1) {
+
+            printf("\n%s\n", invocation_message);
+
+            return 1;
+        }
+
+        if (list_templates(argv[optind], verbose) != 0) {
+
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /***************************************************************************
+
+        Read archive
+
+    ***************************************************************************/
+
+    if (argc - optind < 1 || argc - optind > 3) {
+
+        printf("\n%s\n", invocation_message);
+
+        return 1;
+    }
+
+    int64_t start_time_ns = INT64_MIN;
+
+    int64_t end_time_ns = INT64_MAX;
+
+    if (argc - optind >= 2) {
+
+        int64_t span_ns = 0;
+
+        if (logmsg_parse_partial_utc_time(argv[optind + 1],
+                                          &start_time_ns,
+                                          &span_ns) != 0) {
+
+            printf("\nInvalid start time: %s\n", argv[optind + 1]);
+
+            return 1;
+        }
+
+        end_time_ns = start_time_ns + span_ns - 1;
+
+        if (argc - optind == 3) {
+
+            if (logmsg_parse_partial_utc_time(argv[optind + 2],
+                                              &end_time_ns,
+                                              &span_ns) != 0) {
+
+                printf("\nInvalid end time: %s\n", argv[optind + 2]);
+
+                return 1;
+            }
+
+            end_time_ns += span_ns - 1;
+        }
+    }
+
+    static char stdout_buf[4 << 20];
+
+    setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+    if (read_archive(argv[optind],
+                     max_level,
+                     start_time_ns,
+                     end_time_ns,
+                     template_id,
+                     p_term,
+                     verbose) != 0) {
+
+        return 1;
+    }
+
+    return 0;
+}
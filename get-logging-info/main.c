@@ -2,7 +2,8 @@
 
     get-logging-info
     
-    Gather and print information to be used by dbglog library
+    Gather and print information to be used by dbglog library, or query
+    log files written by it
 
     -----------------------------------------------------------------------
     
@@ -42,6 +43,8 @@
 
 #include <stdio.h>
 
+#include <stdlib.h>
+
 #include <string.h>
 
 #include <stdint.h>
@@ -52,23 +55,646 @@
 
 #include <unistd.h>
 
+#include <getopt.h>
+
+#include <pthread.h>
+
+#include <regex.h>
+
 #include <sys/types.h>
 
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
 #include <sys/syscall.h>
 
 #include <errno.h>
 
+#include <fcntl.h>
+
+#include <logmsg_parse.h>
+
 extern char *program_invocation_short_name;
 
 /*******************************************************************************
 
-    main()
-    
-    Invoke with no arguments
-    
+    FILTER - Conditions an entry must meet to be printed
+
 *******************************************************************************/
 
-int main(int argc, char **argv) {
+typedef struct FILTER {
+
+    LOGMSG_LEVEL max_level;     // Most detailed level to print
+
+    int64_t from_time_ns;
+
+    int64_t to_time_ns;
+
+    const char* host;           // NULL to accept any
+
+    const char* program;        // NULL to accept any
+
+    long pid;                   // -1 to accept any
+
+    long tid;                   // -1 to accept any
+
+    const char* substring;      // NULL to accept any
+
+    const char* regex;          // NULL to accept any
+
+} FILTER;
+
+/*******************************************************************************
+
+    RANGE - Byte range of mapped log file to be printed
+
+*******************************************************************************/
+
+typedef struct RANGE {
+
+    const char* p_begin;
+
+    size_t len;
+
+} RANGE;
+
+/*******************************************************************************
+
+    CHUNK - Portion of a log file scanned by a single thread. Chunks begin
+            and end on entry boundaries.
+
+*******************************************************************************/
+
+typedef struct CHUNK {
+
+    const char* p_begin;
+
+    const char* p_end;
+
+    RANGE* p_ranges;            // Matching entries, adjacent ones merged
+
+    size_t num_ranges;
+
+    size_t max_ranges;
+
+    int done;
+
+} CHUNK;
+
+/*******************************************************************************
+
+    QUERY - State shared by the scanning threads and the output thread
+
+*******************************************************************************/
+
+typedef struct QUERY {
+
+    FILTER filter;
+
+    CHUNK* p_chunks;
+
+    size_t num_chunks;
+
+    size_t next_chunk;          // Next chunk to be claimed by a thread
+
+    size_t next_output;         // Next chunk to be printed
+
+    size_t max_pending;         // Limit on chunks scanned ahead of output
+
+    int failed;
+
+    pthread_mutex_t mutex;
+
+    pthread_cond_t cond;
+
+} QUERY;
+
+/*******************************************************************************
+
+    entry_matches() - Apply filter to an entry
+
+*******************************************************************************/
+
+static int entry_matches(const FILTER* p_filter,
+                         const LOGMSG_RECORD* p_entry,
+                         regex_t* p_regex) {
+
+    if (p_filter->max_level != LOGMSG_LEVEL_UNDEFINED &&
+        (p_entry->level == LOGMSG_LEVEL_UNDEFINED ||
+         p_entry->level > p_filter->max_level)) {
+
+        return 0;
+    }
+
+    if (p_entry->utc_time_ns < p_filter->from_time_ns ||
+        p_entry->utc_time_ns > p_filter->to_time_ns) {
+
+        return 0;
+    }
+
+    if (p_filter->pid >= 0 && p_entry->pid != p_filter->pid) {
+
+        return 0;
+    }
+
+    if (p_filter->tid >= 0 && p_entry->tid != p_filter->tid) {
+
+        return 0;
+    }
+
+    if (p_filter->host != NULL &&
+        (strlen(p_filter->host) != p_entry->host_len ||
+         memcmp(p_filter->host, p_entry->p_host, p_entry->host_len) != 0)) {
+
+        return 0;
+    }
+
+    if (p_filter->program != NULL &&
+        (strlen(p_filter->program) != p_entry->program_len ||
+         memcmp(p_filter->program,
+                p_entry->p_program,
+                p_entry->program_len) != 0)) {
+
+        return 0;
+    }
+
+    if (p_filter->substring != NULL &&
+        memmem(p_entry->p_message,
+               p_entry->message_len,
+               p_filter->substring,
+               strlen(p_filter->substring)) == NULL) {
+
+        return 0;
+    }
+
+    if (p_regex != NULL) {
+
+        regmatch_t match;
+
+        match.rm_so = 0;
+
+        match.rm_eo = p_entry->message_len;
+
+        if (regexec(p_regex, p_entry->p_message, 1, &match, REG_STARTEND)) {
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+
+    add_range() - Record a matching entry for output, merging it with the
+                  previous one if they are adjacent
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int add_range(CHUNK* p_chunk, const char* p_begin, const char* p_end) {
+
+    if (p_chunk->num_ranges > 0) {
+
+        RANGE* p_last = &p_chunk->p_ranges[p_chunk->num_ranges - 1];
+
+        if (p_last->p_begin + p_last->len == p_begin) {
+
+            p_last->len += p_end - p_begin;
+
+            return 0;
+        }
+    }
+
+    if (p_chunk->num_ranges == p_chunk->max_ranges) {
+
+        size_t max_ranges = p_chunk->max_ranges ? 2 * p_chunk->max_ranges : 64;
+
+        RANGE* p_ranges =
+            realloc(p_chunk->p_ranges, max_ranges * sizeof(RANGE));
+
+        if (p_ranges == NULL) {
+
+            return -1;
+        }
+
+        p_chunk->p_ranges = p_ranges;
+
+        p_chunk->max_ranges = max_ranges;
+    }
+
+    p_chunk->p_ranges[p_chunk->num_ranges].p_begin = p_begin;
+
+    p_chunk->p_ranges[p_chunk->num_ranges].len = p_end - p_begin;
+
+    p_chunk->num_ranges++;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    scan_chunk() - Find entries of a chunk which match the filter
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int scan_chunk(const FILTER* p_filter,
+                      CHUNK* p_chunk,
+                      regex_t* p_regex) {
+
+    LOGMSG_PARSER parser;
+
+    LOGMSG_RECORD entry;
+
+    logmsg_parser_init(&parser,
+                       p_chunk->p_begin,
+                       p_chunk->p_end - p_chunk->p_begin);
+
+    int status;
+
+    while ((status = logmsg_parser_next(&parser, &entry)) != 0) {
+
+        /*
+         *  Lines preceding the first entry of a file are never printed
+         */
+
+        if (status > 0 && entry_matches(p_filter, &entry, p_regex)) {
+
+            if (add_range(p_chunk,
+                          entry.p_entry,
+                          entry.p_entry + entry.entry_len) != 0) {
+
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    scan_thread() - Claim and scan chunks until none remain
+
+*******************************************************************************/
+
+static void* scan_thread(void* p_arg) {
+
+    QUERY* p_query = (QUERY*)p_arg;
+
+    /*
+     *  regexec() serializes callers sharing a compiled expression, so
+     *  each thread compiles its own
+     */
+
+    regex_t regex;
+
+    regex_t* p_regex = NULL;
+
+    if (p_query->filter.regex != NULL) {
+
+        if (regcomp(&regex,
+                    p_query->filter.regex,
+                    REG_EXTENDED | REG_NOSUB | REG_NEWLINE) != 0) {
+
+            pthread_mutex_lock(&p_query->mutex);
+
+            p_query->failed = 1;
+
+            p_query->next_chunk = p_query->num_chunks;
+
+            pthread_cond_broadcast(&p_query->cond);
+
+            pthread_mutex_unlock(&p_query->mutex);
+
+            return NULL;
+        }
+
+        p_regex = &regex;
+    }
+
+    for (;;) {
+
+        /*
+         *  Claim next chunk, staying within max_pending of the output
+         */
+
+        size_t chunk_num = 0;
+
+        {
+            pthread_mutex_lock(&p_query->mutex);
+
+            while (p_query->next_chunk < p_query->num_chunks &&
+                   p_query->next_chunk >=
+                       p_query->next_output + p_query->max_pending) {
+
+                pthread_cond_wait(&p_query->cond, &p_query->mutex);
+            }
+
+            chunk_num = p_query->next_chunk;
+
+            if (chunk_num < p_query->num_chunks) {
+
+                p_query->next_chunk++;
+            }
+
+            pthread_mutex_unlock(&p_query->mutex);
+        }
+
+        if (chunk_num >= p_query->num_chunks) {
+
+            break;
+        }
+
+        /*
+         *  Scan chunk, and hand results to output thread
+         */
+
+        CHUNK* p_chunk = &p_query->p_chunks[chunk_num];
+
+        int status = scan_chunk(&p_query->filter, p_chunk, p_regex);
+
+        pthread_mutex_lock(&p_query->mutex);
+
+        if (status != 0) {
+
+            p_query->failed = 1;
+        }
+
+        p_chunk->done = 1;
+
+        pthread_cond_broadcast(&p_query->cond);
+
+        pthread_mutex_unlock(&p_query->mutex);
+    }
+
+    if (p_regex != NULL) {
+
+        regfree(p_regex);
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+
+    add_file_chunks() - Map log file and divide it into chunks of about
+                        chunk_len bytes, split on entry boundaries
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int add_file_chunks(QUERY* p_query,
+                           const char* file_spec,
+                           size_t chunk_len) {
+
+    int fd = open(file_spec, O_RDONLY);
+
+    if (fd < 0) {
+
+        fprintf(stderr, "Could not open %s: %s\n", file_spec, strerror(errno));
+
+        return -1;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+
+        fprintf(stderr, "Could not stat %s: %s\n", file_spec, strerror(errno));
+
+        close(fd);
+
+        return -1;
+    }
+
+    size_t map_len = file_stat.st_size;
+
+    if (map_len == 0) {
+
+        close(fd);
+
+        return 0;
+    }
+
+    const char* p_map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (p_map == MAP_FAILED) {
+
+        fprintf(stderr, "Could not map %s: %s\n", file_spec, strerror(errno));
+
+        return -1;
+    }
+
+    madvise((void*)p_map, map_len, MADV_SEQUENTIAL);
+
+    /*
+     *  Split on entry boundaries, so continuation lines stay with their
+     *  entry
+     */
+
+    const char* p_end = p_map + map_len;
+
+    const char* p_begin = p_map;
+
+    while (p_begin < p_end) {
+
+        const char* p_split = p_begin + chunk_len;
+
+        if (p_split >= p_end) {
+
+            p_split = p_end;
+
+        } else {
+
+            p_split = logmsg_find_newline(p_split, p_end);
+
+            if (p_split < p_end) {
+
+                p_split = logmsg_find_entry(p_split + 1, p_end);
+            }
+        }
+
+        CHUNK* p_chunks = realloc(p_query->p_chunks,
+                                  (p_query->num_chunks + 1) * sizeof(CHUNK));
+
+        if (p_chunks == NULL) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        p_query->p_chunks = p_chunks;
+
+        CHUNK* p_chunk = &p_chunks[p_query->num_chunks++];
+
+        memset(p_chunk, 0, sizeof(CHUNK));
+
+        p_chunk->p_begin = p_begin;
+
+        p_chunk->p_end = p_split;
+
+        p_begin = p_split;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    run_query() - Scan chunks in parallel, and print matching entries in
+                  file order
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int run_query(QUERY* p_query, size_t num_threads) {
+
+    pthread_t threads[num_threads];
+
+    size_t num_started = 0;
+
+    for (; num_started < num_threads; num_started++) {
+
+        if (pthread_create(&threads[num_started],
+                           NULL,
+                           scan_thread,
+                           p_query) != 0) {
+
+            break;
+        }
+    }
+
+    if (num_started == 0) {
+
+        fprintf(stderr, "Could not start threads\n");
+
+        return -1;
+    }
+
+    /*
+     *  Print chunks as they complete, in order
+     */
+
+    static char stdout_buf[1 << 20];
+
+    setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+    for (size_t i = 0; i < p_query->num_chunks; i++) {
+
+        CHUNK* p_chunk = &p_query->p_chunks[i];
+
+        pthread_mutex_lock(&p_query->mutex);
+
+        while (!p_chunk->done && !p_query->failed) {
+
+            pthread_cond_wait(&p_query->cond, &p_query->mutex);
+        }
+
+        int failed = p_query->failed;
+
+        pthread_mutex_unlock(&p_query->mutex);
+
+        if (failed) {
+
+            break;
+        }
+
+        for (size_t j = 0; j < p_chunk->num_ranges; j++) {
+
+            const RANGE* p_range = &p_chunk->p_ranges[j];
+
+            fwrite(p_range->p_begin, 1, p_range->len, stdout);
+
+            // Ranges end with an entry, and the last entry of a log still
+            // being written may be incomplete
+
+            if (p_range->len > 0 &&
+                p_range->p_begin[p_range->len - 1] != '\n') {
+
+                putchar('\n');
+            }
+        }
+
+        free(p_chunk->p_ranges);
+
+        p_chunk->p_ranges = NULL;
+
+        /*
+         *  Release the pages of the printed chunk
+         */
+
+        {
+            uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+
+            uintptr_t begin = ((uintptr_t)p_chunk->p_begin + page_mask) &
+                                  ~page_mask;
+
+            uintptr_t end = (uintptr_t)p_chunk->p_end & ~page_mask;
+
+            if (end > begin) {
+
+                madvise((void*)begin, end - begin, MADV_DONTNEED);
+            }
+        }
+
+        pthread_mutex_lock(&p_query->mutex);
+
+        p_query->next_output++;
+
+        pthread_cond_broadcast(&p_query->cond);
+
+        pthread_mutex_unlock(&p_query->mutex);
+    }
+
+    /*
+     *  Stop claiming chunks if output was abandoned, and wait for threads
+     */
+
+    pthread_mutex_lock(&p_query->mutex);
+
+    if (p_query->failed) {
+
+        p_query->next_chunk = p_query->num_chunks;
+
+        pthread_cond_broadcast(&p_query->cond);
+    }
+
+    pthread_mutex_unlock(&p_query->mutex);
+
+    for (size_t i = 0; i < num_started; i++) {
+
+        pthread_join(threads[i], NULL);
+    }
+
+    fflush(stdout);
+
+    if (p_query->failed) {
+
+        fprintf(stderr, "Query failed\n");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    print_logging_info() - Print the information logmsg places in each entry
+
+*******************************************************************************/
+
+static void print_logging_info(void) {
 
     {
         struct timespec system_time_ns = { 0, 0 };
@@ -118,6 +744,257 @@ int main(int argc, char **argv) {
         
         printf("Thread lwpid  = %d\n", tid);
     }
+}
+
+/*******************************************************************************
+
+    main()
     
+    Invoke with no arguments to print the information logmsg places in each
+    log entry, as seen by this program.
+
+    Invoke with one or more log files to print their entries which meet
+    all of the given conditions, in file order:
+
+        -l, --level <level>     Entries at <level> or more severe
+        -f, --from <time>       Entries stamped at or after <time>
+        -t, --to <time>         Entries stamped within or before <time>
+        -H, --host <name>       Entries from host <name>
+        -p, --program <name>    Entries from program <name>
+        -P, --pid <pid>         Entries from process <pid>
+        -T, --tid <tid>         Entries from thread <tid>
+        -s, --substring <text>  Entries whose message contains <text>
+        -e, --regex <regex>     Entries whose message matches extended
+                                regular expression <regex>
+
+    Times are in the UTC format of the log entries, and may be truncated at
+    any field, e.g. 2018-09-22-14:03 denotes that minute.
+
+    The files are mapped and divided into chunks of --chunk-mib MiB (default
+    16), which are scanned by --threads threads (default one per online CPU).
+    
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    if (argc == 1) {
+
+        print_logging_info();
+
+        return 0;
+    }
+
+    const char* invocation_message =
+        "Invocation: ./get-logging-info [-l <level>] [-f <time>] [-t <time>] "
+        "[-H <host>] [-p <program>] [-P <pid>] [-T <tid>] [-s <text>] "
+        "[-e <regex>] [-j <threads>] [-c <chunk-mib>] <log-file>...";
+
+    /***************************************************************************
+    
+        Get program arguments
+        
+    ***************************************************************************/
+
+    QUERY query;
+
+    memset(&query, 0, sizeof(query));
+
+    query.filter.max_level = LOGMSG_LEVEL_UNDEFINED;
+
+    query.filter.from_time_ns = INT64_MIN;
+
+    query.filter.to_time_ns = INT64_MAX;
+
+    query.filter.pid = -1;
+
+    query.filter.tid = -1;
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    long chunk_mib = 16;
+
+    {
+        static const struct option options[] = {
+
+            { "level",      required_argument, NULL, 'l' },
+            { "from",       required_argument, NULL, 'f' },
+            { "to",         required_argument, NULL, 't' },
+            { "host",       required_argument, NULL, 'H' },
+            { "program",    required_argument, NULL, 'p' },
+            { "pid",        required_argument, NULL, 'P' },
+            { "tid",        required_argument, NULL, 'T' },
+            { "substring",  required_argument, NULL, 's' },
+            { "regex",      required_argument, NULL, 'e' },
+            { "threads",    required_argument, NULL, 'j' },
+            { "chunk-mib",  required_argument, NULL, 'c' },
+            { NULL,         0,                 NULL,  0  }
+        };
+
+        int option;
+
+        while ((option = getopt_long(argc, argv, "l:f:t:H:p:P:T:s:e:j:c:",
+                                     options, NULL)) != -1) {
+
+            int valid = 1;
+
+            int64_t span_ns = 0;
+
+            switch (option) {
+
+            case 'l':
+
+                query.filter.max_level =
+                    logmsg_level_from_string(optarg, strlen(optarg));
+
+                valid = query.filter.max_level != LOGMSG_LEVEL_UNDEFINED;
+
+                break;
+
+            case 'f':
+
+                valid = logmsg_parse_partial_utc_time(
+                            optarg, &query.filter.from_time_ns, &span_ns) == 0;
+
+                break;
+
+            case 't':
+
+                valid = logmsg_parse_partial_utc_time(
+                            optarg, &query.filter.to_time_ns, &span_ns) == 0;
+
+                query.filter.to_time_ns += span_ns - 1;
+
+                break;
+
+            case 'H':
+
+                query.filter.host = optarg;
+
+                break;
+
+            case 'p':
+
+                query.filter.program = optarg;
+
+                break;
+
+            case 'P':
+
+                valid = sscanf(optarg, "%ld", &query.filter.pid) == 1;
+
+                break;
+
+            case 'T':
+
+                valid = sscanf(optarg, "%ld", &query.filter.tid) == 1;
+
+                break;
+
+            case 's':
+
+                query.filter.substring = optarg;
+
+                break;
+
+            case 'e':
+
+                {
+                    regex_t regex;
+
+                    valid = regcomp(&regex, optarg, REG_EXTENDED) == 0;
+
+                    if (valid) {
+
+                        regfree(&regex);
+                    }
+                }
+
+                query.filter.regex = optarg;
+
+                break;
+
+            case 'j':
+
+                valid = sscanf(optarg, "%ld", &num_threads) == 1 &&
+                            num_threads > 0;
+
+                break;
+
+            case 'c':
+
+                valid = sscanf(optarg, "%ld", &chunk_mib) == 1 &&
+                            chunk_mib > 0;
+
+                break;
+
+            default:
+
+                valid = 0;
+
+                break;
+            }
+
+            if (!valid) {
+
+                printf("\n%s\n", invocation_message);
+
+                return 1;
+            }
+        }
+
+        if (optind == argc) {
+
+            printf("\n%s\n", invocation_message);
+
+            return 1;
+        }
+
+        if (num_threads < 1) {
+
+            num_threads = 1;
+        }
+    }
+
+    /***************************************************************************
+    
+        Map log files and divide into chunks
+        
+    ***************************************************************************/
+
+    for (int i = optind; i < argc; i++) {
+
+        if (add_file_chunks(&query, argv[i], (size_t)chunk_mib << 20) != 0) {
+
+            return 1;
+        }
+    }
+
+    if (query.num_chunks == 0) {
+
+        return 0;
+    }
+
+    /***************************************************************************
+    
+        Scan chunks and print matching entries
+        
+    ***************************************************************************/
+
+    query.max_pending = 2 * num_threads;
+
+    pthread_mutex_init(&query.mutex, NULL);
+
+    pthread_cond_init(&query.cond, NULL);
+
+    if ((size_t)num_threads > query.num_chunks) {
+
+        num_threads = query.num_chunks;
+    }
+
+    if (run_query(&query, num_threads) != 0) {
+
+        return 1;
+    }
+
 	return 0;
 }
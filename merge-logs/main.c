@@ -0,0 +1,766 @@
+/*******************************************************************************
+
+    merge-logs
+
+    Merge log files into a single log ordered by UTC time
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include <fcntl.h>
+
+#include <glob.h>
+
+#include <logmsg_parse.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define NSECS_PER_SEC 1000000000LL
+
+// Mapped pages are released once this many bytes behind the oldest pending
+// entry of a file
+
+#define RELEASE_INTERVAL (64 << 20)
+
+/*******************************************************************************
+
+    PENDING - Entry read from an input file but not yet written
+
+*******************************************************************************/
+
+typedef struct PENDING {
+
+    int64_t utc_time_ns;
+
+    uint64_t seq_num;           // Position in file, to keep order of ties
+
+    const char* p_entry;
+
+    size_t entry_len;
+
+} PENDING;
+
+/*******************************************************************************
+
+    INPUT - Input file, and its entries pending output
+
+    Description
+    ===========
+
+    Entries are read into a min-heap ordered by time until the earliest of
+    them is older than the latest entry read by more than the disorder
+    window, or the file is exhausted. Since no later entry can then be
+    older than the earliest pending entry, the latter may be written.
+
+*******************************************************************************/
+
+typedef struct INPUT {
+
+    const char* file_spec;
+
+    const char* p_map;
+
+    size_t map_len;
+
+    size_t released_len;        // Length of mapping released so far
+
+    LOGMSG_PARSER parser;
+
+    int exhausted;
+
+    int64_t max_time_ns;        // Latest time read
+
+    uint64_t num_read;
+
+    PENDING* p_heap;
+
+    size_t heap_len;
+
+    size_t heap_max;
+
+} INPUT;
+
+/*******************************************************************************
+
+    pending_before() - Heap ordering of pending entries
+
+*******************************************************************************/
+
+static inline int pending_before(const PENDING* p_a, const PENDING* p_b) {
+
+    if (p_a->utc_time_ns != p_b->utc_time_ns) {
+
+        return p_a->utc_time_ns < p_b->utc_time_ns;
+    }
+
+    return p_a->seq_num < p_b->seq_num;
+}
+
+/*******************************************************************************
+
+    push_pending() - Add entry to heap of input
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int push_pending(INPUT* p_input, const PENDING* p_pending) {
+
+    if (p_input->heap_len == p_input->heap_max) {
+
+        size_t heap_max = p_input->heap_max ? 2 * p_input->heap_max : 256;
+
+        PENDING* p_heap = realloc(p_input->p_heap, heap_max * sizeof(PENDING));
+
+        if (p_heap == NULL) {
+
+            return -1;
+        }
+
+        p_input->p_heap = p_heap;
+
+        p_input->heap_max = heap_max;
+    }
+
+    PENDING* p_heap = p_input->p_heap;
+
+    size_t i = p_input->heap_len++;
+
+    while (i > 0) {
+
+        size_t parent = (i - 1) / 2;
+
+        if (!pending_before(p_pending, &p_heap[parent])) {
+
+            break;
+        }
+
+        p_heap[i] = p_heap[parent];
+
+        i = parent;
+    }
+
+    p_heap[i] = *p_pending;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    pop_pending() - Remove earliest entry from heap of input
+
+*******************************************************************************/
+
+static void pop_pending(INPUT* p_input) {
+
+    PENDING* p_heap = p_input->p_heap;
+
+    PENDING last = p_heap[--p_input->heap_len];
+
+    size_t len = p_input->heap_len;
+
+    size_t i = 0;
+
+    for (;;) {
+
+        size_t child = 2 * i + 1;
+
+        if (child >= len) {
+
+            break;
+        }
+
+        if (child + 1 < len && pending_before(&p_heap[child + 1],
+                                              &p_heap[child])) {
+
+            child++;
+        }
+
+        if (!pending_before(&p_heap[child], &last)) {
+
+            break;
+        }
+
+        p_heap[i] = p_heap[child];
+
+        i = child;
+    }
+
+    if (len > 0) {
+
+        p_heap[i] = last;
+    }
+}
+
+/*******************************************************************************
+
+    release_pages() - Release mapped pages of input which precede all pending
+                      entries, keeping memory use bounded for large files
+
+*******************************************************************************/
+
+static void release_pages(INPUT* p_input) {
+
+    const char* p_oldest = p_input->parser.p_next;
+
+    for (size_t i = 0; i < p_input->heap_len; i++) {
+
+        if (p_input->p_heap[i].p_entry < p_oldest) {
+
+            p_oldest = p_input->p_heap[i].p_entry;
+        }
+    }
+
+    size_t page_mask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+
+    size_t release_len = (p_oldest - p_input->p_map) & ~page_mask;
+
+    if (release_len > p_input->released_len) {
+
+        madvise((void*)(p_input->p_map + p_input->released_len),
+                release_len - p_input->released_len,
+                MADV_DONTNEED);
+
+        p_input->released_len = release_len;
+    }
+}
+
+/*******************************************************************************
+
+    fill_input() - Read entries of input until its earliest pending entry may
+                   be written
+
+    Description
+    ===========
+
+    Text which is not an entry is given the time of the preceding entry, so
+    that it stays with it. Reading goes on while no entry with a time has
+    been read, max_time_ns being INT64_MIN, as the start of the window 
+    would then overflow.
+
+    Return 0 on success, -1 on memory exhaustion.
+
+*******************************************************************************/
+
+static int fill_input(INPUT* p_input, int64_t window_ns) {
+
+    while (!p_input->exhausted &&
+           (p_input->heap_len == 0 ||
+            p_input->max_time_ns < INT64_MIN + window_ns ||
+            p_input->p_heap[0].utc_time_ns >
+                p_input->max_time_ns - window_ns)) {
+
+        LOGMSG_RECORD record;
+
+        int status = logmsg_parser_next(&p_input->parser, &record);
+
+        if (status == 0) {
+
+            p_input->exhausted = 1;
+
+            break;
+        }
+
+        PENDING pending;
+
+        pending.utc_time_ns = status > 0 ? record.utc_time_ns
+                                         : p_input->max_time_ns;
+
+        pending.seq_num = p_input->num_read++;
+
+        pending.p_entry = record.p_entry;
+
+        pending.entry_len = record.entry_len;
+
+        if (pending.utc_time_ns > p_input->max_time_ns) {
+
+            p_input->max_time_ns = pending.utc_time_ns;
+        }
+
+        if (push_pending(p_input, &pending) != 0) {
+
+            return -1;
+        }
+
+        if (p_input->parser.p_next - p_input->p_map >
+                p_input->released_len + 2 * RELEASE_INTERVAL) {
+
+            release_pages(p_input);
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    input_before() - Ordering of inputs by their earliest pending entry
+
+*******************************************************************************/
+
+static inline int input_before(const INPUT* p_a, const INPUT* p_b) {
+
+    const PENDING* p_pending_a = &p_a->p_heap[0];
+
+    const PENDING* p_pending_b = &p_b->p_heap[0];
+
+    if (p_pending_a->utc_time_ns != p_pending_b->utc_time_ns) {
+
+        return p_pending_a->utc_time_ns < p_pending_b->utc_time_ns;
+    }
+
+    return p_a < p_b;
+}
+
+/*******************************************************************************
+
+    sift_down_input() - Restore heap of inputs below position i after the
+                        input there changed
+
+*******************************************************************************/
+
+static void sift_down_input(INPUT** pp_heap, size_t len, size_t i) {
+
+    INPUT* p_root = pp_heap[i];
+
+    for (;;) {
+
+        size_t child = 2 * i + 1;
+
+        if (child >= len) {
+
+            break;
+        }
+
+        if (child + 1 < len && input_before(pp_heap[child + 1],
+                                            pp_heap[child])) {
+
+            child++;
+        }
+
+        if (!input_before(pp_heap[child], p_root)) {
+
+            break;
+        }
+
+        pp_heap[i] = pp_heap[child];
+
+        i = child;
+    }
+
+    pp_heap[i] = p_root;
+}
+
+/*******************************************************************************
+
+    open_input() - Map input file
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int open_input(INPUT* p_input, const char* file_spec) {
+
+    memset(p_input, 0, sizeof(INPUT));
+
+    p_input->file_spec = file_spec;
+
+    p_input->max_time_ns = INT64_MIN;
+
+    int fd = open(file_spec, O_RDONLY);
+
+    if (fd < 0) {
+
+        fprintf(stderr, "Could not open %s: %s\n", file_spec, strerror(errno));
+
+        return -1;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+
+        fprintf(stderr, "Could not stat %s: %s\n", file_spec, strerror(errno));
+
+        close(fd);
+
+        return -1;
+    }
+
+    p_input->map_len = file_stat.st_size;
+
+    if (p_input->map_len > 0) {
+
+        p_input->p_map = mmap(NULL, p_input->map_len, PROT_READ,
+                              MAP_SHARED, fd, 0);
+
+        if (p_input->p_map == MAP_FAILED) {
+
+            fprintf(stderr, "Could not map %s: %s\n",
+                    file_spec, strerror(errno));
+
+            close(fd);
+
+            return -1;
+        }
+
+        madvise((void*)p_input->p_map, p_input->map_len, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    logmsg_parser_init(&p_input->parser, p_input->p_map, p_input->map_len);
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    add_shards() - Add shard files of the log file log_spec to the list of
+                   input file specs
+
+    Description
+    ===========
+
+    Shard files are named by log_spec followed by "." and the process ID, 
+    and optionally "." and the thread ID, as written by a program which 
+    called logmsg_set_sharding().
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int add_shards(const char* log_spec,
+                      char*** ppp_specs,
+                      size_t* p_num_specs) {
+
+    size_t log_spec_len = strlen(log_spec);
+
+    char pattern[log_spec_len + 8];
+
+    snprintf(pattern, sizeof(pattern), "%s.[0-9]*", log_spec);
+
+    glob_t matches;
+
+    int status = glob(pattern, 0, NULL, &matches);
+
+    if (status == GLOB_NOMATCH) {
+
+        fprintf(stderr, "No shard files found for %s\n", log_spec);
+
+        return -1;
+    }
+
+    if (status != 0) {
+
+        fprintf(stderr, "Could not find shard files for %s\n", log_spec);
+
+        return -1;
+    }
+
+    char** pp_specs = realloc(*ppp_specs, (*p_num_specs + matches.gl_pathc) *
+                                              sizeof(char*));
+
+    if (pp_specs == NULL) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        globfree(&matches);
+
+        return -1;
+    }
+
+    *ppp_specs = pp_specs;
+
+    size_t num_specs = *p_num_specs;
+
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+
+        const char* p_suffix = matches.gl_pathv[i] + log_spec_len + 1;
+
+        if (strspn(p_suffix, "0123456789.") != strlen(p_suffix)) {
+
+            continue;
+        }
+
+        pp_specs[*p_num_specs] = strdup(matches.gl_pathv[i]);
+
+        if (pp_specs[*p_num_specs] == NULL) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            globfree(&matches);
+
+            return -1;
+        }
+
+        (*p_num_specs)++;
+    }
+
+    globfree(&matches);
+
+    if (*p_num_specs == num_specs) {
+
+        fprintf(stderr, "No shard files found for %s\n", log_spec);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        merge-logs [-w <window-secs>] [-s] <log-file>...
+
+    Write the entries of all log files to standard output, in order of
+    their UTC times. Entries with equal times are written in the order of
+    the files on the command line.
+
+    With -s, each <log-file> is the name given to a sharded log file, and
+    its shard files are read in its place, so that they appear as one log.
+
+    Each file is expected to be in time order, apart from local disorder of
+    up to <window-secs> (default 0.0) caused by concurrent writers, which is
+    corrected. Memory use depends on the number of entries falling within
+    the window, not on the size of the files.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    const char* invocation_message =
+        "Invocation: ./merge-logs [-w <window-secs>] [-s] <log-file>...";
+
+    /***************************************************************************
+
+        Get program arguments
+
+    ***************************************************************************/
+
+    int64_t window_ns = 0;
+
+    int sharded = 0;
+
+    {
+        int option;
+
+        while ((option = getopt(argc, argv, "w:s")) != -1) {
+
+            switch (option) {
+
+            case 'w':
+
+                {
+                    double window_secs = 0.0;
+
+                    if (sscanf(optarg, "%lf", &window_secs) != 1 ||
+                        window_secs < 0.0) {
+
+                        printf("\n%s\n", invocation_message);
+
+                        return 1;
+                    }
+
+                    window_ns = window_secs * 1.0e9;
+                }
+
+                break;
+
+            case 's':
+
+                sharded = 1;
+
+                break;
+
+            default:
+
+                printf("\n%s\n", invocation_message);
+
+                return 1;
+            }
+        }
+
+        if (optind == argc) {
+
+            printf("\n%s\n", invocation_message);
+
+            return 1;
+        }
+    }
+
+    /***************************************************************************
+
+        Open input files, and read their first entries
+
+    ***************************************************************************/
+
+    char** pp_file_specs = &argv[optind];
+
+    size_t num_inputs = argc - optind;
+
+    if (sharded) {
+
+        pp_file_specs = NULL;
+
+        num_inputs = 0;
+
+        for (int i = optind; i < argc; i++) {
+
+            if (add_shards(argv[i], &pp_file_specs, &num_inputs) != 0) {
+
+                return 1;
+            }
+        }
+    }
+
+    INPUT* p_inputs = calloc(num_inputs, sizeof(INPUT));
+
+    INPUT** pp_heap = calloc(num_inputs, sizeof(INPUT*));
+
+    size_t heap_len = 0;
+
+    if (p_inputs == NULL || pp_heap == NULL) {
+
+        fprintf(stderr, "Heap memory exhausted\n");
+
+        return 1;
+    }
+
+    for (size_t i = 0; i < num_inputs; i++) {
+
+        if (open_input(&p_inputs[i], pp_file_specs[i]) != 0) {
+
+            return 1;
+        }
+
+        if (fill_input(&p_inputs[i], window_ns) != 0) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return 1;
+        }
+
+        if (p_inputs[i].heap_len > 0) {
+
+            pp_heap[heap_len++] = &p_inputs[i];
+        }
+    }
+
+    for (size_t i = heap_len / 2; i-- > 0; ) {
+
+        sift_down_input(pp_heap, heap_len, i);
+    }
+
+    /***************************************************************************
+
+        Write earliest pending entry of all inputs until all are exhausted
+
+    ***************************************************************************/
+
+    static char stdout_buf[4 << 20];
+
+    setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+    while (heap_len > 0) {
+
+        INPUT* p_input = pp_heap[0];
+
+        const PENDING* p_pending = &p_input->p_heap[0];
+
+        fwrite(p_pending->p_entry, 1, p_pending->entry_len, stdout);
+
+        if (p_pending->entry_len > 0 &&
+            p_pending->p_entry[p_pending->entry_len - 1] != '\n') {
+
+            putchar('\n');
+        }
+
+        pop_pending(p_input);
+
+        if (fill_input(p_input, window_ns) != 0) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return 1;
+        }
+
+        if (p_input->heap_len == 0) {
+
+            pp_heap[0] = pp_heap[--heap_len];
+
+            if (p_input->map_len > 0) {
+
+                munmap((void*)p_input->p_map, p_input->map_len);
+            }
+        }
+
+        if (heap_len > 0) {
+
+            sift_down_input(pp_heap, heap_len, 0);
+        }
+    }
+
+    fflush(stdout);
+
+	return 0;
+}
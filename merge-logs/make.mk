@@ -0,0 +1,44 @@
+################################################################################
+#
+#	Makefile for merge-logs program
+#
+#	Note: The following environment variables should be set prior to
+#	invoking this Makefile: 
+#
+#	${PREFIX}          - Path to installation folder.
+#
+#	${PKG_CONFIG_PATH} - Search path for .pc files.
+#
+################################################################################
+
+SRC_DIR=.
+
+PROGRAM_NAME=merge-logs
+
+OUT_FILE=$(PROGRAM_NAME)
+
+SRC_FILES=$(SRC_DIR)/main.c
+
+CC = gcc
+
+CFLAGS=-g -O2 -Wall -std=c99
+
+CFLAGS+=$(shell pkg-config --cflags liblogmsg)
+
+LDFLAGS=-Wl,-L$(PREFIX)/lib
+
+LDFLAGS+=-Wl,--as-needed -Wl,-rpath=$(PREFIX)/lib
+
+LIBS=
+LIBS+=$(shell pkg-config --libs liblogmsg)
+
+$(OUT_FILE): $(SRC_FILES)
+	$(CC) $(CFLAGS) $(LDFLAGS) $(SRC_FILES) $(LIBS) -o $(OUT_FILE)
+	
+clean:
+	$(RM) $(OUT_FILE) *.o
+	
+install:
+	
+.PHONY: install clean
+
@@ -0,0 +1,617 @@
+/*******************************************************************************
+
+    seek-log
+
+    Print the entries of a log file which fall within a UTC time range
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include <fcntl.h>
+
+#include <logmsg_parse.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define NSECS_PER_SEC 1000000000LL
+
+/*******************************************************************************
+
+    INDEX_RECORD - Record of a time index file written by logmsg_open_index()
+
+*******************************************************************************/
+
+typedef struct INDEX_RECORD {
+
+    int64_t utc_time_ns;    // No entry before file_offset is later than this
+
+    int64_t file_offset;
+
+} INDEX_RECORD;
+
+/*******************************************************************************
+
+    compare_index_records() - qsort() comparison by time
+
+*******************************************************************************/
+
+static int compare_index_records(const void* p_a, const void* p_b) {
+
+    const INDEX_RECORD* p_rec_a = (const INDEX_RECORD*)p_a;
+
+    const INDEX_RECORD* p_rec_b = (const INDEX_RECORD*)p_b;
+
+    return (p_rec_a->utc_time_ns > p_rec_b->utc_time_ns) -
+               (p_rec_a->utc_time_ns < p_rec_b->utc_time_ns);
+}
+
+/*******************************************************************************
+
+    load_index() - Read time index file
+
+    Description
+    ===========
+
+    On success, *pp_records is set to a heap array of the index records
+    sorted by time, and *p_num_records to its length. The file offset of
+    each record is replaced by the greatest offset of it and all earlier
+    records, so that the offset of the last record preceding a given time
+    is the best starting point for that time.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int load_index(const char* index_spec,
+                      INDEX_RECORD** pp_records,
+                      size_t* p_num_records) {
+
+    int fd = open(index_spec, O_RDONLY);
+
+    if (fd < 0) {
+
+        return -1;
+    }
+
+    struct stat index_stat;
+
+    if (fstat(fd, &index_stat) != 0) {
+
+        close(fd);
+
+        return -1;
+    }
+
+    size_t num_records = (size_t)index_stat.st_size / sizeof(INDEX_RECORD);
+
+    INDEX_RECORD* p_records = malloc((num_records + 1) * sizeof(INDEX_RECORD));
+
+    if (p_records == NULL) {
+
+        close(fd);
+
+        return -1;
+    }
+
+    /*
+     *  Read whole records only - a writer may be appending to the file
+     */
+
+    {
+        size_t num_bytes = num_records * sizeof(INDEX_RECORD);
+
+        size_t num_read = 0;
+
+        while (num_read < num_bytes) {
+
+            ssize_t n = read(fd, (char*)p_records + num_read,
+                             num_bytes - num_read);
+
+            if (n <= 0) {
+
+                break;
+            }
+
+            num_read += n;
+        }
+
+        num_records = num_read / sizeof(INDEX_RECORD);
+    }
+
+    close(fd);
+
+    qsort(p_records, num_records, sizeof(INDEX_RECORD), compare_index_records);
+
+    for (size_t i = 1; i < num_records; i++) {
+
+        if (p_records[i].file_offset < p_records[i - 1].file_offset) {
+
+            p_records[i].file_offset = p_records[i - 1].file_offset;
+        }
+    }
+
+    *pp_records = p_records;
+
+    *p_num_records = num_records;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    index_start_offset() - Return offset from which all entries at or after
+                           utc_time_ns can be found, using the time index
+
+*******************************************************************************/
+
+static size_t index_start_offset(const INDEX_RECORD* p_records,
+                                 size_t num_records,
+                                 int64_t utc_time_ns) {
+
+    /*
+     *  Find number of records with time earlier than utc_time_ns
+     */
+
+    size_t lo = 0;
+
+    size_t hi = num_records;
+
+    while (lo < hi) {
+
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (p_records[mid].utc_time_ns < utc_time_ns) {
+
+            lo = mid + 1;
+
+        } else {
+
+            hi = mid;
+        }
+    }
+
+    return lo == 0 ? 0 : (size_t)p_records[lo - 1].file_offset;
+}
+
+/*******************************************************************************
+
+    next_entry() - Find first log entry starting at or after an offset
+
+    Description
+    ===========
+
+    Lines which do not begin with a UTC time, such as the continuation
+    lines of a multi-line message, are skipped.
+
+    Return offset of the entry, with its time in *p_utc_time_ns, or the
+    length of the file if there is no such entry.
+
+*******************************************************************************/
+
+static size_t next_entry(const char* p_map,
+                         size_t map_len,
+                         size_t offset,
+                         int64_t* p_utc_time_ns) {
+
+    const char* p_end = p_map + map_len;
+
+    const char* p = p_map + offset;
+
+    /*
+     *  Advance to start of line
+     */
+
+    if (offset > 0 && p[-1] != '\n') {
+
+        p = logmsg_find_newline(p, p_end);
+
+        if (p == p_end) {
+
+            return map_len;
+        }
+
+        p++;
+    }
+
+    /*
+     *  Skip lines without a UTC time
+     */
+
+    p = logmsg_find_entry(p, p_end);
+
+    if (p == p_end ||
+        logmsg_parse_utc_time(p, p_end - p, p_utc_time_ns) != 0) {
+
+        return map_len;
+    }
+
+    return p - p_map;
+}
+
+/*******************************************************************************
+
+    search_start_offset() - Return offset of first entry at or after
+                            utc_time_ns, found by binary search of the log
+                            file
+
+    Description
+    ===========
+
+    Each writer appends entries in time order, so the file is ordered by
+    time apart from local disorder between concurrent writers. The caller
+    should search for a time somewhat earlier than required to allow for
+    this.
+
+*******************************************************************************/
+
+static size_t search_start_offset(const char* p_map,
+                                  size_t map_len,
+                                  int64_t utc_time_ns) {
+
+    size_t lo = 0;
+
+    size_t hi = map_len;
+
+    while (lo < hi) {
+
+        size_t mid = lo + (hi - lo) / 2;
+
+        int64_t entry_time_ns = 0;
+
+        size_t entry_offset = next_entry(p_map, map_len, mid, &entry_time_ns);
+
+        if (entry_offset < map_len && entry_time_ns < utc_time_ns) {
+
+            lo = entry_offset + 1;
+
+        } else {
+
+            hi = mid;
+        }
+    }
+
+    int64_t entry_time_ns = 0;
+
+    return next_entry(p_map, map_len, lo, &entry_time_ns);
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        seek-log [-i <index-file>] [-w <window-secs>]
+                 <log-file> <start-time> [<end-time>]
+
+    Print entries of <log-file> stamped from <start-time> through <end-
+    time>. Times are given in the UTC format of the log entries, and may
+    be truncated at any field, e.g. 2018-09-22-14:03 denotes that minute.
+    If <end-time> is omitted, the interval denoted by <start-time> is
+    printed.
+
+    The time index file written by logmsg_open_index() is used to find the
+    first entry if present - by default, <log-file>.idx. Otherwise, the
+    log file is searched by bisection, allowing for <window-secs> (default
+    1.0) of disorder between concurrent writers. The same window is used
+    to decide when no later entry can fall within the range.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    const char* invocation_message =
+        "Invocation: ./seek-log [-i <index-file>] [-w <window-secs>] "
+        "<log-file> <start-time> [<end-time>]";
+
+    /***************************************************************************
+
+        Get program arguments
+
+    ***************************************************************************/
+
+    const char* index_spec = NULL;
+
+    int index_required = 0;
+
+    int64_t window_ns = NSECS_PER_SEC;
+
+    const char* log_spec = NULL;
+
+    int64_t start_time_ns = 0;
+
+    int64_t end_time_ns = 0;
+
+    {
+        int option;
+
+        while ((option = getopt(argc, argv, "i:w:")) != -1) {
+
+            switch (option) {
+
+            case 'i':
+
+                index_spec = optarg;
+
+                index_required = 1;
+
+                break;
+
+            case 'w':
+
+                {
+                    double window_secs = 0.0;
+
+                    if (sscanf(optarg, "%lf", &window_secs) != 1 ||
+                        window_secs < 0.0) {
+
+                        printf("\n%s\n", invocation_message);
+
+                        return 1;
+                    }
+
+                    window_ns = window_secs * 1.0e9;
+                }
+
+                break;
+
+            default:
+
+                printf("\n%s\n", invocation_message);
+
+                return 1;
+            }
+        }
+
+        if (argc - optind < 2 || argc - optind > 3) {
+
+            printf("\n%s\n", invocation_message);
+
+            return 1;
+        }
+
+        log_spec = argv[optind];
+
+        int64_t span_ns = 0;
+
+        if (logmsg_parse_partial_utc_time(argv[optind + 1],
+                                          &start_time_ns,
+                                          &span_ns) != 0) {
+
+            printf("\nInvalid start time: %s\n", argv[optind + 1]);
+
+            return 1;
+        }
+
+        end_time_ns = start_time_ns + span_ns - 1;
+
+        if (argc - optind == 3) {
+
+            if (logmsg_parse_partial_utc_time(argv[optind + 2],
+                                              &end_time_ns,
+                                              &span_ns) != 0) {
+
+                printf("\nInvalid end time: %s\n", argv[optind + 2]);
+
+                return 1;
+            }
+
+            end_time_ns += span_ns - 1;
+        }
+    }
+
+    /***************************************************************************
+
+        Map log file
+
+    ***************************************************************************/
+
+    const char* p_map = NULL;
+
+    size_t map_len = 0;
+
+    {
+        int fd = open(log_spec, O_RDONLY);
+
+        if (fd < 0) {
+
+            printf("\nCould not open log file: %s\n", strerror(errno));
+
+            return 1;
+        }
+
+        struct stat log_stat;
+
+        if (fstat(fd, &log_stat) != 0) {
+
+            printf("\nCould not stat log file: %s\n", strerror(errno));
+
+            return 1;
+        }
+
+        map_len = log_stat.st_size;
+
+        if (map_len == 0) {
+
+            return 0;
+        }
+
+        p_map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (p_map == MAP_FAILED) {
+
+            printf("\nCould not map log file: %s\n", strerror(errno));
+
+            return 1;
+        }
+
+        close(fd);
+
+        madvise((void*)p_map, map_len, MADV_RANDOM);
+    }
+
+    /***************************************************************************
+
+        Find first entry which may fall within the range
+
+    ***************************************************************************/
+
+    size_t offset = 0;
+
+    {
+        char default_index_spec[strlen(log_spec) + sizeof(".idx")];
+
+        if (index_spec == NULL) {
+
+            snprintf(default_index_spec, sizeof(default_index_spec),
+                     "%s.idx", log_spec);
+
+            index_spec = default_index_spec;
+        }
+
+        INDEX_RECORD* p_records = NULL;
+
+        size_t num_records = 0;
+
+        if (load_index(index_spec, &p_records, &num_records) == 0) {
+
+            offset = index_start_offset(p_records, num_records, start_time_ns);
+
+            if (offset > map_len) {
+
+                offset = map_len;
+            }
+
+            free(p_records);
+
+        } else if (index_required) {
+
+            printf("\nCould not read index file: %s\n", strerror(errno));
+
+            return 1;
+
+        } else {
+
+            offset = search_start_offset(p_map, map_len,
+                                         start_time_ns - window_ns);
+        }
+    }
+
+    /***************************************************************************
+
+        Print entries within the range, until an entry is found later than
+        the range by more than the disorder window
+
+    ***************************************************************************/
+
+    {
+        static char stdout_buf[1 << 20];
+
+        setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+        madvise((void*)(p_map + (offset & ~(size_t)4095)),
+                map_len - (offset & ~(size_t)4095),
+                MADV_SEQUENTIAL);
+    }
+
+    int in_range = 0;
+
+    while (offset < map_len) {
+
+        const char* p_line = p_map + offset;
+
+        const char* p_eol = logmsg_find_newline(p_line, p_map + map_len);
+
+        size_t line_len = p_eol - p_line + (p_eol < p_map + map_len);
+
+        /*
+         *  Lines without a UTC time continue the preceding entry
+         */
+
+        int64_t entry_time_ns = 0;
+
+        if (logmsg_parse_utc_time(p_line, line_len, &entry_time_ns) == 0) {
+
+            if (entry_time_ns > end_time_ns + window_ns) {
+
+                break;
+            }
+
+            in_range = entry_time_ns >= start_time_ns &&
+                           entry_time_ns <= end_time_ns;
+        }
+
+        if (in_range) {
+
+            fwrite(p_line, 1, line_len, stdout);
+
+            // The last line of a log still being written may be incomplete
+
+            if (p_line[line_len - 1] != '\n') {
+
+                putchar('\n');
+            }
+        }
+
+        offset += line_len;
+    }
+
+    fflush(stdout);
+
+	return 0;
+}
@@ -0,0 +1,472 @@
+/*******************************************************************************
+
+    test-fork
+
+    Test of fork() while threads are logging through the writer thread
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include <sys/wait.h>
+
+#include <logmsg.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Logging threads of the parent, and entries written by each
+
+#define NUM_THREADS 4
+
+#define NUM_ENTRIES 100000
+
+// Children forked while the threads are logging, and entries written by
+// each
+
+#define NUM_FORKS 20
+
+#define CHILD_ENTRIES 2000
+
+// Writer queue length, small so that producers often wait for space
+
+#define QUEUE_LEN (64 * 1024)
+
+// Time after which a test process is taken to be hung, in seconds
+
+#define TIMEOUT_SECS 60
+
+// Writer modes tested
+
+#define MODE_QUEUE   0
+
+#define MODE_PER_CPU 1
+
+#define MODE_DIRECT  2              // Queue, with the log file in O_DIRECT mode
+
+/*******************************************************************************
+
+    Test state
+
+*******************************************************************************/
+
+static uint64_t num_tests = 0;
+
+static uint64_t num_failures = 0;
+
+// # times each entry was found in the log file
+
+static uint8_t parent_counts[NUM_THREADS][NUM_ENTRIES];
+
+static uint8_t child_counts[NUM_FORKS][CHILD_ENTRIES];
+
+/*******************************************************************************
+
+    run_parent_thread() - Write entries of parent thread
+
+*******************************************************************************/
+
+static void* run_parent_thread(void* p_arg) {
+
+    int thread = (int)(intptr_t)p_arg;
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+
+        LOGMSG_INFO_PRINTF("fork-test parent %d %d", thread, i);
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+
+    run_child_thread() - Write entries of child, from a thread of its own
+
+*******************************************************************************/
+
+static void* run_child_thread(void* p_arg) {
+
+    int child = (int)(intptr_t)p_arg;
+
+    for (int i = 0; i < CHILD_ENTRIES; i++) {
+
+        LOGMSG_INFO_PRINTF("fork-test child %d %d", child, i);
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+
+    run_writer_test() - Fork children while threads are logging, in a
+                        process of its own
+
+    Exit with 0 on success, 1 if a child failed, 2 on failure, or 3 if the
+    mode is not supported. A hung process is ended by SIGALRM.
+
+*******************************************************************************/
+
+static void run_writer_test(const char* log_spec, int mode) {
+
+    alarm(TIMEOUT_SECS);
+
+    if (logmsg_open_file(log_spec) != 0) {
+
+        exit(2);
+    }
+
+    if (mode == MODE_DIRECT &&
+        logmsg_set_durability(LOGMSG_DURABILITY_DIRECT, 0, 0) != 0) {
+
+        exit(3);
+    }
+
+    if (mode == MODE_PER_CPU) {
+
+        if (logmsg_start_writer_per_cpu(QUEUE_LEN) != 0) {
+
+            exit(3);
+        }
+
+    } else if (logmsg_start_writer(QUEUE_LEN) != 0) {
+
+        exit(2);
+    }
+
+    logmsg_level = LOGMSG_LEVEL_INFO;
+
+    pthread_t threads[NUM_THREADS];
+
+    for (int thread = 0; thread < NUM_THREADS; thread++) {
+
+        if (pthread_create(&threads[thread],
+                           NULL,
+                           run_parent_thread,
+                           (void*)(intptr_t)thread) != 0) {
+            exit(2);
+        }
+    }
+
+    /*
+     *  Fork children, each logging from a thread while its parent's
+     *  threads go on logging
+     */
+
+    pid_t children[NUM_FORKS];
+
+    int status = 0;
+
+    for (int child = 0; child < NUM_FORKS; child++) {
+
+        usleep(2000);
+
+        children[child] = fork();
+
+        if (children[child] == 0) {
+
+            alarm(TIMEOUT_SECS);
+
+            pthread_t thread;
+
+            if (pthread_create(&thread,
+                               NULL,
+                               run_child_thread,
+                               (void*)(intptr_t)child) != 0) {
+                exit(1);
+            }
+
+            pthread_join(thread, NULL);
+
+            exit(0);
+        }
+
+        if (children[child] < 0) {
+
+            status = 2;
+        }
+    }
+
+    for (int child = 0; child < NUM_FORKS; child++) {
+
+        int child_status;
+
+        if (children[child] > 0 &&
+            (waitpid(children[child], &child_status, 0) < 0 ||
+             !WIFEXITED(child_status) ||
+             WEXITSTATUS(child_status) != 0)) {
+
+            status = 1;
+        }
+    }
+
+    for (int thread = 0; thread < NUM_THREADS; thread++) {
+
+        pthread_join(threads[thread], NULL);
+    }
+
+    exit(status);
+}
+
+/*******************************************************************************
+
+    check_log() - Check that each entry is in the log file exactly once
+
+*******************************************************************************/
+
+static void check_log(const char* log_spec, const char* mode_name) {
+
+    memset(parent_counts, 0, sizeof(parent_counts));
+
+    memset(child_counts, 0, sizeof(child_counts));
+
+    FILE* p_file = fopen(log_spec, "r");
+
+    if (p_file == NULL) {
+
+        printf("FAIL %s: cannot open %s\n", mode_name, log_spec);
+
+        num_failures++;
+
+        return;
+    }
+
+    char line[1024];
+
+    uint64_t num_entries = 0;
+
+    uint64_t num_unknown = 0;
+
+    while (fgets(line, sizeof(line), p_file) != NULL) {
+
+        const char* p_test = strstr(line, "fork-test ");
+
+        char kind[16];
+
+        int id;
+
+        int seq;
+
+        if (p_test == NULL ||
+            sscanf(p_test, "fork-test %15s %d %d", kind, &id, &seq) != 3) {
+
+            continue;
+        }
+
+        num_entries++;
+
+        if (strcmp(kind, "parent") == 0 &&
+            id >= 0 && id < NUM_THREADS && seq >= 0 && seq < NUM_ENTRIES) {
+
+            if (parent_counts[id][seq] < 255) {
+
+                parent_counts[id][seq]++;
+            }
+
+        } else if (strcmp(kind, "child") == 0 &&
+                   id >= 0 && id < NUM_FORKS &&
+                   seq >= 0 && seq < CHILD_ENTRIES) {
+
+            if (child_counts[id][seq] < 255) {
+
+                child_counts[id][seq]++;
+            }
+
+        } else {
+
+            num_unknown++;
+        }
+    }
+
+    fclose(p_file);
+
+    /*
+     *  Count entries lost and duplicated
+     */
+
+    uint64_t num_lost = 0;
+
+    uint64_t num_duplicated = 0;
+
+    for (int id = 0; id < NUM_THREADS; id++) {
+
+        for (int seq = 0; seq < NUM_ENTRIES; seq++) {
+
+            num_lost += parent_counts[id][seq] == 0;
+
+            num_duplicated += parent_counts[id][seq] > 1;
+        }
+    }
+
+    for (int id = 0; id < NUM_FORKS; id++) {
+
+        for (int seq = 0; seq < CHILD_ENTRIES; seq++) {
+
+            num_lost += child_counts[id][seq] == 0;
+
+            num_duplicated += child_counts[id][seq] > 1;
+        }
+    }
+
+    num_tests++;
+
+    if (num_lost != 0 || num_duplicated != 0 || num_unknown != 0) {
+
+        printf("FAIL %s: %lu entries, %lu lost, %lu duplicated, "
+               "%lu unknown\n",
+               mode_name,
+               (unsigned long)num_entries,
+               (unsigned long)num_lost,
+               (unsigned long)num_duplicated,
+               (unsigned long)num_unknown);
+
+        num_failures++;
+
+    } else {
+
+        printf("%s: %lu entries\n", mode_name, (unsigned long)num_entries);
+    }
+}
+
+/*******************************************************************************
+
+    test_mode() - Run test of writer mode in a new process, then check its
+                  log file
+
+*******************************************************************************/
+
+static void test_mode(const char* log_prefix,
+                      int mode,
+                      const char* mode_name) {
+
+    char log_spec[1024];
+
+    snprintf(log_spec, sizeof(log_spec), "%s.%s", log_prefix, mode_name);
+
+    unlink(log_spec);
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        run_writer_test(log_spec, mode);
+    }
+
+    int status;
+
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+
+        printf("FAIL %s: test process failed\n", mode_name);
+
+        num_tests++;
+
+        num_failures++;
+
+        return;
+    }
+
+    switch (WEXITSTATUS(status)) {
+
+    case 0:
+
+        break;
+
+    case 1:
+
+        printf("FAIL %s: child process failed\n", mode_name);
+
+        num_failures++;
+
+        break;
+
+    case 3:
+
+        printf("%s: not supported, skipped\n", mode_name);
+
+        return;
+
+    default:
+
+        printf("FAIL %s: cannot start writer\n", mode_name);
+
+        num_tests++;
+
+        num_failures++;
+
+        return;
+    }
+
+    check_log(log_spec, mode_name);
+}
+
+/*******************************************************************************
+
+    main() - Run tests, with log files named after argv[1] if given
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    const char* log_prefix = argc > 1 ? argv[1] : "test-fork.log";
+
+    test_mode(log_prefix, MODE_QUEUE, "queue");
+
+    test_mode(log_prefix, MODE_PER_CPU, "per-cpu");
+
+    test_mode(log_prefix, MODE_DIRECT, "direct");
+
+    printf("%lu tests, %lu failures\n",
+           (unsigned long)num_tests, (unsigned long)num_failures);
+
+    return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+/*******************************************************************************
+
+    test-format-cpp.cpp - Differential test of logmsg::format() against
+                          glibc snprintf()
+
+    -----------------------------------------------------------------------
+    
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+    
+*******************************************************************************/
+
+#include <logmsg.h>
+
+#include <logmsg.hpp>
+
+#include <stdio.h>
+
+#include <stdarg.h>
+
+#include <stdlib.h>
+
+#include <stdint.h>
+
+#include <string.h>
+
+#include <limits.h>
+
+#include <math.h>
+
+#include <string>
+
+#include <string_view>
+
+/*******************************************************************************
+
+    Test state
+
+*******************************************************************************/
+
+static uint64_t num_tests = 0;
+
+static uint64_t num_failures = 0;
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+/*******************************************************************************
+
+    next_random() - Return next value of xorshift64* generator
+
+*******************************************************************************/
+
+static uint64_t next_random() {
+
+    random_state ^= random_state >> 12;
+
+    random_state ^= random_state << 25;
+
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*******************************************************************************
+
+    random_double() - Return double of random magnitude, mostly in the range
+                      seen in log messages, sometimes with arbitrary bits
+
+*******************************************************************************/
+
+static double random_double() {
+
+    uint64_t r = next_random();
+
+    switch (r % 8) {
+
+    case 0:
+        {
+            double value;
+
+            uint64_t bits = next_random();
+
+            memcpy(&value, &bits, sizeof(value));
+
+            return value;
+        }
+
+    case 1:
+
+        return (double)(int64_t)next_random() / (1 << (r >> 60));
+
+    case 2:
+
+        // Exact ties at various precisions, e.g. 2.5, 0.125
+
+        return (double)(int)(next_random() % 1000) / (1 << (r >> 61));
+
+    default:
+
+        return ((double)(next_random() >> 11) / (1ULL << 53) - 0.5) *
+                   pow(10.0, (int)(next_random() % 24) - 8);
+    }
+}
+
+/*******************************************************************************
+
+    c_arg() - Convert argument to the type snprintf() expects for it
+
+*******************************************************************************/
+
+template <typename T>
+static T c_arg(const T& value) {
+
+    return value;
+}
+
+static const char* c_arg(const char* value) {
+
+    return value;
+}
+
+static const char* c_arg(const std::string& value) {
+
+    return value.c_str();
+}
+
+// Only views of whole strings are tested, so data() is terminated
+
+static const char* c_arg(const std::string_view& value) {
+
+    return value.data();
+}
+
+/*******************************************************************************
+
+    reference_format() - Return arguments formatted by glibc vsnprintf(),
+                         which is called through a va_list so that null
+                         strings are not diagnosed
+
+*******************************************************************************/
+
+static std::string reference_format(const char* format, ...) {
+
+    va_list ap;
+
+    va_start(ap, format);
+
+    int len = vsnprintf(nullptr, 0, format, ap);
+
+    va_end(ap);
+
+    std::string text(len, '\0');
+
+    va_start(ap, format);
+
+    vsnprintf(text.data(), len + 1, format, ap);
+
+    va_end(ap);
+
+    return text;
+}
+
+/*******************************************************************************
+
+    check() - Compare formatting of arguments by logmsg::format(), by
+              logmsg::detail::format_to() and by glibc
+
+*******************************************************************************/
+
+template <typename... Args>
+static void check(logmsg::format_string<Args...> format, const Args&... args) {
+
+    std::string expected = reference_format(format.text, c_arg(args)...);
+
+    std::string actual = logmsg::format(format, args...);
+
+    logmsg::detail::message_buffer buffer;
+
+    logmsg::detail::format_to(buffer, format, args...);
+
+    std::string actual_to(buffer.data(), buffer.size());
+
+    num_tests++;
+
+    if (actual != expected || actual_to != actual) {
+
+        num_failures++;
+
+        if (num_failures <= 20) {
+
+            printf("FAIL \"%s\": expected \"%s\", got \"%s\", "
+                   "format_to \"%s\"\n", format.text, expected.c_str(),
+                   actual.c_str(), actual_to.c_str());
+        }
+    }
+}
+
+/*******************************************************************************
+
+    check_integers() - Compare integer conversions of random values of each
+                       width, with each flag, width and precision
+
+*******************************************************************************/
+
+static void check_integers(int num_values) {
+
+    for (int i = 0; i < num_values; i++) {
+
+        uint64_t bits = next_random();
+
+        int shift = next_random() % 64;
+
+        long long value = (long long)bits >> shift;
+
+        int int_value = (int)value;
+
+        unsigned unsigned_value = (unsigned)value;
+
+        check("%d|%i|%5d|%-5d|%05d|%+d|% d|%.3d|%8.3d|%-+8.3d|%.0d|%+05d",
+              int_value, int_value, int_value, int_value, int_value,
+              int_value, int_value, int_value, int_value, int_value,
+              int_value, int_value);
+
+        check("%u|%x|%X|%o|%#x|%#X|%#o|%#.0o|%.0x|%08x|%-#10x|%#08o|%#.5x",
+              unsigned_value, unsigned_value, unsigned_value, unsigned_value,
+              unsigned_value, unsigned_value, unsigned_value, unsigned_value,
+              unsigned_value, unsigned_value, unsigned_value, unsigned_value,
+              unsigned_value);
+
+        check("%ld|%lu|%lx|%020ld|%-20lu|%+ld|% .15ld|%#lo|%#lX",
+              (long)value, (unsigned long)value, (unsigned long)value,
+              (long)value, (unsigned long)value, (long)value, (long)value,
+              (unsigned long)value, (unsigned long)value);
+
+        check("%lld|%llu|%llx|%zu|%zd|%jd|%td",
+              value, (unsigned long long)value, (unsigned long long)value,
+              (size_t)value, (ssize_t)value, (intmax_t)value,
+              (ptrdiff_t)value);
+
+        check("%hd|%hu|%6hd|%hhd|%hhu|%c|%3c|%-3c|",
+              (short)value, (unsigned short)value, (short)value,
+              (signed char)value, (unsigned char)value,
+              (char)(' ' + bits % 95), (char)(' ' + bits % 95),
+              (char)(' ' + bits % 95));
+    }
+
+    check("%d %d %d %u %lu", 0, INT_MIN, INT_MAX, UINT_MAX, ULONG_MAX);
+
+    check("%ld %lld %llu", LONG_MIN, LLONG_MIN, ULLONG_MAX);
+
+    check("%d %d %x", true, false, true);
+
+    check("%100d%100d%100d%100d%100d%100d", 1, 2, 3, 4, 5, 6);
+}
+
+/*******************************************************************************
+
+    check_floating() - Compare floating conversions of random values, with
+                       each flag, width and precision
+
+*******************************************************************************/
+
+static void check_floating(int num_values) {
+
+    for (int i = 0; i < num_values; i++) {
+
+        double value = random_double();
+
+        float float_value = (float)value;
+
+        check("%f|%.0f|%.1f|%.3f|%10.3f|%-10.3f|%+f|% f|%010.2f|%F|%-+012.4f|",
+              value, value, value, value, value, value, value, value, value,
+              value, value);
+
+        check("%e|%.0e|%.10e|%E|%+12.4e|%-12.2e|%012.3E|% e",
+              value, value, value, value, value, value, value, value);
+
+        check("%g|%.0g|%.1g|%.10g|%G|%-+10g|%012g|%.17g|% G",
+              value, value, value, value, value, value, value, value, value);
+
+        check("%f|%.2e|%g|%.9g|%10.4f", float_value, float_value,
+              float_value, float_value, float_value);
+    }
+
+    check("%.20f %.30e %.40g", 0.1, 1.0 / 3, 2.0 / 3);
+
+    check("%f %e %g %.0f %.0e", 0.0, -0.0, 1e-320, 0.5, 2.5);
+
+    check("%f|%e|%g|%F|%E|%G", INFINITY, -INFINITY, NAN, INFINITY, -NAN,
+          -INFINITY);
+
+    check("%08f|%-8f|%+08e|% 8G", INFINITY, NAN, -INFINITY, NAN);
+
+    check("%.1f %.2f %.3f %.0f %.0f", 0.05, 0.125, 2.0005, 1.5, 2.5);
+
+    check("%f %.99e %.99f", 1e308, 1e-300, 1.0 / 7);
+
+    check("%Lf %.3Lg %.25Le", 1.25L, 1.0L / 3, 2.0L / 3);
+}
+
+/*******************************************************************************
+
+    check_strings() - Compare literal, string and pointer conversions, with
+                      each string type
+
+*******************************************************************************/
+
+static void check_strings() {
+
+    std::string text = "string";
+
+    std::string_view view = "view of string";
+
+    const char* p_null = nullptr;
+
+    check("plain text");
+
+    check("");
+
+    check("100%% done %%");
+
+    check("%s|%10s|%-10s|%.3s|%10.2s|%.0s|", "abc", "right", "left",
+          "truncate", "xyz", "gone");
+
+    check("%s|%10s|%-20s|%.3s|%.100s", text, text, view, view, text);
+
+    check("%s %10s %-10s", p_null, p_null, p_null);
+
+    check("%s:%d:%s() %s %f", "main.c", 42, "main", text, 3.14159);
+
+    check("%p|%20p|%-20p|%p", (void*)0x1234, (void*)&text, (void*)&view,
+          (void*)nullptr);
+
+    check("%% %s %%%% %d%%", "escaped", 7);
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        test-format-cpp [<num-random-values>]
+
+    Compare the output of logmsg::format() and logmsg::detail::format_to()
+    with that of glibc snprintf() for fixed and random arguments, and
+    report the first failures. Exit status is 0 if all comparisons succeed.
+
+*******************************************************************************/
+
+int main(int argc, char *argv[]) {
+
+    int num_values = 100000;
+
+    if (argc > 1) {
+
+        num_values = atoi(argv[1]);
+    }
+
+    check_strings();
+
+    check_integers(num_values);
+
+    check_floating(num_values);
+
+    printf("%lu tests, %lu failures\n",
+           (unsigned long)num_tests, (unsigned long)num_failures);
+
+    return num_failures == 0 ? 0 : 1;
+}
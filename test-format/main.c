@@ -0,0 +1,460 @@
+/*******************************************************************************
+
+    test-format
+
+    Differential test of logmsg_snprintf() against glibc snprintf()
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <math.h>
+
+#include <limits.h>
+
+#include <time.h>
+
+#include <logmsg.h>
+
+/*******************************************************************************
+
+    Test state
+
+*******************************************************************************/
+
+static uint64_t num_tests = 0;
+
+static uint64_t num_failures = 0;
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+/*******************************************************************************
+
+    next_random() - Return next value of xorshift64* generator
+
+*******************************************************************************/
+
+static uint64_t next_random(void) {
+
+    random_state ^= random_state >> 12;
+
+    random_state ^= random_state << 25;
+
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*******************************************************************************
+
+    random_double() - Return double of random magnitude, mostly in the range
+                      seen in log messages, sometimes with arbitrary bits
+
+*******************************************************************************/
+
+static double random_double(void) {
+
+    uint64_t r = next_random();
+
+    switch (r % 8) {
+
+    case 0:
+        {
+            double value;
+
+            uint64_t bits = next_random();
+
+            memcpy(&value, &bits, sizeof(value));
+
+            return value;
+        }
+
+    case 1:
+
+        return (double)(int64_t)next_random() / (1 << (r >> 60));
+
+    case 2:
+
+        // Exact ties at various precisions, e.g. 2.5, 0.125
+
+        return (double)(int)(next_random() % 1000) / (1 << (r >> 61));
+
+    default:
+
+        return ((double)(next_random() >> 11) / (1ULL << 53) - 0.5) *
+                   pow(10.0, (int)(next_random() % 24) - 8);
+    }
+}
+
+/*******************************************************************************
+
+    check() - Compare formatting of arguments by both functions
+
+*******************************************************************************/
+
+static void check(const char* format, ...) {
+
+    char expected[1024];
+
+    char actual[1024];
+
+    va_list ap;
+
+    va_start(ap, format);
+
+    int expected_len = vsnprintf(expected, sizeof(expected), format, ap);
+
+    va_end(ap);
+
+    va_start(ap, format);
+
+    int actual_len = logmsg_vsnprintf(actual, sizeof(actual), format, ap);
+
+    va_end(ap);
+
+    num_tests++;
+
+    if (expected_len != actual_len || strcmp(expected, actual) != 0) {
+
+        num_failures++;
+
+        if (num_failures <= 20) {
+
+            printf("FAIL \"%s\": expected \"%s\" (%d), got \"%s\" (%d)\n",
+                   format, expected, expected_len, actual, actual_len);
+        }
+    }
+}
+
+/*******************************************************************************
+
+    reference_snprintf() - glibc snprintf(), called through vsnprintf() so
+                           that deliberate truncation is not diagnosed
+
+*******************************************************************************/
+
+static int reference_snprintf(char* p_buffer,
+                              size_t buffer_len,
+                              const char* format, ...) {
+
+    va_list ap;
+
+    va_start(ap, format);
+
+    int len = vsnprintf(p_buffer, buffer_len, format, ap);
+
+    va_end(ap);
+
+    return len;
+}
+
+/*******************************************************************************
+
+    check_truncation() - Compare formatting into short buffers
+
+*******************************************************************************/
+
+static void check_truncation(void) {
+
+    for (size_t len = 0; len < 24; len++) {
+
+        char expected[32];
+
+        char actual[32];
+
+        memset(expected, 'X', sizeof(expected));
+
+        memset(actual, 'X', sizeof(actual));
+
+        int expected_len = reference_snprintf(expected, len,
+                                              "%s=%05d %.3f|%-6x|",
+                                              "key", -42, 3.14159, 255);
+
+        int actual_len = logmsg_snprintf(actual, len, "%s=%05d %.3f|%-6x|",
+                                         "key", -42, 3.14159, 255);
+
+        num_tests++;
+
+        if (expected_len != actual_len ||
+            memcmp(expected, actual, sizeof(expected)) != 0) {
+
+            num_failures++;
+
+            printf("FAIL truncation to %zu\n", len);
+        }
+    }
+}
+
+/*******************************************************************************
+
+    check_fixed() - Compare %f conversions of random values at all
+                    precisions handled directly, and a few beyond
+
+*******************************************************************************/
+
+static void check_fixed(int num_values) {
+
+    static const char* formats[] = {
+
+        "%.0f", "%.1f", "%.2f", "%.3f", "%.4f", "%.5f", "%f", "%.7f",
+        "%.8f", "%.9f", "%.10f", "%.11f", "%.12f", "%.13f", "%.14f",
+        "%.15f", "%.16f", "%.17f", "%.18f", "%.19f", "%.20f", "%.21f",
+        "%.22f", "%.23f", "%.30f", "%12.3f", "%-12.3f|", "%012.3f",
+        "%+.2f", "% .2f", "%#.0f", "%F", "%lf", "%+015.4f",
+    };
+
+    size_t num_formats = sizeof(formats) / sizeof(formats[0]);
+
+    for (int i = 0; i < num_values; i++) {
+
+        double value = random_double();
+
+        for (size_t j = 0; j < num_formats; j++) {
+
+            check(formats[j], value);
+        }
+    }
+
+    static const double special[] = {
+
+        0.0, -0.0, 0.5, 1.5, 2.5, -2.5, 0.125, 0.375, 1e-300, 4.9e-324,
+        1e15, 1e22, 1e23, 9007199254740993.0, 1.7976931348623157e308,
+        0.1, 0.2, 0.3, 2.675, 1.005, 999999.9999995,
+    };
+
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+
+        for (size_t j = 0; j < num_formats; j++) {
+
+            check(formats[j], special[i]);
+        }
+    }
+
+    check("%f %F %5f %-6f| %05f %+f", INFINITY, -INFINITY, NAN, -NAN,
+          INFINITY, INFINITY);
+}
+
+/*******************************************************************************
+
+    check_integers() - Compare integer conversions of random values
+
+*******************************************************************************/
+
+static void check_integers(int num_values) {
+
+    static const char* int_formats[] = {
+
+        "%d", "%i", "%5d", "%-5d|", "%05d", "%+d", "% d", "%.3d", "%8.3d",
+        "%-+8.3d|", "%.0d", "%+05d", "% 05d", "%hd", "%hhd", "%c",
+        "%u", "%x", "%X", "%o", "%#x", "%#X", "%#o", "%#.0o", "%.0x",
+        "%08x", "%-#10x|", "%hu", "%hhx", "%#08o",
+    };
+
+    static const char* long_formats[] = {
+
+        "%ld", "%lu", "%lx", "%020ld", "%lld", "%llu", "%llx", "%zu", "%zd",
+        "%jd", "%td", "%#lo", "%+ld",
+    };
+
+    for (int i = 0; i < num_values; i++) {
+
+        uint64_t bits = next_random();
+
+        int shift = next_random() % 64;
+
+        int64_t value = (int64_t)bits >> shift;
+
+        for (size_t j = 0; j < sizeof(int_formats) / sizeof(char*); j++) {
+
+            check(int_formats[j], (int)value);
+        }
+
+        for (size_t j = 0; j < sizeof(long_formats) / sizeof(char*); j++) {
+
+            check(long_formats[j], (long)value);
+        }
+    }
+
+    check("%d %d %d %u %lu", 0, INT_MIN, INT_MAX, UINT_MAX, ULONG_MAX);
+
+    check("%ld %lld", LONG_MIN, LLONG_MIN);
+
+    check("%*d|%-*d|%.*d|%*.*d", 6, 1, 6, 2, 3, 3, -8, 4, 5);
+}
+
+/*******************************************************************************
+
+    check_strings() - Compare string, character and literal conversions
+
+*******************************************************************************/
+
+static void check_strings(void) {
+
+    check("plain text");
+
+    check("");
+
+    check("100%% done %%");
+
+    check("%s|%10s|%-10s|%.3s|%10.2s|%.0s|", "abc", "right", "left",
+          "truncate", "xyz", "gone");
+
+    check("%s %.3s %.6s %10s", (char*)NULL, (char*)NULL, (char*)NULL,
+          (char*)NULL);
+
+    check("%c%c%c|%3c|%-3c|", 'a', 'b', 'c', 'x', 'y');
+
+    check("%05s|%05c|", "ab", 'z');
+
+    check("%s:%d:%s() %s %f", "main.c", 42, "main", "value", 3.14159);
+
+    /*
+     *  Conversions passed to vsnprintf()
+     */
+
+    check("%e %g %G %a", 1.5, 0.0001, 1e20, 1.0);
+
+    check("%p %p", (void*)0x1234, (void*)NULL);
+
+    check("%s %5.1e %d", "mixed", 12345.678, 7);
+
+    check("%2$s %1$s", "world", "hello");
+
+    check("%Lf", (long double)1.25);
+
+    check("%ls", L"wide");
+}
+
+/*******************************************************************************
+
+    benchmark() - Report time per call of each function for a typical
+                  message
+
+*******************************************************************************/
+
+static void benchmark(void) {
+
+    const int num_calls = 1000000;
+
+    char buffer[512];
+
+    size_t total_len = 0;
+
+    double elapsed[2];
+
+    for (int pass = 0; pass < 2; pass++) {
+
+        struct timespec start;
+
+        struct timespec stop;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < num_calls; i++) {
+
+            if (pass == 0) {
+
+                total_len += snprintf(buffer, sizeof(buffer),
+                    "%s:%d:%s() request %s took %.3f ms status %d size %lu",
+                    "main.c", i, "handle", "GET /index", i * 0.001, 200,
+                    (unsigned long)i * 7);
+
+            } else {
+
+                total_len += logmsg_snprintf(buffer, sizeof(buffer),
+                    "%s:%d:%s() request %s took %.3f ms status %d size %lu",
+                    "main.c", i, "handle", "GET /index", i * 0.001, 200,
+                    (unsigned long)i * 7);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        elapsed[pass] = ((stop.tv_sec - start.tv_sec) * 1.0e9 +
+                             (stop.tv_nsec - start.tv_nsec)) / num_calls;
+    }
+
+    printf("snprintf %.1f ns, logmsg_snprintf %.1f ns per call (%zu)\n",
+           elapsed[0], elapsed[1], total_len % 10);
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        test-format [<num-random-values>]
+
+    Compare the output and return values of logmsg_snprintf() and glibc
+    snprintf() for fixed and random arguments, and report the first fai-
+    lures. Exit status is 0 if all comparisons succeed.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    int num_values = 100000;
+
+    if (argc > 1) {
+
+        num_values = atoi(argv[1]);
+    }
+
+    check_strings();
+
+    check_integers(num_values);
+
+    check_fixed(num_values);
+
+    check_truncation();
+
+    printf("%lu tests, %lu failures\n",
+           (unsigned long)num_tests, (unsigned long)num_failures);
+
+    benchmark();
+
+    return num_failures == 0 ? 0 : 1;
+}
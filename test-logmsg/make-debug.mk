@@ -21,7 +21,7 @@ SRC_FILES=$(SRC_DIR)/$(PROGRAM_NAME).cpp
 
 CXX=g++
 
-CFLAGS=-g -O0 -Wall -std=gnu++0x
+CFLAGS=-g -O0 -Wall -std=gnu++20
 
 CFLAGS+=$(shell pkg-config --cflags liblogmsg)
 
@@ -36,12 +36,108 @@
 
 #include <logmsg.h>
 
+#include <logmsg.hpp>
+
 #include <stdlib.h>
 
 #include <stdint.h>
 
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <coroutine>
+
+#include <exception>
+
 #include <iostream>
 
+#include <string>
+
+/*******************************************************************************
+
+    detached_task - Coroutine which runs at once, and is not awaited
+
+*******************************************************************************/
+
+struct detached_task {
+
+    struct promise_type {
+
+        detached_task get_return_object() { return {}; }
+
+        std::suspend_never initial_suspend() { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+/*******************************************************************************
+
+    event_loop - Minimal epoll loop, resuming coroutines when FDs become
+                 readable
+
+*******************************************************************************/
+
+class event_loop {
+
+public:
+
+    event_loop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {}
+
+    ~event_loop() { close(epoll_fd_); }
+
+    void resume_when_readable(int fd, std::coroutine_handle<> handle) {
+
+        struct epoll_event event;
+
+        event.events = EPOLLIN | EPOLLONESHOT;
+
+        event.data.ptr = handle.address();
+
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    bool run_once(int timeout_ms) {
+
+        struct epoll_event event;
+
+        if (epoll_wait(epoll_fd_, &event, 1, timeout_ms) != 1) {
+
+            return false;
+        }
+
+        std::coroutine_handle<>::from_address(event.data.ptr).resume();
+
+        return true;
+    }
+
+private:
+
+    int epoll_fd_;
+};
+
+/*******************************************************************************
+
+    checkpoint() - Log a checkpoint, and await its flush without blocking
+                   the event loop
+
+*******************************************************************************/
+
+detached_task checkpoint(event_loop& loop, bool& is_flushed) {
+
+    logmsg::info("%s", "Checkpoint reached");
+
+    is_flushed = co_await logmsg::flush_async(
+        [&](int fd, std::coroutine_handle<> handle) {
+            loop.resume_when_readable(fd, handle);
+        });
+}
+
 /*******************************************************************************
 
     main()
@@ -69,6 +165,14 @@ int main(int argc, char *argv[]) {
     }
         
     logmsg_level = LOGMSG_LEVEL_INFO;
+
+    /*
+     *  Count entries of each LOGMSG_<LEVEL>_PRINTF() site, reported at exit
+     */
+
+    std::string sites_spec = std::string(argv[1]) + ".sites";
+
+    logmsg_start_site_stats(sites_spec.c_str(), 0);
     
     if (logmsg_level <= LOGMSG_LEVEL_INFO) {
     
@@ -83,8 +187,101 @@ int main(int argc, char *argv[]) {
                       __FILE__, __LINE__, __FUNCTION__, 
                       "The value of E is approximately",
                       2.71828);
+                      
+        logmsg::info("%s:%d:%s() %s %f",
+                     __FILE__, __LINE__, __FUNCTION__,
+                     "The value of PI is approximately",
+                     3.14159);
+                     
+        const char dump[] = "GET / HTTP/1.1";
+        
+        logmsg_write_raw(LOGMSG_LEVEL_INFO, dump, sizeof(dump) - 1);
+        
+        LOGMSG_INFO_KV("constants",
+                       logmsg_kv_string("name", "pi"),
+                       logmsg_kv_double("value", 3.14159),
+                       logmsg_kv_int("digits", 6));
     }
-            
+    
+    /*
+     *  Record DEBUG entries in memory, then dump them to the log file
+     */
+     
+    if (logmsg_start_recorder(LOGMSG_LEVEL_DEBUG, 0, NULL) == 0) {
+    
+        LOGMSG_DEBUG_PRINTF("%s %f", "The value of PI is approximately", 
+                            3.14159);
+                            
+        logmsg::debug("%s %f", "The value of E is approximately", 2.71828);
+        
+        logmsg_dump_recorder();
+    }
+
+    /*
+     *  Copy WARN entries to standard error, and keep them in memory, with
+     *  entries written by the writer thread
+     */
+
+    int memory_sink = logmsg_add_memory_sink(0, LOGMSG_LEVEL_WARN);
+
+    if (memory_sink >= 0 &&
+        logmsg_add_stderr_sink(LOGMSG_LEVEL_WARN) >= 0 &&
+        logmsg_start_writer(0) == 0) {
+
+        LOGMSG_INFO_PRINTF("%s", "Written to the log file only");
+
+        LOGMSG_WARN_PRINTF("%s", "Written to the log file and sinks");
+
+        logmsg_flush();
+
+        char buffer[1024];
+
+        ssize_t len = logmsg_read_memory_sink(memory_sink,
+                                              buffer,
+                                              sizeof(buffer));
+
+        std::cout << "Memory sink holds " << len << " bytes" << std::endl;
+
+        /*
+         *  Flush at a checkpoint from a coroutine on an event loop
+         */
+
+        event_loop loop;
+
+        bool is_flushed = false;
+
+        checkpoint(loop, is_flushed);
+
+        while (!is_flushed && loop.run_once(1000)) {
+        }
+
+        std::cout << "Checkpoint " << (is_flushed ? "flushed" : "not flushed")
+                  << std::endl;
+    }
+
+    /*
+     *  Time nested spans, and export them for chrome://tracing
+     */
+
+    if (logmsg_start_spans(0) == 0) {
+
+        LOGMSG_SPAN(outer);
+
+        for (int i = 0; i < 3; i++) {
+
+            LOGMSG_SPAN(inner);
+
+            logmsg::info("%s %d", "Inside span", i);
+        }
+    }
+
+    std::string trace_spec = std::string(argv[1]) + ".trace.json";
+
+    if (logmsg_export_trace(trace_spec.c_str()) == 0) {
+
+        std::cout << "Spans exported to " << trace_spec << std::endl;
+    }
+
     return 0;
 }
 
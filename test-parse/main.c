@@ -0,0 +1,882 @@
+/*******************************************************************************
+
+    test-parse
+
+    Differential test of the AVX2, SSE2 and scalar paths of the log parser
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <stdarg.h>
+
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+/*
+ *  The parse paths are private to the library, so the parser is compiled
+ *  into the test, and the paths are selected by setting have_avx2
+ */
+
+#include "../Library/src/logmsg_parse.c"
+
+#ifndef LOGMSG_PARSE_X86
+
+#error "test-parse compares the x86 vector paths"
+
+#endif
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+// Longest text parsed, which ends at the guard page
+
+#define MAX_TEXT_LEN 2048
+
+#define MAX_ENTRIES 64
+
+/*******************************************************************************
+
+    PATH - A parse path and whether it is available
+
+*******************************************************************************/
+
+typedef struct PATH {
+
+    const char* name;
+
+    int use_avx2;
+
+    int available;
+
+} PATH;
+
+/*******************************************************************************
+
+    Test state
+
+*******************************************************************************/
+
+static uint64_t num_tests = 0;
+
+static uint64_t num_failures = 0;
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+// Space which ends at an inaccessible page, so that any read beyond the
+// end of a text placed against it faults
+
+static char* p_guarded_end;
+
+static PATH paths[] = {
+
+    { "avx2", 1, 0 },
+    { "sse2", 0, 1 },
+};
+
+#define NUM_PATHS (sizeof(paths) / sizeof(PATH))
+
+/*******************************************************************************
+
+    next_random() - Return next value of xorshift64* generator
+
+*******************************************************************************/
+
+static uint64_t next_random(void) {
+
+    random_state ^= random_state >> 12;
+
+    random_state ^= random_state << 25;
+
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*******************************************************************************
+
+    fail() - Count a failure and report the first few
+
+*******************************************************************************/
+
+static void fail(const char* format, ...) {
+
+    num_failures++;
+
+    if (num_failures <= 20) {
+
+        va_list ap;
+
+        va_start(ap, format);
+
+        printf("FAIL ");
+
+        vprintf(format, ap);
+
+        printf("\n");
+
+        va_end(ap);
+    }
+}
+
+/*******************************************************************************
+
+    init_guarded_space() - Map MAX_TEXT_LEN bytes followed by a guard page
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int init_guarded_space(void) {
+
+    size_t page_len = (size_t)sysconf(_SC_PAGESIZE);
+
+    size_t space_len = (MAX_TEXT_LEN + page_len - 1) / page_len * page_len;
+
+    char* p_space = mmap(NULL, space_len + page_len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p_space == MAP_FAILED) {
+
+        return -1;
+    }
+
+    if (mprotect(p_space + space_len, page_len, PROT_NONE) != 0) {
+
+        return -1;
+    }
+
+    p_guarded_end = p_space + space_len;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    place_text() - Copy text so that it ends at the guard page, and return
+                   a pointer to the copy
+
+*******************************************************************************/
+
+static const char* place_text(const char* p_text, size_t text_len) {
+
+    char* p_copy = p_guarded_end - text_len;
+
+    memcpy(p_copy, p_text, text_len);
+
+    return p_copy;
+}
+
+/*******************************************************************************
+
+    find_newline_scalar() - Reference for the find_newline_*() functions
+
+*******************************************************************************/
+
+static const char* find_newline_scalar(const char* p, const char* p_end) {
+
+    while (p < p_end && *p != '\n') {
+
+        p++;
+    }
+
+    return p;
+}
+
+/*******************************************************************************
+
+    classify_scalar() - Reference for the classify_*() functions
+
+*******************************************************************************/
+
+static void classify_scalar(const char* p, DELIMITERS* p_delimiters) {
+
+    memset(p_delimiters, 0, sizeof(DELIMITERS));
+
+    for (unsigned i = 0; i < HEADER_BLOCK_LEN; i++) {
+
+        uint64_t bit = 1ULL << i;
+
+        switch (p[i]) {
+
+        case ' ':
+
+            p_delimiters->space |= bit;
+
+            break;
+
+        case ':':
+
+            p_delimiters->colon |= bit;
+
+            break;
+
+        case '[':
+
+            p_delimiters->open_bracket |= bit;
+
+            break;
+
+        case ']':
+
+            p_delimiters->close_bracket |= bit;
+
+            break;
+
+        case '\n':
+
+            p_delimiters->newline |= bit;
+
+            break;
+        }
+    }
+}
+
+/*******************************************************************************
+
+    same_header() - Return non-zero if the header fields of two records
+                    are equal
+
+*******************************************************************************/
+
+static int same_header(const LOGMSG_RECORD* p_a, const LOGMSG_RECORD* p_b) {
+
+    return p_a->level == p_b->level &&
+           p_a->p_host == p_b->p_host &&
+           p_a->host_len == p_b->host_len &&
+           p_a->p_program == p_b->p_program &&
+           p_a->program_len == p_b->program_len &&
+           p_a->pid == p_b->pid &&
+           p_a->tid == p_b->tid;
+}
+
+/*******************************************************************************
+
+    same_record() - Return non-zero if two records are equal
+
+*******************************************************************************/
+
+static int same_record(const LOGMSG_RECORD* p_a, const LOGMSG_RECORD* p_b) {
+
+    return same_header(p_a, p_b) &&
+           p_a->p_entry == p_b->p_entry &&
+           p_a->entry_len == p_b->entry_len &&
+           p_a->utc_time_ns == p_b->utc_time_ns &&
+           p_a->p_message == p_b->p_message &&
+           p_a->message_len == p_b->message_len;
+}
+
+/*******************************************************************************
+
+    random_text() - Fill a buffer with characters which are mostly
+                    delimiters and digits
+
+*******************************************************************************/
+
+static void random_text(char* p_text, size_t text_len) {
+
+    static const char alphabet[] = " :[]\n0123456789-abcXYZ";
+
+    for (size_t i = 0; i < text_len; i++) {
+
+        p_text[i] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+    }
+}
+
+/*******************************************************************************
+
+    append_entry() - Append a random entry to text, and return its length
+
+    Description
+    ===========
+
+    Host and program names are of lengths which move the end of the header
+    across the 16, 32 and 64 byte boundaries of the vector paths. Some
+    entries have continuation lines, including one which begins with
+    digits, and some are torn by a newline or have a damaged time or
+    header.
+
+*******************************************************************************/
+
+static size_t append_entry(char* p_text, size_t space) {
+
+    static const char* levels[] = {
+
+        "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "NONE", "INFOX",
+    };
+
+    char entry[512];
+
+    uint64_t r = next_random();
+
+    int len = snprintf(entry, sizeof(entry),
+        "2018-%02u-%02u-%02u:%02u:%02u-%09u %s %.*s:%.*s[%u:%u] %.*s\n",
+        (unsigned)(r % 12) + 1, (unsigned)(r >> 4 & 15) + 10,
+        (unsigned)(r >> 8 & 15), (unsigned)(r >> 12 & 31) + 10,
+        (unsigned)(r >> 17 & 31) + 20, (unsigned)(r >> 22) % 1000000000,
+        levels[r >> 52 & 7],
+        (int)(next_random() % 40), "host-name-long-enough-for-any-block-edge",
+        (int)(next_random() % 40), "program-name-long-enough-for-any-edge",
+        (unsigned)(next_random() % 100000), (unsigned)(next_random() % 1000),
+        (int)(next_random() % 60),
+        "message text with : and [brackets] and 2018 digits to confuse");
+
+    r = next_random();
+
+    switch (r % 16) {
+
+    case 0:
+
+        // Continuation lines
+
+        len += snprintf(entry + len, sizeof(entry) - len,
+                        "    continued\n2018 is not a time\n");
+
+        break;
+
+    case 1:
+
+        // Torn header
+
+        len = (int)(next_random() % len);
+
+        entry[len++] = '\n';
+
+        break;
+
+    case 2:
+
+        // Damaged time or header
+
+        entry[next_random() % len] = (char)"x\n :[]5"[(r >> 8) % 7];
+
+        break;
+
+    case 3:
+
+        // Delimiter noise in the message
+
+        random_text(entry + len - 1, 20);
+
+        len += 19;
+
+        entry[len++] = '\n';
+
+        break;
+    }
+
+    if ((size_t)len > space) {
+
+        return 0;
+    }
+
+    memcpy(p_text, entry, len);
+
+    return len;
+}
+
+/*******************************************************************************
+
+    check_find_newline() - Compare the find_newline_*() functions against
+                           a scalar search, for all starting offsets and
+                           lengths up to the guard page
+
+*******************************************************************************/
+
+static void check_find_newline(int num_texts) {
+
+    char text[256];
+
+    for (int n = 0; n < num_texts; n++) {
+
+        memset(text, 'a', sizeof(text));
+
+        int num_newlines = next_random() % 4;
+
+        for (int i = 0; i < num_newlines; i++) {
+
+            text[next_random() % sizeof(text)] = '\n';
+        }
+
+        const char* p_text = place_text(text, sizeof(text));
+
+        const char* p_end = p_text + sizeof(text);
+
+        for (const char* p = p_text; p <= p_end; p++) {
+
+            for (const char* p_stop = p; p_stop <= p_end; p_stop++) {
+
+                const char* p_expected = find_newline_scalar(p, p_stop);
+
+                num_tests += 2;
+
+                if (paths[0].available &&
+                    find_newline_avx2(p, p_stop) != p_expected) {
+
+                    fail("find_newline_avx2(%td, %td)",
+                         p - p_text, p_stop - p_text);
+                }
+
+                if (find_newline_sse2(p, p_stop) != p_expected) {
+
+                    fail("find_newline_sse2(%td, %td)",
+                         p - p_text, p_stop - p_text);
+                }
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+
+    check_classify() - Compare the classify_*() functions against a scalar
+                       classification
+
+*******************************************************************************/
+
+static void check_classify(int num_blocks) {
+
+    char block[HEADER_BLOCK_LEN];
+
+    for (int n = 0; n < num_blocks; n++) {
+
+        random_text(block, sizeof(block));
+
+        const char* p_block = place_text(block, sizeof(block));
+
+        DELIMITERS expected;
+
+        DELIMITERS actual;
+
+        classify_scalar(p_block, &expected);
+
+        num_tests += 2;
+
+        if (paths[0].available) {
+
+            classify_avx2(p_block, &actual);
+
+            if (memcmp(&expected, &actual, sizeof(DELIMITERS)) != 0) {
+
+                fail("classify_avx2(\"%.*s\")", HEADER_BLOCK_LEN, block);
+            }
+        }
+
+        classify_sse2(p_block, &actual);
+
+        if (memcmp(&expected, &actual, sizeof(DELIMITERS)) != 0) {
+
+            fail("classify_sse2(\"%.*s\")", HEADER_BLOCK_LEN, block);
+        }
+    }
+}
+
+/*******************************************************************************
+
+    check_utc_time() - Compare check_utc_time_sse2() against the scalar
+                       check, for valid times with each character damaged
+
+*******************************************************************************/
+
+static void check_utc_time(void) {
+
+    static const char valid[32] = "2018-09-22-22:08:42-086858743 x";
+
+    char time[32];
+
+    for (int i = 0; i < LOGMSG_UTC_TIME_LEN; i++) {
+
+        for (int c = 0; c < 256; c++) {
+
+            memcpy(time, valid, sizeof(time));
+
+            time[i] = (char)c;
+
+            const char* p_time = place_text(time, sizeof(time));
+
+            num_tests++;
+
+            if (!check_utc_time_sse2(p_time) !=
+                !check_utc_time_scalar(p_time)) {
+
+                fail("check_utc_time_sse2() byte %d = 0x%02x", i, c);
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+
+    check_split_header() - Compare split_header_block() after each
+                           classification against split_header_scalar(),
+                           for headers ending either side of the vector
+                           boundaries and at the end of the text
+
+*******************************************************************************/
+
+static void check_split_header(int num_texts) {
+
+    char text[MAX_TEXT_LEN];
+
+    for (int n = 0; n < num_texts; n++) {
+
+        size_t text_len = append_entry(text, sizeof(text));
+
+        if (text_len <= LOGMSG_UTC_TIME_LEN + 1) {
+
+            continue;
+        }
+
+        /*
+         *  Truncate the entry at every length, so that the header ends
+         *  before, at and after the end of the text
+         */
+
+        for (size_t len = LOGMSG_UTC_TIME_LEN + 1; len <= text_len; len++) {
+
+            const char* p_entry = place_text(text, len);
+
+            const char* p = p_entry + LOGMSG_UTC_TIME_LEN + 1;
+
+            const char* p_end = p_entry + len;
+
+            if (p_end - p < HEADER_BLOCK_LEN) {
+
+                continue;
+            }
+
+            LOGMSG_RECORD expected;
+
+            memset(&expected, 0, sizeof(expected));
+
+            const char* p_expected = split_header_scalar(p, p_end, &expected);
+
+            DELIMITERS delimiters[2];
+
+            classify_sse2(p, &delimiters[1]);
+
+            if (paths[0].available) {
+
+                classify_avx2(p, &delimiters[0]);
+
+            } else {
+
+                delimiters[0] = delimiters[1];
+            }
+
+            for (size_t i = 0; i < NUM_PATHS; i++) {
+
+                LOGMSG_RECORD actual;
+
+                memset(&actual, 0, sizeof(actual));
+
+                const char* p_eol = NULL;
+
+                const char* p_actual = split_header_block(p, &delimiters[i],
+                                                          &actual, &p_eol);
+
+                // NULL defers to the scalar path, which is always correct
+
+                if (p_actual == NULL) {
+
+                    continue;
+                }
+
+                const char* p_expected_eol = find_newline_scalar(p, p_end);
+
+                if (p_expected_eol - p >= HEADER_BLOCK_LEN) {
+
+                    p_expected_eol = NULL;
+                }
+
+                num_tests++;
+
+                if (p_actual != p_expected ||
+                    p_eol != p_expected_eol ||
+                    !same_header(&actual, &expected)) {
+
+                    fail("split_header_block(%s) \"%.*s\"", paths[i].name,
+                         (int)len, text);
+                }
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+
+    parse_text() - Parse all entries of a text by the selected path
+
+    Return the number of entries, or -1 if the parser did not advance.
+
+*******************************************************************************/
+
+static int parse_text(const PATH* p_path,
+                      const char* p_text,
+                      size_t text_len,
+                      LOGMSG_RECORD* p_records,
+                      int* p_statuses) {
+
+    LOGMSG_PARSER parser;
+
+    have_avx2 = p_path->use_avx2;
+
+    logmsg_parser_init(&parser, p_text, text_len);
+
+    int num_entries = 0;
+
+    while (num_entries < MAX_ENTRIES) {
+
+        LOGMSG_RECORD* p_record = &p_records[num_entries];
+
+        memset(p_record, 0, sizeof(LOGMSG_RECORD));
+
+        int status = logmsg_parser_next(&parser, p_record);
+
+        if (status == 0) {
+
+            break;
+        }
+
+        if (p_record->entry_len == 0) {
+
+            return -1;
+        }
+
+        p_statuses[num_entries++] = status;
+    }
+
+    return num_entries;
+}
+
+/*******************************************************************************
+
+    check_parser() - Parse texts of random entries truncated at every
+                     length by each path, and compare the results against
+                     each other and the header of each entry against
+                     split_header_scalar()
+
+*******************************************************************************/
+
+static void check_parser(int num_texts) {
+
+    char text[MAX_TEXT_LEN];
+
+    LOGMSG_RECORD records[NUM_PATHS][MAX_ENTRIES];
+
+    int statuses[NUM_PATHS][MAX_ENTRIES];
+
+    int num_entries[NUM_PATHS];
+
+    for (int n = 0; n < num_texts; n++) {
+
+        size_t text_len = 0;
+
+        for (int i = 0; i < 6; i++) {
+
+            text_len += append_entry(text + text_len,
+                                     sizeof(text) - text_len);
+        }
+
+        for (size_t len = 0; len <= text_len; len++) {
+
+            const char* p_text = place_text(text, len);
+
+            for (size_t i = 0; i < NUM_PATHS; i++) {
+
+                if (!paths[i].available) {
+
+                    num_entries[i] = -2;
+
+                    continue;
+                }
+
+                num_entries[i] = parse_text(&paths[i], p_text, len,
+                                            records[i], statuses[i]);
+
+                if (num_entries[i] == -1) {
+
+                    fail("%s parser did not advance \"%.*s\"",
+                         paths[i].name, (int)len, text);
+                }
+            }
+
+            /*
+             *  The paths agree, the entries cover the text, and each header
+             *  is that found by the scalar path
+             */
+
+            size_t reference = NUM_PATHS - 1;
+
+            for (size_t i = 0; i < NUM_PATHS; i++) {
+
+                if (num_entries[i] < 0 || i == reference) {
+
+                    continue;
+                }
+
+                num_tests++;
+
+                int same = num_entries[i] == num_entries[reference];
+
+                for (int j = 0; same && j < num_entries[i]; j++) {
+
+                    same = statuses[i][j] == statuses[reference][j] &&
+                           (statuses[i][j] < 0 ?
+                               records[i][j].entry_len ==
+                                   records[reference][j].entry_len :
+                               same_record(&records[i][j],
+                                           &records[reference][j]));
+                }
+
+                if (!same) {
+
+                    fail("%s and %s parsers differ \"%.*s\"", paths[i].name,
+                         paths[reference].name, (int)len, text);
+                }
+            }
+
+            if (num_entries[reference] < 0) {
+
+                continue;
+            }
+
+            size_t covered = 0;
+
+            for (int j = 0; j < num_entries[reference]; j++) {
+
+                const LOGMSG_RECORD* p_record = &records[reference][j];
+
+                covered += p_record->entry_len;
+
+                if (statuses[reference][j] < 0) {
+
+                    continue;
+                }
+
+                LOGMSG_RECORD expected;
+
+                memset(&expected, 0, sizeof(expected));
+
+                const char* p_header = p_record->p_entry +
+                                           LOGMSG_UTC_TIME_LEN + 1;
+
+                num_tests++;
+
+                if (split_header_scalar(p_header, p_text + len,
+                                        &expected) == NULL ||
+                    !same_header(p_record, &expected)) {
+
+                    fail("header differs from scalar path \"%.*s\"",
+                         (int)p_record->entry_len, p_record->p_entry);
+                }
+            }
+
+            num_tests++;
+
+            if (covered != len) {
+
+                fail("entries cover %zu of %zu bytes", covered, len);
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        test-parse [<num-random-texts>]
+
+    Compare the AVX2 and SSE2 paths of the log parser against each other
+    and against scalar references, on random entries placed against an
+    inaccessible page, and report the first failures. The AVX2 path is
+    skipped if the processor does not support it. Exit status is 0 if all
+    comparisons succeed.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    int num_texts = 10000;
+
+    if (argc > 1) {
+
+        num_texts = atoi(argv[1]);
+    }
+
+    if (init_guarded_space() != 0) {
+
+        perror("mmap");
+
+        return 2;
+    }
+
+    paths[0].available = have_avx2;
+
+    if (!paths[0].available) {
+
+        printf("AVX2 not supported - comparing SSE2 path only\n");
+    }
+
+    check_utc_time();
+
+    check_find_newline(num_texts / 20 + 1);
+
+    check_classify(num_texts * 50);
+
+    check_split_header(num_texts);
+
+    check_parser(num_texts / 10 + 1);
+
+    printf("%lu tests, %lu failures\n",
+           (unsigned long)num_tests, (unsigned long)num_failures);
+
+    return num_failures == 0 ? 0 : 1;
+}
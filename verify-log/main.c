@@ -0,0 +1,561 @@
+/*******************************************************************************
+
+    verify-log
+
+    Check the framing of binary log records, and recover whole records
+
+    ------------------------------------------------------------------------
+
+    Copyright 2018 Paul Alexander
+
+    Redistribution and use in source and binary forms, with or without modi-
+    fication, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, 
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright 
+       notice, this list of conditions and the following disclaimer in the 
+       documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its con-
+       tributors may be used to endorse or promote products derived from this 
+       software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CON-
+    SEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTI-
+    TUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTER-
+    RUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+    OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+
+#define _BSD_SOURCE
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <stdint.h>
+
+#include <unistd.h>
+
+#include <time.h>
+
+#include <sys/types.h>
+
+#include <sys/stat.h>
+
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include <fcntl.h>
+
+#include <logmsg_parse.h>
+
+/*******************************************************************************
+
+    Constants
+
+*******************************************************************************/
+
+#define NSECS_PER_SEC 1000000000LL
+
+// Offsets of the sequence number and PID within a binary record
+
+#define RECORD_SEQUENCE_OFFSET 8
+
+#define RECORD_PID_OFFSET 24
+
+// Initial number of slots of the table of processes - a power of 2
+
+#define INITIAL_PROCESS_SLOTS 64
+
+/*******************************************************************************
+
+    PROCESS - Sequence numbers of the whole records of one process
+
+*******************************************************************************/
+
+typedef struct PROCESS {
+
+    int32_t pid;
+
+    uint64_t num_records;
+
+    uint64_t min_sequence;
+
+    uint64_t max_sequence;
+
+} PROCESS;
+
+/*******************************************************************************
+
+    PROCESS_TABLE - Processes found in the log, hashed by PID
+
+*******************************************************************************/
+
+typedef struct PROCESS_TABLE {
+
+    PROCESS* p_slots;           // Free slots have num_records 0
+
+    size_t num_slots;
+
+    size_t num_processes;
+
+} PROCESS_TABLE;
+
+/*******************************************************************************
+
+    find_process() - Find slot of process in table, or the free slot for it
+
+*******************************************************************************/
+
+static PROCESS* find_process(const PROCESS_TABLE* p_table, int32_t pid) {
+
+    size_t mask = p_table->num_slots - 1;
+
+    size_t i = ((uint32_t)pid * 2654435761u) & mask;
+
+    while (p_table->p_slots[i].num_records != 0 &&
+           p_table->p_slots[i].pid != pid) {
+
+        i = (i + 1) & mask;
+    }
+
+    return &p_table->p_slots[i];
+}
+
+/*******************************************************************************
+
+    count_record() - Add sequence number of a whole record of process pid
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int count_record(PROCESS_TABLE* p_table,
+                        int32_t pid,
+                        uint64_t sequence) {
+
+    /*
+     *  Grow table when half full
+     */
+
+    if (2 * (p_table->num_processes + 1) > p_table->num_slots) {
+
+        PROCESS_TABLE table;
+
+        table.num_slots = p_table->num_slots ? 2 * p_table->num_slots
+                                             : INITIAL_PROCESS_SLOTS;
+
+        table.num_processes = p_table->num_processes;
+
+        table.p_slots = calloc(table.num_slots, sizeof(PROCESS));
+
+        if (table.p_slots == NULL) {
+
+            fprintf(stderr, "Heap memory exhausted\n");
+
+            return -1;
+        }
+
+        for (size_t i = 0; i < p_table->num_slots; i++) {
+
+            if (p_table->p_slots[i].num_records != 0) {
+
+                *find_process(&table, p_table->p_slots[i].pid) =
+                    p_table->p_slots[i];
+            }
+        }
+
+        free(p_table->p_slots);
+
+        *p_table = table;
+    }
+
+    PROCESS* p_process = find_process(p_table, pid);
+
+    if (p_process->num_records == 0) {
+
+        p_process->pid = pid;
+
+        p_process->min_sequence = sequence;
+
+        p_process->max_sequence = sequence;
+
+        p_table->num_processes++;
+    }
+
+    if (sequence < p_process->min_sequence) {
+
+        p_process->min_sequence = sequence;
+    }
+
+    if (sequence > p_process->max_sequence) {
+
+        p_process->max_sequence = sequence;
+    }
+
+    p_process->num_records++;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    map_file() - Map whole file for reading
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int map_file(const char* file_spec, const char** pp_map, size_t* p_len) {
+
+    int fd = open(file_spec, O_RDONLY);
+
+    if (fd < 0) {
+
+        fprintf(stderr, "Could not open %s: %s\n", file_spec, strerror(errno));
+
+        return -1;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+
+        fprintf(stderr, "Could not stat %s: %s\n", file_spec, strerror(errno));
+
+        close(fd);
+
+        return -1;
+    }
+
+    *pp_map = NULL;
+
+    *p_len = file_stat.st_size;
+
+    if (*p_len > 0) {
+
+        *pp_map = mmap(NULL, *p_len, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (*pp_map == MAP_FAILED) {
+
+            fprintf(stderr, "Could not map %s: %s\n",
+                    file_spec, strerror(errno));
+
+            close(fd);
+
+            return -1;
+        }
+
+        madvise((void*)*pp_map, *p_len, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    verify_log() - Check every record of binary log file, and report damaged
+                   regions
+
+    Description
+    ===========
+
+    Records are checked in turn from the start of the file. At a record
+    which is malformed, or whose CRC does not match, the file is searched
+    for the next whole record, and the bytes skipped are reported as a 
+    damaged region, or as a torn record if they run to the end of the file.
+
+    If out_spec is not NULL, the whole records are written to that file.
+
+    Sequence numbers are counted for each process, so that records lost 
+    whole - e.g. in a region skipped - can be reported too.
+
+    On return *p_num_damaged is the number of damaged regions.
+
+    Return 0 on success, -1 on failure.
+
+*******************************************************************************/
+
+static int verify_log(const char* log_spec,
+                      const char* out_spec,
+                      int verbose,
+                      uint64_t* p_num_damaged) {
+
+    const char* p_map;
+
+    size_t map_len;
+
+    if (map_file(log_spec, &p_map, &map_len) != 0) {
+
+        return -1;
+    }
+
+    FILE* p_out = NULL;
+
+    if (out_spec != NULL) {
+
+        p_out = fopen(out_spec, "w");
+
+        if (p_out == NULL) {
+
+            fprintf(stderr, "Could not create %s: %s\n",
+                    out_spec, strerror(errno));
+
+            return -1;
+        }
+    }
+
+    struct timespec start_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    /*
+     *  Check records, resynchronizing after damaged regions
+     */
+
+    PROCESS_TABLE processes = { NULL, 0, 0 };
+
+    uint64_t num_records = 0;
+
+    uint64_t num_damaged = 0;
+
+    uint64_t bytes_skipped = 0;
+
+    size_t run_start = 0;       // Start of whole records not yet written
+
+    size_t offset = 0;
+
+    while (offset < map_len) {
+
+        uint64_t sequence;
+
+        ssize_t record_len = logmsg_check_binary(p_map + offset,
+                                                 map_len - offset,
+                                                 &sequence);
+
+        if (record_len > 0) {
+
+            int32_t pid;
+
+            memcpy(&pid, p_map + offset + RECORD_PID_OFFSET, sizeof(pid));
+
+            if (count_record(&processes, pid, sequence) != 0) {
+
+                return -1;
+            }
+
+            num_records++;
+
+            offset += record_len;
+
+            continue;
+        }
+
+        if (p_out != NULL &&
+            fwrite(p_map + run_start, 1, offset - run_start, p_out) !=
+                offset - run_start) {
+
+            fprintf(stderr, "Could not write %s\n", out_spec);
+
+            return -1;
+        }
+
+        size_t next_offset = offset + 1 +
+                                 logmsg_find_binary(p_map + offset + 1,
+                                                    map_len - offset - 1);
+
+        printf("%s at offset %llu, %llu bytes\n",
+               record_len == 0 && next_offset == map_len ? "Torn record"
+                                                         : "Damaged region",
+               (unsigned long long)offset,
+               (unsigned long long)(next_offset - offset));
+
+        num_damaged++;
+
+        bytes_skipped += next_offset - offset;
+
+        offset = next_offset;
+
+        run_start = offset;
+    }
+
+    if (p_out != NULL &&
+        (fwrite(p_map + run_start, 1, offset - run_start, p_out) !=
+             offset - run_start ||
+         fclose(p_out) != 0)) {
+
+        fprintf(stderr, "Could not write %s\n", out_spec);
+
+        return -1;
+    }
+
+    struct timespec end_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    /*
+     *  Report records missing by sequence number
+     */
+
+    uint64_t num_missing = 0;
+
+    for (size_t i = 0; i < processes.num_slots; i++) {
+
+        const PROCESS* p_process = &processes.p_slots[i];
+
+        if (p_process->num_records == 0) {
+
+            continue;
+        }
+
+        uint64_t span = p_process->max_sequence - p_process->min_sequence + 1;
+
+        uint64_t missing = span > p_process->num_records ?
+                               span - p_process->num_records : 0;
+
+        num_missing += missing;
+
+        if (verbose) {
+
+            printf("PID %d: records %llu through %llu, %llu missing\n",
+                   p_process->pid,
+                   (unsigned long long)p_process->min_sequence,
+                   (unsigned long long)p_process->max_sequence,
+                   (unsigned long long)missing);
+        }
+    }
+
+    printf("%llu records, %llu damaged regions, %llu bytes skipped, "
+           "%llu records missing from %llu processes\n",
+           (unsigned long long)num_records,
+           (unsigned long long)num_damaged,
+           (unsigned long long)bytes_skipped,
+           (unsigned long long)num_missing,
+           (unsigned long long)processes.num_processes);
+
+    if (verbose) {
+
+        double secs = (end_time.tv_sec - start_time.tv_sec) +
+                      (end_time.tv_nsec - start_time.tv_nsec) /
+                          (double)NSECS_PER_SEC;
+
+        fprintf(stderr, "%llu bytes checked in %.3f s, %.2f GB/s\n",
+                (unsigned long long)map_len,
+                secs,
+                secs > 0 ? map_len / secs / 1e9 : 0.0);
+    }
+
+    *p_num_damaged = num_damaged;
+
+    return 0;
+}
+
+/*******************************************************************************
+
+    main()
+
+    Invocation:
+
+        verify-log [-o <out-file>] [-v] <log-file>
+
+    Check each record of <log-file>, written by logmsg_kv() in the binary
+    format, against its length and CRC, and write the offset and length of
+    each damaged region found - ending at the next whole record - and a 
+    summary, to standard output. A record cut short at the end of the file,
+    e.g. by a crash, is reported as torn. The sequence numbers of the whole
+    records of each process are checked for gaps, and the number of records
+    missing reported.
+
+    With <out-file>, the whole records are written to that file, leaving 
+    out the damaged regions.
+
+    With -v, the sequence numbers found for each process, and the rate of
+    checking, are also written.
+
+    Exit status is 0 if no damaged region is found, or 1 otherwise.
+
+*******************************************************************************/
+
+int main(int argc, char **argv) {
+
+    const char* invocation_message =
+        "Invocation: ./verify-log [-o <out-file>] [-v] <log-file>";
+
+    /***************************************************************************
+
+        Get program arguments
+
+    ***************************************************************************/
+
+    const char* out_spec = NULL;
+
+    int verbose = 0;
+
+    {
+        int option;
+
+        while ((option = getopt(argc, argv, "o:v")) != -1) {
+
+            switch (option) {
+
+            case 'o':
+
+                out_spec = optarg;
+
+                break;
+
+            case 'v':
+
+                verbose = 1;
+
+                break;
+
+            default:
+
+                printf("\n%s\n", invocation_message);
+
+                return 1;
+            }
+        }
+    }
+
+    if (argc - optind != 1) {
+
+        printf("\n%s\n", invocation_message);
+
+        return 1;
+    }
+
+    /***************************************************************************
+
+        Check log file
+
+    ***************************************************************************/
+
+    uint64_t num_damaged;
+
+    if (verify_log(argv[optind], out_spec, verbose, &num_damaged) != 0) {
+
+        return 1;
+    }
+
+    return num_damaged == 0 ? 0 : 1;
+}